@@ -1,8 +1,24 @@
 ﻿#include "Cryptography.h"
 
 #include <stdexcept>
+#include <cstring>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define CRYPTOGRAPHY_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define CRYPTOGRAPHY_TARGET(t)
+#else
+#include <cpuid.h>
+#define CRYPTOGRAPHY_TARGET(t) __attribute__((target(t)))
+#endif
+#endif
 
 static std::uint32_t crc32(std::uint32_t crc, const std::uint8_t *buf, std::size_t size);
+static void sha256_compress(std::uint32_t state[8], const std::uint8_t *data, std::size_t blocks);
+static void chacha20_blocks(const std::uint32_t state[16], std::uint8_t *out, std::size_t blocks);
 
 namespace Algorithms
 {
@@ -13,13 +29,120 @@ namespace Algorithms
             auto c = crc32(0, Bytes.data(), Bytes.size());
             return static_cast<std::int32_t>(c);
         }
+        std::int32_t CRC32(std::span<const std::uint8_t> Bytes)
+        {
+            auto c = crc32(0, Bytes.data(), Bytes.size());
+            return static_cast<std::int32_t>(c);
+        }
         std::vector<std::uint8_t> SHA256(const std::vector<std::uint8_t> &Bytes)
         {
-            throw std::logic_error("NotImplemented");
+            auto Digest = SHA256(std::span<const std::uint8_t>(Bytes.data(), Bytes.size()));
+            return std::vector<std::uint8_t>(Digest.begin(), Digest.end());
+        }
+        std::array<std::uint8_t, 32> SHA256(std::span<const std::uint8_t> Bytes)
+        {
+            SHA256Hasher h;
+            h.Update(Bytes);
+            return h.Final();
         }
         std::vector<std::uint8_t> HMACSHA256Simple(const std::vector<std::uint8_t> &Key, const std::vector<std::uint8_t> &Bytes)
         {
-            throw std::logic_error("NotImplemented");
+            HMACSHA256SimpleState s(std::span<const std::uint8_t>(Key.data(), Key.size()));
+            auto Digest = s.Compute(std::span<const std::uint8_t>(), std::span<const std::uint8_t>(Bytes.data(), Bytes.size()));
+            return std::vector<std::uint8_t>(Digest.begin(), Digest.end());
+        }
+
+        SHA256Hasher::SHA256Hasher()
+            : State{ 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 }, BlockLength(0), TotalLength(0)
+        {
+        }
+        void SHA256Hasher::Update(std::span<const std::uint8_t> Bytes)
+        {
+            auto p = Bytes.data();
+            auto Length = Bytes.size();
+            TotalLength += Length;
+            if (BlockLength > 0)
+            {
+                auto n = std::min(Length, sizeof(Block) - BlockLength);
+                std::memcpy(Block + BlockLength, p, n);
+                BlockLength += n;
+                p += n;
+                Length -= n;
+                if (BlockLength < sizeof(Block)) { return; }
+                sha256_compress(State, Block, 1);
+                BlockLength = 0;
+            }
+            if (Length >= sizeof(Block))
+            {
+                auto NumBlocks = Length / sizeof(Block);
+                sha256_compress(State, p, NumBlocks);
+                p += NumBlocks * sizeof(Block);
+                Length -= NumBlocks * sizeof(Block);
+            }
+            if (Length > 0)
+            {
+                std::memcpy(Block, p, Length);
+                BlockLength = Length;
+            }
+        }
+        std::array<std::uint8_t, 32> SHA256Hasher::Final()
+        {
+            auto BitLength = TotalLength * 8;
+            Block[BlockLength] = 0x80;
+            BlockLength += 1;
+            if (BlockLength > 56)
+            {
+                std::memset(Block + BlockLength, 0, sizeof(Block) - BlockLength);
+                sha256_compress(State, Block, 1);
+                BlockLength = 0;
+            }
+            std::memset(Block + BlockLength, 0, 56 - BlockLength);
+            for (int k = 0; k < 8; k += 1)
+            {
+                Block[56 + k] = static_cast<std::uint8_t>(BitLength >> (56 - k * 8));
+            }
+            sha256_compress(State, Block, 1);
+            BlockLength = 0;
+
+            std::array<std::uint8_t, 32> Digest;
+            for (int k = 0; k < 8; k += 1)
+            {
+                Digest[k * 4] = static_cast<std::uint8_t>(State[k] >> 24);
+                Digest[k * 4 + 1] = static_cast<std::uint8_t>(State[k] >> 16);
+                Digest[k * 4 + 2] = static_cast<std::uint8_t>(State[k] >> 8);
+                Digest[k * 4 + 3] = static_cast<std::uint8_t>(State[k]);
+            }
+            return Digest;
+        }
+
+        static void UpdateXor(SHA256Hasher &h, std::span<const std::uint8_t> Bytes, std::uint8_t Pad)
+        {
+            std::uint8_t Buffer[64];
+            for (std::size_t Offset = 0; Offset < Bytes.size(); Offset += sizeof(Buffer))
+            {
+                auto n = std::min(sizeof(Buffer), Bytes.size() - Offset);
+                for (std::size_t k = 0; k < n; k += 1)
+                {
+                    Buffer[k] = Bytes[Offset + k] ^ Pad;
+                }
+                h.Update(std::span<const std::uint8_t>(Buffer, n));
+            }
+        }
+        HMACSHA256SimpleState::HMACSHA256SimpleState(std::span<const std::uint8_t> KeyPrefix)
+        {
+            UpdateXor(Inner, KeyPrefix, 0x36);
+            UpdateXor(Outer, KeyPrefix, 0x5C);
+        }
+        std::array<std::uint8_t, 32> HMACSHA256SimpleState::Compute(std::span<const std::uint8_t> KeySuffix, std::span<const std::uint8_t> Bytes) const
+        {
+            auto i = Inner;
+            UpdateXor(i, KeySuffix, 0x36);
+            i.Update(Bytes);
+            auto InnerHash = i.Final();
+            auto o = Outer;
+            UpdateXor(o, KeySuffix, 0x5C);
+            o.Update(InnerHash);
+            return o.Final();
         }
     }
 
@@ -59,12 +182,370 @@ namespace Algorithms
         }
     }
 
+    void RC4::Generate(std::uint8_t *Out, std::size_t n)
+    {
+        //i、j放在局部变量中，使用8位无符号数自然取模
+        auto x = static_cast<std::uint8_t>(i);
+        auto y = static_cast<std::uint8_t>(j);
+        for (std::size_t k = 0; k < n; k += 1)
+        {
+            x = static_cast<std::uint8_t>(x + 1);
+            auto a = S[x];
+            y = static_cast<std::uint8_t>(y + a);
+            auto b = S[y];
+            S[x] = b;
+            S[y] = a;
+            Out[k] = S[static_cast<std::uint8_t>(a + b)];
+        }
+        i = x;
+        j = y;
+    }
+
+    void RC4::XorInPlace(std::span<std::uint8_t> Bytes)
+    {
+        //每次生成一块密钥流，再按8字节异或
+        std::uint8_t KeyStream[256];
+        auto Data = Bytes.data();
+        auto Length = Bytes.size();
+        while (Length > 0)
+        {
+            auto n = std::min(Length, sizeof(KeyStream));
+            Generate(KeyStream, n);
+            std::size_t k = 0;
+            for (; k + 8 <= n; k += 8)
+            {
+                std::uint64_t dv;
+                std::uint64_t sv;
+                std::memcpy(&dv, Data + k, 8);
+                std::memcpy(&sv, KeyStream + k, 8);
+                dv ^= sv;
+                std::memcpy(Data + k, &dv, 8);
+            }
+            for (; k < n; k += 1)
+            {
+                Data[k] ^= KeyStream[k];
+            }
+            Data += n;
+            Length -= n;
+        }
+    }
+
     void RC4::Swap(std::uint8_t &a, std::uint8_t &b)
     {
         auto t = a;
         a = b;
         b = t;
     }
+
+    ChaCha20::ChaCha20(std::span<const std::uint8_t> Key, std::span<const std::uint8_t> Nonce, std::uint32_t Counter)
+        : KeyStreamOffset(0), KeyStreamLength(0)
+    {
+        if ((Key.size() != 32) || (Nonce.size() != 12)) { throw std::logic_error("InvalidArgument"); }
+        auto Load = [](const std::uint8_t *p) { return static_cast<std::uint32_t>(p[0]) | (static_cast<std::uint32_t>(p[1]) << 8) | (static_cast<std::uint32_t>(p[2]) << 16) | (static_cast<std::uint32_t>(p[3]) << 24); };
+        State[0] = 0x61707865;
+        State[1] = 0x3320646e;
+        State[2] = 0x79622d32;
+        State[3] = 0x6b206574;
+        for (int k = 0; k < 8; k += 1)
+        {
+            State[4 + k] = Load(Key.data() + k * 4);
+        }
+        State[12] = Counter;
+        for (int k = 0; k < 3; k += 1)
+        {
+            State[13 + k] = Load(Nonce.data() + k * 4);
+        }
+    }
+
+    void ChaCha20::Transform(std::uint8_t *Data, std::size_t Length)
+    {
+        while (Length > 0)
+        {
+            if (KeyStreamOffset >= KeyStreamLength)
+            {
+                //剩余数据不足一批时只生成需要的块数，减少浪费
+                auto Blocks = std::min(sizeof(KeyStream) / 64, (Length + 63) / 64);
+                chacha20_blocks(State, KeyStream, Blocks);
+                State[12] += static_cast<std::uint32_t>(Blocks);
+                KeyStreamOffset = 0;
+                KeyStreamLength = Blocks * 64;
+            }
+            auto n = std::min(Length, KeyStreamLength - KeyStreamOffset);
+            auto s = KeyStream + KeyStreamOffset;
+            std::size_t k = 0;
+            for (; k + 8 <= n; k += 8)
+            {
+                std::uint64_t dv;
+                std::uint64_t sv;
+                std::memcpy(&dv, Data + k, 8);
+                std::memcpy(&sv, s + k, 8);
+                dv ^= sv;
+                std::memcpy(Data + k, &dv, 8);
+            }
+            for (; k < n; k += 1)
+            {
+                Data[k] ^= s[k];
+            }
+            Data += n;
+            Length -= n;
+            KeyStreamOffset += n;
+        }
+    }
+
+    //Poly1305按26位分段的32位实现（poly1305-donna）
+    static std::uint32_t LoadUInt32(const std::uint8_t *p)
+    {
+        return static_cast<std::uint32_t>(p[0]) | (static_cast<std::uint32_t>(p[1]) << 8) | (static_cast<std::uint32_t>(p[2]) << 16) | (static_cast<std::uint32_t>(p[3]) << 24);
+    }
+    static void StoreUInt32(std::uint8_t *p, std::uint32_t v)
+    {
+        p[0] = static_cast<std::uint8_t>(v & 0xFF);
+        p[1] = static_cast<std::uint8_t>((v >> 8) & 0xFF);
+        p[2] = static_cast<std::uint8_t>((v >> 16) & 0xFF);
+        p[3] = static_cast<std::uint8_t>((v >> 24) & 0xFF);
+    }
+
+    Poly1305::Poly1305(std::span<const std::uint8_t> Key)
+        : H{ 0, 0, 0, 0, 0 }, BlockLength(0)
+    {
+        if (Key.size() != 32) { throw std::logic_error("InvalidArgument"); }
+        auto k = Key.data();
+        R[0] = LoadUInt32(k + 0) & 0x3ffffff;
+        R[1] = (LoadUInt32(k + 3) >> 2) & 0x3ffff03;
+        R[2] = (LoadUInt32(k + 6) >> 4) & 0x3ffc0ff;
+        R[3] = (LoadUInt32(k + 9) >> 6) & 0x3f03fff;
+        R[4] = (LoadUInt32(k + 12) >> 8) & 0x00fffff;
+        for (int i = 0; i < 4; i += 1)
+        {
+            Pad[i] = LoadUInt32(k + 16 + i * 4);
+        }
+    }
+
+    void Poly1305::Blocks(const std::uint8_t *Data, std::size_t Length, bool IsFinal)
+    {
+        const std::uint32_t HighBit = IsFinal ? 0 : (static_cast<std::uint32_t>(1) << 24);
+        auto r0 = R[0];
+        auto r1 = R[1];
+        auto r2 = R[2];
+        auto r3 = R[3];
+        auto r4 = R[4];
+        auto s1 = r1 * 5;
+        auto s2 = r2 * 5;
+        auto s3 = r3 * 5;
+        auto s4 = r4 * 5;
+        auto h0 = H[0];
+        auto h1 = H[1];
+        auto h2 = H[2];
+        auto h3 = H[3];
+        auto h4 = H[4];
+        while (Length >= 16)
+        {
+            h0 += LoadUInt32(Data + 0) & 0x3ffffff;
+            h1 += (LoadUInt32(Data + 3) >> 2) & 0x3ffffff;
+            h2 += (LoadUInt32(Data + 6) >> 4) & 0x3ffffff;
+            h3 += (LoadUInt32(Data + 9) >> 6) & 0x3ffffff;
+            h4 += (LoadUInt32(Data + 12) >> 8) | HighBit;
+
+            auto d0 = static_cast<std::uint64_t>(h0) * r0 + static_cast<std::uint64_t>(h1) * s4 + static_cast<std::uint64_t>(h2) * s3 + static_cast<std::uint64_t>(h3) * s2 + static_cast<std::uint64_t>(h4) * s1;
+            auto d1 = static_cast<std::uint64_t>(h0) * r1 + static_cast<std::uint64_t>(h1) * r0 + static_cast<std::uint64_t>(h2) * s4 + static_cast<std::uint64_t>(h3) * s3 + static_cast<std::uint64_t>(h4) * s2;
+            auto d2 = static_cast<std::uint64_t>(h0) * r2 + static_cast<std::uint64_t>(h1) * r1 + static_cast<std::uint64_t>(h2) * r0 + static_cast<std::uint64_t>(h3) * s4 + static_cast<std::uint64_t>(h4) * s3;
+            auto d3 = static_cast<std::uint64_t>(h0) * r3 + static_cast<std::uint64_t>(h1) * r2 + static_cast<std::uint64_t>(h2) * r1 + static_cast<std::uint64_t>(h3) * r0 + static_cast<std::uint64_t>(h4) * s4;
+            auto d4 = static_cast<std::uint64_t>(h0) * r4 + static_cast<std::uint64_t>(h1) * r3 + static_cast<std::uint64_t>(h2) * r2 + static_cast<std::uint64_t>(h3) * r1 + static_cast<std::uint64_t>(h4) * r0;
+
+            std::uint32_t c = static_cast<std::uint32_t>(d0 >> 26);
+            h0 = static_cast<std::uint32_t>(d0) & 0x3ffffff;
+            d1 += c;
+            c = static_cast<std::uint32_t>(d1 >> 26);
+            h1 = static_cast<std::uint32_t>(d1) & 0x3ffffff;
+            d2 += c;
+            c = static_cast<std::uint32_t>(d2 >> 26);
+            h2 = static_cast<std::uint32_t>(d2) & 0x3ffffff;
+            d3 += c;
+            c = static_cast<std::uint32_t>(d3 >> 26);
+            h3 = static_cast<std::uint32_t>(d3) & 0x3ffffff;
+            d4 += c;
+            c = static_cast<std::uint32_t>(d4 >> 26);
+            h4 = static_cast<std::uint32_t>(d4) & 0x3ffffff;
+            h0 += c * 5;
+            c = h0 >> 26;
+            h0 = h0 & 0x3ffffff;
+            h1 += c;
+
+            Data += 16;
+            Length -= 16;
+        }
+        H[0] = h0;
+        H[1] = h1;
+        H[2] = h2;
+        H[3] = h3;
+        H[4] = h4;
+    }
+
+    void Poly1305::Update(std::span<const std::uint8_t> Bytes)
+    {
+        auto Data = Bytes.data();
+        auto Length = Bytes.size();
+        if (BlockLength > 0)
+        {
+            auto n = std::min(Length, static_cast<std::size_t>(16) - BlockLength);
+            std::memcpy(Block + BlockLength, Data, n);
+            BlockLength += n;
+            Data += n;
+            Length -= n;
+            if (BlockLength < 16) { return; }
+            Blocks(Block, 16, false);
+            BlockLength = 0;
+        }
+        auto Whole = Length & ~static_cast<std::size_t>(15);
+        if (Whole > 0)
+        {
+            Blocks(Data, Whole, false);
+            Data += Whole;
+            Length -= Whole;
+        }
+        if (Length > 0)
+        {
+            std::memcpy(Block, Data, Length);
+            BlockLength = Length;
+        }
+    }
+
+    std::array<std::uint8_t, 16> Poly1305::Final()
+    {
+        if (BlockLength > 0)
+        {
+            Block[BlockLength] = 1;
+            for (auto k = BlockLength + 1; k < 16; k += 1)
+            {
+                Block[k] = 0;
+            }
+            Blocks(Block, 16, true);
+            BlockLength = 0;
+        }
+
+        auto h0 = H[0];
+        auto h1 = H[1];
+        auto h2 = H[2];
+        auto h3 = H[3];
+        auto h4 = H[4];
+        std::uint32_t c = h1 >> 26;
+        h1 &= 0x3ffffff;
+        h2 += c;
+        c = h2 >> 26;
+        h2 &= 0x3ffffff;
+        h3 += c;
+        c = h3 >> 26;
+        h3 &= 0x3ffffff;
+        h4 += c;
+        c = h4 >> 26;
+        h4 &= 0x3ffffff;
+        h0 += c * 5;
+        c = h0 >> 26;
+        h0 &= 0x3ffffff;
+        h1 += c;
+
+        //计算h + -p，h >= p时取差值，不使用分支
+        auto g0 = h0 + 5;
+        c = g0 >> 26;
+        g0 &= 0x3ffffff;
+        auto g1 = h1 + c;
+        c = g1 >> 26;
+        g1 &= 0x3ffffff;
+        auto g2 = h2 + c;
+        c = g2 >> 26;
+        g2 &= 0x3ffffff;
+        auto g3 = h3 + c;
+        c = g3 >> 26;
+        g3 &= 0x3ffffff;
+        auto g4 = h4 + c - (static_cast<std::uint32_t>(1) << 26);
+
+        auto Mask = (g4 >> 31) - 1;
+        g0 &= Mask;
+        g1 &= Mask;
+        g2 &= Mask;
+        g3 &= Mask;
+        g4 &= Mask;
+        Mask = ~Mask;
+        h0 = (h0 & Mask) | g0;
+        h1 = (h1 & Mask) | g1;
+        h2 = (h2 & Mask) | g2;
+        h3 = (h3 & Mask) | g3;
+        h4 = (h4 & Mask) | g4;
+
+        h0 = h0 | (h1 << 26);
+        h1 = (h1 >> 6) | (h2 << 20);
+        h2 = (h2 >> 12) | (h3 << 14);
+        h3 = (h3 >> 18) | (h4 << 8);
+
+        std::uint64_t f = static_cast<std::uint64_t>(h0) + Pad[0];
+        h0 = static_cast<std::uint32_t>(f);
+        f = static_cast<std::uint64_t>(h1) + Pad[1] + (f >> 32);
+        h1 = static_cast<std::uint32_t>(f);
+        f = static_cast<std::uint64_t>(h2) + Pad[2] + (f >> 32);
+        h2 = static_cast<std::uint32_t>(f);
+        f = static_cast<std::uint64_t>(h3) + Pad[3] + (f >> 32);
+        h3 = static_cast<std::uint32_t>(f);
+
+        std::array<std::uint8_t, 16> Tag;
+        StoreUInt32(Tag.data() + 0, h0);
+        StoreUInt32(Tag.data() + 4, h1);
+        StoreUInt32(Tag.data() + 8, h2);
+        StoreUInt32(Tag.data() + 12, h3);
+        return Tag;
+    }
+
+    ChaCha20Poly1305::ChaCha20Poly1305(std::span<const std::uint8_t> Key)
+    {
+        if (Key.size() != 32) { throw std::logic_error("InvalidArgument"); }
+        std::memcpy(this->Key.data(), Key.data(), 32);
+    }
+
+    /// <summary>Stream须为计数器0处的密钥流，第0块的前32字节作为Poly1305密钥，之后Stream从计数器1开始</summary>
+    std::array<std::uint8_t, 16> ChaCha20Poly1305::ComputeTag(ChaCha20 &Stream, std::span<const std::uint8_t> AssociatedData, const std::uint8_t *CipherText, std::size_t Length)
+    {
+        std::uint8_t Block0[64] = {};
+        Stream.Transform(Block0, 64);
+        Poly1305 p(std::span<const std::uint8_t>(Block0, 32));
+        static const std::uint8_t Zeros[16] = {};
+        p.Update(AssociatedData);
+        p.Update(std::span<const std::uint8_t>(Zeros, (16 - AssociatedData.size() % 16) % 16));
+        p.Update(std::span<const std::uint8_t>(CipherText, Length));
+        p.Update(std::span<const std::uint8_t>(Zeros, (16 - Length % 16) % 16));
+        std::uint8_t Lengths[16];
+        auto AssociatedDataLength = static_cast<std::uint64_t>(AssociatedData.size());
+        auto CipherTextLength = static_cast<std::uint64_t>(Length);
+        for (int k = 0; k < 8; k += 1)
+        {
+            Lengths[k] = static_cast<std::uint8_t>((AssociatedDataLength >> (k * 8)) & 0xFF);
+            Lengths[8 + k] = static_cast<std::uint8_t>((CipherTextLength >> (k * 8)) & 0xFF);
+        }
+        p.Update(std::span<const std::uint8_t>(Lengths, 16));
+        return p.Final();
+    }
+
+    void ChaCha20Poly1305::Seal(std::span<const std::uint8_t> Nonce, std::span<const std::uint8_t> AssociatedData, std::uint8_t *Data, std::size_t Length, std::uint8_t *Tag)
+    {
+        ChaCha20 Stream(std::span<const std::uint8_t>(Key.data(), 32), Nonce, 0);
+        ChaCha20 DataStream(std::span<const std::uint8_t>(Key.data(), 32), Nonce, 1);
+        DataStream.Transform(Data, Length);
+        auto t = ComputeTag(Stream, AssociatedData, Data, Length);
+        std::memcpy(Tag, t.data(), 16);
+    }
+
+    bool ChaCha20Poly1305::Open(std::span<const std::uint8_t> Nonce, std::span<const std::uint8_t> AssociatedData, std::uint8_t *Data, std::size_t Length, const std::uint8_t *Tag)
+    {
+        ChaCha20 Stream(std::span<const std::uint8_t>(Key.data(), 32), Nonce, 0);
+        auto t = ComputeTag(Stream, AssociatedData, Data, Length);
+        //按固定时间比较标签
+        std::uint8_t Difference = 0;
+        for (int k = 0; k < 16; k += 1)
+        {
+            Difference |= static_cast<std::uint8_t>(t[k] ^ Tag[k]);
+        }
+        if (Difference != 0) { return false; }
+        Stream.Transform(Data, Length);
+        return true;
+    }
 }
 
 /*-
@@ -155,6 +636,197 @@ static std::uint32_t crc32_tab[] = {
     0xb40bbe37, 0xc30c8ea1, 0x5a05df1b, 0x2d02ef8d
 };
 
+#ifdef CRYPTOGRAPHY_X86
+namespace
+{
+    class CpuFeatures
+    {
+    public:
+        bool PCLMUL;
+        bool SSE41;
+        bool SSSE3;
+        bool SHA;
+        bool SSE2;
+        bool AVX2;
+
+        CpuFeatures()
+            : PCLMUL(false), SSE41(false), SSSE3(false), SHA(false), SSE2(false), AVX2(false)
+        {
+            unsigned int r1[4] = { 0, 0, 0, 0 };
+            unsigned int r7[4] = { 0, 0, 0, 0 };
+#ifdef _MSC_VER
+            int v[4];
+            __cpuid(v, 0);
+            auto MaxLeaf = v[0];
+            __cpuidex(v, 1, 0);
+            for (int k = 0; k < 4; k += 1) { r1[k] = static_cast<unsigned int>(v[k]); }
+            if (MaxLeaf >= 7)
+            {
+                __cpuidex(v, 7, 0);
+                for (int k = 0; k < 4; k += 1) { r7[k] = static_cast<unsigned int>(v[k]); }
+            }
+#else
+            __get_cpuid(1, &r1[0], &r1[1], &r1[2], &r1[3]);
+            __get_cpuid_count(7, 0, &r7[0], &r7[1], &r7[2], &r7[3]);
+#endif
+            PCLMUL = (r1[2] & (1u << 1)) != 0;
+            SSSE3 = (r1[2] & (1u << 9)) != 0;
+            SSE41 = (r1[2] & (1u << 19)) != 0;
+            SHA = (r7[1] & (1u << 29)) != 0;
+            SSE2 = (r1[3] & (1u << 26)) != 0;
+            //AVX2还需要操作系统保存YMM寄存器（OSXSAVE且XCR0的位1、2）
+            auto OSXSAVE = (r1[2] & (1u << 27)) != 0;
+            AVX2 = OSXSAVE && ((r7[1] & (1u << 5)) != 0) && ((ReadXCR0() & 6) == 6);
+        }
+
+        CRYPTOGRAPHY_TARGET("xsave")
+        static std::uint64_t ReadXCR0()
+        {
+            return static_cast<std::uint64_t>(_xgetbv(0));
+        }
+
+        static const CpuFeatures &Current()
+        {
+            static CpuFeatures f;
+            return f;
+        }
+    };
+}
+#endif
+
+//slice-by-8：每次处理8个字节，第k张表为第0张表的结果再经过k个字节的移位
+static const std::uint32_t (&crc32_slice_tab())[8][256]
+{
+    static std::uint32_t t[8][256];
+    static bool initialized = [&]()
+    {
+        for (int n = 0; n < 256; n += 1)
+        {
+            t[0][n] = crc32_tab[n];
+        }
+        for (int k = 1; k < 8; k += 1)
+        {
+            for (int n = 0; n < 256; n += 1)
+            {
+                t[k][n] = (t[k - 1][n] >> 8) ^ crc32_tab[t[k - 1][n] & 0xFF];
+            }
+        }
+        return true;
+    }();
+    (void)(initialized);
+    return t;
+}
+
+static std::uint32_t crc32_slice8(std::uint32_t crc, const std::uint8_t *p, std::size_t size)
+{
+    auto &t = crc32_slice_tab();
+    while (size >= 8)
+    {
+        auto one = (static_cast<std::uint32_t>(p[0]) | (static_cast<std::uint32_t>(p[1]) << 8) | (static_cast<std::uint32_t>(p[2]) << 16) | (static_cast<std::uint32_t>(p[3]) << 24)) ^ crc;
+        auto two = static_cast<std::uint32_t>(p[4]) | (static_cast<std::uint32_t>(p[5]) << 8) | (static_cast<std::uint32_t>(p[6]) << 16) | (static_cast<std::uint32_t>(p[7]) << 24);
+        crc = t[7][one & 0xFF] ^ t[6][(one >> 8) & 0xFF] ^ t[5][(one >> 16) & 0xFF] ^ t[4][one >> 24] ^ t[3][two & 0xFF] ^ t[2][(two >> 8) & 0xFF] ^ t[1][(two >> 16) & 0xFF] ^ t[0][two >> 24];
+        p += 8;
+        size -= 8;
+    }
+    while (size--)
+        crc = crc32_tab[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    return crc;
+}
+
+#ifdef CRYPTOGRAPHY_X86
+/*
+* 使用PCLMULQDQ按128位折叠计算CRC32，常数和步骤取自Intel白皮书
+* "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ Instruction"（位反转域）
+* size至少为64且为16的倍数，crc为取反前的中间值
+*/
+CRYPTOGRAPHY_TARGET("pclmul,sse4.1")
+static std::uint32_t crc32_pclmul(std::uint32_t crc, const std::uint8_t *buf, std::size_t size)
+{
+    alignas(16) static const std::uint64_t k1k2[] = { 0x0154442bd4, 0x01c6e41596 };
+    alignas(16) static const std::uint64_t k3k4[] = { 0x01751997d0, 0x00ccaa009e };
+    alignas(16) static const std::uint64_t k5k0[] = { 0x0163cd6124, 0x0000000000 };
+    alignas(16) static const std::uint64_t poly[] = { 0x01db710641, 0x01f7011641 };
+
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+    x1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf + 0x00));
+    x2 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf + 0x10));
+    x3 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf + 0x20));
+    x4 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(static_cast<int>(crc)));
+    x0 = _mm_load_si128(reinterpret_cast<const __m128i *>(k1k2));
+    buf += 64;
+    size -= 64;
+
+    //每次并行折叠64字节
+    while (size >= 64)
+    {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+        y5 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf + 0x00));
+        y6 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf + 0x10));
+        y7 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf + 0x20));
+        y8 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf + 0x30));
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+        buf += 64;
+        size -= 64;
+    }
+
+    //折叠为128位
+    x0 = _mm_load_si128(reinterpret_cast<const __m128i *>(k3k4));
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    //每次折叠16字节
+    while (size >= 16)
+    {
+        x2 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf));
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+        buf += 16;
+        size -= 16;
+    }
+
+    //128位折叠为64位
+    x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+    x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+    x1 = _mm_srli_si128(x1, 8);
+    x1 = _mm_xor_si128(x1, x2);
+    x0 = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(k5k0));
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, x3);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    //Barrett约减为32位
+    x0 = _mm_load_si128(reinterpret_cast<const __m128i *>(poly));
+    x2 = _mm_and_si128(x1, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+    x2 = _mm_and_si128(x2, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    return static_cast<std::uint32_t>(_mm_extract_epi32(x1, 1));
+}
+#endif
+
 static std::uint32_t crc32(std::uint32_t crc, const std::uint8_t *buf, std::size_t size)
 {
     const std::uint8_t *p;
@@ -162,8 +834,333 @@ static std::uint32_t crc32(std::uint32_t crc, const std::uint8_t *buf, std::size
     p = buf;
     crc = crc ^ ~0U;
 
-    while (size--)
-        crc = crc32_tab[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+#ifdef CRYPTOGRAPHY_X86
+    static const bool use_pclmul = CpuFeatures::Current().PCLMUL && CpuFeatures::Current().SSE41;
+    if (use_pclmul && (size >= 64))
+    {
+        auto n = size & ~static_cast<std::size_t>(15);
+        crc = crc32_pclmul(crc, p, n);
+        p += n;
+        size -= n;
+    }
+#endif
+
+    crc = crc32_slice8(crc, p, size);
 
     return crc ^ ~0U;
 }
+
+static const std::uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static inline std::uint32_t sha256_rotr(std::uint32_t x, int n)
+{
+    return (x >> n) | (x << (32 - n));
+}
+
+static void sha256_compress_generic(std::uint32_t state[8], const std::uint8_t *data, std::size_t blocks)
+{
+    std::uint32_t w[64];
+    for (; blocks > 0; blocks -= 1, data += 64)
+    {
+        for (int t = 0; t < 16; t += 1)
+        {
+            w[t] = (static_cast<std::uint32_t>(data[t * 4]) << 24) | (static_cast<std::uint32_t>(data[t * 4 + 1]) << 16) | (static_cast<std::uint32_t>(data[t * 4 + 2]) << 8) | static_cast<std::uint32_t>(data[t * 4 + 3]);
+        }
+        for (int t = 16; t < 64; t += 1)
+        {
+            auto s0 = sha256_rotr(w[t - 15], 7) ^ sha256_rotr(w[t - 15], 18) ^ (w[t - 15] >> 3);
+            auto s1 = sha256_rotr(w[t - 2], 17) ^ sha256_rotr(w[t - 2], 19) ^ (w[t - 2] >> 10);
+            w[t] = w[t - 16] + s0 + w[t - 7] + s1;
+        }
+        auto a = state[0], b = state[1], c = state[2], d = state[3], e = state[4], f = state[5], g = state[6], h = state[7];
+        for (int t = 0; t < 64; t += 1)
+        {
+            auto S1 = sha256_rotr(e, 6) ^ sha256_rotr(e, 11) ^ sha256_rotr(e, 25);
+            auto ch = (e & f) ^ (~e & g);
+            auto t1 = h + S1 + ch + sha256_k[t] + w[t];
+            auto S0 = sha256_rotr(a, 2) ^ sha256_rotr(a, 13) ^ sha256_rotr(a, 22);
+            auto maj = (a & b) ^ (a & c) ^ (b & c);
+            auto t2 = S0 + maj;
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+    }
+}
+
+#ifdef CRYPTOGRAPHY_X86
+//使用SHA扩展指令（SHA-NI），状态按ABEF/CDGH排列，每次处理4轮
+CRYPTOGRAPHY_TARGET("sha,sse4.1,ssse3")
+static void sha256_compress_shani(std::uint32_t state[8], const std::uint8_t *data, std::size_t blocks)
+{
+    const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    auto tmp = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&state[0]));
+    auto state1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&state[4]));
+    tmp = _mm_shuffle_epi32(tmp, 0xB1);
+    state1 = _mm_shuffle_epi32(state1, 0x1B);
+    auto state0 = _mm_alignr_epi8(tmp, state1, 8);
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+    for (; blocks > 0; blocks -= 1, data += 64)
+    {
+        auto abef_save = state0;
+        auto cdgh_save = state1;
+        __m128i w[16];
+        for (int i = 0; i < 16; i += 1)
+        {
+            if (i < 4)
+            {
+                w[i] = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i * 16)), mask);
+            }
+            else
+            {
+                auto m = _mm_sha256msg1_epu32(w[i - 4], w[i - 3]);
+                m = _mm_add_epi32(m, _mm_alignr_epi8(w[i - 1], w[i - 2], 4));
+                w[i] = _mm_sha256msg2_epu32(m, w[i - 1]);
+            }
+            auto msg = _mm_add_epi32(w[i], _mm_loadu_si128(reinterpret_cast<const __m128i *>(&sha256_k[i * 4])));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+            msg = _mm_shuffle_epi32(msg, 0x0E);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+        }
+        state0 = _mm_add_epi32(state0, abef_save);
+        state1 = _mm_add_epi32(state1, cdgh_save);
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1B);
+    state1 = _mm_shuffle_epi32(state1, 0xB1);
+    state0 = _mm_blend_epi16(tmp, state1, 0xF0);
+    state1 = _mm_alignr_epi8(state1, tmp, 8);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(&state[0]), state0);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(&state[4]), state1);
+}
+#endif
+
+static inline std::uint32_t chacha20_rotl(std::uint32_t x, int n)
+{
+    return (x << n) | (x >> (32 - n));
+}
+
+static void chacha20_blocks_generic(const std::uint32_t state[16], std::uint8_t *out, std::size_t blocks)
+{
+    for (std::size_t b = 0; b < blocks; b += 1, out += 64)
+    {
+        std::uint32_t x[16];
+        std::uint32_t input[16];
+        for (int k = 0; k < 16; k += 1)
+        {
+            input[k] = state[k];
+        }
+        input[12] += static_cast<std::uint32_t>(b);
+        for (int k = 0; k < 16; k += 1)
+        {
+            x[k] = input[k];
+        }
+        auto QuarterRound = [&](int a, int b, int c, int d)
+        {
+            x[a] += x[b]; x[d] = chacha20_rotl(x[d] ^ x[a], 16);
+            x[c] += x[d]; x[b] = chacha20_rotl(x[b] ^ x[c], 12);
+            x[a] += x[b]; x[d] = chacha20_rotl(x[d] ^ x[a], 8);
+            x[c] += x[d]; x[b] = chacha20_rotl(x[b] ^ x[c], 7);
+        };
+        for (int r = 0; r < 10; r += 1)
+        {
+            QuarterRound(0, 4, 8, 12);
+            QuarterRound(1, 5, 9, 13);
+            QuarterRound(2, 6, 10, 14);
+            QuarterRound(3, 7, 11, 15);
+            QuarterRound(0, 5, 10, 15);
+            QuarterRound(1, 6, 11, 12);
+            QuarterRound(2, 7, 8, 13);
+            QuarterRound(3, 4, 9, 14);
+        }
+        for (int k = 0; k < 16; k += 1)
+        {
+            auto v = x[k] + input[k];
+            out[k * 4] = static_cast<std::uint8_t>(v);
+            out[k * 4 + 1] = static_cast<std::uint8_t>(v >> 8);
+            out[k * 4 + 2] = static_cast<std::uint8_t>(v >> 16);
+            out[k * 4 + 3] = static_cast<std::uint8_t>(v >> 24);
+        }
+    }
+}
+
+#ifdef CRYPTOGRAPHY_X86
+//每个寄存器存放4个块的同一个字，一次计算4个块
+CRYPTOGRAPHY_TARGET("sse2")
+static void chacha20_blocks4_sse2(const std::uint32_t state[16], std::uint8_t *out)
+{
+    __m128i x[16];
+    __m128i input[16];
+    for (int k = 0; k < 16; k += 1)
+    {
+        input[k] = _mm_set1_epi32(static_cast<int>(state[k]));
+    }
+    input[12] = _mm_add_epi32(input[12], _mm_setr_epi32(0, 1, 2, 3));
+    for (int k = 0; k < 16; k += 1)
+    {
+        x[k] = input[k];
+    }
+#define CHACHA20_ROTL128(v, n) _mm_or_si128(_mm_slli_epi32(v, n), _mm_srli_epi32(v, 32 - (n)))
+#define CHACHA20_QR128(a, b, c, d) \
+    x[a] = _mm_add_epi32(x[a], x[b]); x[d] = CHACHA20_ROTL128(_mm_xor_si128(x[d], x[a]), 16); \
+    x[c] = _mm_add_epi32(x[c], x[d]); x[b] = CHACHA20_ROTL128(_mm_xor_si128(x[b], x[c]), 12); \
+    x[a] = _mm_add_epi32(x[a], x[b]); x[d] = CHACHA20_ROTL128(_mm_xor_si128(x[d], x[a]), 8); \
+    x[c] = _mm_add_epi32(x[c], x[d]); x[b] = CHACHA20_ROTL128(_mm_xor_si128(x[b], x[c]), 7);
+    for (int r = 0; r < 10; r += 1)
+    {
+        CHACHA20_QR128(0, 4, 8, 12)
+        CHACHA20_QR128(1, 5, 9, 13)
+        CHACHA20_QR128(2, 6, 10, 14)
+        CHACHA20_QR128(3, 7, 11, 15)
+        CHACHA20_QR128(0, 5, 10, 15)
+        CHACHA20_QR128(1, 6, 11, 12)
+        CHACHA20_QR128(2, 7, 8, 13)
+        CHACHA20_QR128(3, 4, 9, 14)
+    }
+#undef CHACHA20_QR128
+#undef CHACHA20_ROTL128
+    for (int k = 0; k < 16; k += 1)
+    {
+        x[k] = _mm_add_epi32(x[k], input[k]);
+    }
+    //按4个字一组转置，得到每个块的连续16字节
+    for (int g = 0; g < 4; g += 1)
+    {
+        auto a = x[g * 4], b = x[g * 4 + 1], c = x[g * 4 + 2], d = x[g * 4 + 3];
+        auto ab0 = _mm_unpacklo_epi32(a, b);
+        auto ab1 = _mm_unpackhi_epi32(a, b);
+        auto cd0 = _mm_unpacklo_epi32(c, d);
+        auto cd1 = _mm_unpackhi_epi32(c, d);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 0 * 64 + g * 16), _mm_unpacklo_epi64(ab0, cd0));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 1 * 64 + g * 16), _mm_unpackhi_epi64(ab0, cd0));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 2 * 64 + g * 16), _mm_unpacklo_epi64(ab1, cd1));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 3 * 64 + g * 16), _mm_unpackhi_epi64(ab1, cd1));
+    }
+}
+
+//每个寄存器存放8个块的同一个字，一次计算8个块，低128位为块0-3，高128位为块4-7
+CRYPTOGRAPHY_TARGET("avx2")
+static void chacha20_blocks8_avx2(const std::uint32_t state[16], std::uint8_t *out)
+{
+    __m256i x[16];
+    __m256i input[16];
+    for (int k = 0; k < 16; k += 1)
+    {
+        input[k] = _mm256_set1_epi32(static_cast<int>(state[k]));
+    }
+    input[12] = _mm256_add_epi32(input[12], _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+    for (int k = 0; k < 16; k += 1)
+    {
+        x[k] = input[k];
+    }
+    const auto rot16 = _mm256_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13, 2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13);
+    const auto rot8 = _mm256_setr_epi8(3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14, 3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14);
+#define CHACHA20_ROTL256(v, n) _mm256_or_si256(_mm256_slli_epi32(v, n), _mm256_srli_epi32(v, 32 - (n)))
+#define CHACHA20_QR256(a, b, c, d) \
+    x[a] = _mm256_add_epi32(x[a], x[b]); x[d] = _mm256_shuffle_epi8(_mm256_xor_si256(x[d], x[a]), rot16); \
+    x[c] = _mm256_add_epi32(x[c], x[d]); x[b] = CHACHA20_ROTL256(_mm256_xor_si256(x[b], x[c]), 12); \
+    x[a] = _mm256_add_epi32(x[a], x[b]); x[d] = _mm256_shuffle_epi8(_mm256_xor_si256(x[d], x[a]), rot8); \
+    x[c] = _mm256_add_epi32(x[c], x[d]); x[b] = CHACHA20_ROTL256(_mm256_xor_si256(x[b], x[c]), 7);
+    for (int r = 0; r < 10; r += 1)
+    {
+        CHACHA20_QR256(0, 4, 8, 12)
+        CHACHA20_QR256(1, 5, 9, 13)
+        CHACHA20_QR256(2, 6, 10, 14)
+        CHACHA20_QR256(3, 7, 11, 15)
+        CHACHA20_QR256(0, 5, 10, 15)
+        CHACHA20_QR256(1, 6, 11, 12)
+        CHACHA20_QR256(2, 7, 8, 13)
+        CHACHA20_QR256(3, 4, 9, 14)
+    }
+#undef CHACHA20_QR256
+#undef CHACHA20_ROTL256
+    for (int k = 0; k < 16; k += 1)
+    {
+        x[k] = _mm256_add_epi32(x[k], input[k]);
+    }
+    for (int g = 0; g < 4; g += 1)
+    {
+        auto a = x[g * 4], b = x[g * 4 + 1], c = x[g * 4 + 2], d = x[g * 4 + 3];
+        auto ab0 = _mm256_unpacklo_epi32(a, b);
+        auto ab1 = _mm256_unpackhi_epi32(a, b);
+        auto cd0 = _mm256_unpacklo_epi32(c, d);
+        auto cd1 = _mm256_unpackhi_epi32(c, d);
+        __m256i t[4] = { _mm256_unpacklo_epi64(ab0, cd0), _mm256_unpackhi_epi64(ab0, cd0), _mm256_unpacklo_epi64(ab1, cd1), _mm256_unpackhi_epi64(ab1, cd1) };
+        for (int j = 0; j < 4; j += 1)
+        {
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out + j * 64 + g * 16), _mm256_castsi256_si128(t[j]));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out + (j + 4) * 64 + g * 16), _mm256_extracti128_si256(t[j], 1));
+        }
+    }
+}
+#endif
+
+static void chacha20_blocks(const std::uint32_t state[16], std::uint8_t *out, std::size_t blocks)
+{
+#ifdef CRYPTOGRAPHY_X86
+    static const bool use_avx2 = CpuFeatures::Current().AVX2;
+    static const bool use_sse2 = CpuFeatures::Current().SSE2;
+    std::uint32_t s[16];
+    std::memcpy(s, state, sizeof(s));
+    if (use_avx2)
+    {
+        while (blocks >= 8)
+        {
+            chacha20_blocks8_avx2(s, out);
+            s[12] += 8;
+            out += 8 * 64;
+            blocks -= 8;
+        }
+    }
+    if (use_sse2)
+    {
+        while (blocks >= 4)
+        {
+            chacha20_blocks4_sse2(s, out);
+            s[12] += 4;
+            out += 4 * 64;
+            blocks -= 4;
+        }
+    }
+    chacha20_blocks_generic(s, out, blocks);
+#else
+    chacha20_blocks_generic(state, out, blocks);
+#endif
+}
+
+static void sha256_compress(std::uint32_t state[8], const std::uint8_t *data, std::size_t blocks)
+{
+#ifdef CRYPTOGRAPHY_X86
+    static const bool use_shani = CpuFeatures::Current().SHA && CpuFeatures::Current().SSE41 && CpuFeatures::Current().SSSE3;
+    if (use_shani)
+    {
+        sha256_compress_shani(state, data, blocks);
+        return;
+    }
+#endif
+    sha256_compress_generic(state, data, blocks);
+}
@@ -1,15 +1,50 @@
 ﻿#pragma once
 
 #include <cstdint>
+#include <cstddef>
 #include <vector>
+#include <array>
+#include <span>
 
 namespace Algorithms
 {
     namespace Cryptography
     {
+        //CRC32和SHA256在运行时按处理器支持的指令集（PCLMUL、SHA）选择实现，不支持时使用查表（slice-by-8）和通用实现
         std::int32_t CRC32(const std::vector<std::uint8_t> &Bytes);
+        std::int32_t CRC32(std::span<const std::uint8_t> Bytes);
         std::vector<std::uint8_t> SHA256(const std::vector<std::uint8_t> &Bytes);
+        std::array<std::uint8_t, 32> SHA256(std::span<const std::uint8_t> Bytes);
         std::vector<std::uint8_t> HMACSHA256Simple(const std::vector<std::uint8_t> &Key, const std::vector<std::uint8_t> &Bytes);
+
+        class SHA256Hasher
+        {
+        private:
+            std::uint32_t State[8];
+            std::uint8_t Block[64];
+            std::size_t BlockLength;
+            std::uint64_t TotalLength;
+
+        public:
+            SHA256Hasher();
+            void Update(std::span<const std::uint8_t> Bytes);
+            std::array<std::uint8_t, 32> Final();
+        };
+
+        /// <summary>
+        /// HMACSHA256Simple = H((K XOR opad) :: H((K XOR ipad) :: Inner))，密钥不补齐到块长度
+        /// 密钥由固定前缀和可变后缀组成时，预先吸收前缀的内外两个哈希状态，每次计算只需复制状态后继续
+        /// </summary>
+        class HMACSHA256SimpleState
+        {
+        private:
+            SHA256Hasher Inner;
+            SHA256Hasher Outer;
+
+        public:
+            HMACSHA256SimpleState(std::span<const std::uint8_t> KeyPrefix);
+            std::array<std::uint8_t, 32> Compute(std::span<const std::uint8_t> KeySuffix, std::span<const std::uint8_t> Bytes) const;
+        };
     }
 
     class RC4
@@ -23,7 +58,66 @@ namespace Algorithms
         RC4(const std::vector<std::uint8_t> &Key);
         std::uint8_t NextByte();
         void Skip(int n);
+        /// <summary>连续生成n个字节的密钥流，与调用n次NextByte相同</summary>
+        void Generate(std::uint8_t *Out, std::size_t n);
+        /// <summary>将密钥流异或到数据上，与逐字节异或NextByte相同</summary>
+        void XorInPlace(std::span<std::uint8_t> Bytes);
     private:
         void Swap(std::uint8_t &a, std::uint8_t &b);
     };
+
+    /// <summary>
+    /// ChaCha20流密码（RFC 8439），密钥32字节，Nonce 12字节
+    /// 按批生成密钥流，运行时按处理器支持的指令集选择AVX2（8块）、SSE2（4块）或通用实现
+    /// </summary>
+    class ChaCha20
+    {
+    private:
+        std::uint32_t State[16];
+        std::uint8_t KeyStream[512];
+        std::size_t KeyStreamOffset;
+        std::size_t KeyStreamLength;
+
+    public:
+        ChaCha20(std::span<const std::uint8_t> Key, std::span<const std::uint8_t> Nonce, std::uint32_t Counter = 0);
+        /// <summary>将密钥流异或到数据上，加密和解密相同，可分多次调用</summary>
+        void Transform(std::uint8_t *Data, std::size_t Length);
+    };
+
+    /// <summary>Poly1305消息认证码（RFC 8439），一次性密钥32字节，标签16字节</summary>
+    class Poly1305
+    {
+    private:
+        std::uint32_t R[5];
+        std::uint32_t H[5];
+        std::uint32_t Pad[4];
+        std::uint8_t Block[16];
+        std::size_t BlockLength;
+
+        void Blocks(const std::uint8_t *Data, std::size_t Length, bool IsFinal);
+
+    public:
+        Poly1305(std::span<const std::uint8_t> Key);
+        void Update(std::span<const std::uint8_t> Bytes);
+        std::array<std::uint8_t, 16> Final();
+    };
+
+    /// <summary>
+    /// ChaCha20-Poly1305认证加密（RFC 8439），密钥32字节，Nonce 12字节，标签16字节
+    /// 同一密钥下每次加密须使用不同的Nonce
+    /// </summary>
+    class ChaCha20Poly1305
+    {
+    private:
+        std::array<std::uint8_t, 32> Key;
+
+        std::array<std::uint8_t, 16> ComputeTag(ChaCha20 &Stream, std::span<const std::uint8_t> AssociatedData, const std::uint8_t *CipherText, std::size_t Length);
+
+    public:
+        ChaCha20Poly1305(std::span<const std::uint8_t> Key);
+        /// <summary>原地加密Data，将标签写入Tag</summary>
+        void Seal(std::span<const std::uint8_t> Nonce, std::span<const std::uint8_t> AssociatedData, std::uint8_t *Data, std::size_t Length, std::uint8_t *Tag);
+        /// <summary>验证标签后原地解密Data，标签不符时返回false且不修改Data</summary>
+        bool Open(std::span<const std::uint8_t> Nonce, std::span<const std::uint8_t> AssociatedData, std::uint8_t *Data, std::size_t Length, const std::uint8_t *Tag);
+    };
 }
@@ -12,6 +12,7 @@
 #include <stdexcept>
 #include <functional>
 #include <mutex>
+#include <atomic>
 
 namespace Client
 {
@@ -314,8 +315,13 @@ namespace Client
             std::uint32_t CommandHash;
             std::int32_t ParametersLength;
 
+            //已请求紧凑编号，此后接受服务器发送的紧凑格式帧
+            bool IsCompactCommandIdsRequested;
+            //服务器已同意紧凑编号，此后发送的帧使用紧凑格式
+            std::atomic<bool> IsCompactCommandIds;
+
             Context(int ReadBufferSize)
-                : ReadBufferOffset(0), ReadBufferLength(0), State(0), CommandNameLength(0), CommandName(u""), CommandHash(0), ParametersLength(0)
+                : ReadBufferOffset(0), ReadBufferLength(0), State(0), CommandNameLength(0), CommandName(u""), CommandHash(0), ParametersLength(0), IsCompactCommandIdsRequested(false), IsCompactCommandIds(false)
             {
                 ReadBuffer = std::make_shared<std::vector<std::uint8_t>>();
                 ReadBuffer->resize(ReadBufferSize, 0);
@@ -334,13 +340,7 @@ namespace Client
             this->Transformer = Transformer;
             bc->ClientEvent = [=](std::u16string CommandName, std::uint32_t CommandHash, std::vector<std::uint8_t> Parameters)
             {
-                ByteArrayStream s;
-                s.WriteString(CommandName);
-                s.WriteUInt32(CommandHash);
-                s.WriteInt32(static_cast<std::int32_t>(Parameters.size()));
-                s.WriteBytes(Parameters);
-                s.SetPosition(0);
-                auto Bytes = s.ReadBytes(s.GetLength());
+                auto Bytes = EncodeFrame(CommandName, CommandHash, Parameters);
                 {
                     std::unique_lock<std::mutex> Lock(c.WriteBufferLockee);
                     if (Transformer != nullptr)
@@ -353,6 +353,25 @@ namespace Client
             };
         }
 
+        /// <summary>
+        /// 请求使用紧凑编号代替命令名称和Hash，需在发送其他命令前调用
+        /// 服务器同意后双方改用紧凑格式；服务器不支持时会返回未知命令错误，此后仍使用完整格式
+        /// </summary>
+        void RequestCompactCommandIds()
+        {
+            auto Bytes = EncodeFrame(CompactCommandIdsCommandName, 0, GetHashBytes());
+            {
+                std::unique_lock<std::mutex> Lock(c.WriteBufferLockee);
+                if (Transformer != nullptr)
+                {
+                    Transformer->Transform(Bytes, 0, static_cast<int>(Bytes.size()));
+                }
+                c.IsCompactCommandIdsRequested = true;
+                c.WriteBuffer.push_back(std::make_shared<std::vector<std::uint8_t>>(Bytes));
+            }
+            if (ClientMethod != nullptr) { ClientMethod(); }
+        }
+
         std::shared_ptr<std::vector<std::uint8_t>> GetReadBuffer()
         {
             return c.ReadBuffer;
@@ -385,7 +404,8 @@ namespace Client
             auto BufferLength = c.ReadBufferOffset + c.ReadBufferLength;
             if (Transformer != nullptr)
             {
-                Transformer->Inverse(*Buffer, BufferLength, Count);
+                //逆变换后的长度可能小于读取的长度，Count为0时取出此前暂存的数据
+                Count = Transformer->Inverse(*Buffer, BufferLength, Count);
             }
             BufferLength += Count;
 
@@ -394,12 +414,40 @@ namespace Client
                 auto r = TryShift(c, Buffer, FirstPosition, BufferLength - FirstPosition);
                 if (r == nullptr)
                 {
+                    //逆变换暂存了放不下的数据时，整理缓冲区后继续取出
+                    if (Transformer != nullptr)
+                    {
+                        if ((BufferLength >= static_cast<int>(Buffer->size())) && (FirstPosition > 0))
+                        {
+                            auto CopyLength = BufferLength - FirstPosition;
+                            for (int i = 0; i < CopyLength; i += 1)
+                            {
+                                (*Buffer)[i] = (*Buffer)[FirstPosition + i];
+                            }
+                            BufferLength = CopyLength;
+                            FirstPosition = 0;
+                        }
+                        auto n = Transformer->Inverse(*Buffer, BufferLength, 0);
+                        if (n > 0)
+                        {
+                            BufferLength += n;
+                            continue;
+                        }
+                    }
                     break;
                 }
                 FirstPosition = r->Position;
 
                 if (r->Command != nullptr)
                 {
+                    if (c.IsCompactCommandIdsRequested && (r->Command->CommandName == CompactCommandIdsCommandName))
+                    {
+                        if (r->Command->Parameters == GetHashBytes())
+                        {
+                            c.IsCompactCommandIds = true;
+                        }
+                        continue;
+                    }
                     auto CommandName = r->Command->CommandName;
                     auto CommandHash = r->Command->CommandHash;
                     auto Parameters = r->Command->Parameters;
@@ -432,6 +480,11 @@ namespace Client
                 c.ReadBufferOffset = FirstPosition;
                 c.ReadBufferLength = BufferLength - FirstPosition;
             }
+            //调用方在返回命令后缓冲区为空时不再调用Handle，须先取出逆变换暂存的数据
+            if ((Transformer != nullptr) && ret->OnCommand() && (c.ReadBufferLength == 0))
+            {
+                c.ReadBufferLength = Transformer->Inverse(*Buffer, 0, 0);
+            }
 
             return ret;
         }
@@ -442,6 +495,39 @@ namespace Client
         }
 
     private:
+        static constexpr const char16_t *CompactCommandIdsCommandName = u"$CompactCommandIds";
+
+        std::vector<std::uint8_t> GetHashBytes()
+        {
+            auto Hash = bc->Hash();
+            std::vector<std::uint8_t> HashBytes;
+            for (int k = 0; k < 8; k += 1)
+            {
+                HashBytes.push_back(static_cast<std::uint8_t>((Hash >> (k * 8)) & 0xFF));
+            }
+            return HashBytes;
+        }
+
+        /// <summary>完整格式：NameLength(4) Name CommandHash(4) ParametersLength(4) Parameters；紧凑格式：-1-CommandId(4) ParametersLength(4) Parameters</summary>
+        std::vector<std::uint8_t> EncodeFrame(const std::u16string &CommandName, std::uint32_t CommandHash, const std::vector<std::uint8_t> &Parameters)
+        {
+            ByteArrayStream s;
+            auto CommandId = c.IsCompactCommandIds ? bc->GetCommandId(CommandName, CommandHash) : -1;
+            if (CommandId >= 0)
+            {
+                s.WriteInt32(-1 - CommandId);
+            }
+            else
+            {
+                s.WriteString(CommandName);
+                s.WriteUInt32(CommandHash);
+            }
+            s.WriteInt32(static_cast<std::int32_t>(Parameters.size()));
+            s.WriteBytes(Parameters);
+            s.SetPosition(0);
+            return s.ReadBytes(s.GetLength());
+        }
+
         class Command
         {
         public:
@@ -470,10 +556,18 @@ namespace Client
                     }
                     s.SetPosition(0);
                     bc.CommandNameLength = s.ReadInt32();
-                    if (bc.CommandNameLength < 0 || bc.CommandNameLength > 128) { throw std::logic_error("InvalidOperationException"); }
                     auto r = std::make_shared<TryShiftResult>();
                     r->Command = nullptr;
                     r->Position = Position + 4;
+                    if (bc.CommandNameLength < 0)
+                    {
+                        //紧凑格式，直接跳到读取ParametersLength
+                        if (!bc.IsCompactCommandIdsRequested) { throw std::logic_error("InvalidOperationException"); }
+                        if (!this->bc->TryGetCommand(-1 - bc.CommandNameLength, bc.CommandName, bc.CommandHash)) { throw std::logic_error("InvalidOperationException"); }
+                        bc.State = 3;
+                        return r;
+                    }
+                    if (bc.CommandNameLength > 128) { throw std::logic_error("InvalidOperationException"); }
                     bc.State = 1;
                     return r;
                 }
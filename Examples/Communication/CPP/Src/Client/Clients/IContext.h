@@ -1,21 +1,63 @@
 ﻿#pragma once
 
+#include "BaseSystem/Cryptography.h"
+
 #include <cstdint>
 #include <vector>
+#include <memory>
+#include <mutex>
 
 namespace Client
 {
+    enum class SecureCipher
+    {
+        RC4,
+        ChaCha20
+    };
+
     class SecureContext
     {
     public:
+        SecureCipher Cipher; //流数据加密算法
         std::vector<std::uint8_t> ServerToken; //服务器到客户端数据的Token
         std::vector<std::uint8_t> ClientToken; //客户端到服务器数据的Token
+        std::vector<std::uint8_t> ClientSalt; //ChaCha20使用，客户端为每个会话随机生成，握手时发给服务器
+        std::vector<std::uint8_t> ServerSalt; //ChaCha20使用，服务器为每个会话随机生成，握手时发给客户端
+
+        SecureContext()
+            : Cipher(SecureCipher::RC4)
+        {
+        }
+
+        /// <summary>以ServerToken为密钥前缀的HMAC中间状态，首次使用时创建，此后不能再修改ServerToken</summary>
+        const Algorithms::Cryptography::HMACSHA256SimpleState &ServerTokenHMAC()
+        {
+            std::call_once(ServerTokenHMACOnce, [&]() { ServerTokenHMACValue = std::make_unique<Algorithms::Cryptography::HMACSHA256SimpleState>(ServerToken); });
+            return *ServerTokenHMACValue;
+        }
+        /// <summary>以ClientToken为密钥前缀的HMAC中间状态，首次使用时创建，此后不能再修改ClientToken</summary>
+        const Algorithms::Cryptography::HMACSHA256SimpleState &ClientTokenHMAC()
+        {
+            std::call_once(ClientTokenHMACOnce, [&]() { ClientTokenHMACValue = std::make_unique<Algorithms::Cryptography::HMACSHA256SimpleState>(ClientToken); });
+            return *ClientTokenHMACValue;
+        }
+
+    private:
+        std::once_flag ServerTokenHMACOnce;
+        std::unique_ptr<Algorithms::Cryptography::HMACSHA256SimpleState> ServerTokenHMACValue;
+        std::once_flag ClientTokenHMACOnce;
+        std::unique_ptr<Algorithms::Cryptography::HMACSHA256SimpleState> ClientTokenHMACValue;
     };
 
     class IBinaryTransformer
     {
     public:
+        /// <summary>变换Buffer[Start, Start + Count)，变换后可能变长（如附加认证标签），此时须Start + Count等于Buffer的长度，Buffer随之加长</summary>
         virtual void Transform(std::vector<std::uint8_t> &Buffer, int Start, int Count) = 0;
-        virtual void Inverse(std::vector<std::uint8_t> &Buffer, int Start, int Count) = 0;
+        /// <summary>
+        /// 逆变换Buffer[Start, Start + Count)，结果写回Buffer[Start, Start + 返回值)，不超过Buffer的剩余空间
+        /// 带认证标签时只输出已验证的数据，不完整的记录和放不下的数据暂存，之后以Count为0调用时继续输出；验证失败时抛出异常
+        /// </summary>
+        virtual int Inverse(std::vector<std::uint8_t> &Buffer, int Start, int Count) = 0;
     };
 }
@@ -15,6 +15,9 @@ namespace Client
 
         virtual std::uint64_t Hash() = 0;
         virtual void HandleResult(std::u16string CommandName, std::uint32_t CommandHash, std::vector<std::uint8_t> Parameters) = 0;
+        /// <summary>命令的紧凑编号，不存在时返回-1</summary>
+        virtual std::int32_t GetCommandId(const std::u16string &CommandName, std::uint32_t CommandHash) = 0;
+        virtual bool TryGetCommand(std::int32_t CommandId, std::u16string &CommandName, std::uint32_t &CommandHash) = 0;
         std::function<void(std::u16string CommandName, std::uint32_t CommandHash, std::vector<std::uint8_t> Parameters)> ClientEvent;
     };
 }
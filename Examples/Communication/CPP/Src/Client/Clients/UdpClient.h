@@ -13,6 +13,7 @@
 #include <climits>
 #include <cmath>
 #include <cstring>
+#include <algorithm>
 #include <vector>
 #include <set>
 #include <unordered_map>
@@ -102,6 +103,185 @@ namespace Client
             std::memcpy(&Destination[DestinationIndex], &Source[SourceIndex], Length);
         }
 
+        /// <summary>
+        /// 确认部分以已按序收到的最大序号开头，其后为该序号之后乱序收到的序号，有两种格式
+        /// 列表格式：NumIndex(2) Index(2)*NumIndex
+        /// 位图格式（Flag中包含SAK）：Index(2) NumMaskBytes(2) Mask(NumMaskBytes)，Mask的第k位表示序号Index + 1 + k已收到
+        /// </summary>
+        static int GetAckLength(const std::vector<int> &Indices, bool IsBitmap)
+        {
+            if (!IsBitmap)
+            {
+                return 2 + static_cast<int>(Indices.size()) * 2;
+            }
+            auto NumMaskBytes = 0;
+            for (std::size_t k = 1; k < Indices.size(); k += 1)
+            {
+                auto Bit = (Indices[k] - Indices[0] - 1 + IndexSpace()) % IndexSpace();
+                NumMaskBytes = std::max(NumMaskBytes, Bit / 8 + 1);
+            }
+            return 4 + NumMaskBytes;
+        }
+        static void WriteAck(std::vector<std::uint8_t> &Buffer, int Offset, const std::vector<int> &Indices, bool IsBitmap)
+        {
+            if (!IsBitmap)
+            {
+                auto NumIndex = static_cast<int>(Indices.size());
+                Buffer[Offset] = static_cast<std::uint8_t>(NumIndex & 0xFF);
+                Buffer[Offset + 1] = static_cast<std::uint8_t>((NumIndex >> 8) & 0xFF);
+                int j = 0;
+                for (auto i : Indices)
+                {
+                    Buffer[Offset + 2 + j * 2] = static_cast<std::uint8_t>(i & 0xFF);
+                    Buffer[Offset + 2 + j * 2 + 1] = static_cast<std::uint8_t>((i >> 8) & 0xFF);
+                    j += 1;
+                }
+                return;
+            }
+            auto Index = Indices[0];
+            auto NumMaskBytes = GetAckLength(Indices, true) - 4;
+            Buffer[Offset] = static_cast<std::uint8_t>(Index & 0xFF);
+            Buffer[Offset + 1] = static_cast<std::uint8_t>((Index >> 8) & 0xFF);
+            Buffer[Offset + 2] = static_cast<std::uint8_t>(NumMaskBytes & 0xFF);
+            Buffer[Offset + 3] = static_cast<std::uint8_t>((NumMaskBytes >> 8) & 0xFF);
+            std::fill(Buffer.begin() + Offset + 4, Buffer.begin() + Offset + 4 + NumMaskBytes, static_cast<std::uint8_t>(0));
+            for (std::size_t k = 1; k < Indices.size(); k += 1)
+            {
+                auto Bit = (Indices[k] - Index - 1 + IndexSpace()) % IndexSpace();
+                Buffer[Offset + 4 + Bit / 8] |= static_cast<std::uint8_t>(1 << (Bit % 8));
+            }
+        }
+        static bool TryReadAck(const std::vector<std::uint8_t> &Buffer, int &Offset, bool IsBitmap, std::vector<int> &Indices)
+        {
+            auto Size = static_cast<int>(Buffer.size());
+            if (!IsBitmap)
+            {
+                if (Size < Offset + 2) { return false; }
+                auto NumIndex = Buffer[Offset] | (static_cast<std::int32_t>(Buffer[Offset + 1]) << 8);
+                if (Size < Offset + 2 + NumIndex * 2) { return false; }
+                if (NumIndex > WritingWindowSize()) { return false; }
+                Offset += 2;
+                Indices.resize(NumIndex, 0);
+                for (int k = 0; k < NumIndex; k += 1)
+                {
+                    Indices[k] = Buffer[Offset + k * 2] | (static_cast<std::int32_t>(Buffer[Offset + k * 2 + 1]) << 8);
+                }
+                Offset += NumIndex * 2;
+                return true;
+            }
+            if (Size < Offset + 4) { return false; }
+            auto Index = Buffer[Offset] | (static_cast<std::int32_t>(Buffer[Offset + 1]) << 8);
+            auto NumMaskBytes = Buffer[Offset + 2] | (static_cast<std::int32_t>(Buffer[Offset + 3]) << 8);
+            if (Size < Offset + 4 + NumMaskBytes) { return false; }
+            if (NumMaskBytes > ReadingWindowSize() / 8) { return false; }
+            Offset += 4;
+            Indices.clear();
+            Indices.push_back(Index);
+            for (int k = 0; k < NumMaskBytes; k += 1)
+            {
+                auto b = Buffer[Offset + k];
+                if (b == 0) { continue; }
+                for (int Bit = 0; Bit < 8; Bit += 1)
+                {
+                    if ((b & (1 << Bit)) == 0) { continue; }
+                    if (static_cast<int>(Indices.size()) >= WritingWindowSize()) { return false; }
+                    Indices.push_back((Index + 1 + k * 8 + Bit) % IndexSpace());
+                }
+            }
+            Offset += NumMaskBytes;
+            return true;
+        }
+
+        /// <summary>
+        /// 发送方的往返时间估计和拥塞窗口
+        /// 自适应模式下按SRTT/RTTVAR计算重传超时并指数退避，拥塞窗口按慢启动和拥塞避免增长，超时和快速重传时减小
+        /// 兼容模式下使用固定的重传时间表和固定的写入窗口
+        /// </summary>
+        class CongestionControl
+        {
+        public:
+            bool IsAdaptive;
+            double SmoothedRtt;
+            double RttVariation;
+            bool HasRttSample;
+            int RetransmissionTimeout;
+            double CongestionWindow;
+            double SlowStartThreshold;
+
+            static int InitialRetransmissionTimeout() { return 400; }
+            static int MinRetransmissionTimeout() { return 100; }
+            static int MaxRetransmissionTimeout() { return 4000; }
+            static int InitialCongestionWindow() { return 4; }
+            static int FastRetransmitThreshold() { return 3; }
+
+            CongestionControl(bool IsAdaptive)
+                : IsAdaptive(IsAdaptive), SmoothedRtt(0), RttVariation(0), HasRttSample(false), RetransmissionTimeout(InitialRetransmissionTimeout()), CongestionWindow(InitialCongestionWindow()), SlowStartThreshold(WritingWindowSize())
+            {
+            }
+
+            int GetTimeoutMilliseconds(int ResentCount)
+            {
+                if (!IsAdaptive) { return UdpClient::GetTimeoutMilliseconds(ResentCount); }
+                auto Timeout = RetransmissionTimeout;
+                for (int k = 0; (k < ResentCount) && (Timeout < MaxRetransmissionTimeout()); k += 1)
+                {
+                    Timeout *= 2;
+                }
+                return std::min(Timeout, MaxRetransmissionTimeout());
+            }
+            int WindowSize()
+            {
+                if (!IsAdaptive) { return WritingWindowSize(); }
+                return std::max(1, std::min(static_cast<int>(CongestionWindow), WritingWindowSize()));
+            }
+
+            void OnRttSample(double Milliseconds)
+            {
+                if (!IsAdaptive) { return; }
+                if (!HasRttSample)
+                {
+                    SmoothedRtt = Milliseconds;
+                    RttVariation = Milliseconds / 2;
+                    HasRttSample = true;
+                }
+                else
+                {
+                    RttVariation = 0.75 * RttVariation + 0.25 * std::abs(SmoothedRtt - Milliseconds);
+                    SmoothedRtt = 0.875 * SmoothedRtt + 0.125 * Milliseconds;
+                }
+                auto Timeout = static_cast<int>(std::ceil(SmoothedRtt + std::max(1.0, 4 * RttVariation)));
+                RetransmissionTimeout = std::max(MinRetransmissionTimeout(), std::min(Timeout, MaxRetransmissionTimeout()));
+            }
+            void OnAcknowledged(int Count)
+            {
+                if (!IsAdaptive) { return; }
+                for (int k = 0; k < Count; k += 1)
+                {
+                    if (CongestionWindow < SlowStartThreshold)
+                    {
+                        CongestionWindow += 1;
+                    }
+                    else
+                    {
+                        CongestionWindow += 1 / CongestionWindow;
+                    }
+                }
+                CongestionWindow = std::min(CongestionWindow, static_cast<double>(WritingWindowSize()));
+            }
+            void OnFastRetransmit()
+            {
+                if (!IsAdaptive) { return; }
+                SlowStartThreshold = std::max(CongestionWindow / 2, 2.0);
+                CongestionWindow = SlowStartThreshold;
+            }
+            void OnTimeout()
+            {
+                if (!IsAdaptive) { return; }
+                SlowStartThreshold = std::max(CongestionWindow / 2, 2.0);
+                CongestionWindow = 1;
+            }
+        };
+
         class Part
         {
         public:
@@ -109,6 +289,9 @@ namespace Client
             std::shared_ptr<std::vector<std::uint8_t>> Data;
             std::chrono::steady_clock::time_point ResendTime;
             int ResentCount;
+            bool IsSent;
+            std::chrono::steady_clock::time_point SentTime;
+            int NumSkipped;
         };
         class PartContext
         {
@@ -174,6 +357,8 @@ namespace Client
                 p->Data = b;
                 p->ResendTime = std::chrono::steady_clock::now() + std::chrono::milliseconds(GetTimeoutMilliseconds(0));
                 p->ResentCount = 0;
+                p->IsSent = false;
+                p->NumSkipped = 0;
                 Parts[Index] = p;
                 return true;
             }
@@ -188,11 +373,13 @@ namespace Client
                 p->Data = Data;
                 p->ResendTime = std::chrono::steady_clock::now() + std::chrono::milliseconds(GetTimeoutMilliseconds(0));
                 p->ResentCount = 0;
+                p->IsSent = false;
+                p->NumSkipped = 0;
                 Parts[Index] = p;
                 return true;
             }
 
-            void Acknowledge(int Index, const std::vector<int> &Indices, int MaxWritten)
+            void Acknowledge(int Index, const std::vector<int> &Indices, int MaxWritten, std::chrono::steady_clock::time_point Time, CongestionControl &cc)
             {
                 // Parts (= [MaxHandled, MaxWritten]
                 // Index (- [MaxHandled, MaxWritten]
@@ -212,22 +399,51 @@ namespace Client
                     if (!IsEqualOrAfter(MaxWritten, i)) { return; }
                 }
 
-                while (MaxHandled != Index)
+                auto NumAcknowledged = 0;
+                auto Remove = [&](int i)
                 {
-                    auto i = GetSuccessor(MaxHandled);
-                    if (Parts.count(i) > 0)
+                    auto Pair = Parts.find(i);
+                    if (Pair == Parts.end()) { return; }
+                    auto Value = Pair->second;
+                    if (Value->IsSent)
                     {
-                        Parts.erase(i);
+                        //只用未重传过的包估计往返时间（Karn算法）
+                        if (Value->ResentCount == 0)
+                        {
+                            cc.OnRttSample(std::chrono::duration<double, std::chrono::milliseconds::period>(Time - Value->SentTime).count());
+                        }
+                        NumAcknowledged += 1;
                     }
+                    Parts.erase(Pair);
+                };
+                while (MaxHandled != Index)
+                {
+                    auto i = GetSuccessor(MaxHandled);
+                    Remove(i);
                     MaxHandled = i;
                 }
+                auto MaxAcknowledged = Index;
                 for (auto i : Indices)
                 {
-                    if (Parts.count(i) > 0)
+                    Remove(i);
+                    if (IsEqualOrAfter(i, MaxAcknowledged))
+                    {
+                        MaxAcknowledged = i;
+                    }
+                }
+                //已发送但在最大确认序号之前仍未确认的包，累计被跳过的次数，用于快速重传
+                if (MaxAcknowledged != Index)
+                {
+                    for (auto Pair : Parts)
                     {
-                        Parts.erase(i);
+                        auto Value = std::get<1>(Pair);
+                        if (Value->IsSent && IsEqualOrAfter(MaxAcknowledged, Value->Index))
+                        {
+                            Value->NumSkipped += 1;
+                        }
                     }
                 }
+                cc.OnAcknowledged(NumAcknowledged);
                 while (MaxHandled != MaxWritten)
                 {
                     auto i = GetSuccessor(MaxHandled);
@@ -239,18 +455,68 @@ namespace Client
                 }
             }
 
-            void ForEachTimedoutPacket(int SessionId, std::chrono::steady_clock::time_point Time, std::function<void(int, std::shared_ptr<std::vector<std::uint8_t>>)> f)
+            void ForEachTimedoutPacket(int SessionId, std::chrono::steady_clock::time_point Time, CongestionControl &cc, std::function<void(int, std::shared_ptr<std::vector<std::uint8_t>>)> f)
             {
+                auto IsTimedout = false;
+                auto IsFastRetransmitted = false;
                 for (auto p : Parts)
                 {
                     auto Key = std::get<0>(p);
                     auto Value = std::get<1>(p);
+                    if (!Value->IsSent) { continue; }
                     if (Value->ResendTime <= Time)
                     {
                         f(Key, Value->Data);
-                        Value->ResendTime = std::chrono::steady_clock::now() + std::chrono::milliseconds(GetTimeoutMilliseconds(Value->ResentCount));
+                        Value->ResendTime = std::chrono::steady_clock::now() + std::chrono::milliseconds(cc.GetTimeoutMilliseconds(Value->ResentCount));
                         Value->ResentCount += 1;
+                        Value->NumSkipped = 0;
+                        IsTimedout = true;
                     }
+                    else if (cc.IsAdaptive && (Value->NumSkipped >= CongestionControl::FastRetransmitThreshold()))
+                    {
+                        f(Key, Value->Data);
+                        Value->ResendTime = Time + std::chrono::milliseconds(cc.GetTimeoutMilliseconds(Value->ResentCount));
+                        Value->ResentCount += 1;
+                        Value->NumSkipped = 0;
+                        IsFastRetransmitted = true;
+                    }
+                }
+                if (IsTimedout)
+                {
+                    cc.OnTimeout();
+                }
+                else if (IsFastRetransmitted)
+                {
+                    cc.OnFastRetransmit();
+                }
+            }
+
+            /// <summary>按序号顺序取出尚未发送的包，使已发送未确认的包数量不超过拥塞窗口</summary>
+            void ForEachUnsentPacket(std::chrono::steady_clock::time_point Time, CongestionControl &cc, std::function<void(int, std::shared_ptr<std::vector<std::uint8_t>>)> f)
+            {
+                auto NumInFlight = 0;
+                for (auto p : Parts)
+                {
+                    if (std::get<1>(p)->IsSent)
+                    {
+                        NumInFlight += 1;
+                    }
+                }
+                auto CongestionWindowSize = cc.WindowSize();
+                auto i = MaxHandled;
+                for (int k = 0; (k < WindowSize) && (NumInFlight < CongestionWindowSize); k += 1)
+                {
+                    i = GetSuccessor(i);
+                    auto Pair = Parts.find(i);
+                    if (Pair == Parts.end()) { continue; }
+                    auto Value = Pair->second;
+                    if (Value->IsSent) { continue; }
+                    f(i, Value->Data);
+                    Value->IsSent = true;
+                    Value->SentTime = Time;
+                    Value->ResendTime = Time + std::chrono::milliseconds(cc.GetTimeoutMilliseconds(0));
+                    Value->ResentCount = 0;
+                    NumInFlight += 1;
                 }
             }
         };
@@ -260,8 +526,10 @@ namespace Client
             std::shared_ptr<PartContext> Parts;
             std::set<int> NotAcknowledgedIndices;
             std::chrono::steady_clock::time_point LastCheck;
+            bool EnableSelectiveAck;
+            bool IsSelectiveAck;
             UdpReadContext()
-                : LastCheck(std::chrono::steady_clock::now())
+                : LastCheck(std::chrono::steady_clock::now()), EnableSelectiveAck(true), IsSelectiveAck(false)
             {
             }
         };
@@ -270,6 +538,7 @@ namespace Client
         public:
             std::shared_ptr<PartContext> Parts;
             int WritenIndex;
+            std::shared_ptr<CongestionControl> Congestion;
             std::shared_ptr<asio::steady_timer> Timer;
         };
         BaseSystem::LockedVariable<std::shared_ptr<UdpReadContext>> RawReadingContext;
@@ -316,6 +585,7 @@ namespace Client
                 auto c = std::make_shared<UdpWriteContext>();
                 c->Parts = std::make_shared<PartContext>(WritingWindowSize());
                 c->WritenIndex = IndexSpace() - 1;
+                c->Congestion = std::make_shared<CongestionControl>(true);
                 c->Timer = nullptr;
                 return c;
             });
@@ -349,6 +619,24 @@ namespace Client
             Close();
         }
 
+        /// <summary>是否使用往返时间估计和拥塞窗口，否则使用固定的重传时间表和写入窗口（兼容模式），默认使用</summary>
+        void EnableCongestionControl(bool Value)
+        {
+            CookedWritingContext.DoAction([=](std::shared_ptr<UdpWriteContext> c)
+            {
+                c->Congestion->IsAdaptive = Value;
+            });
+        }
+
+        /// <summary>是否在INI包中声明支持位图格式的确认（SAK），服务器使用位图格式确认后本端也使用位图格式，默认使用</summary>
+        void EnableSelectiveAck(bool Value)
+        {
+            RawReadingContext.DoAction([=](std::shared_ptr<UdpReadContext> c)
+            {
+                c->EnableSelectiveAck = Value;
+            });
+        }
+
     private:
         void OnWrite(IStreamedVirtualTransportClient &vtc, std::function<void()> OnSuccess, std::function<void(asio::error_code)> OnFailure)
         {
@@ -387,8 +675,12 @@ namespace Client
             }
             auto sc = this->SecureContextValue.Check<std::shared_ptr<Client::SecureContext>>([](std::shared_ptr<Client::SecureContext> v) { return v; });
             std::vector<int> Indices;
+            auto EnableSelectiveAck = false;
+            auto IsSelectiveAck = false;
             RawReadingContext.DoAction([&](std::shared_ptr<UdpReadContext> c)
             {
+                EnableSelectiveAck = c->EnableSelectiveAck;
+                IsSelectiveAck = c->IsSelectiveAck;
                 if (c->NotAcknowledgedIndices.size() == 0) { return; }
                 auto MaxHandled = c->Parts->MaxHandled;
                 std::vector<int> Acknowledged;
@@ -441,11 +733,16 @@ namespace Client
                     if (State == ConnectionState_Initial)
                     {
                         Flag |= 4; //INI
+                        if (EnableSelectiveAck)
+                        {
+                            Flag |= 16; //SAK
+                        }
                         IsACK = false;
                     }
+                    auto AckLength = IsACK ? GetAckLength(Indices, IsSelectiveAck) : 0;
 
-                    auto Length = std::min(12 + (IsACK ? 2 + NumIndex * 2 : 0) + TotalLength - WritingOffset, MaxPacketLength());
-                    auto DataLength = Length - (12 + (IsACK ? 2 + NumIndex * 2 : 0));
+                    auto Length = std::min(12 + AckLength + TotalLength - WritingOffset, MaxPacketLength());
+                    auto DataLength = Length - (12 + AckLength);
                     if (DataLength < 0)
                     {
                         se = asio::error::no_buffer_space;
@@ -461,19 +758,15 @@ namespace Client
                     if (IsACK)
                     {
                         Flag |= 1; //ACK
-                        (*Buffer)[12] = static_cast<std::uint8_t>(NumIndex & 0xFF);
-                        (*Buffer)[13] = static_cast<std::uint8_t>((NumIndex >> 8) & 0xFF);
-                        int j = 0;
-                        for (auto i : Indices)
+                        if (IsSelectiveAck)
                         {
-                            (*Buffer)[14 + j * 2] = static_cast<std::uint8_t>(i & 0xFF);
-                            (*Buffer)[14 + j * 2 + 1] = static_cast<std::uint8_t>((i >> 8) & 0xFF);
-                            j += 1;
+                            Flag |= 16; //SAK
                         }
+                        WriteAck(*Buffer, 12, Indices, IsSelectiveAck);
                         Indices.clear();
                     }
 
-                    ArrayCopy(*WriteBuffer, WritingOffset, *Buffer, 12 + (IsACK ? 2 + NumIndex * 2 : 0), DataLength);
+                    ArrayCopy(*WriteBuffer, WritingOffset, *Buffer, 12 + AckLength, DataLength);
                     WritingOffset += DataLength;
 
                     if (sc != nullptr)
@@ -488,16 +781,8 @@ namespace Client
                     std::int32_t Verification = 0;
                     if (sc != nullptr)
                     {
-                        std::vector<std::uint8_t> SHABuffer;
-                        SHABuffer.resize(4);
-                        ArrayCopy(*Buffer, 4, SHABuffer, 0, 4);
-                        auto SHA256 = Algorithms::Cryptography::SHA256(SHABuffer);
-                        std::vector<std::uint8_t> Key;
-                        Key.resize(sc->ClientToken.size() + SHA256.size());
-                        ArrayCopy(sc->ClientToken, 0, Key, 0, static_cast<int>(sc->ClientToken.size()));
-                        ArrayCopy(SHA256, 0, Key, static_cast<int>(sc->ClientToken.size()), static_cast<int>(SHA256.size()));
-                        auto HMACBytes = Algorithms::Cryptography::HMACSHA256Simple(Key, *Buffer);
-                        HMACBytes.resize(4);
+                        auto SHA256 = Algorithms::Cryptography::SHA256(std::span<const std::uint8_t>(Buffer->data() + 4, 4));
+                        auto HMACBytes = sc->ClientTokenHMAC().Compute(SHA256, *Buffer);
                         Verification = HMACBytes[0] | (static_cast<std::int32_t>(HMACBytes[1]) << 8) | (static_cast<std::int32_t>(HMACBytes[2]) << 16) | (static_cast<std::int32_t>(HMACBytes[3]) << 24);
                     }
                     else
@@ -520,10 +805,10 @@ namespace Client
                         se = asio::error::no_buffer_space;
                         return;
                     }
-                    Parts.push_back(Part->Data);
 
                     c->WritenIndex = Index;
                 }
+                c->Parts->ForEachUnsentPacket(Time, *c->Congestion, [&](int i, std::shared_ptr<std::vector<std::uint8_t>> d) { Parts.push_back(d); });
                 if (c->Timer == nullptr)
                 {
                     c->Timer = std::make_shared<asio::steady_timer>(io_service);
@@ -575,8 +860,10 @@ namespace Client
                 });
                 auto sc = this->SecureContextValue.Check<std::shared_ptr<Client::SecureContext>>([](std::shared_ptr<Client::SecureContext> v) { return v; });
                 std::vector<int> Indices;
+                auto IsSelectiveAck = false;
                 RawReadingContext.DoAction([&](std::shared_ptr<UdpReadContext> c)
                 {
+                    IsSelectiveAck = c->IsSelectiveAck;
                     if (c->NotAcknowledgedIndices.size() == 0) { return; }
                     auto CurrentTime = std::chrono::steady_clock::now();
                     if (std::chrono::duration<double, std::chrono::milliseconds::period>(CurrentTime - c->LastCheck).count() + 1 < CheckTimeout()) { return; }
@@ -628,7 +915,7 @@ namespace Client
 
                         auto Flag = 8; //AUX
 
-                        auto Length = 12 + 2 + NumIndex * 2;
+                        auto Length = 12 + GetAckLength(Indices, IsSelectiveAck);
                         if (Length > MaxPacketLength())
                         {
                             return;
@@ -641,15 +928,11 @@ namespace Client
                         (*Buffer)[3] = static_cast<std::uint8_t>((SessionId >> 24) & 0xFF);
 
                         Flag |= 1; //ACK
-                        (*Buffer)[12] = static_cast<std::uint8_t>(NumIndex & 0xFF);
-                        (*Buffer)[13] = static_cast<std::uint8_t>((NumIndex >> 8) & 0xFF);
-                        int j = 0;
-                        for (auto i : Indices)
+                        if (IsSelectiveAck)
                         {
-                            (*Buffer)[14 + j * 2] = static_cast<std::uint8_t>(i & 0xFF);
-                            (*Buffer)[14 + j * 2 + 1] = static_cast<std::uint8_t>((i >> 8) & 0xFF);
-                            j += 1;
+                            Flag |= 16; //SAK
                         }
+                        WriteAck(*Buffer, 12, Indices, IsSelectiveAck);
                         Indices.clear();
 
                         if (sc != nullptr)
@@ -664,16 +947,8 @@ namespace Client
                         std::int32_t Verification = 0;
                         if (sc != nullptr)
                         {
-                            std::vector<std::uint8_t> SHABuffer;
-                            SHABuffer.resize(4);
-                            ArrayCopy(*Buffer, 4, SHABuffer, 0, 4);
-                            auto SHA256 = Algorithms::Cryptography::SHA256(SHABuffer);
-                            std::vector<std::uint8_t> Key;
-                            Key.resize(sc->ClientToken.size() + SHA256.size());
-                            ArrayCopy(sc->ClientToken, 0, Key, 0, static_cast<int>(sc->ClientToken.size()));
-                            ArrayCopy(SHA256, 0, Key, static_cast<int>(sc->ClientToken.size()), static_cast<int>(SHA256.size()));
-                            auto HMACBytes = Algorithms::Cryptography::HMACSHA256Simple(Key, *Buffer);
-                            HMACBytes.resize(4);
+                            auto SHA256 = Algorithms::Cryptography::SHA256(std::span<const std::uint8_t>(Buffer->data() + 4, 4));
+                            auto HMACBytes = sc->ClientTokenHMAC().Compute(SHA256, *Buffer);
                             Verification = HMACBytes[0] | (static_cast<std::int32_t>(HMACBytes[1]) << 8) | (static_cast<std::int32_t>(HMACBytes[2]) << 16) | (static_cast<std::int32_t>(HMACBytes[3]) << 24);
                         }
                         else
@@ -691,11 +966,13 @@ namespace Client
 
                     if (cc->Parts->Parts.size() == 0) { return; }
                     auto t = std::chrono::steady_clock::now();
-                    cc->Parts->ForEachTimedoutPacket(SessionId, t, [&](int i, std::shared_ptr<std::vector<std::uint8_t>> d) { Parts.push_back(d); });
+                    cc->Parts->ForEachTimedoutPacket(SessionId, t, *cc->Congestion, [&](int i, std::shared_ptr<std::vector<std::uint8_t>> d) { Parts.push_back(d); });
+                    cc->Parts->ForEachUnsentPacket(t, *cc->Congestion, [&](int i, std::shared_ptr<std::vector<std::uint8_t>> d) { Parts.push_back(d); });
                     auto Wait = std::numeric_limits<int>::max();
                     for (auto Pair : cc->Parts->Parts)
                     {
                         auto p = std::get<1>(Pair);
+                        if (!p->IsSent) { continue; }
                         auto pWait = std::chrono::duration<double, std::chrono::milliseconds::period>(p->ResendTime - t).count() + 1;
                         if (pWait < Wait)
                         {
@@ -842,16 +1119,8 @@ namespace Client
 
                 if (IsEncrypted)
                 {
-                    std::vector<std::uint8_t> SHABuffer;
-                    SHABuffer.resize(4);
-                    ArrayCopy(*Buffer, 4, SHABuffer, 0, 4);
-                    auto SHA256 = Algorithms::Cryptography::SHA256(SHABuffer);
-                    std::vector<std::uint8_t> Key;
-                    Key.resize(sc->ServerToken.size() + SHA256.size());
-                    ArrayCopy(sc->ServerToken, 0, Key, 0, static_cast<int>(sc->ServerToken.size()));
-                    ArrayCopy(SHA256, 0, Key, static_cast<int>(sc->ServerToken.size()), static_cast<int>(SHA256.size()));
-                    auto HMACBytes = Algorithms::Cryptography::HMACSHA256Simple(Key, *Buffer);
-                    HMACBytes.resize(4);
+                    auto SHA256 = Algorithms::Cryptography::SHA256(std::span<const std::uint8_t>(Buffer->data() + 4, 4));
+                    auto HMACBytes = sc->ServerTokenHMAC().Compute(SHA256, *Buffer);
                     auto HMAC = HMACBytes[0] | (static_cast<std::int32_t>(HMACBytes[1]) << 8) | (static_cast<std::int32_t>(HMACBytes[2]) << 16) | (static_cast<std::int32_t>(HMACBytes[3]) << 24);
                     if (HMAC != Verification) { return; }
                 }
@@ -888,45 +1157,42 @@ namespace Client
                 std::shared_ptr<std::vector<int>> Indices = nullptr;
                 if ((Flag & 1) != 0)
                 {
-                    if (Buffer->size() < 14)
-                    {
-                        return;
-                    }
-                    auto NumIndex = (*Buffer)[Offset] | (static_cast<std::int32_t>((*Buffer)[Offset + 1]) << 8);
-                    if (static_cast<int>(Buffer->size()) < 14 + NumIndex * 2)
-                    {
-                        return;
-                    }
-                    if (NumIndex > WritingWindowSize()) //若Index数量较大，则丢弃包
-                    {
-                        return;
-                    }
-                    Offset += 2;
                     Indices = std::make_shared<std::vector<int>>();
-                    Indices->resize(NumIndex, 0);
-                    for (int k = 0; k < NumIndex; k += 1)
+                    if (!TryReadAck(*Buffer, Offset, (Flag & 16) != 0, *Indices)) //长度不足或Index数量较大，则丢弃包
                     {
-                        (*Indices)[k] = (*Buffer)[Offset + k * 2] | (static_cast<std::int32_t>((*Buffer)[Offset + k * 2 + 1]) << 8);
+                        return;
                     }
-                    Offset += NumIndex * 2;
                 }
 
                 auto Length = static_cast<std::int32_t>(Buffer->size()) - Offset;
 
                 if ((Indices != nullptr) && (Indices->size() > 0))
                 {
+                    //确认后拥塞窗口可能增大，发送此前因窗口限制未发送的包
+                    std::vector<std::shared_ptr<std::vector<std::uint8_t>>> UnsentParts;
                     CookedWritingContext.DoAction([&](std::shared_ptr<UdpWriteContext> c)
                     {
+                        auto Time = std::chrono::steady_clock::now();
                         auto First = (*Indices)[0];
                         Indices->erase(Indices->begin());
-                        c->Parts->Acknowledge(First, *Indices, c->WritenIndex);
+                        c->Parts->Acknowledge(First, *Indices, c->WritenIndex, Time, *c->Congestion);
+                        c->Parts->ForEachUnsentPacket(Time, *c->Congestion, [&](int i, std::shared_ptr<std::vector<std::uint8_t>> d) { UnsentParts.push_back(d); });
                     });
+                    for (auto p : UnsentParts)
+                    {
+                        SendPacket(RemoteEndPoint, p);
+                    }
                 }
 
                 bool Pushed = false;
                 std::vector<std::shared_ptr<std::vector<std::uint8_t>>> Parts;
                 RawReadingContext.DoAction([&](std::shared_ptr<UdpReadContext> c)
                 {
+                    //服务器使用位图格式确认，说明已接受本端在INI包中的声明
+                    if (((Flag & 1) != 0) && ((Flag & 16) != 0) && c->EnableSelectiveAck)
+                    {
+                        c->IsSelectiveAck = true;
+                    }
                     if (c->Parts->HasPart(Index))
                     {
                         Pushed = true;
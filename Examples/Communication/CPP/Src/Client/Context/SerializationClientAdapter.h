@@ -223,6 +223,14 @@ namespace Client
             }
             bc->HandleResult(CommandName, CommandHash, Parameters);
         }
+        virtual std::int32_t GetCommandId(const std::u16string &CommandName, std::uint32_t CommandHash)
+        {
+            return Communication::Binary::BinaryCommandIds::GetCommandId(CommandName, CommandHash);
+        }
+        virtual bool TryGetCommand(std::int32_t CommandId, std::u16string &CommandName, std::uint32_t &CommandHash)
+        {
+            return Communication::Binary::BinaryCommandIds::TryGetCommand(CommandId, CommandName, CommandHash);
+        }
 
         void ClearRequests()
         {
@@ -16,7 +16,7 @@
 #include "Clients/BinaryCountPacketClient.h"
 #include "Clients/TcpClient.h"
 #include "Clients/UdpClient.h"
-#include "Clients/Rc4PacketClientTransformer.h"
+#include "Clients/SecurePacketClientTransformer.h"
 #include "Context/SerializationClientAdapter.h"
 
 #include <exception>
@@ -28,6 +28,8 @@
 #include <chrono>
 #include <thread>
 #include <typeinfo>
+#include <vector>
+#include <random>
 #include <asio.hpp>
 #ifdef _MSC_VER
 #undef SendMessage
@@ -43,6 +45,23 @@ namespace Client
         {
             DisplayTitle();
 
+            //可选参数/compact可出现在任意位置，不计入其他参数的位置
+            auto CompactCommandIds = false;
+            std::vector<char *> Arguments;
+            for (int k = 0; k < argc; k += 1)
+            {
+                if (std::string(argv[k]) == "/compact")
+                {
+                    CompactCommandIds = true;
+                }
+                else
+                {
+                    Arguments.push_back(argv[k]);
+                }
+            }
+            argc = static_cast<int>(Arguments.size());
+            argv = Arguments.data();
+
             if (argc == 5 && (std::string(argv[4]) == "/test"))
             {
                 auto TransportProtocol = std::string(argv[1]);
@@ -54,7 +73,7 @@ namespace Client
                     asio::ip::tcp::endpoint RemoteEndPoint(asio::ip::address::from_string(argv[2]), Parse<uint16_t>(systemToUtf16(argv[3])));
                     for (int k = 0; k < 2048; k += 1)
                     {
-                        IoService.post([=, &IoService]() { RunTcp(IoService, RemoteEndPoint, Test); });
+                        IoService.post([=, &IoService]() { RunTcp(IoService, RemoteEndPoint, CompactCommandIds, Test); });
                     }
                 }
                 else if (TransportProtocol == "udp")
@@ -62,7 +81,7 @@ namespace Client
                     asio::ip::udp::endpoint RemoteEndPoint(asio::ip::address::from_string(argv[2]), Parse<uint16_t>(systemToUtf16(argv[3])));
                     for (int k = 0; k < 2048; k += 1)
                     {
-                        IoService.post([=, &IoService]() { RunUdp(IoService, RemoteEndPoint, Test); });
+                        IoService.post([=, &IoService]() { RunUdp(IoService, RemoteEndPoint, CompactCommandIds, Test); });
                     }
                 }
                 std::vector<std::shared_ptr<std::thread>> Threads;
@@ -124,12 +143,12 @@ namespace Client
                 if (TransportProtocol == "tcp")
                 {
                     asio::ip::tcp::endpoint RemoteEndPoint(asio::ip::address::from_string(argv[2]), Parse<uint16_t>(systemToUtf16(argv[3])));
-                    RunTcp(IoService, RemoteEndPoint, ReadLineAndSendLoop);
+                    RunTcp(IoService, RemoteEndPoint, CompactCommandIds, ReadLineAndSendLoop);
                 }
                 else if (TransportProtocol == "udp")
                 {
                     asio::ip::udp::endpoint RemoteEndPoint(asio::ip::address::from_string(argv[2]), Parse<uint16_t>(systemToUtf16(argv[3])));
-                    RunUdp(IoService, RemoteEndPoint, ReadLineAndSendLoop);
+                    RunUdp(IoService, RemoteEndPoint, CompactCommandIds, ReadLineAndSendLoop);
                 }
                 Work = nullptr;
                 t.join();
@@ -155,7 +174,7 @@ namespace Client
                     }
                 });
                 asio::ip::tcp::endpoint RemoteEndPoint(asio::ip::address::from_string("127.0.0.1"), 8001);
-                RunTcp(IoService, RemoteEndPoint, ReadLineAndSendLoop);
+                RunTcp(IoService, RemoteEndPoint, CompactCommandIds, ReadLineAndSendLoop);
                 Work = nullptr;
                 t.join();
             }
@@ -177,16 +196,62 @@ namespace Client
         static void DisplayInfo()
         {
             std::wprintf(L"%ls\n", L"用法:");
-            std::wprintf(L"%ls\n", L"Client [<TransportProtocol> <IpAddress> <Port>]");
-            std::wprintf(L"%ls\n", L"Client <TransportProtocol> <IpAddress> <Port> /test");
+            std::wprintf(L"%ls\n", L"Client [<TransportProtocol> <IpAddress> <Port>] [/compact]");
+            std::wprintf(L"%ls\n", L"Client <TransportProtocol> <IpAddress> <Port> /test [/compact]");
             std::wprintf(L"%ls\n", L"TransportProtocol 传输协议，可为Tcp和Udp，默认为Tcp");
             std::wprintf(L"%ls\n", L"IpAddress 服务器IP地址，默认为127.0.0.1");
             std::wprintf(L"%ls\n", L"Port 服务器端口，默认为8001");
+            std::wprintf(L"%ls\n", L"/compact 请求使用紧凑命令编号，服务器不支持时会返回未知命令错误");
+        }
+
+        //ChaCha20握手：发送"secure chacha20 <ClientSalt>"，服务器先发来消息"secure chacha20 <ServerSalt>"再回复成功，Salt为32字节的十六进制
+        static constexpr const char16_t *SecureChaCha20Prefix = u"secure chacha20 ";
+        static constexpr std::size_t SaltLength = 32;
+
+        /// <summary>格式不正确时返回空</summary>
+        static std::vector<std::uint8_t> ParseSalt(const std::u16string &s)
+        {
+            std::vector<std::uint8_t> Salt;
+            if (s.size() != SaltLength * 2) { return Salt; }
+            auto Digit = [](char16_t c) -> int
+            {
+                if ((c >= u'0') && (c <= u'9')) { return c - u'0'; }
+                if ((c >= u'A') && (c <= u'F')) { return c - u'A' + 10; }
+                if ((c >= u'a') && (c <= u'f')) { return c - u'a' + 10; }
+                return -1;
+            };
+            for (std::size_t k = 0; k < SaltLength; k += 1)
+            {
+                auto High = Digit(s[k * 2]);
+                auto Low = Digit(s[k * 2 + 1]);
+                if ((High < 0) || (Low < 0)) { return std::vector<std::uint8_t>(); }
+                Salt.push_back(static_cast<std::uint8_t>((High << 4) | Low));
+            }
+            return Salt;
+        }
+        static std::u16string FormatSalt(const std::vector<std::uint8_t> &Salt)
+        {
+            std::wstring s;
+            for (auto b : Salt)
+            {
+                s += std::format(L"{:02X}", b);
+            }
+            return wideCharToUtf16(s);
+        }
+        static std::vector<std::uint8_t> GenerateSalt()
+        {
+            std::random_device rd;
+            std::vector<std::uint8_t> Salt;
+            for (std::size_t k = 0; k < SaltLength; k += 1)
+            {
+                Salt.push_back(static_cast<std::uint8_t>(rd() & 0xFF));
+            }
+            return Salt;
         }
 
         static void ReadLineAndSendLoop(std::shared_ptr<Communication::IApplicationClient> InnerClient, std::function<void(std::shared_ptr<SecureContext>)> SetSecureContext, std::mutex &Lockee)
         {
-            std::wprintf(L"%ls\n", L"输入login登录，输入secure启用安全连接。");
+            std::wprintf(L"%ls\n", L"输入login登录，输入secure启用安全连接，输入secure chacha20启用使用ChaCha20的安全连接。");
 
             InnerClient->GlobalErrorHandler = [=](std::u16string CommandName, std::u16string Message)
             {
@@ -197,8 +262,15 @@ namespace Client
                 auto m = e->Message;
                 wprintf(L"%ls\n", utf16ToWideChar(m).c_str());
             };
+            //事件和回复在同一线程上按到达顺序处理，ServerSalt在回复之前收到
+            auto ServerSalt = std::make_shared<std::vector<std::uint8_t>>();
             InnerClient->MessageReceived = [=](std::shared_ptr<Communication::MessageReceivedEvent> e)
             {
+                if (e->Content.starts_with(SecureChaCha20Prefix))
+                {
+                    *ServerSalt = ParseSalt(e->Content.substr(std::u16string(SecureChaCha20Prefix).size()));
+                    return;
+                }
                 wprintf(L"%ls\n", utf16ToWideChar(e->Content).c_str());
             };
 
@@ -234,14 +306,25 @@ namespace Client
                         });
                         break;
                     }
-                    if (Line == L"secure")
+                    if ((Line == L"secure") || (Line == L"secure chacha20"))
                     {
+                        auto Cipher = Line == L"secure chacha20" ? SecureCipher::ChaCha20 : SecureCipher::RC4;
+                        auto ClientSalt = Cipher == SecureCipher::ChaCha20 ? GenerateSalt() : std::vector<std::uint8_t>();
                         auto RequestSecure = std::make_shared<Communication::SendMessageRequest>();
-                        RequestSecure->Content = wideCharToUtf16(Line);
+                        RequestSecure->Content = Cipher == SecureCipher::ChaCha20 ? SecureChaCha20Prefix + FormatSalt(ClientSalt) : wideCharToUtf16(Line);
                         InnerClient->SendMessage(RequestSecure, [=](std::shared_ptr<Communication::SendMessageReply> r)
                         {
+                            if ((Cipher == SecureCipher::ChaCha20) && (ServerSalt->size() == 0))
+                            {
+                                std::wprintf(L"%ls\n", L"服务器不支持ChaCha20。");
+                                return;
+                            }
                             //生成测试用确定Key
                             auto sc = std::make_shared<SecureContext>();
+                            sc->Cipher = Cipher;
+                            sc->ClientSalt = ClientSalt;
+                            sc->ServerSalt = *ServerSalt;
+                            ServerSalt->clear();
                             for (int i = 0; i < 41; i += 1)
                             {
                                 sc->ServerToken.push_back(static_cast<std::uint8_t>(i));
@@ -318,7 +401,7 @@ namespace Client
             std::this_thread::sleep_for(std::chrono::milliseconds(1000));
         }
 
-        static void RunTcp(asio::io_service &IoService, asio::ip::tcp::endpoint RemoteEndPoint, std::function<void(std::shared_ptr<Communication::IApplicationClient>, std::function<void(std::shared_ptr<SecureContext>)>, std::mutex &)> Action)
+        static void RunTcp(asio::io_service &IoService, asio::ip::tcp::endpoint RemoteEndPoint, bool CompactCommandIds, std::function<void(std::shared_ptr<Communication::IApplicationClient>, std::function<void(std::shared_ptr<SecureContext>)>, std::mutex &)> Action)
         {
             auto bsca = std::make_shared<Client::BinarySerializationClientAdapter>(IoService, 30 * 1000);
             bsca->ClientCommandReceived = [=](std::u16string CommandName, int Milliseconds)
@@ -334,7 +417,7 @@ namespace Client
                 //std::wprintf(L"%ls\n", utf16ToWideChar(CommandName).c_str());
             };
 
-            auto bt = std::make_shared<Rc4PacketClientTransformer>();
+            auto bt = std::make_shared<SecurePacketClientTransformer>();
             auto ac = bsca->GetApplicationClient();
             auto vtc = std::make_shared<BinaryCountPacketClient>(bsca, bt, 128 * 1024);
             auto bc = std::make_shared<TcpClient>(IoService, RemoteEndPoint, vtc);
@@ -363,6 +446,10 @@ namespace Client
                 wprintf(L"%ls\n", utf16ToWideChar(Message).c_str());
                 exit(-1);
             });
+            if (CompactCommandIds)
+            {
+                vtc->RequestCompactCommandIds();
+            }
 
             auto SetSecureContext = [=](std::shared_ptr<SecureContext> c)
             {
@@ -378,7 +465,7 @@ namespace Client
             bsca = nullptr;
         }
 
-        static void RunUdp(asio::io_service &IoService, asio::ip::udp::endpoint RemoteEndPoint, std::function<void(std::shared_ptr<Communication::IApplicationClient>, std::function<void(std::shared_ptr<SecureContext>)>, std::mutex &)> Action)
+        static void RunUdp(asio::io_service &IoService, asio::ip::udp::endpoint RemoteEndPoint, bool CompactCommandIds, std::function<void(std::shared_ptr<Communication::IApplicationClient>, std::function<void(std::shared_ptr<SecureContext>)>, std::mutex &)> Action)
         {
             auto bsca = std::make_shared<Client::BinarySerializationClientAdapter>(IoService, 30 * 1000);
             bsca->ClientCommandReceived = [=](std::u16string CommandName, int Milliseconds)
@@ -394,7 +481,7 @@ namespace Client
                 //std::wprintf(L"%ls\n", utf16ToWideChar(CommandName).c_str());
             };
 
-            auto bt = std::make_shared<Rc4PacketClientTransformer>();
+            auto bt = std::make_shared<SecurePacketClientTransformer>();
             auto ac = bsca->GetApplicationClient();
             auto vtc = std::make_shared<BinaryCountPacketClient>(bsca, bt, 128 * 1024);
             auto bc = std::make_shared<UdpClient>(IoService, RemoteEndPoint, vtc);
@@ -423,6 +510,10 @@ namespace Client
                 wprintf(L"%ls\n", utf16ToWideChar(Message).c_str());
                 exit(-1);
             });
+            if (CompactCommandIds)
+            {
+                vtc->RequestCompactCommandIds();
+            }
 
             auto SetSecureContext = [=](std::shared_ptr<SecureContext> c)
             {
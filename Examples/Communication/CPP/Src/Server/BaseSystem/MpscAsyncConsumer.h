@@ -0,0 +1,216 @@
+﻿#pragma once
+
+#include <queue>
+#include <functional>
+#include <mutex>
+#include <memory>
+#include <atomic>
+#include <cstddef>
+
+namespace BaseSystem
+{
+    /// <summary>
+    /// 本类的所有公共成员均是线程安全的。
+    /// 与AsyncConsumer接口相同，但内部使用无锁的多生产者单消费者环形队列，同一时刻最多只有一个消费者运行，每次调度批量消费若干项。
+    /// 环形队列满时，Push退化为加锁写入溢出队列，此时溢出项与环形队列中的项之间不保证先后顺序。
+    /// </summary>
+    template<typename T>
+    class MpscAsyncConsumer : public std::enable_shared_from_this<MpscAsyncConsumer<T>>
+    {
+    private:
+        struct Cell
+        {
+            std::atomic<std::size_t> Sequence;
+            T Value;
+        };
+
+        std::function<void(std::function<void()>)> QueueUserWorkItem;
+        std::function<bool(T)> DoConsume;
+        std::size_t BatchSize;
+        std::unique_ptr<Cell[]> Cells;
+        std::size_t Mask;
+        std::atomic<std::size_t> EnqueuePosition;
+        std::size_t DequeuePosition; //只能由持有IsConsuming的线程访问
+        std::queue<T> OverflowEntries;
+        std::mutex OverflowEntriesMutex;
+        std::atomic<std::size_t> OverflowCount;
+        std::atomic<bool> IsConsuming;
+        std::atomic<bool> IsExited;
+
+        static std::size_t GetMinNotLessPowerOfTwo(std::size_t v)
+        {
+            std::size_t n = 1;
+            while (n < v)
+            {
+                n <<= 1;
+            }
+            return n;
+        }
+
+    public:
+        MpscAsyncConsumer(std::function<void(std::function<void()>)> QueueUserWorkItem, std::function<bool(T)> DoConsume, std::size_t Capacity = 1024, std::size_t BatchSize = 64)
+            : QueueUserWorkItem(QueueUserWorkItem), DoConsume(DoConsume), BatchSize(BatchSize > 0 ? BatchSize : 1), EnqueuePosition(0), DequeuePosition(0), OverflowCount(0), IsConsuming(false), IsExited(false)
+        {
+            auto n = GetMinNotLessPowerOfTwo(Capacity > 2 ? Capacity : 2);
+            Cells = std::unique_ptr<Cell[]>(new Cell[n]);
+            for (std::size_t k = 0; k < n; k += 1)
+            {
+                Cells[k].Sequence.store(k, std::memory_order_relaxed);
+            }
+            Mask = n - 1;
+        }
+
+        void Push(T Entry)
+        {
+            if (IsExited.load(std::memory_order_acquire))
+            {
+                return;
+            }
+            if (!TryEnqueue(Entry))
+            {
+                std::unique_lock<std::mutex> Lock(OverflowEntriesMutex);
+                OverflowEntries.push(std::move(Entry));
+                OverflowCount.fetch_add(1);
+            }
+            if (!IsConsuming.exchange(true))
+            {
+                Schedule();
+            }
+        }
+
+    private:
+        bool TryEnqueue(T &Entry)
+        {
+            auto Position = EnqueuePosition.load(std::memory_order_relaxed);
+            while (true)
+            {
+                auto &c = Cells[Position & Mask];
+                auto Sequence = c.Sequence.load(std::memory_order_acquire);
+                auto Diff = static_cast<std::ptrdiff_t>(Sequence) - static_cast<std::ptrdiff_t>(Position);
+                if (Diff == 0)
+                {
+                    if (EnqueuePosition.compare_exchange_weak(Position, Position + 1, std::memory_order_relaxed))
+                    {
+                        c.Value = std::move(Entry);
+                        c.Sequence.store(Position + 1, std::memory_order_release);
+                        return true;
+                    }
+                }
+                else if (Diff < 0)
+                {
+                    return false;
+                }
+                else
+                {
+                    Position = EnqueuePosition.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        //只能由持有IsConsuming的线程调用
+        bool TryDequeue(T &Entry)
+        {
+            auto &c = Cells[DequeuePosition & Mask];
+            if (c.Sequence.load(std::memory_order_acquire) == DequeuePosition + 1)
+            {
+                Entry = std::move(c.Value);
+                c.Value = T();
+                c.Sequence.store(DequeuePosition + Mask + 1, std::memory_order_release);
+                DequeuePosition += 1;
+                return true;
+            }
+            if (OverflowCount.load() > 0)
+            {
+                std::unique_lock<std::mutex> Lock(OverflowEntriesMutex);
+                if (OverflowEntries.size() > 0)
+                {
+                    Entry = std::move(OverflowEntries.front());
+                    OverflowEntries.pop();
+                    OverflowCount.fetch_sub(1);
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        //只能由持有IsConsuming的线程调用
+        bool HasEntries()
+        {
+            return (Cells[DequeuePosition & Mask].Sequence.load(std::memory_order_acquire) == DequeuePosition + 1) || (OverflowCount.load() > 0);
+        }
+
+        void Schedule()
+        {
+            auto ThisPtr = this->shared_from_this();
+            QueueUserWorkItem([ThisPtr]() { ThisPtr->Run(); });
+        }
+
+        //释放消费权，若释放后仍有未消费项且能重新取得消费权，则重新调度
+        void Release()
+        {
+            IsConsuming.store(false);
+            if (IsExited.load(std::memory_order_acquire)) { return; }
+            if (HasEntries() && !IsConsuming.exchange(true))
+            {
+                Schedule();
+            }
+        }
+
+        void Run()
+        {
+            for (std::size_t k = 0; k < BatchSize; k += 1)
+            {
+                if (IsExited.load(std::memory_order_acquire))
+                {
+                    IsConsuming.store(false);
+                    return;
+                }
+                T e;
+                if (!TryDequeue(e)) { break; }
+                if (!DoConsume(e))
+                {
+                    IsExited.store(true, std::memory_order_release);
+                    IsConsuming.store(false);
+                    return;
+                }
+            }
+            Release();
+        }
+
+    public:
+        /// <summary>
+        /// 同步消费一项。若此时已有消费者在运行，则直接返回，由该消费者继续消费。
+        /// </summary>
+        void DoOne()
+        {
+            if (IsExited.load(std::memory_order_acquire)) { return; }
+            if (IsConsuming.exchange(true)) { return; }
+            T e;
+            if (TryDequeue(e))
+            {
+                if (!DoConsume(e))
+                {
+                    IsExited.store(true, std::memory_order_release);
+                    IsConsuming.store(false);
+                    return;
+                }
+            }
+            Release();
+        }
+
+        ~MpscAsyncConsumer()
+        {
+            //析构时不存在其他对本对象的引用，已调度的Run也不会再执行，故可直接消费剩余项
+            while (!IsExited.load(std::memory_order_acquire))
+            {
+                T e;
+                if (!TryDequeue(e)) { break; }
+                if (!DoConsume(e))
+                {
+                    break;
+                }
+            }
+            IsExited.store(true, std::memory_order_release);
+        }
+    };
+}
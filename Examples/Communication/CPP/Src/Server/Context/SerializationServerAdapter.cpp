@@ -32,26 +32,31 @@ namespace Server
     {
         return ss->Hash();
     }
-    bool BinarySerializationServerAdapter::HasCommand(std::u16string CommandName, std::uint32_t CommandHash)
+    bool BinarySerializationServerAdapter::HasCommand(const std::u16string &CommandName, std::uint32_t CommandHash)
     {
         return ss->HasCommand(CommandName, CommandHash) || ss->HasCommandAsync(CommandName, CommandHash);
     }
-    void BinarySerializationServerAdapter::ExecuteCommand(std::u16string CommandName, std::uint32_t CommandHash, std::vector<std::uint8_t> Parameters, std::function<void(std::vector<std::uint8_t>)> OnSuccess, std::function<void(const std::exception &)> OnFailure)
+    bool BinarySerializationServerAdapter::IsConcurrentCommand(const std::u16string &CommandName)
     {
+        return Communication::IApplicationServer::IsConcurrentCommand(CommandName);
+    }
+    void BinarySerializationServerAdapter::ExecuteCommand(const std::u16string &CommandName, std::uint32_t CommandHash, std::vector<std::uint8_t> &&Parameters, std::function<void(std::vector<std::uint8_t>)> OnSuccess, std::function<void(const std::exception &)> OnFailure)
+    {
+        //a在本函数返回前同步执行，因此按引用捕获，Parameters只移动一次
         std::function<void()> a;
-        if (ss->HasCommand(CommandName, CommandHash))
+        if (auto cmd = ss->GetCommand(CommandName, CommandHash))
         {
-            a = [=]
+            a = [&]
             {
-                auto OutParameters = ss->ExecuteCommand(s, CommandName, CommandHash, Parameters);
+                auto OutParameters = cmd(s, std::move(Parameters));
                 OnSuccess(OutParameters);
             };
         }
-        else if (ss->HasCommandAsync(CommandName, CommandHash))
+        else if (auto acmd = ss->GetCommandAsync(CommandName, CommandHash))
         {
-            a = [=]
+            a = [&]
             {
-                ss->ExecuteCommandAsync(s, CommandName, CommandHash, Parameters, [=](std::vector<std::uint8_t> OutParameters)
+                acmd(s, std::move(Parameters), [=](std::vector<std::uint8_t> OutParameters)
                 {
                     OnSuccess(OutParameters);
                 }, OnFailure);
@@ -75,4 +80,12 @@ namespace Server
             }
         }
     }
+    std::int32_t BinarySerializationServerAdapter::GetCommandId(const std::u16string &CommandName, std::uint32_t CommandHash)
+    {
+        return Communication::Binary::BinaryCommandIds::GetCommandId(CommandName, CommandHash);
+    }
+    bool BinarySerializationServerAdapter::TryGetCommand(std::int32_t CommandId, std::u16string &CommandName, std::uint32_t &CommandHash)
+    {
+        return Communication::Binary::BinaryCommandIds::TryGetCommand(CommandId, CommandName, CommandHash);
+    }
 }
@@ -23,7 +23,10 @@ namespace Server
         BinarySerializationServerAdapter(std::shared_ptr<Communication::IApplicationServer> ApplicationServer);
 
         std::uint64_t Hash();
-        bool HasCommand(std::u16string CommandName, std::uint32_t CommandHash);
-        void ExecuteCommand(std::u16string CommandName, std::uint32_t CommandHash, std::vector<std::uint8_t> Parameters, std::function<void(std::vector<std::uint8_t>)> OnSuccess, std::function<void(const std::exception &)> OnFailure);
+        bool HasCommand(const std::u16string &CommandName, std::uint32_t CommandHash);
+        bool IsConcurrentCommand(const std::u16string &CommandName);
+        void ExecuteCommand(const std::u16string &CommandName, std::uint32_t CommandHash, std::vector<std::uint8_t> &&Parameters, std::function<void(std::vector<std::uint8_t>)> OnSuccess, std::function<void(const std::exception &)> OnFailure);
+        std::int32_t GetCommandId(const std::u16string &CommandName, std::uint32_t CommandHash);
+        bool TryGetCommand(std::int32_t CommandId, std::u16string &CommandName, std::uint32_t &CommandHash);
     };
 }
@@ -4,12 +4,17 @@
 #include "Generated/CommunicationBinary.h"
 #include "Context/SerializationServerAdapter.h"
 #include "Services/ServerImplementation.h"
+#include "Servers/BroadcastFrame.h"
+
+#include <unordered_map>
+#include <vector>
 
 namespace Server
 {
     ServerContext::ServerContext()
         :
-        SessionSet(std::unordered_set<std::shared_ptr<SessionContext>>()),
+        SessionLog(nullptr),
+        SessionSet(SessionSetState()),
         EnableLogNormalInValue(false),
         EnableLogNormalOutValue(false),
         EnableLogUnknownErrorValue(false),
@@ -37,4 +42,106 @@ namespace Server
         auto a = std::make_shared<BinarySerializationServerAdapter>(si);
         return std::make_pair(si, a);
     }
+
+    /// <summary>
+    /// 按一个客户端版本引发并序列化广播事件，截获序列化后的参数
+    /// 使用一个不注册的会话上下文，通过与普通会话相同的EventPump和序列化路径引发事件；会话上下文、服务器实现和适配器只创建一次，在锁中复用
+    /// </summary>
+    class ServerContext::BroadcastEncoder
+    {
+    public:
+        BroadcastEncoder(ServerContext &Owner, const std::u16string &Version)
+            : Frames(nullptr)
+        {
+            SessionContext = std::dynamic_pointer_cast<class SessionContext>(Owner.CreateSessionContext());
+            SessionContext->Version = Version;
+            //编码器由ServerContext持有，服务器实现对ServerContext只能不拥有地引用，否则形成循环引用
+            auto NonOwningOwner = std::shared_ptr<class ServerContext>(std::shared_ptr<class ServerContext>(), &Owner);
+            ServerImplementation = std::make_shared<Server::Services::ServerImplementation>(NonOwningOwner, SessionContext);
+            Adapter = std::make_shared<BinarySerializationServerAdapter>(ServerImplementation);
+            Adapter->ServerEvent = [this](std::u16string CommandName, std::uint32_t CommandHash, std::vector<std::uint8_t> Parameters)
+            {
+                Frames->push_back(std::make_shared<BroadcastFrame>(std::move(CommandName), CommandHash, std::move(Parameters)));
+            };
+        }
+        BroadcastEncoder(const BroadcastEncoder &) = delete;
+        BroadcastEncoder &operator=(const BroadcastEncoder &) = delete;
+
+        /// <summary>一个事件转换到旧版本时可能对应多个命令，因此得到一组帧</summary>
+        void Encode(const std::function<void(Communication::IEventPump &)> &Raise, std::vector<std::shared_ptr<BroadcastFrame>> &Output)
+        {
+            std::unique_lock<std::mutex> Lock(Lockee);
+            Frames = &Output;
+            try
+            {
+                Raise(*SessionContext->EventPump);
+            }
+            catch (...)
+            {
+                Frames = nullptr;
+                throw;
+            }
+            Frames = nullptr;
+        }
+
+    private:
+        std::mutex Lockee;
+        std::shared_ptr<class SessionContext> SessionContext;
+        std::shared_ptr<Server::Services::ServerImplementation> ServerImplementation;
+        std::shared_ptr<BinarySerializationServerAdapter> Adapter;
+        //只在Lockee中访问
+        std::vector<std::shared_ptr<BroadcastFrame>> *Frames;
+    };
+
+    std::shared_ptr<ServerContext::BroadcastEncoder> ServerContext::GetBroadcastEncoder(const std::u16string &Version)
+    {
+        std::unique_lock<std::mutex> Lock(BroadcastEncoderLockee);
+        auto &e = BroadcastEncoders[Version];
+        if (e == nullptr)
+        {
+            e = std::make_shared<BroadcastEncoder>(*this, Version);
+        }
+        return e;
+    }
+
+    int ServerContext::Broadcast(std::function<void(Communication::IEventPump &)> Raise, std::function<bool(class SessionContext &)> OnSession)
+    {
+        std::unordered_map<std::u16string, std::vector<std::shared_ptr<BroadcastFrame>>> FramesByVersion;
+        auto GetFrames = [&](const std::u16string &Version) -> const std::vector<std::shared_ptr<BroadcastFrame>> &
+        {
+            auto i = FramesByVersion.find(Version);
+            if (i != FramesByVersion.end()) { return i->second; }
+            auto &Frames = FramesByVersion[Version];
+            GetBroadcastEncoder(Version)->Encode(Raise, Frames);
+            return Frames;
+        };
+
+        //集合锁中只取得快照指针，集合改变后的第一次广播才重建快照；会话写锁、加密和写入通知均在集合锁外进行，不阻塞会话的注册和注销
+        std::shared_ptr<const std::vector<std::shared_ptr<class SessionContext>>> Targets;
+        SessionSet.DoAction([&](SessionSetState &ss)
+        {
+            if (ss.Snapshot == nullptr)
+            {
+                ss.Snapshot = std::make_shared<const std::vector<std::shared_ptr<class SessionContext>>>(ss.Sessions.begin(), ss.Sessions.end());
+            }
+            Targets = ss.Snapshot;
+        });
+        auto Count = static_cast<int>(Targets->size());
+        for (auto &rc : *Targets)
+        {
+            auto Lock = rc->WriterLock();
+            if (!OnSession(*rc)) { continue; }
+            if (rc->EventPump == nullptr) { continue; }
+            if (rc->BroadcastFrameReceived == nullptr)
+            {
+                Raise(*rc->EventPump);
+                continue;
+            }
+            for (auto &f : GetFrames(rc->Version))
+            {
+                rc->BroadcastFrameReceived(f);
+            }
+        }
+        return Count;
+    }
 }
@@ -10,10 +10,13 @@
 #include <cstdint>
 #include <vector>
 #include <unordered_set>
+#include <unordered_map>
 #include <string>
 #include <functional>
 #include <memory>
 #include <stdexcept>
+#include <atomic>
+#include <mutex>
 
 namespace Server
 {
@@ -55,29 +58,61 @@ namespace Server
             if (Shutdown != nullptr) { Shutdown(); }
         }
 
-        std::function<void(std::shared_ptr<SessionLogEntry>)> SessionLog;
-        void RaiseSessionLog(std::shared_ptr<SessionLogEntry> Entry)
+        std::atomic<SessionLogger *> SessionLog; //为nullptr时不记录会话日志
+        void RaiseSessionLog(SessionLogType Type, const SessionLogSource &Source, const std::u16string &Name, std::int64_t Value)
         {
-            if (SessionLog != nullptr)
+            auto l = SessionLog.load(std::memory_order_acquire);
+            if (l != nullptr)
             {
-                SessionLog(Entry);
+                l->Log(Type, Source, Name, Value);
+            }
+        }
+        void RaiseSessionLog(SessionLogType Type, const SessionLogSource &Source, SessionLogNameCache &NameCache, const std::u16string &Name, std::int64_t Value)
+        {
+            auto l = SessionLog.load(std::memory_order_acquire);
+            if (l != nullptr)
+            {
+                l->Log(Type, Source, NameCache, Name, Value);
+            }
+        }
+        void RaiseSessionLog(SessionLogType Type, const SessionLogSource &Source, const std::u16string &Name, const std::u16string &Message)
+        {
+            auto l = SessionLog.load(std::memory_order_acquire);
+            if (l != nullptr)
+            {
+                l->Log(Type, Source, Name, Message);
             }
         }
 
+        ServerMetrics &Metrics() { return MetricsValue; }
+
     private:
-        BaseSystem::LockedVariable<std::unordered_set<std::shared_ptr<SessionContext>>> SessionSet;
-    public:
-        std::shared_ptr<std::vector<std::shared_ptr<SessionContext>>> Sessions()
+        ServerMetrics MetricsValue;
+        class SessionSetState
         {
-            return SessionSet.Check<std::shared_ptr<std::vector<std::shared_ptr<SessionContext>>>>([](const std::unordered_set<std::shared_ptr<SessionContext>> &ss) { return std::make_shared<std::vector<std::shared_ptr<SessionContext>>>(std::begin(ss), std::end(ss)); });
-        }
+        public:
+            std::unordered_set<std::shared_ptr<class SessionContext>> Sessions;
+            //会话集合的只读快照，集合改变时置空，下次广播时重建；广播在集合锁中只复制快照指针
+            std::shared_ptr<const std::vector<std::shared_ptr<class SessionContext>>> Snapshot;
+        };
+        BaseSystem::LockedVariable<SessionSetState> SessionSet;
+    public:
+        /// <summary>
+        /// 向所有会话广播事件，Raise在给定的IEventPump上引发事件，返回会话总数
+        /// 会话集合未改变时各次广播共用同一快照，集合锁中只复制快照指针，各会话的处理在集合锁外进行；OnSession在会话的写锁中调用，返回false时跳过该会话
+        /// 每个客户端版本只引发并序列化一次事件，序列化结果由该版本的各会话共享；用于序列化的会话上下文和EventPump每个版本只创建一次；未订阅BroadcastFrameReceived的会话仍通过自己的EventPump发送
+        /// </summary>
+        int Broadcast(std::function<void(Communication::IEventPump &)> Raise, std::function<bool(class SessionContext &)> OnSession);
         void RegisterSession(std::shared_ptr<ISessionContext> SessionContext)
         {
             auto sc = std::dynamic_pointer_cast<class SessionContext>(SessionContext);
             if (sc == nullptr) { throw std::logic_error("InvalidOperationException"); }
-            SessionSet.DoAction([=](std::unordered_set<std::shared_ptr<class SessionContext>> &ss)
+            SessionSet.DoAction([=](SessionSetState &ss)
             {
-                ss.insert(sc);
+                if (ss.Sessions.insert(sc).second)
+                {
+                    ss.Snapshot = nullptr;
+                }
             });
         }
         bool TryUnregisterSession(std::shared_ptr<ISessionContext> SessionContext)
@@ -85,11 +120,11 @@ namespace Server
             auto sc = std::dynamic_pointer_cast<class SessionContext>(SessionContext);
             if (sc == nullptr) { throw std::logic_error("InvalidOperationException"); }
             auto Success = false;
-            SessionSet.DoAction([sc, &Success](std::unordered_set<std::shared_ptr<class SessionContext>> &ss)
+            SessionSet.DoAction([sc, &Success](SessionSetState &ss)
             {
-                if (ss.count(sc) > 0)
+                if (ss.Sessions.erase(sc) > 0)
                 {
-                    ss.erase(sc);
+                    ss.Snapshot = nullptr;
                     Success = true;
                 }
             });
@@ -117,5 +152,11 @@ namespace Server
         bool EnableLogSystemValue;
         bool ServerDebugValue;
         bool ClientDebugValue;
+
+        /// <summary>每个客户端版本一个，在第一次向该版本的会话广播时创建；放在最后以便最先析构</summary>
+        class BroadcastEncoder;
+        std::mutex BroadcastEncoderLockee;
+        std::unordered_map<std::u16string, std::shared_ptr<BroadcastEncoder>> BroadcastEncoders;
+        std::shared_ptr<BroadcastEncoder> GetBroadcastEncoder(const std::u16string &Version);
     };
 }
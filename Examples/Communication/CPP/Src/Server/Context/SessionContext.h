@@ -11,6 +11,7 @@
 #include <functional>
 #include <mutex>
 #include <shared_mutex>
+#include <atomic>
 #include <asio.hpp>
 #ifdef _MSC_VER
 #undef SendMessage
@@ -103,16 +104,18 @@ namespace Server
 
         int SendMessageCount;
 
+        //可并发命令执行时会跨线程写入
+
         std::chrono::system_clock::time_point RequestTime()
         {
-            return RequestTimeValue;
+            return RequestTimeValue.load(std::memory_order_relaxed);
         }
         void RequestTime(std::chrono::system_clock::time_point value)
         {
-            RequestTimeValue = value;
+            RequestTimeValue.store(value, std::memory_order_relaxed);
         }
 
     private:
-        std::chrono::system_clock::time_point RequestTimeValue;
+        std::atomic<std::chrono::system_clock::time_point> RequestTimeValue;
     };
 }
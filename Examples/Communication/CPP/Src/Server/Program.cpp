@@ -12,19 +12,24 @@
 #include "Services/ServerImplementation.h"
 #include "Servers/TcpServer.h"
 #include "Servers/UdpServer.h"
+#include "Servers/IoServicePool.h"
 #include "Servers/BinaryCountPacketServer.h"
+#include "Servers/BufferPool.h"
+#include "Servers/MetricsServer.h"
 
 #include "BaseSystem/StringUtilities.h"
 #include "BaseSystem/AutoResetEvent.h"
 #include "BaseSystem/Optional.h"
 #include "BaseSystem/ExceptionStackTrace.h"
-#include "Util/ConsoleLogger.h"
+#include "Util/SessionLogger.h"
 
 #include <vector>
 #include <string>
+#include <algorithm>
 #include <exception>
 #include <stdexcept>
 #include <cwchar>
+#include <fstream>
 #include <thread>
 #include <typeinfo>
 #include <asio.hpp>
@@ -51,17 +56,41 @@ namespace Server
                 }
             }
 
-            if (argc == 3)
+            if ((argc >= 3) && (argc <= 6))
             {
-                Run(Parse<std::uint16_t>(systemToWideChar(argv[1])), !EqualIgnoreCase(systemToWideChar(argv[2]), L"/nolog"));
+                auto EnableLogConsole = true;
+                auto EnableShard = false;
+                std::wstring LogFilePath = L"";
+                std::uint16_t MetricsPort = 0;
+                for (int k = 2; k < argc; k += 1)
+                {
+                    auto v = systemToWideChar(argv[k]);
+                    if (EqualIgnoreCase(v, L"/nolog"))
+                    {
+                        EnableLogConsole = false;
+                    }
+                    else if (EqualIgnoreCase(v, L"/shard"))
+                    {
+                        EnableShard = true;
+                    }
+                    else if (EqualIgnoreCase(v.substr(0, 9), L"/logfile:"))
+                    {
+                        LogFilePath = v.substr(9);
+                    }
+                    else if (EqualIgnoreCase(v.substr(0, 9), L"/metrics:"))
+                    {
+                        MetricsPort = Parse<std::uint16_t>(v.substr(9));
+                    }
+                }
+                Run(Parse<std::uint16_t>(systemToWideChar(argv[1])), EnableLogConsole, EnableShard, LogFilePath, MetricsPort);
             }
             else if (argc == 2)
             {
-                Run(Parse<std::uint16_t>(systemToWideChar(argv[1])), true);
+                Run(Parse<std::uint16_t>(systemToWideChar(argv[1])), true, false, L"", 0);
             }
             else if (argc == 1)
             {
-                Run(8001, true);
+                Run(8001, true, false, L"", 0);
             }
             else
             {
@@ -81,12 +110,15 @@ namespace Server
         static void DisplayInfo()
         {
             std::wprintf(L"%ls\n", L"用法:");
-            std::wprintf(L"%ls\n", L"Server [<Port> [/nolog]]");
+            std::wprintf(L"%ls\n", L"Server [<Port> [/nolog] [/shard] [/logfile:<LogFilePath>] [/metrics:<MetricsPort>]]");
             std::wprintf(L"%ls\n", L"Port 服务器端口，默认为8001");
             std::wprintf(L"%ls\n", L"/nolog 表示不显示日志");
+            std::wprintf(L"%ls\n", L"/shard 表示每个逻辑处理器使用一个独立的io_service和线程，会话固定在一个分片上");
+            std::wprintf(L"%ls\n", L"/logfile 表示将日志以UTF-8追加写入到指定文件，而不是显示在控制台");
+            std::wprintf(L"%ls\n", L"/metrics 表示在127.0.0.1的指定端口上提供文本格式的指标，可用HTTP GET抓取");
         }
 
-        static void Run(std::uint16_t Port, bool EnableLogConsole)
+        static void Run(std::uint16_t Port, bool EnableLogConsole, bool EnableShard, std::wstring LogFilePath, std::uint16_t MetricsPort)
         {
             auto ExitEvent = std::make_shared<BaseSystem::AutoResetEvent>();
 
@@ -94,18 +126,19 @@ namespace Server
 
             std::wprintf(L"%ls\n", (L"逻辑处理器数量: " + ToString(ProcessorCount)).c_str());
 
-            auto IoServiceLogNumThread = 1;
             auto IoServicePurifierNumThread = 2;
-            auto IoServiceNumThread = ProcessorCount * 2 + 1;
+            auto IoServiceNumThread = EnableShard ? 0 : ProcessorCount * 2 + 1;
 
-            auto IoServiceLog = std::make_shared<asio::io_service>(IoServiceLogNumThread);
             auto IoServicePurifier = std::make_shared<asio::io_service>(IoServicePurifierNumThread);
             auto IoService = std::make_shared<asio::io_service>(IoServiceNumThread);
-            asio::io_service::work WorkLog(*IoServiceLog);
             asio::io_service::work WorkPurifier(*IoServicePurifier);
             asio::io_service::work Work(*IoService);
-
-            ConsoleLogger cl;
+            std::shared_ptr<IoServicePool> Shards = nullptr;
+            if (EnableShard)
+            {
+                Shards = std::make_shared<IoServicePool>(std::max(ProcessorCount, 1), true);
+                std::wprintf(L"%ls\n", (L"分片数量: " + ToString(Shards->NumShard())).c_str());
+            }
 
             auto ServerContext = std::make_shared<class ServerContext>();
             ServerContext->EnableLogNormalIn(true);
@@ -122,13 +155,26 @@ namespace Server
                 ExitEvent->Set();
             };
 
-            if (EnableLogConsole)
+            std::shared_ptr<SessionLogger> Logger = nullptr;
+            if (LogFilePath != L"")
             {
-                ServerContext->SessionLog = [&](std::shared_ptr<SessionLogEntry> e)
+                auto LogFile = std::make_shared<std::ofstream>(wideCharToSystem(LogFilePath), std::ios::binary | std::ios::app);
+                if (!*LogFile) { throw std::runtime_error("LogFileOpenFailed: " + wideCharToSystem(LogFilePath)); }
+                Logger = std::make_shared<SessionLogger>([LogFile](const std::u16string &Lines)
                 {
-                    IoServiceLog->post([e, &cl]() { cl.Log(e); });
-                };
+                    auto Bytes = utf16ToUtf8(Lines);
+                    LogFile->write(Bytes.data(), static_cast<std::streamsize>(Bytes.size()));
+                    LogFile->flush();
+                });
+            }
+            else if (EnableLogConsole)
+            {
+                Logger = std::make_shared<SessionLogger>([](const std::u16string &Lines)
+                {
+                    std::wprintf(L"%ls", utf16ToWideChar(Lines).c_str());
+                });
             }
+            ServerContext->SessionLog = Logger.get();
 
             auto VirtualTransportServerFactory = [=](std::shared_ptr<ISessionContext> Context, std::shared_ptr<IBinaryTransformer> t) -> std::pair<std::shared_ptr<IServerImplementation>, std::shared_ptr<IStreamedVirtualTransportServer>>
             {
@@ -140,13 +186,22 @@ namespace Server
                     return true;
                 };
                 auto bcps = std::make_shared<BinaryCountPacketServer>(a, CheckCommandAllowed, t);
+                //BinaryCountPacketServer经由适配器和服务器实现间接持有会话上下文，这里只能弱引用
+                std::weak_ptr<BinaryCountPacketServer> wbcps = bcps;
+                Context->BroadcastFrameReceived = [wbcps](std::shared_ptr<BroadcastFrame> Frame)
+                {
+                    if (auto bcps = wbcps.lock())
+                    {
+                        bcps->PushBroadcastFrame(Frame);
+                    }
+                };
                 return std::make_pair(si, bcps);
             };
 
             auto Servers = std::make_shared<std::vector<std::shared_ptr<IServer>>>();
 
             {
-                auto Server = std::make_shared<TcpServer>(*IoService, ServerContext, VirtualTransportServerFactory, [=](std::function<void()> a) { IoService->post(a); }, [=](std::function<void()> a) { IoServicePurifier->post(a); });
+                auto Server = Shards != nullptr ? std::make_shared<TcpServer>(Shards, ServerContext, VirtualTransportServerFactory, [=](std::function<void()> a) { IoServicePurifier->post(a); }) : std::make_shared<TcpServer>(*IoService, ServerContext, VirtualTransportServerFactory, [=](std::function<void()> a) { IoService->post(a); }, [=](std::function<void()> a) { IoServicePurifier->post(a); });
 
                 auto Bindings = std::make_shared<std::vector<asio::ip::tcp::endpoint>>();
                 auto LocalEndPoint = asio::ip::tcp::endpoint(asio::ip::tcp::v4(), Port);
@@ -159,6 +214,11 @@ namespace Server
                 Server->MaxUnauthenticatedPerIP(32768);
                 Server->MaxBadCommands(8);
                 Server->TimeoutCheckPeriod(30);
+                Server->MaxWriteBufferCount(64);
+                Server->MaxWriteBufferBytes(1024 * 1024);
+                Server->ReusePort(true);
+                Server->ConnectionCountMergePeriod(100);
+                Server->MaxConcurrentCommands(8);
 
                 Server->Start();
 
@@ -168,7 +228,7 @@ namespace Server
             }
 
             {
-                auto Server = std::make_shared<UdpServer>(*IoService, ServerContext, VirtualTransportServerFactory, [=](std::function<void()> a) { IoService->post(a); }, [=](std::function<void()> a) { IoServicePurifier->post(a); });
+                auto Server = Shards != nullptr ? std::make_shared<UdpServer>(Shards, ServerContext, VirtualTransportServerFactory, [=](std::function<void()> a) { IoServicePurifier->post(a); }) : std::make_shared<UdpServer>(*IoService, ServerContext, VirtualTransportServerFactory, [=](std::function<void()> a) { IoService->post(a); }, [=](std::function<void()> a) { IoServicePurifier->post(a); });
 
                 auto Bindings = std::make_shared<std::vector<asio::ip::udp::endpoint>>();
                 auto LocalEndPoint = asio::ip::udp::endpoint(asio::ip::udp::v4(), Port);
@@ -180,7 +240,12 @@ namespace Server
                 Server->MaxConnectionsPerIP(32768);
                 Server->MaxUnauthenticatedPerIP(32768);
                 Server->MaxBadCommands(8);
-                Server->TimeoutCheckPeriod(30);
+                Server->ReusePort(true);
+                Server->BatchedIo(true);
+                Server->BatchSize(32);
+                Server->EnableCongestionControl(true);
+                Server->SelectiveAck(true);
+                Server->MaxConcurrentCommands(8);
 
                 Server->Start();
 
@@ -189,15 +254,17 @@ namespace Server
                 Servers->push_back(Server);
             }
 
-            std::vector<std::shared_ptr<std::thread>> Threads;
-            for (int i = 0; i < IoServiceLogNumThread; i += 1)
+            std::shared_ptr<MetricsServer> Metrics = nullptr;
+            if (MetricsPort != 0)
             {
-                auto t = std::make_shared<std::thread>([&]()
-                {
-                    IoServiceLog->run();
-                });
-                Threads.push_back(t);
+                Metrics = std::make_shared<MetricsServer>(*IoServicePurifier, [=]() { return ServerContext->Metrics().Scrape(); });
+                auto MetricsEndPoint = asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), MetricsPort);
+                Metrics->Start(MetricsEndPoint);
+
+                std::wprintf(L"%ls\n", (L"指标端点已启动。结点: " + systemToWideChar(MetricsEndPoint.address().to_string()) + L":" + ToString(MetricsEndPoint.port()) + L"(TCP)").c_str());
             }
+
+            std::vector<std::shared_ptr<std::thread>> Threads;
             for (int i = 0; i < IoServicePurifierNumThread; i += 1)
             {
                 auto t = std::make_shared<std::thread>([&]()
@@ -214,9 +281,17 @@ namespace Server
                 });
                 Threads.push_back(t);
             }
+            if (Shards != nullptr)
+            {
+                Shards->Start();
+            }
 
             ExitEvent->WaitOne();
 
+            if (Metrics != nullptr)
+            {
+                Metrics->Stop();
+            }
             for (auto Server : *Servers)
             {
                 Server->Stop();
@@ -224,11 +299,11 @@ namespace Server
             Servers->clear();
 
             IoService->stop();
+            if (Shards != nullptr)
+            {
+                Shards->Stop();
+            }
             IoServicePurifier->stop();
-            IoServiceLog->stop();
-
-            ServerContext->SessionLog = nullptr;
-            ServerContext = nullptr;
 
             for (int i = 0; i < (int)(Threads.size()); i += 1)
             {
@@ -236,6 +311,16 @@ namespace Server
                 t->join();
             }
 
+            ServerContext->SessionLog = nullptr;
+            ServerContext = nullptr;
+            if (Logger != nullptr)
+            {
+                auto DroppedCount = Logger->DroppedCount();
+                Logger = nullptr;
+                std::wprintf(L"%ls\n", (L"丢弃日志数量: " + ToString(DroppedCount)).c_str());
+            }
+
+            std::wprintf(L"%ls\n", (L"写入缓冲池命中: " + ToString(BufferPool::Hits()) + L" 未命中: " + ToString(BufferPool::Misses())).c_str());
             std::wprintf(L"%ls\n", L"服务器已关闭。");
         }
     };
@@ -3,6 +3,8 @@
 #include "IContext.h"
 #include "ISerializationServer.h"
 #include "StreamedServer.h"
+#include "BufferPool.h"
+#include "BroadcastFrame.h"
 
 #include <memory>
 #include <cstdint>
@@ -12,6 +14,10 @@
 #include <stdexcept>
 #include <functional>
 #include <mutex>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <deque>
 
 namespace Server
 {
@@ -293,6 +299,20 @@ namespace Server
             }
         };
 
+        class PendingReply
+        {
+        public:
+            bool IsCompleted;
+            //命令失败时为nullptr
+            std::shared_ptr<std::vector<std::uint8_t>> Bytes;
+            //命令执行中在本线程上引发的事件，在此前的回复均已提交后、本命令的回复之前发出
+            std::vector<std::shared_ptr<std::vector<std::uint8_t>>> Events;
+
+            PendingReply()
+                : IsCompleted(false)
+            {
+            }
+        };
         class Context
         {
         public:
@@ -302,24 +322,29 @@ namespace Server
             std::mutex WriteBufferLockee;
             std::vector<std::shared_ptr<std::vector<std::uint8_t>>> WriteBuffer;
 
-            int State;
-            // 0 初始状态
-            // 1 已读取NameLength
-            // 2 已读取CommandHash
-            // 3 已读取Name
-            // 4 已读取ParametersLength
+            //读取大参数时ReadBuffer为参数缓冲区，StreamReadBuffer保存平常使用的读取缓冲区
+            std::shared_ptr<std::vector<std::uint8_t>> StreamReadBuffer;
+            bool IsReadingLargeParameters;
+            std::u16string LargeCommandName;
+            std::uint32_t LargeCommandHash;
+            std::int32_t LargeCommandByteLength;
 
-            std::int32_t CommandNameLength;
-            std::u16string CommandName;
-            std::uint32_t CommandHash;
-            std::int32_t ParametersLength;
-            std::size_t InputCommandByteLength;
+            //已同意客户端使用紧凑编号，此后发送的帧使用紧凑格式，只在WriteBufferLockee中修改
+            std::atomic<bool> IsCompactCommandIds;
+
+            //命令按到达顺序编号，NextCommandSequence只在Handle中访问
+            //并发执行的命令可能乱序完成，回复按编号依次放入WriteBuffer；PendingReplies[k]对应编号NextReplySequence + k，只在WriteBufferLockee中访问
+            //命令在执行线程上同步引发的事件（包括发给本会话的广播）暂存在该命令的位置中，与串行执行时一样排在此前命令的回复之后
+            std::uint64_t NextCommandSequence;
+            std::uint64_t NextReplySequence;
+            std::deque<PendingReply> PendingReplies;
 
             Context(int ReadBufferSize)
-                : ReadBufferOffset(0), ReadBufferLength(0), State(0), CommandNameLength(0), CommandName(u""), CommandHash(0), ParametersLength(0), InputCommandByteLength(0)
+                : ReadBufferOffset(0), ReadBufferLength(0), IsReadingLargeParameters(false), LargeCommandName(u""), LargeCommandHash(0), LargeCommandByteLength(0), IsCompactCommandIds(false), NextCommandSequence(0), NextReplySequence(0)
             {
                 ReadBuffer = std::make_shared<std::vector<std::uint8_t>>();
                 ReadBuffer->resize(ReadBufferSize, 0);
+                StreamReadBuffer = ReadBuffer;
             }
         };
 
@@ -327,32 +352,30 @@ namespace Server
         Context c;
         std::function<bool(std::u16string)> CheckCommandAllowed;
         std::shared_ptr<IBinaryTransformer> Transformer;
+        int MaxParametersLength;
 
     public:
-        BinaryCountPacketServer(std::shared_ptr<IBinarySerializationServerAdapter> SerializationServerAdapter, std::function<bool(std::u16string)> CheckCommandAllowed, std::shared_ptr<IBinaryTransformer> Transformer = nullptr, int ReadBufferSize = 8 * 1024)
-            : c(ReadBufferSize)
+        /// <summary>
+        /// ReadBufferSize为读取缓冲区大小，MaxParametersLength为命令参数的最大长度
+        /// 参数长度不小于读取缓冲区的一半且尚未完整到达时，为参数单独分配缓冲区并直接读取到其中，完成后移交给命令处理，不再复制
+        /// </summary>
+        BinaryCountPacketServer(std::shared_ptr<IBinarySerializationServerAdapter> SerializationServerAdapter, std::function<bool(std::u16string)> CheckCommandAllowed, std::shared_ptr<IBinaryTransformer> Transformer = nullptr, int ReadBufferSize = 8 * 1024, int MaxParametersLength = 1024 * 1024)
+            : c(ReadBufferSize), MaxParametersLength(MaxParametersLength)
         {
             this->ss = SerializationServerAdapter;
             this->CheckCommandAllowed = CheckCommandAllowed;
             this->Transformer = Transformer;
             this->ss->ServerEvent = [=](std::u16string CommandName, std::uint32_t CommandHash, std::vector<std::uint8_t> Parameters)
             {
-                ByteArrayStream s;
-                s.WriteString(CommandName);
-                s.WriteUInt32(CommandHash);
-                s.WriteInt32(static_cast<std::int32_t>(Parameters.size()));
-                s.WriteBytes(Parameters);
-                s.SetPosition(0);
-                auto Bytes = s.ReadBytes(s.GetLength());
-                auto BytesLength = Bytes.size();
+                auto Bytes = EncodeFrame(CommandName, CommandHash, Parameters);
+                auto BytesLength = Bytes->size();
                 {
                     std::unique_lock<std::mutex> Lock(c.WriteBufferLockee);
-                    if (Transformer != nullptr)
+                    if (!TryDeferEventLocked(Bytes))
                     {
-                        Transformer->Transform(Bytes, 0, static_cast<int>(Bytes.size()));
+                        PushFrameLocked(Bytes);
                     }
                 }
-                c.WriteBuffer.push_back(std::make_shared<std::vector<std::uint8_t>>(Bytes));
                 if (OutputByteLengthReport != nullptr)
                 {
                     OutputByteLengthReport(CommandName, BytesLength);
@@ -377,13 +400,47 @@ namespace Server
             return c.ReadBufferLength;
         }
 
-        std::vector<std::shared_ptr<std::vector<std::uint8_t>>> TakeWriteBuffer()
+        void TakeWriteBuffer(std::vector<std::shared_ptr<std::vector<std::uint8_t>>> &WriteBuffer)
         {
+            WriteBuffer.clear();
             {
                 std::unique_lock<std::mutex> Lock(c.WriteBufferLockee);
-                auto WriteBuffer = c.WriteBuffer;
-                c.WriteBuffer.clear();
-                return WriteBuffer;
+                c.WriteBuffer.swap(WriteBuffer);
+            }
+        }
+
+        /// <summary>
+        /// 将广播帧放入写入缓冲区，帧按本会话的编号格式编码，同一格式的帧在各会话间只编码一次
+        /// 未加密时直接放入共享的帧缓冲区；加密或须暂存到此前命令的回复之后时复制，因为加密会原地修改缓冲区
+        /// </summary>
+        void PushBroadcastFrame(std::shared_ptr<BroadcastFrame> Frame)
+        {
+            std::size_t BytesLength;
+            {
+                std::unique_lock<std::mutex> Lock(c.WriteBufferLockee);
+                auto Bytes = Frame->GetFrame(c.IsCompactCommandIds, [&]() { return EncodeFrame(Frame->CommandName, Frame->CommandHash, Frame->Parameters); });
+                BytesLength = Bytes->size();
+                if (IsEventDeferredLocked() || ((Transformer != nullptr) && Transformer->IsTransforming()))
+                {
+                    auto Copied = BufferPool::Acquire(BytesLength);
+                    std::memcpy(Copied->data(), Bytes->data(), BytesLength);
+                    if (!TryDeferEventLocked(Copied))
+                    {
+                        PushFrameLocked(Copied);
+                    }
+                }
+                else
+                {
+                    c.WriteBuffer.push_back(Bytes);
+                }
+            }
+            if (OutputByteLengthReport != nullptr)
+            {
+                OutputByteLengthReport(Frame->CommandName, BytesLength);
+            }
+            if (this->ServerEvent != nullptr)
+            {
+                this->ServerEvent();
             }
         }
 
@@ -396,79 +453,85 @@ namespace Server
             auto BufferLength = c.ReadBufferOffset + c.ReadBufferLength;
             if (Transformer != nullptr)
             {
-                Transformer->Inverse(*Buffer, BufferLength, Count);
+                //逆变换后的长度可能小于读取的长度，Count为0时取出此前暂存的数据
+                Count = Transformer->Inverse(*Buffer, BufferLength, Count);
             }
             BufferLength += Count;
 
-            while (true)
+            if (c.IsReadingLargeParameters)
             {
-                auto r = TryShift(c, Buffer, FirstPosition, BufferLength - FirstPosition);
-                if (r == nullptr)
+                if (BufferLength < static_cast<int>(Buffer->size()))
                 {
-                    break;
+                    c.ReadBufferOffset = 0;
+                    c.ReadBufferLength = BufferLength;
+                    return ret;
                 }
-                FirstPosition = r->Position;
+                Command cmd;
+                cmd.CommandName = std::move(c.LargeCommandName);
+                cmd.CommandHash = c.LargeCommandHash;
+                cmd.Parameters = std::move(*Buffer);
+                cmd.ByteLength = c.LargeCommandByteLength;
+                c.IsReadingLargeParameters = false;
+                c.LargeCommandName = u"";
+                c.LargeCommandHash = 0;
+                c.LargeCommandByteLength = 0;
+                c.ReadBuffer = c.StreamReadBuffer;
+                c.ReadBufferOffset = 0;
+                c.ReadBufferLength = 0;
+                return CreateCommandResult(std::move(cmd));
+            }
 
-                if (r->Command != nullptr)
+            while (true)
+            {
+                Command cmd;
+                auto r = TryShift(Buffer, FirstPosition, BufferLength - FirstPosition, cmd);
+                if (r == TryShiftResult::NotEnough)
                 {
-                    auto CommandName = r->Command->CommandName;
-                    auto CommandHash = r->Command->CommandHash;
-                    auto Parameters = r->Command->Parameters;
-                    if (InputByteLengthReport != nullptr)
-                    {
-                        InputByteLengthReport(CommandName, r->Command->ByteLength);
-                    }
-                    if (ss->HasCommand(CommandName, CommandHash) && (CheckCommandAllowed != nullptr ? CheckCommandAllowed(CommandName) : true))
+                    //逆变换暂存了放不下的数据时，整理缓冲区后继续取出
+                    if (Transformer != nullptr)
                     {
-                        auto Command = std::make_shared<StreamedVirtualTransportServerHandleResultCommand>();
-                        Command->CommandName = CommandName;
-                        Command->ExecuteCommand = [=](std::function<void()> OnSuccess, std::function<void(const std::exception &)> OnFailure)
+                        if ((BufferLength >= static_cast<int>(Buffer->size())) && (FirstPosition > 0))
+                        {
+                            auto CopyLength = BufferLength - FirstPosition;
+                            std::memmove(Buffer->data(), Buffer->data() + FirstPosition, static_cast<std::size_t>(CopyLength));
+                            BufferLength = CopyLength;
+                            FirstPosition = 0;
+                        }
+                        auto n = Transformer->Inverse(*Buffer, BufferLength, 0);
+                        if (n > 0)
                         {
-                            auto OnSuccessInner = [=](std::vector<std::uint8_t> OutputParameters)
-                            {
-                                ByteArrayStream s;
-                                s.WriteString(CommandName);
-                                s.WriteUInt32(CommandHash);
-                                s.WriteInt32(static_cast<std::int32_t>(OutputParameters.size()));
-                                s.WriteBytes(OutputParameters);
-                                s.SetPosition(0);
-                                auto Bytes = s.ReadBytes(s.GetLength());
-                                auto BytesLength = Bytes.size();
-                                {
-                                    std::unique_lock<std::mutex> Lock(c.WriteBufferLockee);
-                                    if (Transformer != nullptr)
-                                    {
-                                        Transformer->Transform(Bytes, 0, static_cast<int>(Bytes.size()));
-                                    }
-                                    c.WriteBuffer.push_back(std::make_shared<std::vector<std::uint8_t>>(Bytes));
-                                }
-                                if (OutputByteLengthReport != nullptr)
-                                {
-                                    OutputByteLengthReport(CommandName, BytesLength);
-                                }
-                                OnSuccess();
-                            };
-                            ss->ExecuteCommand(CommandName, CommandHash, Parameters, OnSuccessInner, OnFailure);
-                        };
-                        ret = StreamedVirtualTransportServerHandleResult::CreateCommand(Command);
+                            BufferLength += n;
+                            continue;
+                        }
                     }
-                    else
+                    break;
+                }
+                if (r == TryShiftResult::LargeParameters)
+                {
+                    //TryShift已将ReadBuffer切换为参数缓冲区并设置了已读取长度
+                    c.ReadBufferOffset = 0;
+                    //逆变换可能还暂存有参数的后续部分，须先取出到参数缓冲区
+                    if (Transformer != nullptr)
                     {
-                        auto BadCommand = std::make_shared<StreamedVirtualTransportServerHandleResultBadCommand>();
-                        BadCommand->CommandName = CommandName;
-                        ret = StreamedVirtualTransportServerHandleResult::CreateBadCommand(BadCommand);
+                        return Handle(0);
                     }
-                    break;
+                    return ret;
+                }
+                FirstPosition += cmd.ByteLength;
+                if (cmd.CommandName == CompactCommandIdsCommandName)
+                {
+                    NegotiateCompactCommandIds(cmd.Parameters);
+                    continue;
                 }
+                ret = CreateCommandResult(std::move(cmd));
+                break;
             }
 
+            //剩余空间不足时把未处理的数据移到缓冲区开头
             if ((BufferLength >= static_cast<int>(Buffer->size())) && (FirstPosition > 0))
             {
                 auto CopyLength = BufferLength - FirstPosition;
-                for (int i = 0; i < CopyLength; i += 1)
-                {
-                    (*Buffer)[i] = (*Buffer)[FirstPosition + i];
-                }
+                std::memmove(Buffer->data(), Buffer->data() + FirstPosition, static_cast<std::size_t>(CopyLength));
                 BufferLength = CopyLength;
                 FirstPosition = 0;
             }
@@ -501,132 +564,291 @@ namespace Server
             std::int32_t ByteLength;
         };
 
-        class TryShiftResult
+        /// <summary>
+        /// 紧凑编号协商帧，参数为客户端Schema的Hash(8)
+        /// 服务器在Hash相同时回复相同的帧并改用紧凑格式，否则回复空参数；不支持的服务器作为未知命令处理
+        /// </summary>
+        static constexpr const char16_t *CompactCommandIdsCommandName = u"$CompactCommandIds";
+
+        void NegotiateCompactCommandIds(const std::vector<std::uint8_t> &Parameters)
         {
-        public:
-            std::shared_ptr<class Command> Command;
-            int Position;
-        };
+            auto Hash = ss->Hash();
+            std::vector<std::uint8_t> HashBytes;
+            for (int k = 0; k < 8; k += 1)
+            {
+                HashBytes.push_back(static_cast<std::uint8_t>((Hash >> (k * 8)) & 0xFF));
+            }
+            auto Accepted = Parameters == HashBytes;
+            auto Bytes = EncodeFrame(CompactCommandIdsCommandName, 0, Accepted ? HashBytes : std::vector<std::uint8_t>());
+            {
+                std::unique_lock<std::mutex> Lock(c.WriteBufferLockee);
+                PushFrameLocked(Bytes);
+                if (Accepted) { c.IsCompactCommandIds = true; }
+            }
+            if (this->ServerEvent != nullptr)
+            {
+                this->ServerEvent();
+            }
+        }
 
-        std::shared_ptr<TryShiftResult> TryShift(Context &bc, std::shared_ptr<std::vector<uint8_t>> Buffer, int Position, int Length)
+        /// <summary>
+        /// 完整格式：NameLength(4) Name CommandHash(4) ParametersLength(4) Parameters；紧凑格式：-1-CommandId(4) ParametersLength(4) Parameters
+        /// 直接编码到从BufferPool获取的缓冲区中
+        /// </summary>
+        std::shared_ptr<std::vector<std::uint8_t>> EncodeFrame(const std::u16string &CommandName, std::uint32_t CommandHash, const std::vector<std::uint8_t> &Parameters)
         {
-            if (bc.State == 0)
+            auto CommandId = c.IsCompactCommandIds ? ss->GetCommandId(CommandName, CommandHash) : -1;
+            auto CommandNameLength = CommandName.size() * 2;
+            auto HeaderLength = CommandId >= 0 ? 8 : 4 + CommandNameLength + 8;
+            auto Bytes = BufferPool::Acquire(HeaderLength + Parameters.size());
+            auto p = Bytes->data();
+            if (CommandId >= 0)
             {
-                if (Length >= 4)
-                {
-                    ByteArrayStream s;
-                    for (int k = 0; k < 4; k += 1)
-                    {
-                        s.WriteByte((*Buffer)[Position + k]);
-                    }
-                    s.SetPosition(0);
-                    bc.CommandNameLength = s.ReadInt32();
-                    if (bc.CommandNameLength < 0 || bc.CommandNameLength > 128) { throw std::logic_error("InvalidOperationException"); }
-                    auto r = std::make_shared<TryShiftResult>();
-                    r->Command = nullptr;
-                    r->Position = Position + 4;
-                    bc.InputCommandByteLength += 4;
-                    bc.State = 1;
-                    return r;
-                }
-                return nullptr;
+                WriteInt32At(p, -1 - CommandId);
             }
-            else if (bc.State == 1)
+            else
             {
-                if (Length >= bc.CommandNameLength)
+                WriteInt32At(p, static_cast<std::int32_t>(CommandNameLength));
+                for (std::size_t k = 0; k < CommandName.size(); k += 1)
                 {
-                    ByteArrayStream s;
-                    s.WriteInt32(bc.CommandNameLength);
-                    for (int k = 0; k < bc.CommandNameLength; k += 1)
-                    {
-                        s.WriteByte((*Buffer)[Position + k]);
-                    }
-                    s.SetPosition(0);
-                    bc.CommandName = s.ReadString();
-                    auto r = std::make_shared<TryShiftResult>();
-                    r->Command = nullptr;
-                    r->Position = Position + bc.CommandNameLength;
-                    bc.InputCommandByteLength += bc.CommandNameLength;
-                    bc.State = 2;
-                    return r;
+                    p[4 + k * 2] = static_cast<std::uint8_t>(CommandName[k] & 0xFF);
+                    p[4 + k * 2 + 1] = static_cast<std::uint8_t>((CommandName[k] >> 8) & 0xFF);
                 }
-                return nullptr;
+                WriteInt32At(p + 4 + CommandNameLength, static_cast<std::int32_t>(CommandHash));
             }
-            else if (bc.State == 2)
+            WriteInt32At(p + HeaderLength - 4, static_cast<std::int32_t>(Parameters.size()));
+            if (Parameters.size() > 0)
             {
-                if (Length >= 4)
+                std::memcpy(p + HeaderLength, Parameters.data(), Parameters.size());
+            }
+            return Bytes;
+        }
+
+        /// <summary>加密是流式的，须按写入顺序在WriteBufferLockee中进行</summary>
+        void PushFrameLocked(std::shared_ptr<std::vector<std::uint8_t>> Bytes)
+        {
+            if (Transformer != nullptr)
+            {
+                Transformer->Transform(*Bytes, 0, static_cast<int>(Bytes->size()));
+            }
+            c.WriteBuffer.push_back(Bytes);
+        }
+
+        /// <summary>提交编号为Sequence的命令的回复，Bytes为nullptr表示没有回复；此前的回复均已提交时放入写入缓冲区，否则暂存</summary>
+        void CommitReply(std::uint64_t Sequence, std::shared_ptr<std::vector<std::uint8_t>> Bytes)
+        {
+            std::unique_lock<std::mutex> Lock(c.WriteBufferLockee);
+            if ((Sequence == c.NextReplySequence) && c.PendingReplies.empty())
+            {
+                c.NextReplySequence += 1;
+                if (Bytes != nullptr) { PushFrameLocked(Bytes); }
+                return;
+            }
+            auto Index = static_cast<std::size_t>(Sequence - c.NextReplySequence);
+            if (c.PendingReplies.size() <= Index)
+            {
+                c.PendingReplies.resize(Index + 1);
+            }
+            c.PendingReplies[Index].IsCompleted = true;
+            c.PendingReplies[Index].Bytes = Bytes;
+            FlushPendingRepliesLocked();
+        }
+        /// <summary>事件是否由本会话中尚有更早的命令未回复的命令在本线程上引发</summary>
+        bool IsEventDeferredLocked()
+        {
+            auto &Executing = ExecutingCommand();
+            return (Executing.Server == this) && (Executing.Sequence > c.NextReplySequence);
+        }
+        /// <summary>事件由本会话中尚有更早的命令未回复的命令在本线程上引发时，暂存在该命令的回复之前，待此前的回复均已提交后再加密放入写入缓冲区</summary>
+        bool TryDeferEventLocked(std::shared_ptr<std::vector<std::uint8_t>> Bytes)
+        {
+            if (!IsEventDeferredLocked()) { return false; }
+            auto Index = static_cast<std::size_t>(ExecutingCommand().Sequence - c.NextReplySequence);
+            if (c.PendingReplies.size() <= Index)
+            {
+                c.PendingReplies.resize(Index + 1);
+            }
+            c.PendingReplies[Index].Events.push_back(Bytes);
+            return true;
+        }
+        void FlushPendingRepliesLocked()
+        {
+            while (!c.PendingReplies.empty())
+            {
+                auto &r = c.PendingReplies.front();
+                for (auto &e : r.Events)
                 {
-                    ByteArrayStream s;
-                    for (int k = 0; k < 4; k += 1)
-                    {
-                        s.WriteByte((*Buffer)[Position + k]);
-                    }
-                    s.SetPosition(0);
-                    bc.CommandHash = s.ReadUInt32();
-                    auto r = std::make_shared<TryShiftResult>();
-                    r->Command = nullptr;
-                    r->Position = Position + 4;
-                    bc.InputCommandByteLength += 4;
-                    bc.State = 3;
-                    return r;
+                    PushFrameLocked(e);
                 }
-                return nullptr;
+                r.Events.clear();
+                if (!r.IsCompleted) { break; }
+                auto b = std::move(r.Bytes);
+                c.PendingReplies.pop_front();
+                c.NextReplySequence += 1;
+                if (b != nullptr) { PushFrameLocked(b); }
             }
-            if (bc.State == 3)
-            {
-                if (Length >= 4)
+        }
+
+        /// <summary>当前线程上正在执行的命令，用于将命令引发的事件放入该命令的回复顺序中</summary>
+        struct ExecutingCommandInfo
+        {
+            BinaryCountPacketServer *Server;
+            std::uint64_t Sequence;
+        };
+        static ExecutingCommandInfo &ExecutingCommand()
+        {
+            thread_local ExecutingCommandInfo Info = { nullptr, 0 };
+            return Info;
+        }
+
+        enum class TryShiftResult
+        {
+            NotEnough,
+            Command,
+            LargeParameters
+        };
+
+        std::shared_ptr<StreamedVirtualTransportServerHandleResult> CreateCommandResult(Command &&cmd)
+        {
+            auto CommandName = std::move(cmd.CommandName);
+            auto CommandHash = cmd.CommandHash;
+            auto Parameters = std::move(cmd.Parameters);
+            if (InputByteLengthReport != nullptr)
+            {
+                InputByteLengthReport(CommandName, static_cast<std::size_t>(cmd.ByteLength));
+            }
+            if (ss->HasCommand(CommandName, CommandHash) && (CheckCommandAllowed != nullptr ? CheckCommandAllowed(CommandName) : true))
+            {
+                auto Sequence = c.NextCommandSequence;
+                c.NextCommandSequence += 1;
+                auto Command = std::make_shared<StreamedVirtualTransportServerHandleResultCommand>();
+                Command->CommandName = CommandName;
+                Command->IsConcurrent = ss->IsConcurrentCommand(CommandName);
+                Command->InputByteLength = static_cast<std::size_t>(cmd.ByteLength);
+                Command->ReceiveTime = std::chrono::steady_clock::now();
+                Command->ExecuteCommand = [=, Parameters = std::move(Parameters)](std::function<void(std::chrono::steady_clock::time_point)> OnReady, std::function<void()> OnSuccess, std::function<void(const std::exception &)> OnFailure) mutable
                 {
-                    ByteArrayStream s;
-                    for (int k = 0; k < 4; k += 1)
+                    auto OnSuccessInner = [=](std::vector<std::uint8_t> OutputParameters)
+                    {
+                        auto Bytes = EncodeFrame(CommandName, CommandHash, OutputParameters);
+                        auto BytesLength = Bytes->size();
+                        //回复放入写入缓冲区后可能立即被其他线程上开始的写入取走，须在此之前记录就绪时间
+                        OnReady(std::chrono::steady_clock::now());
+                        CommitReply(Sequence, Bytes);
+                        if (OutputByteLengthReport != nullptr)
+                        {
+                            OutputByteLengthReport(CommandName, BytesLength);
+                        }
+                        OnSuccess();
+                    };
+                    auto OnFailureInner = [=](const std::exception &ex)
+                    {
+                        CommitReply(Sequence, nullptr);
+                        OnFailure(ex);
+                    };
+                    //命令在本线程上同步执行期间引发的事件与回复一同排序；异步命令在其他线程上引发的事件直接发出
+                    auto &Executing = ExecutingCommand();
+                    auto Previous = Executing;
+                    Executing = { this, Sequence };
+                    try
                     {
-                        s.WriteByte((*Buffer)[Position + k]);
+                        ss->ExecuteCommand(CommandName, CommandHash, std::move(Parameters), OnSuccessInner, OnFailureInner);
                     }
-                    s.SetPosition(0);
-                    bc.ParametersLength = s.ReadInt32();
-                    if (bc.ParametersLength < 0 || bc.ParametersLength > static_cast<int>(Buffer->size())) { throw std::logic_error("InvalidOperationException"); }
-                    auto r = std::make_shared<TryShiftResult>();
-                    r->Command = nullptr;
-                    r->Position = Position + 4;
-                    bc.InputCommandByteLength += 4;
-                    bc.State = 4;
-                    return r;
-                }
-                return nullptr;
+                    catch (...)
+                    {
+                        Executing = Previous;
+                        throw;
+                    }
+                    Executing = Previous;
+                };
+                return StreamedVirtualTransportServerHandleResult::CreateCommand(Command);
+            }
+            else
+            {
+                auto BadCommand = std::make_shared<StreamedVirtualTransportServerHandleResultBadCommand>();
+                BadCommand->CommandName = CommandName;
+                return StreamedVirtualTransportServerHandleResult::CreateBadCommand(BadCommand);
+            }
+        }
+
+        static std::int32_t ReadInt32At(const std::uint8_t *p)
+        {
+            return static_cast<std::int32_t>(static_cast<std::uint32_t>(p[0]) | (static_cast<std::uint32_t>(p[1]) << 8) | (static_cast<std::uint32_t>(p[2]) << 16) | (static_cast<std::uint32_t>(p[3]) << 24));
+        }
+        static void WriteInt32At(std::uint8_t *p, std::int32_t v)
+        {
+            auto u = static_cast<std::uint32_t>(v);
+            p[0] = static_cast<std::uint8_t>(u & 0xFF);
+            p[1] = static_cast<std::uint8_t>((u >> 8) & 0xFF);
+            p[2] = static_cast<std::uint8_t>((u >> 16) & 0xFF);
+            p[3] = static_cast<std::uint8_t>((u >> 24) & 0xFF);
+        }
+
+        /// <summary>
+        /// 直接从读取缓冲区解析一帧，格式见EncodeFrame，紧凑格式只在协商后接受
+        /// 帧未完整到达时不消耗数据，下次从帧头重新解析；命令名称在帧完整后才解码
+        /// </summary>
+        TryShiftResult TryShift(std::shared_ptr<std::vector<uint8_t>> Buffer, int Position, int Length, Command &cmd)
+        {
+            if (Length < 4) { return TryShiftResult::NotEnough; }
+            auto p = Buffer->data() + Position;
+            auto CommandNameLength = ReadInt32At(p);
+            auto IsCompact = CommandNameLength < 0;
+            if (IsCompact && !c.IsCompactCommandIds) { throw std::logic_error("InvalidOperationException"); }
+            if (CommandNameLength > 128) { throw std::logic_error("InvalidOperationException"); }
+            auto HeaderLength = IsCompact ? 8 : 4 + CommandNameLength + 8;
+            if (Length < HeaderLength) { return TryShiftResult::NotEnough; }
+            auto CommandNameView = p + 4;
+            std::u16string CompactCommandName;
+            std::uint32_t CommandHash = 0;
+            if (IsCompact)
+            {
+                if (!ss->TryGetCommand(-1 - CommandNameLength, CompactCommandName, CommandHash)) { throw std::logic_error("InvalidOperationException"); }
+            }
+            else
+            {
+                CommandHash = static_cast<std::uint32_t>(ReadInt32At(p + 4 + CommandNameLength));
             }
-            else if (bc.State == 4)
+            auto ParametersLength = ReadInt32At(p + HeaderLength - 4);
+            if (ParametersLength < 0 || ParametersLength > std::max(MaxParametersLength, static_cast<int>(Buffer->size()))) { throw std::logic_error("InvalidOperationException"); }
+
+            auto DecodeCommandName = [&]()
             {
-                if (Length >= bc.ParametersLength)
+                if (IsCompact) { return std::move(CompactCommandName); }
+                std::u16string CommandName;
+                CommandName.resize(static_cast<std::size_t>(CommandNameLength / 2));
+                for (int k = 0; k < CommandNameLength / 2; k += 1)
                 {
-                    std::vector<std::uint8_t> Parameters;
-                    Parameters.resize(bc.ParametersLength, 0);
-                    for (int k = 0; k < bc.ParametersLength; k += 1)
-                    {
-                        Parameters[k] = (*Buffer)[Position + k];
-                    }
-                    bc.InputCommandByteLength += bc.ParametersLength;
-                    auto cmd = std::make_shared<Command>();
-                    cmd->CommandName = bc.CommandName;
-                    cmd->CommandHash = bc.CommandHash;
-                    cmd->Parameters = std::move(Parameters);
-                    cmd->ByteLength = static_cast<std::int32_t>(bc.InputCommandByteLength);
-                    auto r = std::make_shared<TryShiftResult>();
-                    r->Command = cmd;
-                    r->Position = Position + bc.ParametersLength;
-                    bc.CommandNameLength = 0;
-                    bc.CommandName = u"";
-                    bc.CommandHash = 0;
-                    bc.ParametersLength = 0;
-                    bc.InputCommandByteLength = 0;
-                    bc.State = 0;
-                    return r;
+                    CommandName[k] = static_cast<char16_t>(static_cast<std::uint16_t>(CommandNameView[k * 2]) | (static_cast<std::uint16_t>(CommandNameView[k * 2 + 1]) << 8));
                 }
-                return nullptr;
+                return CommandName;
+            };
+
+            auto Available = Length - HeaderLength;
+            if (Available >= ParametersLength)
+            {
+                cmd.CommandName = DecodeCommandName();
+                cmd.CommandHash = CommandHash;
+                cmd.Parameters.assign(p + HeaderLength, p + HeaderLength + ParametersLength);
+                cmd.ByteLength = HeaderLength + ParametersLength;
+                return TryShiftResult::Command;
             }
-            else
+
+            //参数较大时改为直接读取到参数缓冲区；否则等待，必要时由Handle整理缓冲区
+            if ((ParametersLength < static_cast<int>(Buffer->size()) / 2) && (HeaderLength + ParametersLength <= static_cast<int>(Buffer->size())))
             {
-                throw std::logic_error("InvalidOperationException");
+                return TryShiftResult::NotEnough;
             }
-            return nullptr;
+            auto Parameters = std::make_shared<std::vector<std::uint8_t>>();
+            Parameters->resize(static_cast<std::size_t>(ParametersLength));
+            std::memcpy(Parameters->data(), p + HeaderLength, static_cast<std::size_t>(Available));
+            c.IsReadingLargeParameters = true;
+            c.LargeCommandName = DecodeCommandName();
+            c.LargeCommandHash = CommandHash;
+            c.LargeCommandByteLength = HeaderLength + ParametersLength;
+            c.ReadBuffer = Parameters;
+            c.ReadBufferLength = Available;
+            return TryShiftResult::LargeParameters;
         }
     };
 }
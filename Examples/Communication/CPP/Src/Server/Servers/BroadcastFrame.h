@@ -0,0 +1,45 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <string>
+#include <memory>
+#include <utility>
+#include <mutex>
+
+namespace Server
+{
+    /// <summary>
+    /// 已序列化的服务器事件，由接收广播的各会话共享，创建后不再修改。
+    /// 各会话按自己使用的帧格式（完整或紧凑）取得编码后的帧，每种格式只编码一次；返回的帧缓冲区由各会话共享，只能读取。
+    /// 本类的所有公共成员均是线程安全的。
+    /// </summary>
+    class BroadcastFrame
+    {
+    public:
+        const std::u16string CommandName;
+        const std::uint32_t CommandHash;
+        const std::vector<std::uint8_t> Parameters;
+
+        BroadcastFrame(std::u16string CommandName, std::uint32_t CommandHash, std::vector<std::uint8_t> Parameters)
+            : CommandName(std::move(CommandName)), CommandHash(CommandHash), Parameters(std::move(Parameters))
+        {
+        }
+
+        BroadcastFrame(const BroadcastFrame &) = delete;
+        BroadcastFrame &operator=(const BroadcastFrame &) = delete;
+
+        /// <summary>取得指定格式的帧，该格式首次被取得时调用Encode编码</summary>
+        template <typename TEncode>
+        std::shared_ptr<std::vector<std::uint8_t>> GetFrame(bool IsCompact, TEncode Encode)
+        {
+            auto Index = IsCompact ? 1 : 0;
+            std::call_once(FrameOnce[Index], [&]() { Frames[Index] = Encode(); });
+            return Frames[Index];
+        }
+
+    private:
+        std::once_flag FrameOnce[2];
+        std::shared_ptr<std::vector<std::uint8_t>> Frames[2];
+    };
+}
@@ -0,0 +1,369 @@
+﻿#include "BufferPool.h"
+
+#include <atomic>
+#include <algorithm>
+#include <mutex>
+#include <unordered_set>
+#include <new>
+
+namespace Server
+{
+    namespace
+    {
+        const int MinSizeClassBits = 6;
+        const int NumSizeClass = 15;
+        const std::size_t MaxThreadCachedBytesPerSizeClass = 256 * 1024;
+        const std::size_t MaxThreadCachedCountPerSizeClass = 64;
+        const std::size_t MaxDepotBytesPerSizeClass = 4 * 1024 * 1024;
+        const std::size_t MaxDepotCountPerSizeClass = 1024;
+        const std::size_t ControlBlockSize = 64;
+        const std::size_t MaxThreadCachedControlBlocks = 256;
+        const std::size_t MaxDepotControlBlocks = 16384;
+
+        /// <summary>每个线程的命中和未命中次数，只由所属线程写入，写入时不使用原子读改写；读取时汇总所有线程</summary>
+        class alignas(64) ThreadCounter
+        {
+        public:
+            std::atomic<std::uint64_t> HitCount;
+            std::atomic<std::uint64_t> MissCount;
+
+            ThreadCounter();
+            ~ThreadCounter();
+
+            static void Increase(std::atomic<std::uint64_t> &Count)
+            {
+                Count.store(Count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            }
+        };
+        class CounterRegistry
+        {
+        public:
+            std::mutex Lockee;
+            std::unordered_set<ThreadCounter *> Counters;
+            //已退出线程的计数
+            std::uint64_t RetiredHitCount = 0;
+            std::uint64_t RetiredMissCount = 0;
+        };
+        /// <summary>不析构，保证在各线程的ThreadCounter析构时仍然可用</summary>
+        CounterRegistry &GetCounterRegistry()
+        {
+            static auto r = new CounterRegistry();
+            return *r;
+        }
+        ThreadCounter::ThreadCounter()
+            : HitCount(0), MissCount(0)
+        {
+            auto &r = GetCounterRegistry();
+            std::unique_lock<std::mutex> Lock(r.Lockee);
+            r.Counters.insert(this);
+        }
+        ThreadCounter::~ThreadCounter()
+        {
+            auto &r = GetCounterRegistry();
+            std::unique_lock<std::mutex> Lock(r.Lockee);
+            r.Counters.erase(this);
+            r.RetiredHitCount += HitCount.load(std::memory_order_relaxed);
+            r.RetiredMissCount += MissCount.load(std::memory_order_relaxed);
+        }
+        ThreadCounter &GetThreadCounter()
+        {
+            thread_local ThreadCounter c;
+            return c;
+        }
+        std::uint64_t SumCounters(std::uint64_t CounterRegistry::*Retired, std::atomic<std::uint64_t> ThreadCounter::*Count)
+        {
+            auto &r = GetCounterRegistry();
+            std::unique_lock<std::mutex> Lock(r.Lockee);
+            auto Sum = r.*Retired;
+            for (auto c : r.Counters)
+            {
+                Sum += (c->*Count).load(std::memory_order_relaxed);
+            }
+            return Sum;
+        }
+
+        std::size_t SizeOfSizeClass(int k)
+        {
+            return static_cast<std::size_t>(1) << (MinSizeClassBits + k);
+        }
+        std::size_t MaxThreadCachedCountOfSizeClass(int k)
+        {
+            return std::max<std::size_t>(std::min(MaxThreadCachedBytesPerSizeClass / SizeOfSizeClass(k), MaxThreadCachedCountPerSizeClass), 2);
+        }
+        std::size_t MaxDepotCountOfSizeClass(int k)
+        {
+            return std::max<std::size_t>(std::min(MaxDepotBytesPerSizeClass / SizeOfSizeClass(k), MaxDepotCountPerSizeClass), 4);
+        }
+        /// <summary>能容纳Size的最小级别，超过最大级别时返回-1</summary>
+        int SizeClassOfSize(std::size_t Size)
+        {
+            for (int k = 0; k < NumSizeClass; k += 1)
+            {
+                if (Size <= SizeOfSizeClass(k)) { return k; }
+            }
+            return -1;
+        }
+        /// <summary>容量Capacity满足的最大级别，不满足最小级别或达到最大级别的两倍时返回-1</summary>
+        int SizeClassOfCapacity(std::size_t Capacity)
+        {
+            if ((Capacity < SizeOfSizeClass(0)) || (Capacity >= SizeOfSizeClass(NumSizeClass))) { return -1; }
+            for (int k = NumSizeClass - 1; k >= 0; k -= 1)
+            {
+                if (Capacity >= SizeOfSizeClass(k)) { return k; }
+            }
+            return -1;
+        }
+
+        /// <summary>
+        /// 所有线程共享的有界仓库，每个级别一个锁，线程缓存满时成批移入，线程缓存空时成批取回
+        /// 缓冲区通常在工作线程上获取、在I/O线程上释放，经仓库回到获取缓冲区的线程；仓库满时直接删除
+        /// 不析构，保证在各线程的缓存析构时仍然可用
+        /// </summary>
+        class Depot
+        {
+        public:
+            class SizeClass
+            {
+            public:
+                std::mutex Lockee;
+                std::vector<std::vector<std::uint8_t> *> Buffers;
+            };
+            SizeClass SizeClasses[NumSizeClass];
+            std::mutex ControlBlocksLockee;
+            std::vector<void *> ControlBlocks;
+
+            /// <summary>将l末尾的Count项移入仓库，放不下的删除</summary>
+            void PutBuffers(int k, std::vector<std::vector<std::uint8_t> *> &l, std::size_t Count)
+            {
+                auto &c = SizeClasses[k];
+                auto Begin = l.end() - static_cast<std::ptrdiff_t>(Count);
+                {
+                    std::unique_lock<std::mutex> Lock(c.Lockee);
+                    auto n = std::min(Count, MaxDepotCountOfSizeClass(k) - std::min(c.Buffers.size(), MaxDepotCountOfSizeClass(k)));
+                    c.Buffers.insert(c.Buffers.end(), Begin, Begin + static_cast<std::ptrdiff_t>(n));
+                    Begin += static_cast<std::ptrdiff_t>(n);
+                }
+                for (auto i = Begin; i != l.end(); ++i)
+                {
+                    delete *i;
+                }
+                l.resize(l.size() - Count);
+            }
+            /// <summary>从仓库取回至多Count项追加到l末尾，返回取回的数量</summary>
+            std::size_t TakeBuffers(int k, std::vector<std::vector<std::uint8_t> *> &l, std::size_t Count)
+            {
+                auto &c = SizeClasses[k];
+                std::unique_lock<std::mutex> Lock(c.Lockee);
+                auto n = std::min(Count, c.Buffers.size());
+                l.insert(l.end(), c.Buffers.end() - static_cast<std::ptrdiff_t>(n), c.Buffers.end());
+                c.Buffers.resize(c.Buffers.size() - n);
+                return n;
+            }
+            void PutControlBlocks(std::vector<void *> &l, std::size_t Count)
+            {
+                auto Begin = l.end() - static_cast<std::ptrdiff_t>(Count);
+                {
+                    std::unique_lock<std::mutex> Lock(ControlBlocksLockee);
+                    auto n = std::min(Count, MaxDepotControlBlocks - std::min(ControlBlocks.size(), MaxDepotControlBlocks));
+                    ControlBlocks.insert(ControlBlocks.end(), Begin, Begin + static_cast<std::ptrdiff_t>(n));
+                    Begin += static_cast<std::ptrdiff_t>(n);
+                }
+                for (auto i = Begin; i != l.end(); ++i)
+                {
+                    ::operator delete(*i);
+                }
+                l.resize(l.size() - Count);
+            }
+            std::size_t TakeControlBlocks(std::vector<void *> &l, std::size_t Count)
+            {
+                std::unique_lock<std::mutex> Lock(ControlBlocksLockee);
+                auto n = std::min(Count, ControlBlocks.size());
+                l.insert(l.end(), ControlBlocks.end() - static_cast<std::ptrdiff_t>(n), ControlBlocks.end());
+                ControlBlocks.resize(ControlBlocks.size() - n);
+                return n;
+            }
+        };
+        Depot &GetDepot()
+        {
+            static auto d = new Depot();
+            return *d;
+        }
+
+        thread_local bool IsThreadCacheDestroyed = false;
+
+        /// <summary>每个线程的缓存，满时把一半移入仓库，空时从仓库取回一半容量</summary>
+        class ThreadCache
+        {
+        public:
+            std::vector<std::vector<std::uint8_t> *> Buffers[NumSizeClass];
+            std::vector<void *> ControlBlocks;
+
+            ThreadCache()
+            {
+                for (int k = 0; k < NumSizeClass; k += 1)
+                {
+                    Buffers[k].reserve(MaxThreadCachedCountOfSizeClass(k));
+                }
+                ControlBlocks.reserve(MaxThreadCachedControlBlocks);
+            }
+            ~ThreadCache()
+            {
+                auto &d = GetDepot();
+                for (int k = 0; k < NumSizeClass; k += 1)
+                {
+                    d.PutBuffers(k, Buffers[k], Buffers[k].size());
+                }
+                d.PutControlBlocks(ControlBlocks, ControlBlocks.size());
+                IsThreadCacheDestroyed = true;
+            }
+
+            std::vector<std::uint8_t> *TakeBuffer(int k)
+            {
+                auto &l = Buffers[k];
+                if ((l.size() == 0) && (GetDepot().TakeBuffers(k, l, (MaxThreadCachedCountOfSizeClass(k) + 1) / 2) == 0))
+                {
+                    return nullptr;
+                }
+                auto b = l.back();
+                l.pop_back();
+                return b;
+            }
+            void PutBuffer(int k, std::vector<std::uint8_t> *b)
+            {
+                auto &l = Buffers[k];
+                if (l.size() >= MaxThreadCachedCountOfSizeClass(k))
+                {
+                    GetDepot().PutBuffers(k, l, (l.size() + 1) / 2);
+                }
+                l.push_back(b);
+            }
+            void *TakeControlBlock()
+            {
+                if ((ControlBlocks.size() == 0) && (GetDepot().TakeControlBlocks(ControlBlocks, MaxThreadCachedControlBlocks / 2) == 0))
+                {
+                    return nullptr;
+                }
+                auto p = ControlBlocks.back();
+                ControlBlocks.pop_back();
+                return p;
+            }
+            void PutControlBlock(void *p)
+            {
+                if (ControlBlocks.size() >= MaxThreadCachedControlBlocks)
+                {
+                    GetDepot().PutControlBlocks(ControlBlocks, ControlBlocks.size() / 2);
+                }
+                ControlBlocks.push_back(p);
+            }
+        };
+
+        /// <summary>线程退出时缓存已析构，此后在该线程上获取和释放的缓冲区直接经过仓库</summary>
+        ThreadCache *GetThreadCache()
+        {
+            if (IsThreadCacheDestroyed) { return nullptr; }
+            thread_local ThreadCache tc;
+            return &tc;
+        }
+
+        class Recycler
+        {
+        public:
+            void operator()(std::vector<std::uint8_t> *b) const
+            {
+                auto k = SizeClassOfCapacity(b->capacity());
+                if (k < 0)
+                {
+                    delete b;
+                    return;
+                }
+                auto tc = GetThreadCache();
+                if (tc != nullptr)
+                {
+                    tc->PutBuffer(k, b);
+                    return;
+                }
+                std::vector<std::vector<std::uint8_t> *> l{ b };
+                GetDepot().PutBuffers(k, l, 1);
+            }
+        };
+
+        template <typename T>
+        class ControlBlockAllocator
+        {
+        public:
+            typedef T value_type;
+
+            ControlBlockAllocator() noexcept {}
+            template <typename U>
+            ControlBlockAllocator(const ControlBlockAllocator<U> &) noexcept {}
+
+            T *allocate(std::size_t n)
+            {
+                if (sizeof(T) * n > ControlBlockSize)
+                {
+                    return static_cast<T *>(::operator new(sizeof(T) * n));
+                }
+                auto tc = GetThreadCache();
+                auto p = tc != nullptr ? tc->TakeControlBlock() : nullptr;
+                if (p != nullptr)
+                {
+                    return static_cast<T *>(p);
+                }
+                return static_cast<T *>(::operator new(ControlBlockSize));
+            }
+            void deallocate(T *p, std::size_t n) noexcept
+            {
+                if (sizeof(T) * n <= ControlBlockSize)
+                {
+                    auto tc = GetThreadCache();
+                    if (tc != nullptr)
+                    {
+                        tc->PutControlBlock(p);
+                        return;
+                    }
+                }
+                ::operator delete(p);
+            }
+
+            template <typename U>
+            bool operator==(const ControlBlockAllocator<U> &) const noexcept { return true; }
+            template <typename U>
+            bool operator!=(const ControlBlockAllocator<U> &) const noexcept { return false; }
+        };
+    }
+
+    std::shared_ptr<std::vector<std::uint8_t>> BufferPool::Acquire(std::size_t Size)
+    {
+        auto k = SizeClassOfSize(Size);
+        if (k < 0)
+        {
+            ThreadCounter::Increase(GetThreadCounter().MissCount);
+            auto b = std::make_shared<std::vector<std::uint8_t>>();
+            b->resize(Size, 0);
+            return b;
+        }
+        auto tc = GetThreadCache();
+        auto b = tc != nullptr ? tc->TakeBuffer(k) : nullptr;
+        if (b != nullptr)
+        {
+            ThreadCounter::Increase(GetThreadCounter().HitCount);
+        }
+        else
+        {
+            ThreadCounter::Increase(GetThreadCounter().MissCount);
+            b = new std::vector<std::uint8_t>();
+            b->reserve(SizeOfSizeClass(k));
+        }
+        b->resize(Size);
+        return std::shared_ptr<std::vector<std::uint8_t>>(b, Recycler(), ControlBlockAllocator<std::vector<std::uint8_t>>());
+    }
+
+    std::uint64_t BufferPool::Hits()
+    {
+        return SumCounters(&CounterRegistry::RetiredHitCount, &ThreadCounter::HitCount);
+    }
+    std::uint64_t BufferPool::Misses()
+    {
+        return SumCounters(&CounterRegistry::RetiredMissCount, &ThreadCounter::MissCount);
+    }
+}
@@ -0,0 +1,28 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <memory>
+
+namespace Server
+{
+    /// <summary>
+    /// 按线程缓存的缓冲区池，容量按2的幂分级（64B至1MB），超过最大级别的缓冲区不缓存。
+    /// 缓冲区在引用计数归零时回到释放线程的缓存，线程缓存满时把一半成批移入所有线程共享的有界仓库，获取时线程缓存为空则从仓库成批取回；
+    /// 在工作线程上获取、在I/O线程上释放的缓冲区经仓库回到工作线程，shared_ptr的控制块同样处理，稳定状态下获取和释放均不分配堆内存。
+    /// 每个线程每级缓存不超过256KB（至少2个），仓库每级不超过4MB（至少4个），超出时直接删除。
+    /// 本类的所有公共成员均是线程安全的。
+    /// </summary>
+    class BufferPool
+    {
+    public:
+        /// <summary>获取长度为Size的缓冲区，内容不保证为0</summary>
+        static std::shared_ptr<std::vector<std::uint8_t>> Acquire(std::size_t Size);
+
+        /// <summary>从线程缓存中取得缓冲区的次数</summary>
+        static std::uint64_t Hits();
+        /// <summary>需要新分配缓冲区的次数</summary>
+        static std::uint64_t Misses();
+    };
+}
@@ -0,0 +1,201 @@
+﻿#pragma once
+
+#include "IContext.h"
+
+#include "BaseSystem/Cryptography.h"
+
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <string>
+#include <span>
+#include <stdexcept>
+
+namespace Server
+{
+    /// <summary>
+    /// 使用ChaCha20-Poly1305（RFC 8439）加密流数据，每个方向的密钥和Nonce由该方向的Token和握手时双方随机生成的ClientSalt、ServerSalt经HMAC派生，不同会话的密钥不同
+    /// 每次Transform的数据分为不超过MaxRecordLength的记录，记录格式为Length(2) CipherText Tag(16)，Length作为附加认证数据，Nonce为派生的Nonce与该方向的记录序号异或
+    /// 记录的标签不符时Inverse抛出异常，会话随之断开；篡改、删除、重放或调换记录都会使验证失败
+    /// 与Rc4PacketServerTransformer相同，收到客户端的第一个加密记录后才开始加密发送的数据
+    /// </summary>
+    class ChaCha20PacketServerTransformer : public IBinaryTransformer
+    {
+    private:
+        static constexpr std::size_t MaxRecordLength = 16384;
+        static constexpr std::size_t RecordHeaderLength = 2;
+        static constexpr std::size_t TagLength = 16;
+
+        bool WillUseEncryption;
+        std::atomic<bool> UseEncryption;
+        std::shared_ptr<Algorithms::ChaCha20Poly1305> ServerCipher;
+        std::shared_ptr<Algorithms::ChaCha20Poly1305> ClientCipher;
+        std::array<std::uint8_t, 12> ServerNonce;
+        std::array<std::uint8_t, 12> ClientNonce;
+        std::uint64_t ServerSequence;
+        std::uint64_t ClientSequence;
+
+        //Inverse时末尾不完整的记录，以及已验证但读取缓冲区放不下的明文
+        std::vector<std::uint8_t> PendingRecords;
+        std::vector<std::uint8_t> PendingPlainText;
+        std::size_t PendingPlainTextOffset;
+
+        /// <summary>HMACSHA256Simple(Token, Label :: ClientSalt :: ServerSalt)</summary>
+        static std::vector<std::uint8_t> Derive(const std::vector<std::uint8_t> &Token, const std::string &Label, const SecureContext &c)
+        {
+            std::vector<std::uint8_t> Bytes(Label.begin(), Label.end());
+            Bytes.insert(Bytes.end(), c.ClientSalt.begin(), c.ClientSalt.end());
+            Bytes.insert(Bytes.end(), c.ServerSalt.begin(), c.ServerSalt.end());
+            return Algorithms::Cryptography::HMACSHA256Simple(Token, Bytes);
+        }
+        static std::shared_ptr<Algorithms::ChaCha20Poly1305> CreateCipher(const std::vector<std::uint8_t> &Token, const std::string &Direction, const SecureContext &c, std::array<std::uint8_t, 12> &Nonce)
+        {
+            auto Key = Derive(Token, Direction + "Key", c);
+            auto NonceBytes = Derive(Token, Direction + "Nonce", c);
+            std::memcpy(Nonce.data(), NonceBytes.data(), Nonce.size());
+            return std::make_shared<Algorithms::ChaCha20Poly1305>(std::span<const std::uint8_t>(Key.data(), 32));
+        }
+        /// <summary>Nonce的后8字节与记录序号（小端）异或</summary>
+        static std::array<std::uint8_t, 12> GetRecordNonce(const std::array<std::uint8_t, 12> &Nonce, std::uint64_t Sequence)
+        {
+            auto n = Nonce;
+            for (int k = 0; k < 8; k += 1)
+            {
+                n[4 + k] ^= static_cast<std::uint8_t>((Sequence >> (k * 8)) & 0xFF);
+            }
+            return n;
+        }
+
+        /// <summary>依次验证并原地解密Records中完整的记录，明文交给Emit，返回已处理的长度；标签不符时抛出异常</summary>
+        template <typename TEmit>
+        std::size_t OpenRecords(std::uint8_t *Records, std::size_t Length, TEmit &&Emit)
+        {
+            std::size_t Offset = 0;
+            while (Length - Offset >= RecordHeaderLength)
+            {
+                auto p = Records + Offset;
+                auto n = static_cast<std::size_t>(p[0]) | (static_cast<std::size_t>(p[1]) << 8);
+                if ((n == 0) || (n > MaxRecordLength)) { throw std::logic_error("InvalidOperationException"); }
+                if (Length - Offset < RecordHeaderLength + n + TagLength) { break; }
+                auto Nonce = GetRecordNonce(ClientNonce, ClientSequence);
+                if (!ClientCipher->Open(Nonce, std::span<const std::uint8_t>(p, RecordHeaderLength), p + RecordHeaderLength, n, p + RecordHeaderLength + n))
+                {
+                    throw std::logic_error("AuthenticationFailed");
+                }
+                ClientSequence += 1;
+                if (!UseEncryption.load(std::memory_order_relaxed)) { UseEncryption.store(true, std::memory_order_release); }
+                Emit(p + RecordHeaderLength, n);
+                Offset += RecordHeaderLength + n + TagLength;
+            }
+            return Offset;
+        }
+
+    public:
+        ChaCha20PacketServerTransformer()
+            : WillUseEncryption(false), UseEncryption(false), ServerNonce{}, ClientNonce{}, ServerSequence(0), ClientSequence(0), PendingPlainTextOffset(0)
+        {
+        }
+
+        void SetSecureContext(std::shared_ptr<SecureContext> SecureContext)
+        {
+            if (SecureContext->ClientSalt.empty() || SecureContext->ServerSalt.empty()) { throw std::logic_error("InvalidOperationException"); }
+            ServerCipher = CreateCipher(SecureContext->ServerToken, "Server", *SecureContext, ServerNonce);
+            ClientCipher = CreateCipher(SecureContext->ClientToken, "Client", *SecureContext, ClientNonce);
+            WillUseEncryption = true;
+        }
+
+        void Transform(std::vector<std::uint8_t> &Buffer, int Start, int Count)
+        {
+            if (!UseEncryption.load(std::memory_order_acquire)) { return; }
+            if (static_cast<std::size_t>(Start + Count) != Buffer.size()) { throw std::logic_error("InvalidArgument"); }
+            if (Count <= 0) { return; }
+
+            auto Length = static_cast<std::size_t>(Count);
+            auto NumRecords = (Length + MaxRecordLength - 1) / MaxRecordLength;
+            Buffer.resize(static_cast<std::size_t>(Start) + Length + NumRecords * (RecordHeaderLength + TagLength));
+            auto Base = Buffer.data() + Start;
+            //从后向前把各记录的明文移到最终位置，目标位置不早于原位置，不会覆盖尚未移动的数据
+            for (auto r = NumRecords; r > 0; r -= 1)
+            {
+                auto Offset = (r - 1) * MaxRecordLength;
+                auto n = std::min(MaxRecordLength, Length - Offset);
+                auto p = Base + Offset + (r - 1) * (RecordHeaderLength + TagLength);
+                std::memmove(p + RecordHeaderLength, Base + Offset, n);
+                p[0] = static_cast<std::uint8_t>(n & 0xFF);
+                p[1] = static_cast<std::uint8_t>((n >> 8) & 0xFF);
+            }
+            auto p = Base;
+            for (std::size_t r = 0; r < NumRecords; r += 1)
+            {
+                auto n = static_cast<std::size_t>(p[0]) | (static_cast<std::size_t>(p[1]) << 8);
+                auto Nonce = GetRecordNonce(ServerNonce, ServerSequence);
+                ServerSequence += 1;
+                ServerCipher->Seal(Nonce, std::span<const std::uint8_t>(p, RecordHeaderLength), p + RecordHeaderLength, n, p + RecordHeaderLength + n);
+                p += RecordHeaderLength + n + TagLength;
+            }
+        }
+
+        /// <summary>
+        /// 没有暂存数据时直接在Buffer中原地解密并去掉记录头和标签，只暂存末尾不完整的记录
+        /// 有暂存数据时先把新数据追加到暂存的记录后再解密，明文写回Buffer，放不下的部分暂存，之后以Count为0调用时继续输出
+        /// </summary>
+        int Inverse(std::vector<std::uint8_t> &Buffer, int Start, int Count)
+        {
+            if (!WillUseEncryption) { return Count; }
+
+            auto Output = Buffer.data() + Start;
+            auto Capacity = Buffer.size() - static_cast<std::size_t>(Start);
+            std::size_t Length = 0;
+            if (PendingRecords.empty() && (PendingPlainTextOffset == PendingPlainText.size()))
+            {
+                //明文总是不长于密文，原地写入不会覆盖尚未解密的数据
+                auto Offset = OpenRecords(Output, static_cast<std::size_t>(Count), [&](const std::uint8_t *p, std::size_t n)
+                {
+                    std::memmove(Output + Length, p, n);
+                    Length += n;
+                });
+                PendingRecords.assign(Output + Offset, Output + Count);
+                return static_cast<int>(Length);
+            }
+
+            PendingRecords.insert(PendingRecords.end(), Output, Output + Count);
+            auto Emit = [&](const std::uint8_t *p, std::size_t n)
+            {
+                auto m = PendingPlainTextOffset == PendingPlainText.size() ? std::min(n, Capacity - Length) : 0;
+                if (m > 0)
+                {
+                    std::memcpy(Output + Length, p, m);
+                    Length += m;
+                }
+                if (m < n)
+                {
+                    PendingPlainText.insert(PendingPlainText.end(), p + m, p + n);
+                }
+            };
+            if (PendingPlainTextOffset < PendingPlainText.size())
+            {
+                auto n = std::min(PendingPlainText.size() - PendingPlainTextOffset, Capacity);
+                std::memcpy(Output, PendingPlainText.data() + PendingPlainTextOffset, n);
+                Length += n;
+                PendingPlainTextOffset += n;
+                if (PendingPlainTextOffset == PendingPlainText.size())
+                {
+                    PendingPlainText.clear();
+                    PendingPlainTextOffset = 0;
+                }
+            }
+            auto Offset = OpenRecords(PendingRecords.data(), PendingRecords.size(), Emit);
+            PendingRecords.erase(PendingRecords.begin(), PendingRecords.begin() + static_cast<std::ptrdiff_t>(Offset));
+            return static_cast<int>(Length);
+        }
+
+        bool IsTransforming()
+        {
+            return UseEncryption.load(std::memory_order_acquire);
+        }
+    };
+}
@@ -1,7 +1,9 @@
 ﻿#pragma once
 
-#include "Util/SessionLogEntry.h"
+#include "Util/SessionLogger.h"
+#include "Util/ServerMetrics.h"
 #include "ISerializationServer.h"
+#include "BaseSystem/Cryptography.h"
 
 #include <cstdint>
 #include <utility>
@@ -9,6 +11,7 @@
 #include <string>
 #include <functional>
 #include <memory>
+#include <mutex>
 #include <chrono>
 
 namespace Server
@@ -23,6 +26,7 @@ namespace Server
     };
 
     class ISessionContext;
+    class BroadcastFrame;
     class IServerContext
     {
     public:
@@ -38,7 +42,11 @@ namespace Server
         virtual bool ServerDebug() = 0;
         virtual bool ClientDebug() = 0;
 
-        virtual void RaiseSessionLog(std::shared_ptr<SessionLogEntry> Entry) = 0;
+        virtual void RaiseSessionLog(SessionLogType Type, const SessionLogSource &Source, const std::u16string &Name, std::int64_t Value) = 0;
+        virtual void RaiseSessionLog(SessionLogType Type, const SessionLogSource &Source, SessionLogNameCache &NameCache, const std::u16string &Name, std::int64_t Value) = 0;
+        virtual void RaiseSessionLog(SessionLogType Type, const SessionLogSource &Source, const std::u16string &Name, const std::u16string &Message) = 0;
+
+        virtual ServerMetrics &Metrics() = 0;
 
         virtual void RegisterSession(std::shared_ptr<ISessionContext> SessionContext) = 0;
         virtual bool TryUnregisterSession(std::shared_ptr<ISessionContext> SessionContext) = 0;
@@ -47,11 +55,44 @@ namespace Server
         virtual std::pair<std::shared_ptr<IServerImplementation>, std::shared_ptr<IBinarySerializationServerAdapter>> CreateServerImplementationWithBinaryAdapter(std::shared_ptr<ISessionContext> SessionContext) = 0;
     };
 
+    enum class SecureCipher
+    {
+        RC4,
+        ChaCha20
+    };
+
     class SecureContext
     {
     public:
+        SecureCipher Cipher; //流数据加密算法
         std::vector<std::uint8_t> ServerToken; //服务器到客户端数据的Token
         std::vector<std::uint8_t> ClientToken; //客户端到服务器数据的Token
+        std::vector<std::uint8_t> ClientSalt; //ChaCha20使用，客户端为每个会话随机生成，握手时发给服务器
+        std::vector<std::uint8_t> ServerSalt; //ChaCha20使用，服务器为每个会话随机生成，握手时发给客户端
+
+        SecureContext()
+            : Cipher(SecureCipher::RC4)
+        {
+        }
+
+        /// <summary>以ServerToken为密钥前缀的HMAC中间状态，首次使用时创建，此后不能再修改ServerToken</summary>
+        const Algorithms::Cryptography::HMACSHA256SimpleState &ServerTokenHMAC()
+        {
+            std::call_once(ServerTokenHMACOnce, [&]() { ServerTokenHMACValue = std::make_unique<Algorithms::Cryptography::HMACSHA256SimpleState>(ServerToken); });
+            return *ServerTokenHMACValue;
+        }
+        /// <summary>以ClientToken为密钥前缀的HMAC中间状态，首次使用时创建，此后不能再修改ClientToken</summary>
+        const Algorithms::Cryptography::HMACSHA256SimpleState &ClientTokenHMAC()
+        {
+            std::call_once(ClientTokenHMACOnce, [&]() { ClientTokenHMACValue = std::make_unique<Algorithms::Cryptography::HMACSHA256SimpleState>(ClientToken); });
+            return *ClientTokenHMACValue;
+        }
+
+    private:
+        std::once_flag ServerTokenHMACOnce;
+        std::unique_ptr<Algorithms::Cryptography::HMACSHA256SimpleState> ServerTokenHMACValue;
+        std::once_flag ClientTokenHMACOnce;
+        std::unique_ptr<Algorithms::Cryptography::HMACSHA256SimpleState> ClientTokenHMACValue;
     };
 
     class IBinaryTransformer
@@ -59,8 +100,15 @@ namespace Server
     public:
         virtual ~IBinaryTransformer() {}
 
+        /// <summary>变换Buffer[Start, Start + Count)，变换后可能变长（如附加认证标签），此时须Start + Count等于Buffer的长度，Buffer随之加长</summary>
         virtual void Transform(std::vector<std::uint8_t> &Buffer, int Start, int Count) = 0;
-        virtual void Inverse(std::vector<std::uint8_t> &Buffer, int Start, int Count) = 0;
+        /// <summary>
+        /// 逆变换Buffer[Start, Start + Count)，结果写回Buffer[Start, Start + 返回值)，不超过Buffer的剩余空间
+        /// 带认证标签时只输出已验证的数据，不完整的记录和放不下的数据暂存，之后以Count为0调用时继续输出；验证失败时抛出异常
+        /// </summary>
+        virtual int Inverse(std::vector<std::uint8_t> &Buffer, int Start, int Count) = 0;
+        /// <summary>Transform当前是否会修改数据，为false时可跳过Transform直接发送共享的缓冲区；无法确定时应返回true</summary>
+        virtual bool IsTransforming() { return true; }
     };
 
     class ISessionContext
@@ -73,6 +121,7 @@ namespace Server
         std::function<void()> Quit; //跨线程事件(订阅者需要保证线程安全)
         std::function<void()> Authenticated; //跨线程事件(订阅者需要保证线程安全)
         std::function<void(std::shared_ptr<SecureContext>)> SecureConnectionRequired; //跨线程事件(订阅者需要保证线程安全)
+        std::function<void(std::shared_ptr<BroadcastFrame>)> BroadcastFrameReceived; //跨线程事件(订阅者需要保证线程安全)，为nullptr时广播改由EventPump逐个序列化发送
 
         virtual std::u16string RemoteEndPoint() = 0;
         virtual void RemoteEndPoint(std::u16string value) = 0;
@@ -16,8 +16,14 @@ namespace Server
         virtual ~IBinarySerializationServerAdapter() {}
 
         virtual std::uint64_t Hash() = 0;
-        virtual bool HasCommand(std::u16string CommandName, std::uint32_t CommandHash) = 0;
-        virtual void ExecuteCommand(std::u16string CommandName, std::uint32_t CommandHash, std::vector<std::uint8_t> Parameters, std::function<void(std::vector<std::uint8_t>)> OnSuccess, std::function<void(const std::exception &)> OnFailure) = 0;
+        virtual bool HasCommand(const std::u16string &CommandName, std::uint32_t CommandHash) = 0;
+        /// <summary>命令在Schema中标记为[Concurrent]，可能与同一会话的其他此类命令并发执行；回复及其执行线程上同步引发的事件按命令到达顺序发出，异步完成后在其他线程上引发的事件则在引发时立即发出</summary>
+        virtual bool IsConcurrentCommand(const std::u16string &CommandName) = 0;
+        /// <summary>Parameters的所有权转移给适配器，直到反序列化为止不再复制</summary>
+        virtual void ExecuteCommand(const std::u16string &CommandName, std::uint32_t CommandHash, std::vector<std::uint8_t> &&Parameters, std::function<void(std::vector<std::uint8_t>)> OnSuccess, std::function<void(const std::exception &)> OnFailure) = 0;
+        /// <summary>命令的紧凑编号，不存在时返回-1</summary>
+        virtual std::int32_t GetCommandId(const std::u16string &CommandName, std::uint32_t CommandHash) = 0;
+        virtual bool TryGetCommand(std::int32_t CommandId, std::u16string &CommandName, std::uint32_t &CommandHash) = 0;
         BinaryServerEventDelegate ServerEvent;
     };
 }
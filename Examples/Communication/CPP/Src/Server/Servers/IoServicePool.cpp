@@ -0,0 +1,79 @@
+﻿#include "IoServicePool.h"
+
+#include <stdexcept>
+#ifdef _WIN32
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace Server
+{
+    IoServicePool::IoServicePool(int NumShard, bool PinThreads)
+        : NextShard(0), PinThreads(PinThreads)
+    {
+        if (NumShard < 1) { throw std::logic_error("InvalidArgument"); }
+        for (int k = 0; k < NumShard; k += 1)
+        {
+            auto ios = std::make_shared<asio::io_service>(1);
+            IoServices.push_back(ios);
+            Works.push_back(std::make_shared<asio::io_service::work>(*ios));
+        }
+    }
+
+    void IoServicePool::Start()
+    {
+        if (Threads.size() > 0) { throw std::logic_error("InvalidOperationException"); }
+        auto ProcessorCount = static_cast<int>(std::thread::hardware_concurrency());
+        for (int k = 0; k < static_cast<int>(IoServices.size()); k += 1)
+        {
+            auto ios = IoServices[k];
+            auto Pin = PinThreads && (ProcessorCount > 0);
+            auto ProcessorIndex = ProcessorCount > 0 ? k % ProcessorCount : 0;
+            auto t = std::make_shared<std::thread>([=]()
+            {
+                if (Pin)
+                {
+                    PinCurrentThread(ProcessorIndex);
+                }
+                ios->run();
+            });
+            Threads.push_back(t);
+        }
+    }
+
+    void IoServicePool::Stop()
+    {
+        Works.clear();
+        for (auto ios : IoServices)
+        {
+            ios->stop();
+        }
+        for (auto t : Threads)
+        {
+            if (t->joinable())
+            {
+                t->join();
+            }
+        }
+        Threads.clear();
+    }
+
+    IoServicePool::~IoServicePool()
+    {
+        Stop();
+    }
+
+    void IoServicePool::PinCurrentThread(int ProcessorIndex)
+    {
+#ifdef _WIN32
+        SetThreadAffinityMask(GetCurrentThread(), static_cast<DWORD_PTR>(1) << ProcessorIndex);
+#elif defined(__linux__)
+        cpu_set_t s;
+        CPU_ZERO(&s);
+        CPU_SET(ProcessorIndex, &s);
+        pthread_setaffinity_np(pthread_self(), sizeof(s), &s);
+#endif
+    }
+}
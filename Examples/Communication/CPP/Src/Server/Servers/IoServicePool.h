@@ -0,0 +1,64 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <vector>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <asio.hpp>
+#ifdef _MSC_VER
+#undef SendMessage
+#endif
+
+namespace Server
+{
+    /// <summary>
+    /// 分片的io_service集合，每个分片只由一个线程运行，该线程可绑定到一个逻辑处理器。
+    /// 会话在创建时分配到一个分片，此后其所有回调均在该分片上执行，跨分片的操作需显式调用Post。
+    /// 本类的所有公共成员均是线程安全的。
+    /// </summary>
+    class IoServicePool
+    {
+    private:
+        std::vector<std::shared_ptr<asio::io_service>> IoServices;
+        std::vector<std::shared_ptr<asio::io_service::work>> Works;
+        std::vector<std::shared_ptr<std::thread>> Threads;
+        std::atomic<std::size_t> NextShard;
+        bool PinThreads;
+
+    public:
+        IoServicePool(int NumShard, bool PinThreads);
+
+        int NumShard() const
+        {
+            return static_cast<int>(IoServices.size());
+        }
+        asio::io_service &IoService(int ShardIndex)
+        {
+            return *IoServices[ShardIndex];
+        }
+        /// <summary>按轮转方式选择下一个分片</summary>
+        int NextShardIndex()
+        {
+            return static_cast<int>(NextShard.fetch_add(1, std::memory_order_relaxed) % IoServices.size());
+        }
+        void Post(int ShardIndex, std::function<void()> a)
+        {
+            IoServices[ShardIndex]->post(a);
+        }
+        std::function<void(std::function<void()>)> QueueUserWorkItem(int ShardIndex)
+        {
+            auto ios = IoServices[ShardIndex];
+            return [=](std::function<void()> a) { ios->post(a); };
+        }
+
+        void Start();
+        void Stop();
+
+        ~IoServicePool();
+
+    private:
+        static void PinCurrentThread(int ProcessorIndex);
+    };
+}
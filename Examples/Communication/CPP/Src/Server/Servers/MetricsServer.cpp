@@ -0,0 +1,112 @@
+﻿#include "MetricsServer.h"
+
+#include <array>
+#include <algorithm>
+
+namespace Server
+{
+    namespace
+    {
+        const std::size_t MaxRequestLength = 8192;
+        const int TimeoutSeconds = 10;
+        const std::chrono::milliseconds MinAcceptRetryDelay(10);
+        const std::chrono::milliseconds MaxAcceptRetryDelay(1000);
+    }
+
+    MetricsServer::MetricsServer(asio::io_service &IoService, std::function<std::string()> Scrape)
+        : IoService(IoService), Scrape(Scrape), Acceptor(nullptr), AcceptRetryTimer(IoService), AcceptRetryDelay(MinAcceptRetryDelay)
+    {
+    }
+
+    void MetricsServer::Start(asio::ip::tcp::endpoint Binding)
+    {
+        Acceptor = std::make_shared<asio::ip::tcp::acceptor>(IoService, Binding);
+        Accept();
+    }
+    void MetricsServer::Stop()
+    {
+        auto a = Acceptor;
+        if (a == nullptr) { return; }
+        auto ThisPtr = this->shared_from_this();
+        IoService.post([ThisPtr, a]()
+        {
+            asio::error_code ec;
+            a->close(ec);
+            ThisPtr->AcceptRetryTimer.cancel();
+        });
+    }
+
+    void MetricsServer::Accept()
+    {
+        auto ThisPtr = this->shared_from_this();
+        auto c = std::make_shared<Connection>(IoService);
+        Acceptor->async_accept(c->Socket, [ThisPtr, c](const asio::error_code &ec)
+        {
+            if (ec == asio::error::operation_aborted) { return; }
+            if (ec)
+            {
+                //立即重试在错误持续时（如EMFILE）会形成忙循环
+                auto Delay = ThisPtr->AcceptRetryDelay;
+                ThisPtr->AcceptRetryDelay = std::min(Delay * 2, MaxAcceptRetryDelay);
+                ThisPtr->AcceptRetryTimer.expires_after(Delay);
+                ThisPtr->AcceptRetryTimer.async_wait([ThisPtr](const asio::error_code &TimerError)
+                {
+                    if (TimerError == asio::error::operation_aborted) { return; }
+                    if (!ThisPtr->Acceptor->is_open()) { return; }
+                    ThisPtr->Accept();
+                });
+                return;
+            }
+            ThisPtr->AcceptRetryDelay = MinAcceptRetryDelay;
+            c->Timer.expires_after(std::chrono::seconds(TimeoutSeconds));
+            c->Timer.async_wait(c->Strand.wrap([c](const asio::error_code &TimerError)
+            {
+                if (TimerError == asio::error::operation_aborted) { return; }
+                asio::error_code ec;
+                c->Socket.close(ec);
+            }));
+            c->Strand.dispatch([ThisPtr, c]() { ThisPtr->ReadRequest(c); });
+            ThisPtr->Accept();
+        });
+    }
+
+    void MetricsServer::ReadRequest(std::shared_ptr<Connection> c)
+    {
+        auto ThisPtr = this->shared_from_this();
+        auto Buffer = std::make_shared<std::array<char, 1024>>();
+        c->Socket.async_read_some(asio::buffer(*Buffer), c->Strand.wrap([ThisPtr, c, Buffer](const asio::error_code &ec, std::size_t Count)
+        {
+            if (ec)
+            {
+                c->Timer.cancel();
+                return;
+            }
+            auto Request = &c->Request;
+            Request->append(Buffer->data(), Count);
+            //请求头以空行结束；不是HTTP请求时以第一个换行结束
+            auto IsHttp = Request->compare(0, 4, "GET ") == 0;
+            auto IsComplete = IsHttp ? (Request->find("\r\n\r\n") != std::string::npos) || (Request->find("\n\n") != std::string::npos) : (Request->find('\n') != std::string::npos);
+            if (IsComplete || (Request->size() >= MaxRequestLength))
+            {
+                ThisPtr->WriteResponse(c);
+            }
+            else
+            {
+                ThisPtr->ReadRequest(c);
+            }
+        }));
+    }
+
+    void MetricsServer::WriteResponse(std::shared_ptr<Connection> c)
+    {
+        auto Body = Scrape();
+        auto Response = std::make_shared<std::string>("HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " + std::to_string(Body.size()) + "\r\nConnection: close\r\n\r\n" + Body);
+        asio::async_write(c->Socket, asio::buffer(*Response), c->Strand.wrap([c, Response](const asio::error_code &, std::size_t)
+        {
+            c->Timer.cancel();
+            asio::error_code ec;
+            c->Socket.shutdown(asio::socket_base::shutdown_both, ec);
+            c->Socket.close(ec);
+        }));
+    }
+}
@@ -0,0 +1,55 @@
+﻿#pragma once
+
+#include <string>
+#include <functional>
+#include <memory>
+#include <asio.hpp>
+#include <asio/steady_timer.hpp>
+#ifdef _MSC_VER
+#undef SendMessage
+#endif
+
+namespace Server
+{
+    /// <summary>
+    /// 本地指标文本端点。每个连接读取一个HTTP请求头后返回一次Scrape的结果并关闭，可直接用curl或Prometheus抓取。
+    /// 连接在超时时间内未完成请求和回复时直接关闭。
+    /// 只应绑定到回环地址，不做身份验证。
+    /// 本类的所有公共成员均是线程安全的。
+    /// </summary>
+    class MetricsServer : public std::enable_shared_from_this<MetricsServer>
+    {
+    public:
+        MetricsServer(asio::io_service &IoService, std::function<std::string()> Scrape);
+
+        void Start(asio::ip::tcp::endpoint Binding);
+        void Stop();
+
+    private:
+        asio::io_service &IoService;
+        std::function<std::string()> Scrape;
+        std::shared_ptr<asio::ip::tcp::acceptor> Acceptor;
+        /// <summary>接受连接失败（如文件描述符耗尽）时延迟后重试，延迟逐次加倍，成功后恢复；只在接受连接的回调中访问</summary>
+        asio::steady_timer AcceptRetryTimer;
+        std::chrono::milliseconds AcceptRetryDelay;
+
+        /// <summary>连接上的操作和超时均在Strand中执行，避免关闭套接字与读写并发</summary>
+        class Connection
+        {
+        public:
+            asio::ip::tcp::socket Socket;
+            asio::io_service::strand Strand;
+            asio::steady_timer Timer;
+            std::string Request;
+
+            Connection(asio::io_service &IoService)
+                : Socket(IoService), Strand(IoService), Timer(IoService)
+            {
+            }
+        };
+
+        void Accept();
+        void ReadRequest(std::shared_ptr<Connection> c);
+        void WriteResponse(std::shared_ptr<Connection> c);
+    };
+}
@@ -7,6 +7,7 @@
 #include <cstdint>
 #include <memory>
 #include <vector>
+#include <span>
 
 namespace Server
 {
@@ -38,24 +39,22 @@ namespace Server
             if (!UseEncryption) { return; }
 
             auto s = ServerStream;
-            for (int k = 0; k < Count; k += 1)
-            {
-                auto Index = Start + k;
-                Buffer[Index] = Buffer[Index] ^ s->NextByte();
-            }
+            s->XorInPlace(std::span<std::uint8_t>(Buffer.data() + Start, static_cast<std::size_t>(Count)));
         }
 
-        void Inverse(std::vector<std::uint8_t> &Buffer, int Start, int Count)
+        int Inverse(std::vector<std::uint8_t> &Buffer, int Start, int Count)
         {
-            if (!WillUseEncryption) { return; }
+            if (!WillUseEncryption) { return Count; }
 
             auto s = ClientStream;
-            for (int k = 0; k < Count; k += 1)
-            {
-                auto Index = Start + k;
-                Buffer[Index] = Buffer[Index] ^ s->NextByte();
-            }
+            s->XorInPlace(std::span<std::uint8_t>(Buffer.data() + Start, static_cast<std::size_t>(Count)));
             if (!UseEncryption) { UseEncryption = true; }
+            return Count;
+        }
+
+        bool IsTransforming()
+        {
+            return UseEncryption;
         }
     };
 }
@@ -0,0 +1,70 @@
+﻿#pragma once
+
+#include "IContext.h"
+#include "Rc4PacketServerTransformer.h"
+#include "ChaCha20PacketServerTransformer.h"
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+namespace Server
+{
+    /// <summary>按SecureContext中的Cipher选择RC4或ChaCha20</summary>
+    class SecurePacketServerTransformer : public IBinaryTransformer
+    {
+    private:
+        //由处理握手的线程写入，读写线程读取
+        std::atomic<bool> UseChaCha20;
+        std::shared_ptr<Rc4PacketServerTransformer> Rc4;
+        std::shared_ptr<ChaCha20PacketServerTransformer> ChaCha20;
+
+    public:
+        SecurePacketServerTransformer()
+            : UseChaCha20(false), Rc4(std::make_shared<Rc4PacketServerTransformer>()), ChaCha20(std::make_shared<ChaCha20PacketServerTransformer>())
+        {
+        }
+
+        void SetSecureContext(std::shared_ptr<SecureContext> SecureContext)
+        {
+            if (SecureContext->Cipher == SecureCipher::ChaCha20)
+            {
+                ChaCha20->SetSecureContext(SecureContext);
+                UseChaCha20.store(true, std::memory_order_release);
+            }
+            else
+            {
+                Rc4->SetSecureContext(SecureContext);
+            }
+        }
+
+        void Transform(std::vector<std::uint8_t> &Buffer, int Start, int Count)
+        {
+            if (UseChaCha20.load(std::memory_order_acquire))
+            {
+                ChaCha20->Transform(Buffer, Start, Count);
+            }
+            else
+            {
+                Rc4->Transform(Buffer, Start, Count);
+            }
+        }
+
+        int Inverse(std::vector<std::uint8_t> &Buffer, int Start, int Count)
+        {
+            if (UseChaCha20.load(std::memory_order_acquire))
+            {
+                return ChaCha20->Inverse(Buffer, Start, Count);
+            }
+            else
+            {
+                return Rc4->Inverse(Buffer, Start, Count);
+            }
+        }
+
+        bool IsTransforming()
+        {
+            return UseChaCha20.load(std::memory_order_acquire) ? ChaCha20->IsTransforming() : Rc4->IsTransforming();
+        }
+    };
+}
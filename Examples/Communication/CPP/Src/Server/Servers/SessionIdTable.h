@@ -0,0 +1,90 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <shared_mutex>
+#include <memory>
+
+namespace Server
+{
+    /// <summary>
+    /// 本类的所有公共成员均是线程安全的。
+    /// SessionId到会话的映射，按SessionId的低位分为2的幂个分片。
+    /// 每个分片有独立的读写锁，查找只加分片的共享锁，修改在分片内加独占锁并就地修改映射表，不复制。
+    /// 不同分片的查找和修改互不影响，同一分片的多个查找可并行。
+    /// </summary>
+    template<typename TSession>
+    class SessionIdTable
+    {
+    private:
+        typedef std::unordered_map<int, std::shared_ptr<TSession>> Map;
+
+        class Shard
+        {
+        public:
+            std::shared_mutex Lockee;
+            Map Sessions;
+        };
+
+        std::vector<std::unique_ptr<Shard>> Shards;
+        std::uint32_t Mask;
+
+        Shard &GetShard(int SessionId)
+        {
+            return *Shards[static_cast<std::uint32_t>(SessionId) & Mask];
+        }
+
+    public:
+        SessionIdTable(int NumShardBits = 6)
+        {
+            auto NumShard = static_cast<std::uint32_t>(1) << NumShardBits;
+            for (std::uint32_t k = 0; k < NumShard; k += 1)
+            {
+                Shards.push_back(std::make_unique<Shard>());
+            }
+            Mask = NumShard - 1;
+        }
+
+        std::shared_ptr<TSession> Find(int SessionId)
+        {
+            auto &sh = GetShard(SessionId);
+            std::shared_lock<std::shared_mutex> Lock(sh.Lockee);
+            auto i = sh.Sessions.find(SessionId);
+            if (i == sh.Sessions.end()) { return nullptr; }
+            return i->second;
+        }
+
+        /// <summary>若SessionId已存在，则不修改并返回false</summary>
+        bool TryAdd(int SessionId, std::shared_ptr<TSession> s)
+        {
+            auto &sh = GetShard(SessionId);
+            std::unique_lock<std::shared_mutex> Lock(sh.Lockee);
+            return sh.Sessions.emplace(SessionId, s).second;
+        }
+
+        /// <summary>仅当SessionId对应的会话为s时移除</summary>
+        void Remove(int SessionId, std::shared_ptr<TSession> s)
+        {
+            auto &sh = GetShard(SessionId);
+            std::unique_lock<std::shared_mutex> Lock(sh.Lockee);
+            auto i = sh.Sessions.find(SessionId);
+            if ((i == sh.Sessions.end()) || (i->second != s)) { return; }
+            sh.Sessions.erase(i);
+        }
+
+        void Clear()
+        {
+            for (auto &sh : Shards)
+            {
+                //在锁外析构会话，避免会话析构时的操作在分片锁中进行
+                Map Sessions;
+                {
+                    std::unique_lock<std::shared_mutex> Lock(sh->Lockee);
+                    Sessions.swap(sh->Sessions);
+                }
+            }
+        }
+    };
+}
@@ -1,379 +1,536 @@
 ﻿#pragma once
 
-#include "BaseSystem/LockedVariable.h"
 #include "BaseSystem/ExceptionStackTrace.h"
 
-#include <queue>
-#include <list>
+#include <cstdint>
+#include <vector>
+#include <string>
 #include <functional>
 #include <memory>
+#include <atomic>
+#include <thread>
+#include <utility>
+#include <algorithm>
+#include <type_traits>
 #include <exception>
+#include <stdexcept>
 #include <typeinfo>
 
 namespace Server
 {
     /// <summary>
+    /// 会话状态机，TSession提供以下钩子，在编译时绑定：
+    /// static bool IsKnownException(const std::exception &)
+    /// void OnCriticalError(const std::exception &)
+    /// void OnShutdownRead()、void OnShutdownWrite()、void OnExit()
+    /// void OnWrite()，完成时调用NotifyWriteSuccess或NotifyFailure
+    /// static bool IsConcurrent(const TRead &)，为true的读取可与其他此类读取并发执行
+    /// void OnExecute(TRead, bool IsConcurrent)，完成时调用NotifyExecuteSuccess(IsConcurrent)或NotifyExecuteFailure(IsConcurrent)
+    /// void OnStartRawRead()，完成时调用NotifyStartRawReadSuccess或NotifyStartRawReadFailure
+    /// 状态保存在一个原子字中，以CAS转换；操作队列为侵入式的多生产者单消费者队列，状态转换不分配内存。
+    /// 写入中收到的多次NotifyWrite合并为一次OnWrite，OnWrite应取出当时全部待写入的数据。
+    /// MaxConcurrentExecutes大于0时，连续的可并发读取不进入执行中状态，而是通过QueueUserWorkItem并发执行，至多MaxConcurrentExecutes个；不可并发的读取等待它们全部完成后才执行；回复顺序由TSession保证。
     /// 本类的公共成员均是线程安全的。
     /// </summary>
-    template<typename TRead, typename TWrite>
-    class SessionStateMachine : public std::enable_shared_from_this<SessionStateMachine<TRead, TWrite>>
+    template <typename TSession, typename TRead>
+    class SessionStateMachine : public std::enable_shared_from_this<SessionStateMachine<TSession, TRead>>
     {
     private:
-        class Context
+        //状态字
+        //第0-2位 状态 0 初始 1 空闲 2 写入中 3 执行中 4 结束
+        //第3-9位为下列标志，第10-17位为并发执行中的读取数
+        static constexpr std::uint32_t StateMask = 7;
+        static constexpr std::uint32_t IsReadEnabled = 1 << 3;
+        static constexpr std::uint32_t IsWriteEnabled = 1 << 4;
+        static constexpr std::uint32_t IsInRawRead = 1 << 5;
+        static constexpr std::uint32_t IsReadShutDown = 1 << 6;
+        static constexpr std::uint32_t IsWriteShutDown = 1 << 7;
+        static constexpr std::uint32_t HasWrite = 1 << 8;
+        static constexpr std::uint32_t HasRead = 1 << 9;
+        static constexpr std::uint32_t ConcurrentShift = 10;
+        static constexpr std::uint32_t ConcurrentOne = 1 << ConcurrentShift;
+        static constexpr std::uint32_t ConcurrentMask = 0xFF << ConcurrentShift;
+        static constexpr int MaxConcurrentLimit = 0xFF;
+
+        static std::uint32_t WithState(std::uint32_t w, std::uint32_t State)
+        {
+            return (w & ~StateMask) | State;
+        }
+
+        class ActionNode
         {
         public:
-            //0 初始
-            //1 空闲
-            //2 写入中
-            //3 执行中
-            //4 结束
-            int State;
+            std::atomic<ActionNode *> Next;
 
-            bool IsReadEnabled;
-            bool IsWriteEnabled;
-            std::queue<TRead> Reads;
-            std::queue<TWrite> Writes;
-            bool IsInRawRead;
-            bool IsReadShutDown;
-            bool IsWriteShutDown;
+            ActionNode() : Next(nullptr) {}
+            virtual void Run() {}
+            //执行后调用，堆上分配的节点在此释放
+            virtual void Release() {}
+            virtual ~ActionNode() {}
+        };
+        class CheckNode : public ActionNode
+        {
+        public:
+            SessionStateMachine *Owner;
 
-            Context()
-                : State(0), IsReadEnabled(false), IsWriteEnabled(false), IsInRawRead(false), IsReadShutDown(false), IsWriteShutDown(false)
+            CheckNode(SessionStateMachine *Owner) : Owner(Owner) {}
+            void Run() override
             {
+                Owner->IsCheckQueued.store(false, std::memory_order_release);
+                Owner->Check();
             }
         };
-
-        class SessionActionQueue
+        template <typename TAction>
+        class FunctionNode : public ActionNode
         {
         public:
-            bool IsRunning;
-            std::list<std::function<void()>> Queue;
+            TAction Action;
 
-            SessionActionQueue()
-                : IsRunning(false)
+            template <typename T>
+            FunctionNode(T &&Action) : Action(std::forward<T>(Action)) {}
+            void Run() override
             {
+                Action();
+            }
+            void Release() override
+            {
+                delete this;
             }
         };
 
-        BaseSystem::LockedVariable<std::shared_ptr<Context>> c;
-        BaseSystem::LockedVariable<std::shared_ptr<SessionActionQueue>> ActionQueue;
-        std::function<bool(const std::exception &)> IsKnownException;
-        std::function<void(const std::exception &)> OnCriticalError;
-        std::function<void()> OnShutdownRead;
-        std::function<void()> OnShutdownWrite;
-        std::function<void(TWrite, std::function<void()>, std::function<void()>)> OnWrite;
-        std::function<void(TRead, std::function<void()>, std::function<void()>)> OnExecute;
-        std::function<void(std::function<void(std::shared_ptr<std::vector<TRead>>)>, std::function<void()>)> OnStartRawRead;
-        std::function<void()> OnExit;
+        TSession &Session;
         std::function<void(std::function<void()>)> QueueUserWorkItem;
+        std::uint32_t MaxConcurrentExecutes;
+        std::atomic<std::uint32_t> Word;
+
+        //只在NotifyStartRawReadSuccess（IsInRawRead时）和Check（HasRead时）中访问，两者不会同时发生
+        std::vector<TRead> Reads;
+        std::size_t ReadIndex;
+
+        //操作队列，Head由生产者交换，Tail只由消费者访问；NumPending为已入队未执行的操作数，由0变为1时调度消费者，同一时间只有一个消费者
+        std::atomic<ActionNode *> Head;
+        ActionNode *Tail;
+        ActionNode Stub;
+        std::atomic<std::size_t> NumPending;
+        CheckNode CheckNodeValue;
+        std::atomic<bool> IsCheckQueued;
 
     public:
-        SessionStateMachine(std::function<bool(const std::exception &)> IsKnownException, std::function<void(const std::exception &)> OnCriticalError, std::function<void()> OnShutdownRead, std::function<void()> OnShutdownWrite, std::function<void(TWrite, std::function<void()>, std::function<void()>)> OnWrite, std::function<void(TRead, std::function<void()>, std::function<void()>)> OnExecute, std::function<void(std::function<void(std::shared_ptr<std::vector<TRead>>)>, std::function<void()>)> OnStartRawRead, std::function<void()> OnExit, std::function<void(std::function<void()>)> QueueUserWorkItem)
-            : c(nullptr), ActionQueue(std::make_shared<SessionActionQueue>()), IsKnownException(IsKnownException), OnCriticalError(OnCriticalError), OnShutdownRead(OnShutdownRead), OnShutdownWrite(OnShutdownWrite), OnWrite(OnWrite), OnExecute(OnExecute), OnStartRawRead(OnStartRawRead), OnExit(OnExit), QueueUserWorkItem(QueueUserWorkItem)
+        SessionStateMachine(TSession &Session, std::function<void(std::function<void()>)> QueueUserWorkItem, int MaxConcurrentExecutes = 0)
+            : Session(Session), QueueUserWorkItem(QueueUserWorkItem), MaxConcurrentExecutes(static_cast<std::uint32_t>(std::min(std::max(MaxConcurrentExecutes, 0), MaxConcurrentLimit))), Word(IsReadEnabled | IsWriteEnabled), ReadIndex(0), Head(&Stub), Tail(&Stub), NumPending(0), CheckNodeValue(this), IsCheckQueued(false)
         {
-            c.Update([](std::shared_ptr<Context> cc)
+        }
+
+        ~SessionStateMachine()
+        {
+            while (true)
             {
-                auto c = std::make_shared<Context>();
-                c->State = 0;
-                c->IsReadEnabled = true;
-                c->IsWriteEnabled = true;
-                c->IsInRawRead = false;
-                c->IsReadShutDown = false;
-                c->IsWriteShutDown = false;
-                return c;
-            });
+                auto a = TryDequeue();
+                if (a == nullptr) { break; }
+                a->Release();
+            }
         }
 
         void Start()
         {
-            AddToActionQueue([this]() { Check(); });
+            RequestCheck();
         }
 
     private:
+        void RequestCheck()
+        {
+            if (!IsCheckQueued.exchange(true, std::memory_order_acq_rel))
+            {
+                Enqueue(&CheckNodeValue);
+            }
+        }
+
+        enum class Step
+        {
+            None,
+            Check,
+            Write,
+            Execute,
+            ExecuteConcurrent,
+            StartRawRead,
+            ShutdownRead,
+            ShutdownWrite,
+            Exit
+        };
+
         void Check()
         {
-            std::function<void()> AfterAction = nullptr;
-            c.DoAction([&](std::shared_ptr<Context> cc)
+            auto w = Word.load(std::memory_order_acquire);
+            while (true)
             {
-                if (cc->State == 0)
+                auto n = w;
+                auto s = Step::None;
+                auto State = w & StateMask;
+                auto IsLastRead = false;
+                if (State == 0)
                 {
-                    cc->State = 1;
-                    AfterAction = [=]() { AddToActionQueue([this]() { Check(); }); };
-                    return;
+                    n = WithState(n, 1);
+                    s = Step::Check;
                 }
-                if (cc->State == 1)
+                else if (State == 1)
                 {
-                    if (cc->IsWriteEnabled)
+                    if ((w & IsWriteEnabled) && (w & HasWrite))
                     {
-                        if (cc->Writes.size() > 0)
-                        {
-                            cc->State = 2;
-                            auto w = cc->Writes.front();
-                            cc->Writes.pop();
-                            AfterAction = [=]() { AddToActionQueue([this, w]() { Write(w); }); };
-                            return;
-                        }
+                        n = WithState(n, 2) & ~HasWrite;
+                        s = Step::Write;
                     }
-                    if (cc->IsReadEnabled)
+                    else if (w & IsReadEnabled)
                     {
-                        if (cc->Reads.size() > 0)
+                        if (w & HasRead)
                         {
-                            cc->State = 3;
-                            auto r = cc->Reads.front();
-                            cc->Reads.pop();
-                            AfterAction = [=]() { AddToActionQueue([this, r]() { Execute(r); }); };
-                            return;
+                            //可并发的读取在未达上限时直接派发，不可并发的读取等待并发执行中的读取全部完成
+                            auto NumConcurrent = (w & ConcurrentMask) >> ConcurrentShift;
+                            auto IsConcurrent = (MaxConcurrentExecutes > 0) && TSession::IsConcurrent(Reads[ReadIndex]);
+                            IsLastRead = ReadIndex + 1 >= Reads.size();
+                            if (IsConcurrent)
+                            {
+                                if (NumConcurrent < MaxConcurrentExecutes)
+                                {
+                                    n += ConcurrentOne;
+                                    s = Step::ExecuteConcurrent;
+                                }
+                            }
+                            else if (NumConcurrent == 0)
+                            {
+                                n = WithState(n, 3);
+                                s = Step::Execute;
+                            }
+                            if ((s != Step::None) && IsLastRead)
+                            {
+                                n &= ~HasRead;
+                            }
                         }
-                        if (!cc->IsInRawRead)
+                        else if (!(w & IsInRawRead))
                         {
-                            cc->IsInRawRead = true;
-                            AfterAction = [=]() { OnStartRawRead([this](std::shared_ptr<std::vector<TRead>> Reads) { NotifyStartRawReadSuccess(Reads); }, [this]() { NotifyStartRawReadFailure(); }); };
-                            return;
+                            n |= IsInRawRead;
+                            s = Step::StartRawRead;
                         }
                     }
                     else
                     {
-                        if (!cc->IsReadShutDown)
+                        if (!(w & IsReadShutDown))
                         {
-                            cc->IsReadShutDown = true;
-                            AfterAction = [=]()
-                            {
-                                OnShutdownRead();
-                                AddToActionQueue([this]() { Check(); });
-                            };
-                            return;
+                            n |= IsReadShutDown;
+                            s = Step::ShutdownRead;
                         }
-                        if (cc->IsWriteEnabled)
+                        else if (w & IsWriteEnabled)
                         {
-                            if (!cc->IsWriteShutDown)
+                            if (!(w & IsWriteShutDown))
                             {
-                                cc->IsWriteEnabled = false;
-                                cc->IsWriteShutDown = true;
-                                AfterAction = [=]()
-                                {
-                                    OnShutdownWrite();
-                                    AddToActionQueue([this]() { Check(); });
-                                };
-                                return;
+                                n = (n & ~IsWriteEnabled) | IsWriteShutDown;
+                                s = Step::ShutdownWrite;
                             }
                         }
+                        else if ((w & IsReadShutDown) && (w & IsWriteShutDown) && !(w & IsInRawRead) && !(w & ConcurrentMask))
+                        {
+                            n = WithState(n, 4);
+                            s = Step::Exit;
+                        }
+                    }
+                }
+                if (s == Step::None) { return; }
+                if (!Word.compare_exchange_weak(w, n, std::memory_order_acq_rel, std::memory_order_acquire)) { continue; }
+
+                switch (s)
+                {
+                case Step::Check:
+                    RequestCheck();
+                    break;
+                case Step::Write:
+                    Session.OnWrite();
+                    break;
+                case Step::Execute:
+                case Step::ExecuteConcurrent:
+                    {
+                        //HasRead已清除时不会再有新的读取，此前Reads只由本线程访问
+                        auto r = std::move(Reads[ReadIndex]);
+                        ReadIndex += 1;
+                        if (IsLastRead)
+                        {
+                            Reads.clear();
+                            ReadIndex = 0;
+                        }
+                        if (s == Step::Execute)
+                        {
+                            Session.OnExecute(std::move(r), false);
+                        }
                         else
                         {
-                            if (cc->IsReadShutDown && cc->IsWriteShutDown && !cc->IsInRawRead)
-                            {
-                                cc->State = 4;
-                                AfterAction = OnExit;
-                                return;
-                            }
+                            auto ThisPtr = this->shared_from_this();
+                            QueueUserWorkItem([ThisPtr, r]() { ThisPtr->ExecuteConcurrent(r); });
+                            RequestCheck();
                         }
                     }
+                    break;
+                case Step::StartRawRead:
+                    Session.OnStartRawRead();
+                    break;
+                case Step::ShutdownRead:
+                    Session.OnShutdownRead();
+                    RequestCheck();
+                    break;
+                case Step::ShutdownWrite:
+                    Session.OnShutdownWrite();
+                    RequestCheck();
+                    break;
+                case Step::Exit:
+                    Session.OnExit();
+                    break;
+                default:
+                    break;
                 }
-            });
+                return;
+            }
+        }
 
-            if (AfterAction != nullptr)
+        /// <summary>若当前状态为From则转为空闲</summary>
+        void NotifyStepSuccess(std::uint32_t From)
+        {
+            auto w = Word.load(std::memory_order_acquire);
+            while ((w & StateMask) == From)
             {
-                AfterAction();
+                if (Word.compare_exchange_weak(w, WithState(w, 1), std::memory_order_acq_rel, std::memory_order_acquire)) { break; }
             }
+            RequestCheck();
         }
 
-        void Write(TWrite w)
+        /// <summary>关闭读写，返回原状态字</summary>
+        std::uint32_t ShutDown(std::uint32_t Clear)
         {
-            auto OnSuccess = [=]()
+            auto w = Word.load(std::memory_order_acquire);
+            while (true)
             {
-                c.DoAction([](std::shared_ptr<Context> cc)
+                auto n = w;
+                if ((n & StateMask) != 4)
                 {
-                    if (cc->State == 2)
-                    {
-                        cc->State = 1;
-                    }
-                });
-                AddToActionQueue([this]() { Check(); });
-            };
-            auto OnFailure = [this]() { NotifyFailure(); };
-            OnWrite(w, OnSuccess, OnFailure);
+                    n = WithState(n, 1);
+                }
+                n &= ~(IsReadEnabled | IsWriteEnabled | Clear);
+                n |= IsReadShutDown | IsWriteShutDown;
+                if (Word.compare_exchange_weak(w, n, std::memory_order_acq_rel, std::memory_order_acquire)) { return w; }
+            }
         }
-        void Execute(TRead r)
+
+    public:
+        void NotifyWrite()
         {
-            auto OnSuccess = [=]()
+            auto w = Word.load(std::memory_order_acquire);
+            while ((w & IsWriteEnabled) && !(w & HasWrite))
             {
-                c.DoAction([](std::shared_ptr<Context> cc)
-                {
-                    if (cc->State == 3)
-                    {
-                        cc->State = 1;
-                    }
-                });
-                AddToActionQueue([this]() { Check(); });
-            };
-            auto OnFailure = [this]() { NotifyFailure(); };
-            OnExecute(r, OnSuccess, OnFailure);
+                if (Word.compare_exchange_weak(w, w | HasWrite, std::memory_order_acq_rel, std::memory_order_acquire)) { break; }
+            }
+            RequestCheck();
         }
-    public:
-        void NotifyWrite(TWrite w)
+        void NotifyWriteSuccess()
+        {
+            NotifyStepSuccess(2);
+        }
+        void NotifyExecuteSuccess(bool IsConcurrent)
         {
-            c.DoAction([=](std::shared_ptr<Context> cc)
+            if (IsConcurrent)
             {
-                if (cc->IsWriteEnabled)
-                {
-                    cc->Writes.push(w);
-                }
-            });
-            AddToActionQueue([this]() { Check(); });
+                Word.fetch_sub(ConcurrentOne, std::memory_order_acq_rel);
+                RequestCheck();
+                return;
+            }
+            NotifyStepSuccess(3);
         }
-    private:
-        void NotifyStartRawReadSuccess(std::shared_ptr<std::vector<TRead>> Reads)
+        void NotifyExecuteFailure(bool IsConcurrent)
         {
-            c.DoAction([=](std::shared_ptr<Context> cc)
+            if (IsConcurrent)
             {
-                if (cc->IsReadEnabled)
-                {
-                    for (auto r : *Reads)
-                    {
-                        cc->Reads.push(r);
-                    }
-                }
-                cc->IsInRawRead = false;
-            });
-            AddToActionQueue([this]() { Check(); });
+                Word.fetch_sub(ConcurrentOne, std::memory_order_acq_rel);
+            }
+            NotifyFailure();
         }
 
-    public:
-        void NotifyFailure()
+        /// <summary>NewReads与内部的空列表交换，调用方可重复使用该列表</summary>
+        void NotifyStartRawReadSuccess(std::vector<TRead> &NewReads)
         {
-            auto IsReadShutDown = false;
-            auto IsWriteShutDown = false;
-            c.DoAction([&](std::shared_ptr<Context> cc)
+            Reads.swap(NewReads);
+            NewReads.clear();
+            ReadIndex = 0;
+            auto IsEmpty = Reads.empty();
+            auto w = Word.load(std::memory_order_acquire);
+            while (true)
             {
-                if (cc->State != 4)
+                auto n = w & ~IsInRawRead;
+                if ((w & IsReadEnabled) && !IsEmpty)
                 {
-                    cc->State = 1;
+                    n |= HasRead;
                 }
-                cc->IsReadEnabled = false;
-                cc->IsWriteEnabled = false;
-                IsReadShutDown = cc->IsReadShutDown;
-                cc->IsReadShutDown = true;
-                IsWriteShutDown = cc->IsWriteShutDown;
-                cc->IsWriteShutDown = true;
-            });
-            if (!IsReadShutDown)
+                if (Word.compare_exchange_weak(w, n, std::memory_order_acq_rel, std::memory_order_acquire)) { break; }
+            }
+            if (!(w & IsReadEnabled))
+            {
+                //读取已关闭时丢弃，此后不会再开始读取
+                Reads.clear();
+            }
+            RequestCheck();
+        }
+
+        void NotifyFailure()
+        {
+            auto w = ShutDown(0);
+            if (!(w & IsReadShutDown))
             {
-                OnShutdownRead();
+                Session.OnShutdownRead();
             }
-            if (!IsWriteShutDown)
+            if (!(w & IsWriteShutDown))
             {
-                OnShutdownWrite();
+                Session.OnShutdownWrite();
             }
-            AddToActionQueue([this]() { Check(); });
+            RequestCheck();
         }
-    private:
         void NotifyStartRawReadFailure()
         {
-            auto IsReadShutDown = false;
-            auto IsWriteShutDown = false;
-            c.DoAction([&](std::shared_ptr<Context> cc)
-            {
-                if (cc->State != 4)
-                {
-                    cc->State = 1;
-                }
-                cc->IsReadEnabled = false;
-                cc->IsWriteEnabled = false;
-                IsReadShutDown = cc->IsReadShutDown;
-                cc->IsReadShutDown = true;
-                IsWriteShutDown = cc->IsWriteShutDown;
-                cc->IsWriteShutDown = true;
-                cc->IsInRawRead = false;
-            });
-            if (!IsReadShutDown)
+            auto w = ShutDown(IsInRawRead);
+            if (!(w & IsReadShutDown))
             {
-                OnShutdownRead();
+                Session.OnShutdownRead();
             }
-            if (!IsWriteShutDown)
+            if (!(w & IsWriteShutDown))
             {
-                OnShutdownWrite();
+                Session.OnShutdownWrite();
             }
-            AddToActionQueue([this]() { Check(); });
+            RequestCheck();
         }
 
-    public:
         void NotifyExit()
         {
-            c.DoAction([&](std::shared_ptr<Context> cc)
+            auto w = Word.load(std::memory_order_acquire);
+            while (true)
             {
-                if (cc->State != 4)
+                auto n = w & ~IsReadEnabled;
+                if ((n & StateMask) != 4)
                 {
-                    cc->State = 1;
+                    n = WithState(n, 1);
                 }
-                cc->IsReadEnabled = false;
-            });
-            AddToActionQueue([this]() { Check(); });
+                if (Word.compare_exchange_weak(w, n, std::memory_order_acq_rel, std::memory_order_acquire)) { break; }
+            }
+            RequestCheck();
         }
 
         bool IsExited()
         {
-            auto CheckStateFinished = [](std::shared_ptr<Context> cc) { return cc->State == 4; };
-            auto CheckQueueFinished = [](std::shared_ptr<SessionActionQueue> q) { return !q->IsRunning; };
-            auto IsStateFinished = c.template Check<bool>(CheckStateFinished);
-            auto IsQueueFinished = ActionQueue.template Check<bool>(CheckQueueFinished);
+            auto IsStateFinished = (Word.load(std::memory_order_acquire) & StateMask) == 4;
+            auto IsQueueFinished = NumPending.load(std::memory_order_acquire) == 0;
             return IsStateFinished && IsQueueFinished;
         }
 
-        void AddToActionQueue(std::function<void()> Action)
+        /// <summary>操作与队列节点一次分配</summary>
+        template <typename TAction>
+        void AddToActionQueue(TAction &&Action)
         {
-            ActionQueue.DoAction([=](std::shared_ptr<SessionActionQueue> q)
+            Enqueue(new FunctionNode<typename std::decay<TAction>::type>(std::forward<TAction>(Action)));
+        }
+
+    private:
+        /// <summary>在QueueUserWorkItem的线程上执行，不经过操作队列</summary>
+        void ExecuteConcurrent(TRead r)
+        {
+            if (ExceptionStackTrace::IsDebuggerAttached())
+            {
+                Session.OnExecute(std::move(r), true);
+                return;
+            }
+            try
+            {
+                ExceptionStackTrace::Execute([&]() { Session.OnExecute(std::move(r), true); });
+            }
+            catch (const std::exception &ex)
             {
-                q->Queue.push_back(Action);
-                if (!q->IsRunning)
+                if (!TSession::IsKnownException(ex))
                 {
-                    q->IsRunning = true;
-                    auto ThisPtr = this->shared_from_this();
-                    QueueUserWorkItem([ThisPtr]() { ThisPtr->ExecuteActionQueue(); });
+                    auto Message = std::string() + typeid(*(&ex)).name() + "\r\n" + ex.what() + "\r\n" + ExceptionStackTrace::GetStackTrace();
+                    Session.OnCriticalError(std::runtime_error(Message));
                 }
-            });
+                NotifyExecuteFailure(true);
+            }
         }
-    private:
+
+        void Enqueue(ActionNode *a)
+        {
+            a->Next.store(nullptr, std::memory_order_relaxed);
+            auto Previous = Head.exchange(a, std::memory_order_acq_rel);
+            Previous->Next.store(a, std::memory_order_release);
+            if (NumPending.fetch_add(1, std::memory_order_acq_rel) == 0)
+            {
+                auto ThisPtr = this->shared_from_this();
+                QueueUserWorkItem([ThisPtr]() { ThisPtr->ExecuteActionQueue(); });
+            }
+        }
+
+        /// <summary>只由消费者调用，生产者正在链接节点时也返回nullptr</summary>
+        ActionNode *TryDequeue()
+        {
+            auto t = Tail;
+            auto n = t->Next.load(std::memory_order_acquire);
+            if (t == &Stub)
+            {
+                if (n == nullptr) { return nullptr; }
+                Tail = n;
+                t = n;
+                n = n->Next.load(std::memory_order_acquire);
+            }
+            if (n != nullptr)
+            {
+                Tail = n;
+                return t;
+            }
+            if (t != Head.load(std::memory_order_acquire)) { return nullptr; }
+            Stub.Next.store(nullptr, std::memory_order_relaxed);
+            auto Previous = Head.exchange(&Stub, std::memory_order_acq_rel);
+            Previous->Next.store(&Stub, std::memory_order_release);
+            n = t->Next.load(std::memory_order_acquire);
+            if (n != nullptr)
+            {
+                Tail = n;
+                return t;
+            }
+            return nullptr;
+        }
+
         void ExecuteActionQueue()
         {
             int Count = 64;
             while (true)
             {
-                std::function<void()> a = nullptr;
-                ActionQueue.DoAction([&](std::shared_ptr<SessionActionQueue> q)
-                {
-                    if (q->Queue.size() > 0)
-                    {
-                        a = q->Queue.front();
-                        q->Queue.pop_front();
-                    }
-                    else
-                    {
-                        q->IsRunning = false;
-                    }
-                });
-                if (a == nullptr)
+                //NumPending不为0时队列中必有节点，可能尚未链接完成
+                ActionNode *a = nullptr;
+                while (true)
                 {
-                    return;
+                    a = TryDequeue();
+                    if (a != nullptr) { break; }
+                    std::this_thread::yield();
                 }
                 if (ExceptionStackTrace::IsDebuggerAttached())
                 {
-                    a();
+                    a->Run();
                 }
                 else
                 {
                     try
                     {
-                        ExceptionStackTrace::Execute(a);
+                        ExceptionStackTrace::Execute([=]() { a->Run(); });
                     }
                     catch (const std::exception &ex)
                     {
-                        if (!IsKnownException(ex))
+                        if (!TSession::IsKnownException(ex))
                         {
                             auto Message = std::string() + typeid(*(&ex)).name() + "\r\n" + ex.what() + "\r\n" + ExceptionStackTrace::GetStackTrace();
-                            OnCriticalError(std::runtime_error(Message));
+                            Session.OnCriticalError(std::runtime_error(Message));
                         }
                         NotifyFailure();
                     }
                 }
+                a->Release();
+                if (NumPending.fetch_sub(1, std::memory_order_acq_rel) == 1) { return; }
                 Count -= 1;
                 if (Count == 0) { break; }
             }
@@ -7,6 +7,7 @@
 #include <memory>
 #include <exception>
 #include <stdexcept>
+#include <chrono>
 
 #ifndef _UNIT_TYPE_
 typedef struct {} Unit;
@@ -20,7 +21,19 @@ namespace Server
     {
     public:
         std::u16string CommandName;
-        std::function<void(std::function<void()>, std::function<void(const std::exception &)>)> ExecuteCommand;
+        /// <summary>参数依次为OnReady、OnSuccess、OnFailure；OnReady在回复编码完成、放入写入缓冲区之前调用，参数为就绪时间</summary>
+        std::function<void(std::function<void(std::chrono::steady_clock::time_point)>, std::function<void()>, std::function<void(const std::exception &)>)> ExecuteCommand;
+        /// <summary>可与同一会话中其他可并发命令并发执行，回复仍按命令到达顺序写入</summary>
+        Boolean IsConcurrent;
+        /// <summary>命令帧的字节数</summary>
+        std::size_t InputByteLength;
+        /// <summary>命令解析完成的时间，用于统计排队时间</summary>
+        std::chrono::steady_clock::time_point ReceiveTime;
+
+        StreamedVirtualTransportServerHandleResultCommand()
+            : IsConcurrent(false), InputByteLength(0)
+        {
+        }
     };
 
     class StreamedVirtualTransportServerHandleResultBadCommand
@@ -107,7 +120,8 @@ namespace Server
         virtual std::shared_ptr<std::vector<std::uint8_t>> GetReadBuffer() = 0;
         virtual int GetReadBufferOffset() = 0;
         virtual int GetReadBufferLength() = 0;
-        virtual std::vector<std::shared_ptr<std::vector<std::uint8_t>>> TakeWriteBuffer() = 0;
+        /// <summary>取出待写入的缓冲区，WriteBuffer会被清空后与内部列表交换，调用方可重复使用同一列表以避免分配</summary>
+        virtual void TakeWriteBuffer(std::vector<std::shared_ptr<std::vector<std::uint8_t>>> &WriteBuffer) = 0;
         virtual std::shared_ptr<StreamedVirtualTransportServerHandleResult> Handle(int Count) = 0;
         virtual std::uint64_t Hash() = 0;
         std::function<void()> ServerEvent;
@@ -14,7 +14,7 @@ namespace Server
         :
         IsRunningValue(false),
         IoService(IoService),
-        SessionSets(std::make_shared<ServerSessionSets>()),
+        MergedConnectionCounts(std::make_shared<const MergedConnectionCounter>()),
         VirtualTransportServerFactory(VirtualTransportServerFactory),
         QueueUserWorkItem(QueueUserWorkItem),
         PurifierQueueUserWorkItem(PurifierQueueUserWorkItem),
@@ -25,10 +25,20 @@ namespace Server
         MaxConnectionsPerIPValue(Optional<int>::CreateNotHasValue()),
         MaxUnauthenticatedPerIPValue(Optional<int>::CreateNotHasValue()),
         TimeoutCheckPeriodValue(30),
+        MaxWriteBufferCountValue(64),
+        MaxWriteBufferBytesValue(1024 * 1024),
+        ReusePortValue(false),
+        ConnectionCountMergePeriodValue(100),
+        MaxConcurrentCommandsValue(0),
         SessionMappings(std::make_shared<std::unordered_map<std::shared_ptr<ISessionContext>, std::shared_ptr<TcpSession>>>())
     {
         ServerContext(sc);
     }
+    TcpServer::TcpServer(std::shared_ptr<IoServicePool> Shards, std::shared_ptr<IServerContext> sc, std::function<std::pair<std::shared_ptr<IServerImplementation>, std::shared_ptr<IStreamedVirtualTransportServer>>(std::shared_ptr<ISessionContext>, std::shared_ptr<IBinaryTransformer>)> VirtualTransportServerFactory, std::function<void(std::function<void()>)> PurifierQueueUserWorkItem)
+        : TcpServer(Shards->IoService(0), sc, VirtualTransportServerFactory, Shards->QueueUserWorkItem(0), PurifierQueueUserWorkItem)
+    {
+        this->Shards = Shards;
+    }
 
     void TcpServer::OnMaxConnectionsExceeded(std::shared_ptr<TcpSession> s)
     {
@@ -45,18 +55,19 @@ namespace Server
         }
     }
 
-    void TcpServer::DoTimeoutCheck()
+    void TcpServer::DoTimeoutCheck(int ShardIndex)
     {
         auto TimePeriod = std::chrono::seconds(std::max(TimeoutCheckPeriodValue, 1));
-        auto WaitHandler = [this, TimePeriod](const asio::error_code& ec)
+        auto WaitHandler = [this, ShardIndex](const asio::error_code& ec)
         {
             if (!ec)
             {
                 if (UnauthenticatedSessionIdleTimeoutValue.HasValue)
                 {
                     auto CheckTime = std::chrono::steady_clock::now() + std::chrono::seconds(-UnauthenticatedSessionIdleTimeoutValue.Value());
-                    SessionSets.DoAction([&](std::shared_ptr<ServerSessionSets> ss)
                     {
+                        auto ss = SessionSets[ShardIndex];
+                        std::unique_lock<std::mutex> Lock(ss->Lockee);
                         for (auto s : ss->Sessions)
                         {
                             auto IpAddress = s->RemoteEndPoint.address();
@@ -69,14 +80,15 @@ namespace Server
                                 }
                             }
                         }
-                    });
+                    }
                 }
 
                 if (SessionIdleTimeoutValue.HasValue)
                 {
                     auto CheckTime = std::chrono::steady_clock::now() + std::chrono::seconds(-SessionIdleTimeoutValue.Value());
-                    SessionSets.DoAction([&](std::shared_ptr<ServerSessionSets> ss)
                     {
+                        auto ss = SessionSets[ShardIndex];
+                        std::unique_lock<std::mutex> Lock(ss->Lockee);
                         for (auto s : ss->Sessions)
                         {
                             auto IpAddress = s->RemoteEndPoint.address();
@@ -89,15 +101,94 @@ namespace Server
                                 }
                             }
                         }
-                    });
+                    }
                 }
 
-                DoTimeoutCheck();
+                DoTimeoutCheck(ShardIndex);
+            }
+        };
+        auto &TimerIoService = Shards != nullptr ? Shards->IoService(ShardIndex) : this->IoService;
+        auto Timer = std::make_shared<asio::steady_timer>(TimerIoService);
+        LastActiveTimeCheckTimers[ShardIndex] = Timer;
+        Timer->expires_from_now(TimePeriod);
+        Timer->async_wait(WaitHandler);
+    }
+
+    void TcpServer::DoConnectionCountMerge()
+    {
+        auto TimePeriod = std::chrono::milliseconds(std::max(ConnectionCountMergePeriodValue, 1));
+        auto WaitHandler = [this](const asio::error_code& ec)
+        {
+            if (!ec)
+            {
+                MergeConnectionCounts();
+                DoConnectionCountMerge();
             }
         };
-        LastActiveTimeCheckTimer = std::make_shared<asio::steady_timer>(this->IoService);
-        LastActiveTimeCheckTimer->expires_from_now(TimePeriod);
-        LastActiveTimeCheckTimer->async_wait(WaitHandler);
+        ConnectionCountMergeTimer = std::make_shared<asio::steady_timer>(this->IoService);
+        ConnectionCountMergeTimer->expires_from_now(TimePeriod);
+        ConnectionCountMergeTimer->async_wait(WaitHandler);
+    }
+
+    void TcpServer::MergeConnectionCounts()
+    {
+        //各分片依次加锁取计数，全部取完后一次发布，发布前后各分片的计数都不会被修改
+        auto m = std::make_shared<MergedConnectionCounter>();
+        for (auto ss : SessionSets)
+        {
+            std::unique_lock<std::mutex> Lock(ss->Lockee);
+            auto Count = static_cast<int>(ss->Sessions.size());
+            m->Count += Count;
+            m->ShardCounts.push_back(Count);
+            m->ShardIpCounts.emplace_back();
+            auto &ShardIpCounts = m->ShardIpCounts.back();
+            for (auto &p : ss->IpSessions)
+            {
+                m->IpCounts[p.first] += p.second->Count;
+                ShardIpCounts[p.first] = p.second->Count;
+            }
+        }
+        MergedConnectionCounts.store(m);
+    }
+
+    int TcpServer::GetConnectionCount(int ShardIndex)
+    {
+        auto m = MergedConnectionCounts.load();
+        auto Count = m->Count;
+        if (ShardIndex < static_cast<int>(m->ShardCounts.size()))
+        {
+            Count -= m->ShardCounts[ShardIndex];
+        }
+        auto ss = SessionSets[ShardIndex];
+        std::unique_lock<std::mutex> Lock(ss->Lockee);
+        return Count + static_cast<int>(ss->Sessions.size());
+    }
+    int TcpServer::GetConnectionCountPerIP(int ShardIndex, const asio::ip::address &IpAddress)
+    {
+        auto m = MergedConnectionCounts.load();
+        auto Count = 0;
+        auto i = m->IpCounts.find(IpAddress);
+        if (i != m->IpCounts.end())
+        {
+            Count += i->second;
+        }
+        if (ShardIndex < static_cast<int>(m->ShardIpCounts.size()))
+        {
+            auto &ShardIpCounts = m->ShardIpCounts[ShardIndex];
+            auto j = ShardIpCounts.find(IpAddress);
+            if (j != ShardIpCounts.end())
+            {
+                Count -= j->second;
+            }
+        }
+        auto ss = SessionSets[ShardIndex];
+        std::unique_lock<std::mutex> Lock(ss->Lockee);
+        auto k = ss->IpSessions.find(IpAddress);
+        if (k != ss->IpSessions.end())
+        {
+            Count += k->second->Count;
+        }
+        return Count;
     }
 
     void TcpServer::Start()
@@ -122,10 +213,19 @@ namespace Server
 
             ListeningTaskToken = std::make_shared<BaseSystem::CancellationToken>();
 
+            auto NumShard = Shards != nullptr ? Shards->NumShard() : 1;
+            SessionSets.clear();
+            for (int k = 0; k < NumShard; k += 1)
+            {
+                SessionSets.push_back(std::make_shared<ShardSessionSets>());
+            }
+            MergedConnectionCounts.store(std::make_shared<const MergedConnectionCounter>());
+
             auto Purify = [=](std::shared_ptr<TcpSession> StoppingSession)
             {
-                SessionSets.DoAction([=](std::shared_ptr<ServerSessionSets> ss)
                 {
+                    auto ss = SessionSets[StoppingSession->ShardIndex];
+                    std::unique_lock<std::mutex> Lock(ss->Lockee);
                     if (ss->Sessions.count(StoppingSession) > 0)
                     {
                         ss->Sessions.erase(StoppingSession);
@@ -141,12 +241,13 @@ namespace Server
                             ss->IpSessions.erase(IpAddress);
                         }
                     }
-                });
+                }
                 StoppingSession->Stop();
             };
 
-            auto Accept = [=](std::shared_ptr<asio::ip::tcp::socket> a)
+            auto Accept = [=](std::shared_ptr<AcceptResult> r)
             {
+                auto a = r->AcceptSocket;
                 asio::error_code ec;
                 auto ep = a->remote_endpoint(ec);
                 if (ec)
@@ -154,13 +255,14 @@ namespace Server
                     a->close(ec);
                     return;
                 }
-                auto s = std::make_shared<TcpSession>(*this, a, ep, VirtualTransportServerFactory, QueueUserWorkItem);
+                auto SessionQueueUserWorkItem = Shards != nullptr ? Shards->QueueUserWorkItem(r->ShardIndex) : QueueUserWorkItem;
+                auto s = std::make_shared<TcpSession>(*this, a, ep, r->ShardIndex, VirtualTransportServerFactory, SessionQueueUserWorkItem);
 
-                if (MaxConnectionsValue.OnHasValue() && (SessionSets.Check<int>([=](std::shared_ptr<ServerSessionSets> ss) { return static_cast<int>(ss->Sessions.size()); }) >= MaxConnectionsValue.Value()))
+                if (MaxConnectionsValue.OnHasValue() && (GetConnectionCount(r->ShardIndex) >= MaxConnectionsValue.Value()))
                 {
                     PurifyConsumer->DoOne();
                 }
-                if (MaxConnectionsValue.OnHasValue() && (SessionSets.Check<int>([=](std::shared_ptr<ServerSessionSets> ss) { return static_cast<int>(ss->Sessions.size()); }) >= MaxConnectionsValue.Value()))
+                if (MaxConnectionsValue.OnHasValue() && (GetConnectionCount(r->ShardIndex) >= MaxConnectionsValue.Value()))
                 {
                     BaseSystem::AutoRelease ar([&]()
                     {
@@ -171,7 +273,7 @@ namespace Server
                     return;
                 }
 
-                if (MaxConnectionsPerIPValue.OnHasValue() && (SessionSets.Check<int>([=](std::shared_ptr<ServerSessionSets> ss) { return ss->IpSessions.count(ep.address()) > 0 ? ss->IpSessions[ep.address()]->Count : 0; }) >= MaxConnectionsPerIPValue.Value()))
+                if (MaxConnectionsPerIPValue.OnHasValue() && (GetConnectionCountPerIP(r->ShardIndex, ep.address()) >= MaxConnectionsPerIPValue.Value()))
                 {
                     BaseSystem::AutoRelease ar([&]()
                     {
@@ -182,7 +284,7 @@ namespace Server
                     return;
                 }
 
-                if (MaxUnauthenticatedPerIPValue.OnHasValue() && (SessionSets.Check<int>([=](std::shared_ptr<ServerSessionSets> ss) { return ss->IpSessions.count(ep.address()) > 0 ? ss->IpSessions[ep.address()]->Count : 0; }) >= MaxUnauthenticatedPerIPValue.Value()))
+                if (MaxUnauthenticatedPerIPValue.OnHasValue() && (GetConnectionCountPerIP(r->ShardIndex, ep.address()) >= MaxUnauthenticatedPerIPValue.Value()))
                 {
                     BaseSystem::AutoRelease ar([&]()
                     {
@@ -193,8 +295,10 @@ namespace Server
                     return;
                 }
 
-                SessionSets.DoAction([=](std::shared_ptr<ServerSessionSets> ss)
+                //只加本分片的锁，不同分片的接受互不阻塞
                 {
+                    auto ss = SessionSets[r->ShardIndex];
+                    std::unique_lock<std::mutex> Lock(ss->Lockee);
                     ss->Sessions.insert(s);
                     if (ss->IpSessions.count(ep.address()) > 0)
                     {
@@ -206,85 +310,154 @@ namespace Server
                         isi->Count += 1;
                         ss->IpSessions[ep.address()] = isi;
                     }
-                });
+                }
 
                 s->Start();
             };
-            AcceptConsumer = std::make_shared<BaseSystem::AsyncConsumer<std::shared_ptr<asio::ip::tcp::socket>>>(QueueUserWorkItem, [=](std::shared_ptr<asio::ip::tcp::socket> a) { Accept(a); return true; }, std::numeric_limits<int>::max());
+            //分片模式下每个分片有自己的AcceptConsumer，连接的检查和会话的创建在其所在的分片上并行执行
+            AcceptConsumers.clear();
+            for (int k = 0; k < NumShard; k += 1)
+            {
+                auto ShardQueueUserWorkItem = Shards != nullptr ? Shards->QueueUserWorkItem(k) : QueueUserWorkItem;
+                AcceptConsumers.push_back(std::make_shared<BaseSystem::AsyncConsumer<std::shared_ptr<AcceptResult>>>(ShardQueueUserWorkItem, [=](std::shared_ptr<AcceptResult> r) { Accept(r); return true; }, std::numeric_limits<int>::max()));
+            }
+
+#ifdef SO_REUSEPORT
+            auto UseReusePort = (Shards != nullptr) && ReusePortValue;
+#else
+            auto UseReusePort = false;
+#endif
+            auto NumAcceptor = UseReusePort ? NumShard : 1;
 
             auto Exceptions = std::make_shared<std::vector<asio::error_code>>();
             for (auto Binding : *BindingsValue)
             {
-                auto CreateSocket = [=]() -> std::shared_ptr<asio::ip::tcp::acceptor>
+                for (int AcceptorIndex = 0; AcceptorIndex < NumAcceptor; AcceptorIndex += 1)
                 {
-                    auto s = std::make_shared<asio::ip::tcp::acceptor>(IoService, Binding);
-                    return s;
-                };
-
-                auto Socket = CreateSocket();
-
-                asio::error_code ec;
-                Socket->listen(MaxConnectionsValue.OnHasValue() ? (MaxConnectionsValue.Value() + 1) : 128, ec);
-                if (ec)
-                {
-                    Exceptions->push_back(ec);
-                    continue;
-                }
+                    auto ListenShardIndex = UseReusePort ? AcceptorIndex : -1;
+                    auto ListenIoService = UseReusePort ? &Shards->IoService(ListenShardIndex) : &IoService;
+                    auto ListenQueueUserWorkItem = UseReusePort ? Shards->QueueUserWorkItem(ListenShardIndex) : QueueUserWorkItem;
+                    auto CreateSocket = [=]() -> std::shared_ptr<asio::ip::tcp::acceptor>
+                    {
+                        if (!UseReusePort)
+                        {
+                            auto s = std::make_shared<asio::ip::tcp::acceptor>(*ListenIoService, Binding);
+                            return s;
+                        }
+#ifdef SO_REUSEPORT
+                        //多个监听套接字绑定到同一结点，由内核在各分片间分配新连接
+                        typedef asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT> reuse_port;
+                        auto s = std::make_shared<asio::ip::tcp::acceptor>(*ListenIoService);
+                        s->open(Binding.protocol());
+                        s->set_option(asio::ip::tcp::acceptor::reuse_address(true));
+                        s->set_option(reuse_port(true));
+                        s->bind(Binding);
+                        return s;
+#else
+                        throw std::logic_error("InvalidOperationException");
+#endif
+                    };
+
+                    std::shared_ptr<asio::ip::tcp::acceptor> Socket;
+                    try
+                    {
+                        Socket = CreateSocket();
+                    }
+                    catch (const asio::system_error &ex)
+                    {
+                        Exceptions->push_back(ex.code());
+                        continue;
+                    }
 
-                auto bi = std::make_shared<BindingInfo>();
-                bi->Socket = std::make_shared<BaseSystem::LockedVariable<std::shared_ptr<asio::ip::tcp::acceptor>>>(Socket);
-                auto bip = &*bi;
-                auto Completed = [this, Binding, CreateSocket, bip](std::shared_ptr<AcceptResult> args) -> bool
-                {
-                    if (ListeningTaskToken->IsCancellationRequested()) { return false; }
-                    if (!args->ec)
+                    asio::error_code ec;
+                    Socket->listen(MaxConnectionsValue.OnHasValue() ? (MaxConnectionsValue.Value() + 1) : 128, ec);
+                    if (ec)
                     {
-                        auto a = args->AcceptSocket;
-                        AcceptConsumer->Push(a);
+                        Exceptions->push_back(ec);
+                        continue;
                     }
-                    else
+
+                    auto bi = std::make_shared<BindingInfo>();
+                    bi->EndPoint = Binding;
+                    bi->ShardIndex = ListenShardIndex;
+                    bi->Socket = std::make_shared<BaseSystem::LockedVariable<std::shared_ptr<asio::ip::tcp::acceptor>>>(Socket);
+                    auto bip = &*bi;
+                    auto Completed = [this, Binding, CreateSocket, bip](std::shared_ptr<AcceptResult> args) -> bool
                     {
-                        bip->Socket->Update([=](std::shared_ptr<asio::ip::tcp::acceptor> OriginalSocket) -> std::shared_ptr<asio::ip::tcp::acceptor>
+                        if (ListeningTaskToken->IsCancellationRequested()) { return false; }
+                        if (!args->ec)
                         {
-                            return nullptr;
-                        });
-                        bip->Socket->Update([=](std::shared_ptr<asio::ip::tcp::acceptor> OriginalSocket) -> std::shared_ptr<asio::ip::tcp::acceptor>
+                            AcceptConsumers[args->ShardIndex]->Push(args);
+                        }
+                        else
                         {
-                            auto NewSocket = CreateSocket();
-                            NewSocket->listen(MaxConnectionsValue.OnHasValue() ? (MaxConnectionsValue.Value() + 1) : 128);
-                            return NewSocket;
-                        });
-                    }
-                    bip->Start();
-                    return true;
-                };
-                bi->ListenConsumer = std::make_shared<BaseSystem::AsyncConsumer<std::shared_ptr<AcceptResult>>>(QueueUserWorkItem, Completed, 1);
-                bi->Start = [this, bip]()
-                {
-                    auto a = std::make_shared<AcceptResult>();
-                    a->AcceptSocket = std::make_shared<asio::ip::tcp::socket>(IoService);
-                    auto RemoteEndPoint = std::make_shared<asio::ip::tcp::endpoint>();
-                    auto bs = bip->Socket->Check<std::shared_ptr<asio::ip::tcp::acceptor>>([](const std::shared_ptr<asio::ip::tcp::acceptor> &s) { return s; });
-                    bs->async_accept(*a->AcceptSocket, *RemoteEndPoint, [this, a, RemoteEndPoint, bip](const asio::error_code &ec)
+                            bip->Socket->Update([=](std::shared_ptr<asio::ip::tcp::acceptor> OriginalSocket) -> std::shared_ptr<asio::ip::tcp::acceptor>
+                            {
+                                return nullptr;
+                            });
+                            bip->Socket->Update([=](std::shared_ptr<asio::ip::tcp::acceptor> OriginalSocket) -> std::shared_ptr<asio::ip::tcp::acceptor>
+                            {
+                                auto NewSocket = CreateSocket();
+                                NewSocket->listen(MaxConnectionsValue.OnHasValue() ? (MaxConnectionsValue.Value() + 1) : 128);
+                                return NewSocket;
+                            });
+                        }
+                        bip->Start();
+                        return true;
+                    };
+                    bi->ListenConsumer = std::make_shared<BaseSystem::AsyncConsumer<std::shared_ptr<AcceptResult>>>(ListenQueueUserWorkItem, Completed, 1);
+                    bi->Start = [this, bip]()
                     {
-                        if (ec == asio::error::operation_aborted) { return; }
-                        a->ec = ec;
-                        bip->ListenConsumer->Push(a);
-                    });
-                };
+                        auto a = std::make_shared<AcceptResult>();
+                        if ((Shards != nullptr) && (bip->ShardIndex >= 0))
+                        {
+                            //SO_REUSEPORT模式下，连接固定在接受它的监听套接字所在的分片上
+                            a->ShardIndex = bip->ShardIndex;
+                            a->AcceptSocket = std::make_shared<asio::ip::tcp::socket>(Shards->IoService(a->ShardIndex));
+                        }
+                        else if (Shards != nullptr)
+                        {
+                            //连接的套接字直接创建在所分配的分片上，此后的读写完成回调均在该分片上执行
+                            a->ShardIndex = Shards->NextShardIndex();
+                            a->AcceptSocket = std::make_shared<asio::ip::tcp::socket>(Shards->IoService(a->ShardIndex));
+                        }
+                        else
+                        {
+                            a->ShardIndex = 0;
+                            a->AcceptSocket = std::make_shared<asio::ip::tcp::socket>(IoService);
+                        }
+                        auto RemoteEndPoint = std::make_shared<asio::ip::tcp::endpoint>();
+                        auto bs = bip->Socket->Check<std::shared_ptr<asio::ip::tcp::acceptor>>([](const std::shared_ptr<asio::ip::tcp::acceptor> &s) { return s; });
+                        bs->async_accept(*a->AcceptSocket, *RemoteEndPoint, [this, a, RemoteEndPoint, bip](const asio::error_code &ec)
+                        {
+                            if (ec == asio::error::operation_aborted) { return; }
+                            a->ec = ec;
+                            bip->ListenConsumer->Push(a);
+                        });
+                    };
 
-                BindingInfos.push_back(bi);
+                    BindingInfos.push_back(bi);
+                }
             }
             if (BindingInfos.size() == 0)
             {
                 throw std::logic_error("NoValidBinding");
             }
 
-            PurifyConsumer = std::make_shared<BaseSystem::AsyncConsumer<std::shared_ptr<TcpSession>>>(PurifierQueueUserWorkItem, [=](std::shared_ptr<TcpSession> s) { Purify(s); return true; }, std::numeric_limits<int>::max());
+            PurifyConsumer = std::make_shared<BaseSystem::MpscAsyncConsumer<std::shared_ptr<TcpSession>>>(PurifierQueueUserWorkItem, [=](std::shared_ptr<TcpSession> s) { Purify(s); return true; });
 
+            LastActiveTimeCheckTimers.clear();
+            LastActiveTimeCheckTimers.resize(NumShard);
             if (UnauthenticatedSessionIdleTimeoutValue.OnHasValue() || SessionIdleTimeoutValue.OnHasValue())
             {
-                DoTimeoutCheck();
+                for (int k = 0; k < NumShard; k += 1)
+                {
+                    DoTimeoutCheck(k);
+                }
+            }
+            if ((NumShard > 1) && (MaxConnectionsValue.OnHasValue() || MaxConnectionsPerIPValue.OnHasValue() || MaxUnauthenticatedPerIPValue.OnHasValue()))
+            {
+                DoConnectionCountMerge();
             }
 
             for (auto BindingInfo : BindingInfos)
@@ -304,9 +477,13 @@ namespace Server
         {
             if (!b) { return false; }
 
-            if (LastActiveTimeCheckTimer != nullptr)
+            for (auto &Timer : LastActiveTimeCheckTimers)
+            {
+                Timer = nullptr;
+            }
+            if (ConnectionCountMergeTimer != nullptr)
             {
-                LastActiveTimeCheckTimer = nullptr;
+                ConnectionCountMergeTimer = nullptr;
             }
 
             if (ListeningTaskToken != nullptr)
@@ -331,18 +508,17 @@ namespace Server
                 ListeningTaskToken = nullptr;
             }
 
-            if (AcceptConsumer != nullptr)
-            {
-                AcceptConsumer = nullptr;
-            }
+            AcceptConsumers.clear();
 
             std::unordered_set<std::shared_ptr<TcpSession>> Sessions;
-            SessionSets.DoAction([&](std::shared_ptr<ServerSessionSets> ss)
+            for (auto ss : SessionSets)
             {
-                Sessions = ss->Sessions;
+                std::unique_lock<std::mutex> Lock(ss->Lockee);
+                Sessions.insert(ss->Sessions.begin(), ss->Sessions.end());
                 ss->Sessions.clear();
                 ss->IpSessions.clear();
-            });
+            }
+            MergedConnectionCounts.store(std::make_shared<const MergedConnectionCounter>());
             for (auto s : Sessions)
             {
                 s->Stop();
@@ -365,17 +541,16 @@ namespace Server
     void TcpServer::NotifySessionAuthenticated(std::shared_ptr<TcpSession> s)
     {
         auto e = s->RemoteEndPoint;
-        SessionSets.DoAction([=](std::shared_ptr<ServerSessionSets> ss)
+        auto ss = SessionSets[s->ShardIndex];
+        std::unique_lock<std::mutex> Lock(ss->Lockee);
+        if (ss->IpSessions.count(e.address()) > 0)
         {
-            if (ss->IpSessions.count(e.address()) > 0)
+            auto isi = ss->IpSessions[e.address()];
+            if (isi->Authenticated.count(s) == 0)
             {
-                auto isi = ss->IpSessions[e.address()];
-                if (isi->Authenticated.count(s) == 0)
-                {
-                    isi->Authenticated.insert(s);
-                }
+                isi->Authenticated.insert(s);
             }
-        });
+        }
     }
 
     TcpServer::~TcpServer()
@@ -2,11 +2,13 @@
 
 #include "BaseSystem/LockedVariable.h"
 #include "BaseSystem/AsyncConsumer.h"
+#include "BaseSystem/MpscAsyncConsumer.h"
 #include "BaseSystem/CancellationToken.h"
 #include "BaseSystem/Optional.h"
 #include "Concept.h"
 #include "IContext.h"
 #include "StreamedServer.h"
+#include "IoServicePool.h"
 
 #include <vector>
 #include <unordered_set>
@@ -14,6 +16,8 @@
 #include <functional>
 #include <utility>
 #include <memory>
+#include <mutex>
+#include <atomic>
 #include <stdexcept>
 #include <asio.hpp>
 #include <asio/steady_timer.hpp>
@@ -36,12 +40,14 @@ namespace Server
         public:
             asio::error_code ec;
             std::shared_ptr<asio::ip::tcp::socket> AcceptSocket;
+            int ShardIndex;
         };
 
         class BindingInfo
         {
         public:
             asio::ip::tcp::endpoint EndPoint;
+            int ShardIndex;
             std::shared_ptr<BaseSystem::LockedVariable<std::shared_ptr<asio::ip::tcp::acceptor>>> Socket;
             std::shared_ptr<BaseSystem::AsyncConsumer<std::shared_ptr<AcceptResult>>> ListenConsumer;
             std::function<void()> Start;
@@ -51,12 +57,15 @@ namespace Server
 
     private:
         asio::io_service &IoService;
+        std::shared_ptr<IoServicePool> Shards;
 
         std::vector<std::shared_ptr<BindingInfo>> BindingInfos;
         std::shared_ptr<BaseSystem::CancellationToken> ListeningTaskToken;
-        std::shared_ptr<BaseSystem::AsyncConsumer<std::shared_ptr<asio::ip::tcp::socket>>> AcceptConsumer;
-        std::shared_ptr<BaseSystem::AsyncConsumer<std::shared_ptr<TcpSession>>> PurifyConsumer;
-        std::shared_ptr<asio::steady_timer> LastActiveTimeCheckTimer;
+        std::vector<std::shared_ptr<BaseSystem::AsyncConsumer<std::shared_ptr<AcceptResult>>>> AcceptConsumers;
+        std::shared_ptr<BaseSystem::MpscAsyncConsumer<std::shared_ptr<TcpSession>>> PurifyConsumer;
+        //每个分片一个，只检查本分片的会话
+        std::vector<std::shared_ptr<asio::steady_timer>> LastActiveTimeCheckTimers;
+        std::shared_ptr<asio::steady_timer> ConnectionCountMergeTimer;
 
         struct IpAddressHash
         {
@@ -108,13 +117,37 @@ namespace Server
             {
             }
         };
-        class ServerSessionSets
+        /// <summary>
+        /// 每个分片的会话集合，只在本分片接受连接、清理会话和会话通过认证时修改，各分片的锁互相独立。
+        /// 本分片的连接数为Sessions的大小，每个IP的连接数为IpSessions中的Count。
+        /// </summary>
+        class ShardSessionSets
         {
         public:
+            std::mutex Lockee;
             std::unordered_set<std::shared_ptr<TcpSession>> Sessions;
             std::unordered_map<asio::ip::address, std::shared_ptr<IpSessionInfo>, IpAddressHash> IpSessions;
         };
-        BaseSystem::LockedVariable<std::shared_ptr<ServerSessionSets>> SessionSets;
+        std::vector<std::shared_ptr<ShardSessionSets>> SessionSets;
+
+        /// <summary>
+        /// 各分片连接数的定期合并结果，合并后不再修改。
+        /// 同时保存合并时各分片自己的计数，查询时以本分片的当前计数替换其中本分片的部分，不会重复计数；其他分片的计数最多滞后一个合并周期。
+        /// </summary>
+        class MergedConnectionCounter
+        {
+        public:
+            int Count;
+            std::unordered_map<asio::ip::address, int, IpAddressHash> IpCounts;
+            std::vector<int> ShardCounts;
+            std::vector<std::unordered_map<asio::ip::address, int, IpAddressHash>> ShardIpCounts;
+
+            MergedConnectionCounter()
+                : Count(0)
+            {
+            }
+        };
+        std::atomic<std::shared_ptr<const MergedConnectionCounter>> MergedConnectionCounts;
 
     public:
         std::shared_ptr<IServerContext> ServerContext() const
@@ -140,6 +173,11 @@ namespace Server
         Optional<int> MaxConnectionsPerIPValue;
         Optional<int> MaxUnauthenticatedPerIPValue;
         int TimeoutCheckPeriodValue;
+        int MaxWriteBufferCountValue;
+        int MaxWriteBufferBytesValue;
+        bool ReusePortValue;
+        int ConnectionCountMergePeriodValue;
+        int MaxConcurrentCommandsValue;
 
     public:
         /// <summary>只能在启动前修改，以保证线程安全</summary>
@@ -247,15 +285,89 @@ namespace Server
                 TimeoutCheckPeriodValue = value;
             });
         }
+        /// <summary>单次聚集写入的最大缓冲区个数，只能在启动前修改，以保证线程安全</summary>
+        int MaxWriteBufferCount() const
+        {
+            return MaxWriteBufferCountValue;
+        }
+        void MaxWriteBufferCount(int value)
+        {
+            IsRunningValue.DoAction([=](bool b)
+            {
+                if (b) { throw std::logic_error("InvalidOperationException"); }
+                MaxWriteBufferCountValue = value;
+            });
+        }
+        /// <summary>单次聚集写入的最大字节数，单个缓冲区超过时单独写入，只能在启动前修改，以保证线程安全</summary>
+        int MaxWriteBufferBytes() const
+        {
+            return MaxWriteBufferBytesValue;
+        }
+        void MaxWriteBufferBytes(int value)
+        {
+            IsRunningValue.DoAction([=](bool b)
+            {
+                if (b) { throw std::logic_error("InvalidOperationException"); }
+                MaxWriteBufferBytesValue = value;
+            });
+        }
+        /// <summary>分片模式下，每个分片使用一个设置了SO_REUSEPORT的监听套接字并行接受连接，在不支持SO_REUSEPORT的平台上无效，只能在启动前修改，以保证线程安全</summary>
+        bool ReusePort() const
+        {
+            return ReusePortValue;
+        }
+        void ReusePort(bool value)
+        {
+            IsRunningValue.DoAction([=](bool b)
+            {
+                if (b) { throw std::logic_error("InvalidOperationException"); }
+                ReusePortValue = value;
+            });
+        }
+        /// <summary>各分片连接计数的合并周期(毫秒)，连接数限制以本分片的准确计数加上其他分片在上次合并时的计数判断，只能在启动前修改，以保证线程安全</summary>
+        int ConnectionCountMergePeriod() const
+        {
+            return ConnectionCountMergePeriodValue;
+        }
+        void ConnectionCountMergePeriod(int value)
+        {
+            IsRunningValue.DoAction([=](bool b)
+            {
+                if (b) { throw std::logic_error("InvalidOperationException"); }
+                ConnectionCountMergePeriodValue = value;
+            });
+        }
+        /// <summary>每个会话中同时执行的可并发命令（Schema中标记为[Concurrent]）的最大数目，0表示全部命令依次执行，只能在启动前修改，以保证线程安全</summary>
+        int MaxConcurrentCommands() const
+        {
+            return MaxConcurrentCommandsValue;
+        }
+        void MaxConcurrentCommands(int value)
+        {
+            IsRunningValue.DoAction([=](bool b)
+            {
+                if (b) { throw std::logic_error("InvalidOperationException"); }
+                MaxConcurrentCommandsValue = value;
+            });
+        }
 
         BaseSystem::LockedVariable<std::shared_ptr<std::unordered_map<std::shared_ptr<ISessionContext>, std::shared_ptr<TcpSession>>>> SessionMappings;
 
         TcpServer(asio::io_service &IoService, std::shared_ptr<IServerContext> sc, std::function<std::pair<std::shared_ptr<IServerImplementation>, std::shared_ptr<IStreamedVirtualTransportServer>>(std::shared_ptr<ISessionContext>, std::shared_ptr<IBinaryTransformer>)> VirtualTransportServerFactory, std::function<void(std::function<void()>)> QueueUserWorkItem, std::function<void(std::function<void()>)> PurifierQueueUserWorkItem);
+        /// <summary>
+        /// 分片模式，使用ReusePort时每个分片各有一个监听套接字，连接固定在接受它的分片上；否则监听在第0个分片上，每个连接按轮转方式分配到一个分片。
+        /// 连接的套接字和会话的所有回调均在该分片上执行，空闲超时检查在各分片上分别进行
+        /// </summary>
+        TcpServer(std::shared_ptr<IoServicePool> Shards, std::shared_ptr<IServerContext> sc, std::function<std::pair<std::shared_ptr<IServerImplementation>, std::shared_ptr<IStreamedVirtualTransportServer>>(std::shared_ptr<ISessionContext>, std::shared_ptr<IBinaryTransformer>)> VirtualTransportServerFactory, std::function<void(std::function<void()>)> PurifierQueueUserWorkItem);
 
     private:
         void OnMaxConnectionsExceeded(std::shared_ptr<TcpSession> s);
         void OnMaxConnectionsPerIPExceeded(std::shared_ptr<TcpSession> s);
-        void DoTimeoutCheck();
+        void DoTimeoutCheck(int ShardIndex);
+        void DoConnectionCountMerge();
+        void MergeConnectionCounts();
+        int GetConnectionCount(int ShardIndex);
+        int GetConnectionCountPerIP(int ShardIndex, const asio::ip::address &IpAddress);
 
     public:
         void Start();
@@ -4,45 +4,39 @@
 #include "BaseSystem/StringUtilities.h"
 #include "BaseSystem/Times.h"
 #include "BaseSystem/ExceptionStackTrace.h"
-#include "Rc4PacketServerTransformer.h"
+#include "SecurePacketServerTransformer.h"
 
 #include <chrono>
+#include <algorithm>
 #include <stdexcept>
 #include <typeinfo>
+#include <span>
 
 namespace Server
 {
-    TcpSession::TcpSession(TcpServer &Server, std::shared_ptr<asio::ip::tcp::socket> Socket, asio::ip::tcp::endpoint RemoteEndPoint, std::function<std::pair<std::shared_ptr<IServerImplementation>, std::shared_ptr<IStreamedVirtualTransportServer>>(std::shared_ptr<ISessionContext>, std::shared_ptr<IBinaryTransformer>)> VirtualTransportServerFactory, std::function<void(std::function<void()>)> QueueUserWorkItem)
+    TcpSession::TcpSession(TcpServer &Server, std::shared_ptr<asio::ip::tcp::socket> Socket, asio::ip::tcp::endpoint RemoteEndPoint, int ShardIndex, std::function<std::pair<std::shared_ptr<IServerImplementation>, std::shared_ptr<IStreamedVirtualTransportServer>>(std::shared_ptr<ISessionContext>, std::shared_ptr<IBinaryTransformer>)> VirtualTransportServerFactory, std::function<void(std::function<void()>)> QueueUserWorkItem)
         :
         Server(Server),
         Socket(Socket),
         RemoteEndPoint(RemoteEndPoint),
+        ShardIndex(ShardIndex),
         LastActiveTimeValue(std::chrono::steady_clock::now()),
         NumBadCommands(0),
         IsDisposed(false),
         IsRunningValue(false),
         IsExitingValue(false)
     {
-        ssm = std::make_shared<SessionStateMachine<std::shared_ptr<StreamedVirtualTransportServerHandleResult>, Unit>>(
-            [](const std::exception &ex) { return dynamic_cast<const asio::system_error *>(&ex) != nullptr; },
-            [this](const std::exception &ex) { return OnCriticalError(ex); },
-            [this]() { return OnShutdownRead(); },
-            [this]() { return OnShutdownWrite(); },
-            [this](Unit w, std::function<void()> OnSuccess, std::function<void()> OnFailure) { return OnWrite(w, OnSuccess, OnFailure); },
-            [this](std::shared_ptr<StreamedVirtualTransportServerHandleResult> r, std::function<void()> OnSuccess, std::function<void()> OnFailure) { return OnExecute(r, OnSuccess, OnFailure); },
-            [this](std::function<void(std::shared_ptr<std::vector<std::shared_ptr<StreamedVirtualTransportServerHandleResult>>>)> OnSuccess, std::function<void()> OnFailure) { return OnStartRawRead(OnSuccess, OnFailure); },
-            [this]() { return OnExit(); },
-            QueueUserWorkItem
-        );
+        ssm = std::make_shared<SessionStateMachine<TcpSession, std::shared_ptr<StreamedVirtualTransportServerHandleResult>>>(*this, QueueUserWorkItem, Server.MaxConcurrentCommands());
 
         Context = Server.ServerContext()->CreateSessionContext();
+        LogSource = SessionLogSource::Create(this->RemoteEndPoint.address(), this->RemoteEndPoint.port(), Context->SessionToken());
         Context->Quit = [this]() { ssm->NotifyExit(); };
         Context->Authenticated = [this]()
         {
             this->Server.NotifySessionAuthenticated(this->shared_from_this());
         };
 
-        auto rpst = std::make_shared<Rc4PacketServerTransformer>();
+        auto rpst = std::make_shared<SecurePacketServerTransformer>();
         auto Pair = VirtualTransportServerFactory(Context, rpst);
         si = std::get<0>(Pair);
         vts = std::get<1>(Pair);
@@ -50,28 +44,16 @@ namespace Server
         {
             rpst->SetSecureContext(c);
         };
-        vts->ServerEvent = [this]() { ssm->NotifyWrite(Unit()); };
+        vts->ServerEvent = [this]() { ssm->NotifyWrite(); };
         vts->InputByteLengthReport = [this](std::u16string CommandName, std::size_t ByteLength)
         {
-            auto e = std::make_shared<SessionLogEntry>();
-            e->Token = Context->SessionTokenString();
-            e->RemoteEndPoint = systemToUtf16(this->RemoteEndPoint.address().to_string()) + u":" + ToU16String(this->RemoteEndPoint.port());
-            e->Time = UtcNow();
-            e->Type = u"InBytes";
-            e->Name = CommandName;
-            e->Message = ToU16String(ByteLength);
-            this->Server.ServerContext()->RaiseSessionLog(e);
+            this->Server.ServerContext()->RaiseSessionLog(SessionLogType::InBytes, LogSource, LogNames, CommandName, static_cast<std::int64_t>(ByteLength));
         };
         vts->OutputByteLengthReport = [this](std::u16string CommandName, std::size_t ByteLength)
         {
-            auto e = std::make_shared<SessionLogEntry>();
-            e->Token = Context->SessionTokenString();
-            e->RemoteEndPoint = systemToUtf16(this->RemoteEndPoint.address().to_string()) + u":" + ToU16String(this->RemoteEndPoint.port());
-            e->Time = UtcNow();
-            e->Type = u"OutBytes";
-            e->Name = CommandName;
-            e->Message = ToU16String(ByteLength);
-            this->Server.ServerContext()->RaiseSessionLog(e);
+            auto &Metrics = this->Server.ServerContext()->Metrics();
+            Metrics.AddOutputBytes(Metrics.GetCommandId(CommandName), ByteLength);
+            this->Server.ServerContext()->RaiseSessionLog(SessionLogType::OutBytes, LogSource, LogNames, CommandName, static_cast<std::int64_t>(ByteLength));
         };
     }
 
@@ -87,29 +69,36 @@ namespace Server
         Socket->close();
     }
 
-    void TcpSession::OnWrite(Unit w, std::function<void()> OnSuccess, std::function<void()> OnFailure)
+    void TcpSession::OnWrite()
     {
-        auto ByteArrays = vts->TakeWriteBuffer();
-        if (ByteArrays.size() == 0)
+        //先归入已就绪的回复再取出缓冲区，保证归入的回复都已在本次或之后的写入中
+        WriteMetrics.BeginWrite();
+        vts->TakeWriteBuffer(WritingByteArrays);
+        if (WritingByteArrays.size() == 0)
         {
-            OnSuccess();
+            ssm->NotifyWriteSuccess();
             return;
         }
-        int TotalLength = 0;
-        for (auto b : ByteArrays)
-        {
-            TotalLength += static_cast<int>(b->size());
-        }
-        if ((WriteBuffer == nullptr) || (TotalLength > static_cast<int>(WriteBuffer->size())))
-        {
-            WriteBuffer = std::make_shared<std::vector<std::uint8_t>>();
-            WriteBuffer->resize(GetMinNotLessPowerOfTwo(TotalLength), 0);
-        }
-        auto Offset = 0;
-        for (auto b : ByteArrays)
+        WriteByteArrays(0);
+    }
+    void TcpSession::WriteByteArrays(std::size_t Index)
+    {
+        //直接将各回复的缓冲区作为缓冲区序列聚集写入，不再复制到一个连续缓冲区；WritingByteArrays持有缓冲区直到写入结束，之后清空使缓冲区回到BufferPool
+        auto MaxCount = static_cast<std::size_t>(std::max(Server.MaxWriteBufferCount(), 1));
+        auto MaxBytes = static_cast<std::size_t>(std::max(Server.MaxWriteBufferBytes(), 1));
+        WritingBuffers.clear();
+        std::size_t TotalLength = 0;
+        auto NextIndex = Index;
+        while ((NextIndex < WritingByteArrays.size()) && (WritingBuffers.size() < MaxCount))
         {
-            ArrayCopy(*b, 0, *WriteBuffer, Offset, static_cast<int>(b->size()));
-            Offset += static_cast<int>(b->size());
+            auto &b = *WritingByteArrays[NextIndex];
+            if ((WritingBuffers.size() > 0) && (TotalLength + b.size() > MaxBytes)) { break; }
+            if (b.size() > 0)
+            {
+                WritingBuffers.push_back(asio::buffer(b));
+            }
+            TotalLength += b.size();
+            NextIndex += 1;
         }
         auto WriteHandler = [=](const asio::error_code &ec, size_t Count)
         {
@@ -120,17 +109,27 @@ namespace Server
                 {
                     OnCriticalError(ex);
                 }
-                OnFailure();
+                WritingByteArrays.clear();
+                ssm->NotifyFailure();
+            }
+            else if (NextIndex < WritingByteArrays.size())
+            {
+                WriteByteArrays(NextIndex);
             }
             else
             {
-                OnSuccess();
+                WritingByteArrays.clear();
+                WriteMetrics.EndWrite(Server.ServerContext()->Metrics());
+                ssm->NotifyWriteSuccess();
             }
         };
-        asio::async_write(*Socket, asio::buffer(*WriteBuffer, TotalLength), WriteHandler);
+        //以span传递缓冲区序列，异步操作只保存引用而不复制列表
+        asio::async_write(*Socket, std::span<const asio::const_buffer>(WritingBuffers), WriteHandler);
     }
-    void TcpSession::OnExecute(std::shared_ptr<StreamedVirtualTransportServerHandleResult> r, std::function<void()> OnSuccess, std::function<void()> OnFailure)
+    void TcpSession::OnExecute(std::shared_ptr<StreamedVirtualTransportServerHandleResult> r, bool IsConcurrent)
     {
+        auto OnSuccess = [this, IsConcurrent]() { ssm->NotifyExecuteSuccess(IsConcurrent); };
+        auto OnFailure = [this, IsConcurrent]() { ssm->NotifyExecuteFailure(IsConcurrent); };
         if (r->OnCommand())
         {
             auto CommandName = r->Command->CommandName;
@@ -139,54 +138,46 @@ namespace Server
             {
                 auto CurrentTime = UtcNow();
                 Context->RequestTime(CurrentTime);
-                if (Server.ServerContext()->EnableLogPerformance())
+                auto &Metrics = Server.ServerContext()->Metrics();
+                auto CommandId = Metrics.GetCommandId(CommandName);
+                auto StartTime = std::chrono::steady_clock::now();
+                Metrics.AddRequest(CommandId, r->Command->InputByteLength);
+                Metrics.AddLatency(CommandId, CommandStage::Queue, StartTime - r->Command->ReceiveTime);
+                auto OnReadyInner = [=, &Metrics](std::chrono::steady_clock::time_point EndTime)
                 {
-                    auto StartTime = std::chrono::high_resolution_clock::now();
-                    auto OnSuccessInner = [=]()
+                    Metrics.AddLatency(CommandId, CommandStage::Execute, EndTime - StartTime);
+                    WriteMetrics.Ready(CommandId, EndTime);
+                    if (Server.ServerContext()->EnableLogPerformance())
                     {
-                        auto EndTime = std::chrono::high_resolution_clock::now();
                         auto Microseconds = std::chrono::duration_cast<std::chrono::microseconds>(EndTime - StartTime).count();
-                        auto e = std::make_shared<SessionLogEntry>();
-                        e->Token = Context->SessionTokenString();
-                        e->RemoteEndPoint = systemToUtf16(this->RemoteEndPoint.address().to_string()) + u":" + ToU16String(this->RemoteEndPoint.port());
-                        e->Time = UtcNow();
-                        e->Type = u"Time";
-                        e->Name = CommandName;
-                        e->Message = ToU16String(Microseconds) + u"μs";
-                        this->Server.ServerContext()->RaiseSessionLog(e);
-                        ssm->NotifyWrite(Unit());
-                        OnSuccess();
-                    };
-                    auto OnFailureInner = [=](const std::exception &ex)
-                    {
-                        RaiseUnknownError(CommandName, ex);
-                        OnSuccess();
-                    };
-                    r->Command->ExecuteCommand(OnSuccessInner, OnFailureInner);
-                }
-                else
+                        this->Server.ServerContext()->RaiseSessionLog(SessionLogType::Time, LogSource, LogNames, CommandName, static_cast<std::int64_t>(Microseconds));
+                    }
+                };
+                auto OnSuccessInner = [=]()
                 {
-                    auto OnSuccessInner = [=]()
-                    {
-                        ssm->NotifyWrite(Unit());
-                        OnSuccess();
-                    };
-                    auto OnFailureInner = [=](const std::exception &ex)
-                    {
-                        RaiseUnknownError(CommandName, ex);
-                        OnSuccess();
-                    };
-                    r->Command->ExecuteCommand(OnSuccessInner, OnFailureInner);
-                }
+                    ssm->NotifyWrite();
+                    OnSuccess();
+                };
+                auto OnFailureInner = [=, &Metrics](const std::exception &ex)
+                {
+                    Metrics.AddError(CommandId);
+                    RaiseUnknownError(CommandName, ex);
+                    //失败的命令没有回复，但可能使此前暂存的后续命令的回复可以写入
+                    ssm->NotifyWrite();
+                    OnSuccess();
+                };
+                r->Command->ExecuteCommand(OnReadyInner, OnSuccessInner, OnFailureInner);
             };
 
-            ssm->AddToActionQueue(a);
+            //OnExecute已在状态机的操作队列中或并发执行时在QueueUserWorkItem的线程上执行，直接执行命令
+            a();
         }
         else if (r->OnBadCommand())
         {
             auto CommandName = r->BadCommand->CommandName;
 
             NumBadCommands += 1;
+            Server.ServerContext()->Metrics().AddBadCommand();
 
             // Maximum allowed bad commands exceeded.
             if (Server.MaxBadCommands() != 0 && NumBadCommands > Server.MaxBadCommands())
@@ -205,6 +196,7 @@ namespace Server
             auto CommandLine = r->BadCommandLine->CommandLine;
 
             NumBadCommands += 1;
+            Server.ServerContext()->Metrics().AddBadCommand();
 
             // Maximum allowed bad commands exceeded.
             if (Server.MaxBadCommands() != 0 && NumBadCommands > Server.MaxBadCommands())
@@ -223,18 +215,18 @@ namespace Server
             throw std::logic_error("InvalidOperationException");
         }
     }
-    void TcpSession::OnStartRawRead(std::function<void(std::shared_ptr<std::vector<std::shared_ptr<StreamedVirtualTransportServerHandleResult>>>)> OnSuccess, std::function<void()> OnFailure)
+    void TcpSession::OnStartRawRead()
     {
         auto Completed = [=](int Count)
         {
             LastActiveTimeValue.Update([](std::chrono::steady_clock::time_point v) { return std::chrono::steady_clock::now(); });
             if (Count <= 0)
             {
-                OnFailure();
+                ssm->NotifyStartRawReadFailure();
                 return;
             }
             if (ssm->IsExited()) { return; }
-            auto Results = std::make_shared<std::vector<std::shared_ptr<StreamedVirtualTransportServerHandleResult>>>();
+            RawReadResults.clear();
             auto c = Count;
             while (true)
             {
@@ -253,21 +245,14 @@ namespace Server
                     {
                         if (dynamic_cast<const std::logic_error *>(&ex) != nullptr)
                         {
-                            auto e = std::make_shared<SessionLogEntry>();
-                            e->Token = Context->SessionTokenString();
-                            e->RemoteEndPoint = systemToUtf16(this->RemoteEndPoint.address().to_string()) + u":" + ToU16String(this->RemoteEndPoint.port());
-                            e->Time = UtcNow();
-                            e->Type = u"Known";
-                            e->Name = u"Exception";
-                            e->Message = systemToUtf16(std::string() + typeid(*(&ex)).name() + "\r\n" + ex.what() + "\r\n" + ExceptionStackTrace::GetStackTrace());
-                            Server.ServerContext()->RaiseSessionLog(e);
+                            Server.ServerContext()->RaiseSessionLog(SessionLogType::Known, LogSource, u"Exception", systemToUtf16(std::string() + typeid(*(&ex)).name() + "\r\n" + ex.what() + "\r\n" + ExceptionStackTrace::GetStackTrace()));
                         }
                         else if (!IsSocketErrorKnown(ex))
                         {
                             auto Message = std::string() + typeid(*(&ex)).name() + "\r\n" + ex.what() + "\r\n" + ExceptionStackTrace::GetStackTrace();
                             OnCriticalError(std::runtime_error(Message));
                         }
-                        OnFailure();
+                        ssm->NotifyStartRawReadFailure();
                         return;
                     }
                 }
@@ -276,14 +261,14 @@ namespace Server
                 {
                     break;
                 }
-                Results->push_back(Result);
+                RawReadResults.push_back(Result);
             }
-            if (Results->size() == 0)
+            if (RawReadResults.size() == 0)
             {
-                OnStartRawRead(OnSuccess, OnFailure);
+                OnStartRawRead();
                 return;
             }
-            OnSuccess(Results);
+            ssm->NotifyStartRawReadSuccess(RawReadResults);
         };
         auto Faulted = [=](const std::exception &ex)
         {
@@ -291,7 +276,7 @@ namespace Server
             {
                 OnCriticalError(ex);
             }
-            OnFailure();
+            ssm->NotifyStartRawReadFailure();
         };
         auto Buffer = vts->GetReadBuffer();
         auto BufferLength = vts->GetReadBufferOffset() + vts->GetReadBufferLength();
@@ -324,7 +309,10 @@ namespace Server
                 Mappings->erase(Context);
             }
         });
-        Server.ServerContext()->TryUnregisterSession(Context);
+        if (Server.ServerContext()->TryUnregisterSession(Context))
+        {
+            Server.ServerContext()->Metrics().AddTcpSessions(-1);
+        }
 
         si->Stop();
         si = nullptr;
@@ -336,21 +324,13 @@ namespace Server
         {
         }
 
-        auto SessionTokenString = Context->SessionTokenString();
         Context = nullptr;
 
         IsExitingValue.Update([](bool b) { return false; });
 
         if (Server.ServerContext()->EnableLogSystem())
         {
-            auto e = std::make_shared<SessionLogEntry>();
-            e->Token = SessionTokenString;
-            e->RemoteEndPoint = systemToUtf16(this->RemoteEndPoint.address().to_string()) + u":" + ToU16String(this->RemoteEndPoint.port());
-            e->Time = UtcNow();
-            e->Type = u"Sys";
-            e->Name = u"SessionExit";
-            e->Message = u"";
-            Server.ServerContext()->RaiseSessionLog(e);
+            Server.ServerContext()->RaiseSessionLog(SessionLogType::Sys, LogSource, u"SessionExit", u"");
         }
     }
 
@@ -387,18 +367,12 @@ namespace Server
                 Context->RemoteEndPoint(systemToUtf16(this->RemoteEndPoint.address().to_string()) + u":" + ToU16String(this->RemoteEndPoint.port()));
 
                 Server.ServerContext()->RegisterSession(Context);
+                Server.ServerContext()->Metrics().AddTcpSessions(1);
                 Server.SessionMappings.DoAction([=](std::shared_ptr<std::unordered_map<std::shared_ptr<ISessionContext>, std::shared_ptr<TcpSession>>> Mappings) { (*Mappings)[Context] = this->shared_from_this(); });
 
                 if (Server.ServerContext()->EnableLogSystem())
                 {
-                    auto e = std::make_shared<SessionLogEntry>();
-                    e->Token = Context->SessionTokenString();
-                    e->RemoteEndPoint = systemToUtf16(this->RemoteEndPoint.address().to_string()) + u":" + ToU16String(this->RemoteEndPoint.port());
-                    e->Time = UtcNow();
-                    e->Type = u"Sys";
-                    e->Name = u"SessionEnter";
-                    e->Message = u"";
-                    Server.ServerContext()->RaiseSessionLog(e);
+                    Server.ServerContext()->RaiseSessionLog(SessionLogType::Sys, LogSource, u"SessionEnter", u"");
                 }
                 ssm->Start();
             });
@@ -411,6 +385,10 @@ namespace Server
         }
     }
 
+    bool TcpSession::IsKnownException(const std::exception &ex)
+    {
+        return dynamic_cast<const asio::system_error *>(&ex) != nullptr;
+    }
     bool TcpSession::IsSocketErrorKnown(const std::exception &ex)
     {
         auto se = dynamic_cast<const asio::system_error *>(&ex);
@@ -422,33 +400,6 @@ namespace Server
         return false;
     }
 
-    int TcpSession::GetMinNotLessPowerOfTwo(int v)
-    {
-        //计算不小于TotalLength的最小2的幂
-        if (v < 1) { return 1; }
-        auto n = 0;
-        auto z = v - 1;
-        while (z != 0)
-        {
-            z >>= 1;
-            n += 1;
-        }
-        auto Value = 1 << n;
-        if (Value == 0) { throw std::logic_error("InvalidOperationException"); }
-        return Value;
-    }
-
-    void TcpSession::ArrayCopy(const std::vector<std::uint8_t> &Source, int SourceIndex, std::vector<std::uint8_t> &Destination, int DestinationIndex, int Length)
-    {
-        if (Length < 0) { throw std::logic_error("InvalidArgument"); }
-        if (SourceIndex < 0) { throw std::logic_error("InvalidArgument"); }
-        if (DestinationIndex < 0) { throw std::logic_error("InvalidArgument"); }
-        if (SourceIndex + Length > static_cast<int>(Source.size())) { throw std::logic_error("InvalidArgument"); }
-        if (DestinationIndex + Length > static_cast<int>(Destination.size())) { throw std::logic_error("InvalidArgument"); }
-        if (Length == 0) { return; }
-        std::memcpy(&Destination[DestinationIndex], &Source[SourceIndex], Length);
-    }
-
     void TcpSession::RaiseError(std::u16string CommandName, std::u16string Message)
     {
         si->RaiseError(CommandName, Message);
@@ -466,14 +417,7 @@ namespace Server
         }
         if (Server.ServerContext()->EnableLogUnknownError())
         {
-            auto e = std::make_shared<SessionLogEntry>();
-            e->Token = Context->SessionTokenString();
-            e->RemoteEndPoint = systemToUtf16(this->RemoteEndPoint.address().to_string()) + u":" + ToU16String(this->RemoteEndPoint.port());
-            e->Time = UtcNow();
-            e->Type = u"Unk";
-            e->Name = u"Exception";
-            e->Message = Info;
-            Server.ServerContext()->RaiseSessionLog(e);
+            Server.ServerContext()->RaiseSessionLog(SessionLogType::Unk, LogSource, u"Exception", Info);
         }
     }
 
@@ -482,14 +426,7 @@ namespace Server
         if (Server.ServerContext()->EnableLogCriticalError())
         {
             auto Info = systemToUtf16(ex.what());
-            auto e = std::make_shared<SessionLogEntry>();
-            e->Token = Context->SessionTokenString();
-            e->RemoteEndPoint = systemToUtf16(this->RemoteEndPoint.address().to_string()) + u":" + ToU16String(this->RemoteEndPoint.port());
-            e->Time = UtcNow();
-            e->Type = u"Crtcu";
-            e->Name = u"Exception";
-            e->Message = Info;
-            Server.ServerContext()->RaiseSessionLog(e);
+            Server.ServerContext()->RaiseSessionLog(SessionLogType::Crtcu, LogSource, u"Exception", Info);
         }
     }
 }
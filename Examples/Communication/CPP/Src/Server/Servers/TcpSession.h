@@ -1,5 +1,6 @@
 ﻿#pragma once
 
+#include "BaseSystem/LockedVariable.h"
 #include "IContext.h"
 #include "StreamedServer.h"
 #include "SessionStateMachine.h"
@@ -25,12 +26,15 @@ namespace Server
     /// </summary>
     class TcpSession : public std::enable_shared_from_this<TcpSession>
     {
+        friend class SessionStateMachine<TcpSession, std::shared_ptr<StreamedVirtualTransportServerHandleResult>>;
     public:
         TcpServer &Server;
     private:
         std::shared_ptr<asio::ip::tcp::socket> Socket;
     public:
         const asio::ip::tcp::endpoint RemoteEndPoint;
+        /// <summary>会话所在的分片，非分片模式下为0</summary>
+        const int ShardIndex;
 
     private:
         BaseSystem::LockedVariable<std::chrono::steady_clock::time_point> LastActiveTimeValue;
@@ -42,23 +46,33 @@ namespace Server
 
     private:
         std::shared_ptr<ISessionContext> Context;
+        SessionLogSource LogSource;
+        SessionLogNameCache LogNames;
         std::shared_ptr<IServerImplementation> si;
         std::shared_ptr<IStreamedVirtualTransportServer> vts;
         int NumBadCommands = 0;
         bool IsDisposed;
 
-        std::shared_ptr<std::vector<std::uint8_t>> WriteBuffer;
-        std::shared_ptr<SessionStateMachine<std::shared_ptr<StreamedVirtualTransportServerHandleResult>, Unit>> ssm;
+        std::shared_ptr<SessionStateMachine<TcpSession, std::shared_ptr<StreamedVirtualTransportServerHandleResult>>> ssm;
+
+        PendingWriteMetrics WriteMetrics;
+
+        //同一时间只有一个写入，正在写入的缓冲区列表和缓冲区序列重复使用，写入结束时释放缓冲区
+        std::vector<std::shared_ptr<std::vector<std::uint8_t>>> WritingByteArrays;
+        std::vector<asio::const_buffer> WritingBuffers;
+        //同一时间只有一个读取，解析出的命令交给状态机时与其内部的空列表交换
+        std::vector<std::shared_ptr<StreamedVirtualTransportServerHandleResult>> RawReadResults;
 
     public:
-        TcpSession(TcpServer &Server, std::shared_ptr<asio::ip::tcp::socket> Socket, asio::ip::tcp::endpoint RemoteEndPoint, std::function<std::pair<std::shared_ptr<IServerImplementation>, std::shared_ptr<IStreamedVirtualTransportServer>>(std::shared_ptr<ISessionContext>, std::shared_ptr<IBinaryTransformer>)> VirtualTransportServerFactory, std::function<void(std::function<void()>)> QueueUserWorkItem);
+        TcpSession(TcpServer &Server, std::shared_ptr<asio::ip::tcp::socket> Socket, asio::ip::tcp::endpoint RemoteEndPoint, int ShardIndex, std::function<std::pair<std::shared_ptr<IServerImplementation>, std::shared_ptr<IStreamedVirtualTransportServer>>(std::shared_ptr<ISessionContext>, std::shared_ptr<IBinaryTransformer>)> VirtualTransportServerFactory, std::function<void(std::function<void()>)> QueueUserWorkItem);
 
     private:
         void OnShutdownRead();
         void OnShutdownWrite();
-        void OnWrite(Unit w, std::function<void()> OnSuccess, std::function<void()> OnFailure);
-        void OnExecute(std::shared_ptr<StreamedVirtualTransportServerHandleResult> r, std::function<void()> OnSuccess, std::function<void()> OnFailure);
-        void OnStartRawRead(std::function<void(std::shared_ptr<std::vector<std::shared_ptr<StreamedVirtualTransportServerHandleResult>>>)> OnSuccess, std::function<void()> OnFailure);
+        void OnWrite();
+        void WriteByteArrays(std::size_t Index);
+        void OnExecute(std::shared_ptr<StreamedVirtualTransportServerHandleResult> r, bool IsConcurrent);
+        void OnStartRawRead();
 
     public:
         void Stop();
@@ -80,11 +94,13 @@ namespace Server
         }
 
     private:
+        static bool IsKnownException(const std::exception &ex);
+        static bool IsConcurrent(const std::shared_ptr<StreamedVirtualTransportServerHandleResult> &r)
+        {
+            return r->OnCommand() && r->Command->IsConcurrent;
+        }
         static bool IsSocketErrorKnown(const std::exception &ex);
 
-        static int GetMinNotLessPowerOfTwo(int v);
-
-        static void ArrayCopy(const std::vector<std::uint8_t> &Source, int SourceIndex, std::vector<std::uint8_t> &Destination, int DestinationIndex, int Length);
     public:
         //线程安全
         void RaiseError(std::u16string CommandName, std::u16string Message);
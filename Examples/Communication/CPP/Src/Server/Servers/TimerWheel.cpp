@@ -0,0 +1,132 @@
+﻿#include "TimerWheel.h"
+
+#include <stdexcept>
+
+namespace Server
+{
+    TimerWheel::TimerWheel(asio::io_service &IoService, int TickMilliseconds)
+        : IoService(IoService), Tick(std::max(TickMilliseconds, 1)), Origin(std::chrono::steady_clock::now()), CurrentTick(0), IsRunning(false)
+    {
+        Slots.resize(NumLevel() * NumSlot());
+    }
+
+    void TimerWheel::Start()
+    {
+        std::unique_lock<std::mutex> Lock(Lockee);
+        if (IsRunning) { throw std::logic_error("InvalidOperationException"); }
+        IsRunning = true;
+        Origin = std::chrono::steady_clock::now();
+        CurrentTick = 0;
+        Timer = std::make_shared<asio::steady_timer>(IoService);
+        Wait();
+    }
+
+    void TimerWheel::Stop()
+    {
+        std::shared_ptr<asio::steady_timer> t;
+        std::vector<std::vector<Entry>> Removed;
+        {
+            std::unique_lock<std::mutex> Lock(Lockee);
+            if (!IsRunning) { return; }
+            IsRunning = false;
+            t = Timer;
+            Timer = nullptr;
+            Removed.resize(Slots.size());
+            Slots.swap(Removed);
+        }
+        if (t != nullptr)
+        {
+            asio::error_code ec;
+            t->cancel(ec);
+        }
+    }
+
+    void TimerWheel::Schedule(std::chrono::steady_clock::time_point Deadline, std::function<void()> Callback)
+    {
+        std::unique_lock<std::mutex> Lock(Lockee);
+        if (!IsRunning) { return; }
+        auto Offset = std::chrono::duration_cast<std::chrono::milliseconds>(Deadline - Origin).count();
+        auto DeadlineTick = Offset <= 0 ? static_cast<std::uint64_t>(0) : static_cast<std::uint64_t>((Offset + Tick.count() - 1) / Tick.count());
+        if (DeadlineTick <= CurrentTick)
+        {
+            DeadlineTick = CurrentTick + 1;
+        }
+        Entry e;
+        e.DeadlineTick = DeadlineTick;
+        e.Callback = std::move(Callback);
+        Insert(std::move(e));
+    }
+
+    void TimerWheel::Insert(Entry e)
+    {
+        //按距离到期的间隔数选择层，超出最高层范围的项放在最高层最远的格中，下放时重新计算
+        auto Delta = e.DeadlineTick > CurrentTick ? e.DeadlineTick - CurrentTick : static_cast<std::uint64_t>(0);
+        auto Mask = static_cast<std::uint64_t>(NumSlot() - 1);
+        for (int Level = 0; Level < NumLevel(); Level += 1)
+        {
+            auto Shift = NumSlotBits() * Level;
+            if ((Delta >> (Shift + NumSlotBits())) == 0)
+            {
+                auto Slot = static_cast<int>((e.DeadlineTick >> Shift) & Mask);
+                Slots[Level * NumSlot() + Slot].push_back(std::move(e));
+                return;
+            }
+        }
+        auto Shift = NumSlotBits() * (NumLevel() - 1);
+        auto Slot = static_cast<int>(((CurrentTick >> Shift) + Mask) & Mask);
+        Slots[(NumLevel() - 1) * NumSlot() + Slot].push_back(std::move(e));
+    }
+
+    void TimerWheel::Advance(std::vector<std::function<void()>> &Callbacks)
+    {
+        CurrentTick += 1;
+        auto Mask = static_cast<std::uint64_t>(NumSlot() - 1);
+
+        //先从高层到低层下放本间隔所在的格
+        for (int Level = NumLevel() - 1; Level >= 1; Level -= 1)
+        {
+            auto LowerShift = NumSlotBits() * Level;
+            if ((CurrentTick & ((static_cast<std::uint64_t>(1) << LowerShift) - 1)) != 0) { continue; }
+            auto Slot = static_cast<int>((CurrentTick >> LowerShift) & Mask);
+            std::vector<Entry> Entries;
+            Entries.swap(Slots[Level * NumSlot() + Slot]);
+            for (auto &e : Entries)
+            {
+                Insert(std::move(e));
+            }
+        }
+
+        auto &Expired = Slots[static_cast<int>(CurrentTick & Mask)];
+        for (auto &e : Expired)
+        {
+            Callbacks.push_back(std::move(e.Callback));
+        }
+        Expired.clear();
+    }
+
+    void TimerWheel::Wait()
+    {
+        auto Self = shared_from_this();
+        Timer->expires_at(Origin + Tick * static_cast<std::int64_t>(CurrentTick + 1));
+        Timer->async_wait([Self](const asio::error_code &ec)
+        {
+            if (ec) { return; }
+            std::vector<std::function<void()>> Callbacks;
+            {
+                std::unique_lock<std::mutex> Lock(Self->Lockee);
+                if (!Self->IsRunning) { return; }
+                //定时器触发延迟时补齐落后的间隔
+                auto Target = static_cast<std::uint64_t>((std::chrono::steady_clock::now() - Self->Origin) / Self->Tick);
+                do
+                {
+                    Self->Advance(Callbacks);
+                } while (Self->CurrentTick < Target);
+                Self->Wait();
+            }
+            for (auto &Callback : Callbacks)
+            {
+                Callback();
+            }
+        });
+    }
+}
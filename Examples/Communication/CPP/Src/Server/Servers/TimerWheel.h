@@ -0,0 +1,60 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <asio.hpp>
+#include <asio/steady_timer.hpp>
+#ifdef _MSC_VER
+#undef SendMessage
+#endif
+
+namespace Server
+{
+    /// <summary>
+    /// 分层时间轮，由一个io_service上的定时器按固定间隔推进，每次只触发到期的项。
+    /// 第0层每格一个间隔，每层256格，上一层的一格在下一层转完一圈时下放到下一层。
+    /// 回调在锁外执行，不支持取消，回调中应自行判断是否仍需处理。
+    /// 本类的所有公共成员均是线程安全的。
+    /// </summary>
+    class TimerWheel : public std::enable_shared_from_this<TimerWheel>
+    {
+    private:
+        class Entry
+        {
+        public:
+            std::uint64_t DeadlineTick;
+            std::function<void()> Callback;
+        };
+
+        static int NumLevel() { return 3; }
+        static int NumSlotBits() { return 8; }
+        static int NumSlot() { return 1 << NumSlotBits(); }
+
+        asio::io_service &IoService;
+        std::chrono::milliseconds Tick;
+        std::chrono::steady_clock::time_point Origin;
+        std::uint64_t CurrentTick;
+        std::vector<std::vector<Entry>> Slots;
+        std::shared_ptr<asio::steady_timer> Timer;
+        bool IsRunning;
+        std::mutex Lockee;
+
+    public:
+        TimerWheel(asio::io_service &IoService, int TickMilliseconds);
+
+        void Start();
+        void Stop();
+
+        /// <summary>在Deadline之后的第一个间隔触发Callback，若Deadline已过则在下一个间隔触发</summary>
+        void Schedule(std::chrono::steady_clock::time_point Deadline, std::function<void()> Callback);
+
+    private:
+        void Insert(Entry e);
+        void Advance(std::vector<std::function<void()>> &Callbacks);
+        void Wait();
+    };
+}
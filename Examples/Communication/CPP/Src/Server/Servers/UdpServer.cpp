@@ -10,9 +10,13 @@
 #include <cstring>
 #include <limits>
 #include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <exception>
 #include <typeinfo>
+#ifdef __linux__
+#include <sys/socket.h>
+#endif
 
 namespace Server
 {
@@ -30,11 +34,21 @@ namespace Server
         MaxConnectionsValue(Optional<int>::CreateNotHasValue()),
         MaxConnectionsPerIPValue(Optional<int>::CreateNotHasValue()),
         MaxUnauthenticatedPerIPValue(Optional<int>::CreateNotHasValue()),
-        TimeoutCheckPeriodValue(30),
+        ReusePortValue(false),
+        BatchedIoValue(false),
+        BatchSizeValue(32),
+        EnableCongestionControlValue(true),
+        SelectiveAckValue(true),
+        MaxConcurrentCommandsValue(0),
         SessionMappings(std::make_shared<std::unordered_map<std::shared_ptr<ISessionContext>, std::shared_ptr<UdpSession>>>())
     {
         ServerContext(sc);
     }
+    UdpServer::UdpServer(std::shared_ptr<IoServicePool> Shards, std::shared_ptr<IServerContext> sc, std::function<std::pair<std::shared_ptr<IServerImplementation>, std::shared_ptr<IStreamedVirtualTransportServer>>(std::shared_ptr<ISessionContext>, std::shared_ptr<IBinaryTransformer>)> VirtualTransportServerFactory, std::function<void(std::function<void()>)> PurifierQueueUserWorkItem)
+        : UdpServer(Shards->IoService(0), sc, VirtualTransportServerFactory, Shards->QueueUserWorkItem(0), PurifierQueueUserWorkItem)
+    {
+        this->Shards = Shards;
+    }
 
     void UdpServer::OnMaxConnectionsExceeded(std::shared_ptr<UdpSession> s)
     {
@@ -51,59 +65,60 @@ namespace Server
         }
     }
 
-    void UdpServer::DoTimeoutCheck()
+    void UdpServer::ScheduleSessionIdleCheck(std::shared_ptr<UdpSession> s, std::chrono::steady_clock::time_point Deadline)
     {
-        auto TimePeriod = std::chrono::seconds(std::max(TimeoutCheckPeriodValue, 1));
-        auto WaitHandler = [this, TimePeriod](const asio::error_code& ec)
+        std::weak_ptr<UdpSession> ws = s;
+        s->Wheel->Schedule(Deadline, [this, ws]()
         {
-            if (!ec)
+            auto s = ws.lock();
+            if (s == nullptr) { return; }
+            CheckSessionIdle(s);
+        });
+    }
+    void UdpServer::CheckSessionIdle(std::shared_ptr<UdpSession> s)
+    {
+        //每个会话只在自己的超时时刻被检查一次，未超时则按最后活动时间重新登记
+        auto Exists = false;
+        auto IsAuthenticated = false;
+        SessionSets.DoAction([&](std::shared_ptr<ServerSessionSets> ss)
+        {
+            if (ss->Sessions.count(s) == 0) { return; }
+            Exists = true;
+            auto IpAddress = s->RemoteEndPoint.address();
+            if (ss->IpSessions.count(IpAddress) > 0)
             {
-                if (UnauthenticatedSessionIdleTimeoutValue.HasValue)
-                {
-                    auto CheckTime = std::chrono::steady_clock::now() + std::chrono::seconds(-UnauthenticatedSessionIdleTimeoutValue.Value());
-                    SessionSets.DoAction([&](std::shared_ptr<ServerSessionSets> ss)
-                    {
-                        for (auto s : ss->Sessions)
-                        {
-                            auto IpAddress = s->RemoteEndPoint.address();
-                            auto isi = ss->IpSessions[IpAddress];
-                            if (isi->Authenticated.count(s) == 0)
-                            {
-                                if (s->LastActiveTime() < CheckTime)
-                                {
-                                    PurifyConsumer->Push(s);
-                                }
-                            }
-                        }
-                    });
-                }
+                IsAuthenticated = ss->IpSessions[IpAddress]->Authenticated.count(s) > 0;
+            }
+        });
+        if (!Exists) { return; }
 
-                if (SessionIdleTimeoutValue.HasValue)
-                {
-                    auto CheckTime = std::chrono::steady_clock::now() + std::chrono::seconds(-SessionIdleTimeoutValue.Value());
-                    SessionSets.DoAction([&](std::shared_ptr<ServerSessionSets> ss)
-                    {
-                        for (auto s : ss->Sessions)
-                        {
-                            auto IpAddress = s->RemoteEndPoint.address();
-                            auto isi = ss->IpSessions[IpAddress];
-                            if (isi->Authenticated.count(s) > 0)
-                            {
-                                if (s->LastActiveTime() < CheckTime)
-                                {
-                                    PurifyConsumer->Push(s);
-                                }
-                            }
-                        }
-                    });
-                }
+        auto Timeout = IsAuthenticated ? SessionIdleTimeoutValue : UnauthenticatedSessionIdleTimeoutValue;
+        if (!Timeout.OnHasValue()) { return; }
+        auto Deadline = s->LastActiveTime() + std::chrono::seconds(Timeout.Value());
+        if (Deadline <= std::chrono::steady_clock::now())
+        {
+            PurifyConsumer->Push(s);
+            return;
+        }
+        ScheduleSessionIdleCheck(s, Deadline);
+    }
 
-                DoTimeoutCheck();
+    std::shared_ptr<std::vector<std::uint8_t>> UdpServer::BindingInfo::TakeReadSlot()
+    {
+        //引用计数为1表示只有缓冲池持有该槽，之前的数据包已处理完成
+        for (std::size_t k = 0; k < ReadSlots.size(); k += 1)
+        {
+            auto &Slot = ReadSlots[ReadSlotCursor];
+            ReadSlotCursor = (ReadSlotCursor + 1) % ReadSlots.size();
+            if (Slot.use_count() == 1)
+            {
+                std::atomic_thread_fence(std::memory_order_acquire);
+                return Slot;
             }
-        };
-        LastActiveTimeCheckTimer = std::make_shared<asio::steady_timer>(this->IoService);
-        LastActiveTimeCheckTimer->expires_from_now(TimePeriod);
-        LastActiveTimeCheckTimer->async_wait(WaitHandler);
+        }
+        auto Slot = std::make_shared<std::vector<std::uint8_t>>();
+        Slot->reserve(UdpSession::MaxPacketLength());
+        return Slot;
     }
 
     static void ArrayCopy(const std::vector<std::uint8_t> &Source, int SourceIndex, std::vector<std::uint8_t> &Destination, int DestinationIndex, int Length)
@@ -162,6 +177,13 @@ namespace Server
 
             ListeningTaskToken = std::make_shared<BaseSystem::CancellationToken>();
 
+            auto NumShard = Shards != nullptr ? Shards->NumShard() : 1;
+#ifdef SO_REUSEPORT
+            auto UseReusePort = (Shards != nullptr) && ReusePortValue;
+#else
+            auto UseReusePort = false;
+#endif
+
             auto Purify = [=](std::shared_ptr<UdpSession> StoppingSession)
             {
                 SessionSets.DoAction([=](std::shared_ptr<ServerSessionSets> ss)
@@ -181,22 +203,22 @@ namespace Server
                             ss->IpSessions.erase(IpAddress);
                         }
                         auto SessionId = StoppingSession->SessionId();
-                        ss->SessionIdToSession.erase(SessionId);
+                        SessionIdToSession.Remove(SessionId, StoppingSession);
                     }
                 });
                 StoppingSession->Stop();
             };
 
-            auto Accept = [=](std::shared_ptr<AcceptingInfo> a)
+            auto Accept = [=](const AcceptingInfo &a)
             {
-                auto ep = a->RemoteEndPoint;
+                auto ep = a.RemoteEndPoint;
                 std::shared_ptr<UdpSession> s = nullptr;
 
                 try
                 {
                     ExceptionStackTrace::Execute([&]()
                     {
-                        auto Buffer = a->ReadBuffer;
+                        auto Buffer = a.ReadBuffer;
                         if (Buffer->size() < 12) { return; }
                         auto SessionId = (*Buffer)[0] | (static_cast<std::int32_t>((*Buffer)[1]) << 8) | (static_cast<std::int32_t>((*Buffer)[2]) << 16) | (static_cast<std::int32_t>((*Buffer)[3]) << 24);
                         auto Flag = (*Buffer)[4] | (static_cast<std::int32_t>((*Buffer)[5]) << 8);
@@ -221,7 +243,10 @@ namespace Server
                             if ((Flag & 8) != 0) { return; }
                             auto Offset = 12;
 
-                            s = std::make_shared<UdpSession>(*this, a->Socket, ep, VirtualTransportServerFactory, QueueUserWorkItem);
+                            auto ShardIndex = Shards == nullptr ? 0 : (UseReusePort ? a.ShardIndex : Shards->NextShardIndex());
+                            auto SessionQueueUserWorkItem = Shards != nullptr ? Shards->QueueUserWorkItem(ShardIndex) : QueueUserWorkItem;
+                            auto SessionTimerWheel = TimerWheels[ShardIndex];
+                            s = std::make_shared<UdpSession>(*this, a.Socket, ep, VirtualTransportServerFactory, SessionQueueUserWorkItem, SessionTimerWheel);
                             SessionId = s->SessionId();
 
                             if (MaxConnectionsValue.OnHasValue() && (SessionSets.Check<int>([=](std::shared_ptr<ServerSessionSets> ss) { return static_cast<int>(ss->Sessions.size()); }) >= MaxConnectionsValue.Value()))
@@ -263,6 +288,11 @@ namespace Server
 
                             SessionSets.DoAction([&](std::shared_ptr<ServerSessionSets> ss)
                             {
+                                while ((SessionId == 0) || !SessionIdToSession.TryAdd(SessionId, s))
+                                {
+                                    s = std::make_shared<UdpSession>(*this, a.Socket, ep, VirtualTransportServerFactory, SessionQueueUserWorkItem, SessionTimerWheel);
+                                    SessionId = s->SessionId();
+                                }
                                 ss->Sessions.insert(s);
                                 if (ss->IpSessions.count(ep.address()) > 0)
                                 {
@@ -274,16 +304,21 @@ namespace Server
                                     isi->Count += 1;
                                     ss->IpSessions[ep.address()] = isi;
                                 }
-                                while ((SessionId == 0) || (ss->SessionIdToSession.count(SessionId) > 0))
-                                {
-                                    s = std::make_shared<UdpSession>(*this, a->Socket, ep, VirtualTransportServerFactory, QueueUserWorkItem);
-                                    SessionId = s->SessionId();
-                                }
-                                ss->SessionIdToSession[SessionId] = s;
                             });
 
+                            //如果Flag中包含SAK，则客户端支持位图格式的确认
+                            if (((Flag & 16) != 0) && SelectiveAckValue)
+                            {
+                                s->SelectiveAck(true);
+                            }
+
                             s->Start();
 
+                            if (UnauthenticatedSessionIdleTimeoutValue.OnHasValue())
+                            {
+                                ScheduleSessionIdleCheck(s, s->LastActiveTime() + std::chrono::seconds(UnauthenticatedSessionIdleTimeoutValue.Value()));
+                            }
+
                             s->PrePush([=]()
                             {
                                 if (!s->Push(ep, Index, nullptr, Buffer, Offset, static_cast<int>(Buffer->size()) - Offset))
@@ -294,17 +329,8 @@ namespace Server
                         }
                         else
                         {
-                            auto Close = false;
-                            SessionSets.DoAction([&](std::shared_ptr<ServerSessionSets> ss)
-                            {
-                                if (ss->SessionIdToSession.count(SessionId) == 0)
-                                {
-                                    Close = true;
-                                    return;
-                                }
-                                s = ss->SessionIdToSession[SessionId];
-                            });
-                            if (Close)
+                            s = SessionIdToSession.Find(SessionId);
+                            if (s == nullptr)
                             {
                                 return;
                             }
@@ -327,16 +353,8 @@ namespace Server
                                 }
                                 if (IsEncrypted)
                                 {
-                                    std::vector<std::uint8_t> SHABuffer;
-                                    SHABuffer.resize(4);
-                                    ArrayCopy(*Buffer, 4, SHABuffer, 0, 4);
-                                    auto SHA256 = Algorithms::Cryptography::SHA256(SHABuffer);
-                                    std::vector<std::uint8_t> Key;
-                                    Key.resize(SecureContext->ClientToken.size() + SHA256.size());
-                                    ArrayCopy(SecureContext->ClientToken, 0, Key, 0, static_cast<int>(SecureContext->ClientToken.size()));
-                                    ArrayCopy(SHA256, 0, Key, static_cast<int>(SecureContext->ClientToken.size()), static_cast<int>(SHA256.size()));
-                                    auto HMACBytes = Algorithms::Cryptography::HMACSHA256Simple(Key, *Buffer);
-                                    HMACBytes.resize(4);
+                                    auto SHA256 = Algorithms::Cryptography::SHA256(std::span<const std::uint8_t>(Buffer->data() + 4, 4));
+                                    auto HMACBytes = SecureContext->ClientTokenHMAC().Compute(SHA256, *Buffer);
                                     auto HMAC = HMACBytes[0] | (static_cast<std::int32_t>(HMACBytes[1]) << 8) | (static_cast<std::int32_t>(HMACBytes[2]) << 16) | (static_cast<std::int32_t>(HMACBytes[3]) << 24);
                                     if (HMAC != Verification) { return; }
                                 }
@@ -345,27 +363,11 @@ namespace Server
                                 std::shared_ptr<std::vector<int>> Indices = nullptr;
                                 if ((Flag & 1) != 0)
                                 {
-                                    if (static_cast<int>(Buffer->size()) < 14)
-                                    {
-                                        return;
-                                    }
-                                    auto NumIndex = (*Buffer)[Offset] | (static_cast<std::int32_t>((*Buffer)[Offset + 1]) << 8);
-                                    if (static_cast<int>(Buffer->size()) < 14 + NumIndex * 2)
-                                    {
-                                        return;
-                                    }
-                                    if (NumIndex > UdpSession::WritingWindowSize()) //若Index数量较大，则丢弃包
-                                    {
-                                        return;
-                                    }
-                                    Offset += 2;
                                     Indices = std::make_shared<std::vector<int>>();
-                                    Indices->resize(NumIndex, 0);
-                                    for (int k = 0; k < NumIndex; k += 1)
+                                    if (!UdpSession::TryReadAck(*Buffer, Offset, (Flag & 16) != 0, *Indices)) //长度不足或Index数量较大，则丢弃包
                                     {
-                                        (*Indices)[k] = (*Buffer)[Offset + k * 2] | (static_cast<std::int32_t>((*Buffer)[Offset + k * 2 + 1]) << 8);
+                                        return;
                                     }
-                                    Offset += NumIndex * 2;
                                 }
 
 
@@ -419,6 +421,7 @@ namespace Server
                                         }
 
                                         s->RemoteEndPoint = ep;
+                                        s->LogSource = SessionLogSource::Create(ep.address(), ep.port(), s->LogSource.SessionId);
                                     });
                                 }
 
@@ -444,14 +447,7 @@ namespace Server
                 {
                     if (ServerContext()->EnableLogSystem())
                     {
-                        auto e = std::make_shared<SessionLogEntry>();
-                        e->Token = u"";
-                        e->RemoteEndPoint = systemToUtf16(ep.address().to_string()) + u":" + ToU16String(ep.port());
-                        e->Time = UtcNow();
-                        e->Type = u"Sys";
-                        e->Name = u"Exception";
-                        e->Message = systemToUtf16(std::string() + typeid(*(&ex)).name() + "\r\n" + ex.what() + "\r\n" + ExceptionStackTrace::GetStackTrace());
-                        ServerContext()->RaiseSessionLog(e);
+                        ServerContext()->RaiseSessionLog(SessionLogType::Sys, SessionLogSource::Create(ep.address(), ep.port()), u"Exception", systemToUtf16(std::string() + typeid(*(&ex)).name() + "\r\n" + ex.what() + "\r\n" + ExceptionStackTrace::GetStackTrace()));
                     }
                     if (s != nullptr)
                     {
@@ -459,7 +455,28 @@ namespace Server
                     }
                 }
             };
-            AcceptConsumer = std::make_shared<BaseSystem::AsyncConsumer<std::shared_ptr<AcceptingInfo>>>(QueueUserWorkItem, [=](std::shared_ptr<AcceptingInfo> a) { Accept(a); return true; }, std::numeric_limits<int>::max());
+            AcceptConsumers.clear();
+            AcceptBatchConsumers.clear();
+            for (int k = 0; k < NumShard; k += 1)
+            {
+                auto ShardQueueUserWorkItem = Shards != nullptr ? Shards->QueueUserWorkItem(k) : QueueUserWorkItem;
+                AcceptConsumers.push_back(std::make_shared<BaseSystem::AsyncConsumer<std::shared_ptr<AcceptingInfo>>>(ShardQueueUserWorkItem, [=](std::shared_ptr<AcceptingInfo> a) { Accept(*a); return true; }, std::numeric_limits<int>::max()));
+                AcceptBatchConsumers.push_back(std::make_shared<BaseSystem::AsyncConsumer<std::shared_ptr<std::vector<AcceptingInfo>>>>(ShardQueueUserWorkItem, [=](std::shared_ptr<std::vector<AcceptingInfo>> Batch)
+                {
+                    for (auto &a : *Batch)
+                    {
+                        Accept(a);
+                    }
+                    return true;
+                }, std::numeric_limits<int>::max()));
+            }
+
+#ifdef __linux__
+            auto UseBatchedIo = BatchedIoValue;
+#else
+            auto UseBatchedIo = false;
+#endif
+            auto NumBatch = std::max(BatchSizeValue, 1);
 
             auto Exceptions = std::make_shared<std::vector<asio::error_code>>();
             auto Bindings = std::make_shared<std::vector<asio::ip::udp::endpoint>>();
@@ -476,107 +493,215 @@ namespace Server
                     Bindings->push_back(Binding);
                 }
             }
+            auto NumSocketPerBinding = UseReusePort ? NumShard : 1;
+            auto BindingIndex = 0;
             for (auto Binding : *Bindings)
             {
-                auto CreateSocket = [=]() -> std::shared_ptr<asio::ip::udp::socket>
+                for (int SocketIndex = 0; SocketIndex < NumSocketPerBinding; SocketIndex += 1)
                 {
-                    auto s = std::make_shared<asio::ip::udp::socket>(IoService);
-
-                    if (Binding.address().is_v4())
-                    {
-                        s->open(asio::ip::udp::v4());
-                    }
-                    else
+                    //ReusePort时每个分片一个套接字，由内核按来源地址在各套接字间分配数据包；否则各绑定按轮转方式分布在各分片上
+                    auto ShardIndex = UseReusePort ? SocketIndex : (BindingIndex % NumShard);
+                    auto SocketIoService = Shards != nullptr ? &Shards->IoService(ShardIndex) : &IoService;
+                    auto SocketQueueUserWorkItem = Shards != nullptr ? Shards->QueueUserWorkItem(ShardIndex) : QueueUserWorkItem;
+                    auto CreateSocket = [=]() -> std::shared_ptr<asio::ip::udp::socket>
                     {
-                        s->open(asio::ip::udp::v6());
-                    }
+                        auto s = std::make_shared<asio::ip::udp::socket>(*SocketIoService);
+
+                        if (Binding.address().is_v4())
+                        {
+                            s->open(asio::ip::udp::v4());
+                        }
+                        else
+                        {
+                            s->open(asio::ip::udp::v6());
+                        }
 
 #if _MSC_VER
-                    //在Windows下关闭SIO_UDP_CONNRESET报告，防止接受数据出错
-                    //http://support.microsoft.com/kb/263823/en-us
-                    connection_reset_command command;
-                    s->io_control(command);
+                        //在Windows下关闭SIO_UDP_CONNRESET报告，防止接受数据出错
+                        //http://support.microsoft.com/kb/263823/en-us
+                        connection_reset_command command;
+                        s->io_control(command);
+#endif
+#ifdef SO_REUSEPORT
+                        if (UseReusePort)
+                        {
+                            typedef asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT> reuse_port;
+                            s->set_option(asio::ip::udp::socket::reuse_address(true));
+                            s->set_option(reuse_port(true));
+                        }
 #endif
-                    return s;
-                };
+                        return s;
+                    };
 
-                auto Socket = CreateSocket();
+                    auto Socket = CreateSocket();
 
-                asio::error_code ec;
-                Socket->bind(Binding, ec);
-                if (ec)
-                {
-                    Exceptions->push_back(ec);
-                    continue;
-                }
+                    asio::error_code ec;
+                    Socket->bind(Binding, ec);
+                    if (ec)
+                    {
+                        Exceptions->push_back(ec);
+                        continue;
+                    }
 
-                auto bi = std::make_shared<BindingInfo>();
-                bi->EndPoint = Binding;
-                bi->Socket = std::make_shared<BaseSystem::LockedVariable<std::shared_ptr<asio::ip::udp::socket>>>(Socket);
-                bi->ReadBuffer = std::make_shared<std::vector<std::uint8_t>>();
-                bi->ReadBuffer->resize(UdpSession::MaxPacketLength());
-                auto bip = &*bi;
-                auto Completed = [this, Binding, CreateSocket, bip](std::shared_ptr<AcceptResult> args) -> bool
-                {
-                    if (ListeningTaskToken->IsCancellationRequested()) { return false; }
-                    if (!args->ec)
+                    auto bi = std::make_shared<BindingInfo>();
+                    bi->EndPoint = Binding;
+                    bi->ShardIndex = ShardIndex;
+                    bi->Socket = std::make_shared<BaseSystem::LockedVariable<std::shared_ptr<asio::ip::udp::socket>>>(Socket);
+                    bi->ReadBuffer = std::make_shared<std::vector<std::uint8_t>>();
+                    bi->ReadBuffer->resize(UdpSession::MaxPacketLength());
+                    auto bip = &*bi;
+                    if (UseBatchedIo)
                     {
-                        auto Count = args->BytesTransferred;
-                        auto ReadBuffer = std::make_shared<std::vector<std::uint8_t>>();
-                        ReadBuffer->resize(Count, 0);
-                        ArrayCopy(*bip->ReadBuffer, 0, *ReadBuffer, 0, static_cast<int>(Count));
-                        auto a = std::make_shared<AcceptingInfo>();
-                        a->Socket = bip->Socket->Check<std::shared_ptr<asio::ip::udp::socket>>([](std::shared_ptr<asio::ip::udp::socket> s) { return s; });
-                        a->ReadBuffer = ReadBuffer;
-                        a->RemoteEndPoint = args->RemoteEndPoint;
-                        AcceptConsumer->Push(a);
+                        for (int k = 0; k < NumBatch * 2; k += 1)
+                        {
+                            auto Slot = std::make_shared<std::vector<std::uint8_t>>();
+                            Slot->reserve(UdpSession::MaxPacketLength());
+                            bi->ReadSlots.push_back(Slot);
+                        }
+#ifdef __linux__
+                        bi->ReadMessages.resize(NumBatch);
+                        bi->ReadIoVectors.resize(NumBatch);
+                        bi->ReadAddresses.resize(NumBatch);
+#endif
                     }
-                    else
+                    auto ReceiveBatch = [this, bip, NumBatch]()
                     {
-                        bip->Socket->Update([=](std::shared_ptr<asio::ip::udp::socket> OriginalSocket) -> std::shared_ptr<asio::ip::udp::socket>
+#ifdef __linux__
+                        //使用recvmmsg一次读取多个数据包到缓冲池的槽中，不再复制，整批交给所在分片的AcceptBatchConsumer按SessionId分发到各会话
+                        auto bs = bip->Socket->Check<std::shared_ptr<asio::ip::udp::socket>>([](std::shared_ptr<asio::ip::udp::socket> s) { return s; });
+                        if (bs == nullptr) { return; }
+                        std::vector<std::shared_ptr<std::vector<std::uint8_t>>> Slots;
+                        Slots.resize(NumBatch);
+                        //限制每次就绪时的读取轮数，以免长时间占用线程
+                        for (int Round = 0; Round < 16; Round += 1)
                         {
-                            return nullptr;
-                        });
-                        bip->Socket->Update([=](std::shared_ptr<asio::ip::udp::socket> OriginalSocket) -> std::shared_ptr<asio::ip::udp::socket>
+                            for (int k = 0; k < NumBatch; k += 1)
+                            {
+                                Slots[k] = bip->TakeReadSlot();
+                                Slots[k]->resize(UdpSession::MaxPacketLength());
+                                auto &v = bip->ReadIoVectors[k];
+                                v.iov_base = Slots[k]->data();
+                                v.iov_len = Slots[k]->size();
+                                auto &m = bip->ReadMessages[k];
+                                std::memset(&m, 0, sizeof(m));
+                                m.msg_hdr.msg_name = &bip->ReadAddresses[k];
+                                m.msg_hdr.msg_namelen = sizeof(bip->ReadAddresses[k]);
+                                m.msg_hdr.msg_iov = &v;
+                                m.msg_hdr.msg_iovlen = 1;
+                            }
+                            auto Count = recvmmsg(bs->native_handle(), bip->ReadMessages.data(), static_cast<unsigned int>(NumBatch), MSG_DONTWAIT, nullptr);
+                            if (Count <= 0) { break; }
+                            auto Batch = std::make_shared<std::vector<AcceptingInfo>>();
+                            Batch->reserve(static_cast<std::size_t>(Count));
+                            for (int k = 0; k < Count; k += 1)
+                            {
+                                auto &m = bip->ReadMessages[k];
+                                if ((m.msg_hdr.msg_flags & MSG_TRUNC) != 0) { continue; }
+                                Slots[k]->resize(m.msg_len);
+                                AcceptingInfo a;
+                                a.Socket = bs;
+                                a.ReadBuffer = Slots[k];
+                                a.ShardIndex = bip->ShardIndex;
+                                std::memcpy(a.RemoteEndPoint.data(), &bip->ReadAddresses[k], m.msg_hdr.msg_namelen);
+                                a.RemoteEndPoint.resize(m.msg_hdr.msg_namelen);
+                                Batch->push_back(a);
+                            }
+                            if (Batch->size() > 0)
+                            {
+                                AcceptBatchConsumers[bip->ShardIndex]->Push(Batch);
+                            }
+                            for (auto &Slot : Slots)
+                            {
+                                Slot = nullptr;
+                            }
+                            if (Count < NumBatch) { break; }
+                        }
+#endif
+                    };
+                    auto Completed = [this, Binding, CreateSocket, bip, UseBatchedIo, ReceiveBatch](std::shared_ptr<AcceptResult> args) -> bool
+                    {
+                        if (ListeningTaskToken->IsCancellationRequested()) { return false; }
+                        if (!args->ec && UseBatchedIo)
                         {
-                            auto NewSocket = CreateSocket();
-                            NewSocket->bind(Binding);
-                            return NewSocket;
-                        });
-                    }
-                    bip->Start();
-                    return true;
-                };
-                bi->ListenConsumer = std::make_shared<BaseSystem::AsyncConsumer<std::shared_ptr<AcceptResult>>>(QueueUserWorkItem, Completed, 1);
-                bi->Start = [this, bip]()
-                {
-                    auto bs = bip->Socket->Check<std::shared_ptr<asio::ip::udp::socket>>([](const std::shared_ptr<asio::ip::udp::socket> &s) { return s; });
-                    auto ReadBuffer = bip->ReadBuffer;
-                    auto RemoteEndPoint = std::make_shared<asio::ip::udp::endpoint>();
-                    auto ReadHandler = [=](const asio::error_code &ec, std::size_t Count)
+                            ReceiveBatch();
+                        }
+                        else if (!args->ec)
+                        {
+                            auto Count = args->BytesTransferred;
+                            auto ReadBuffer = std::make_shared<std::vector<std::uint8_t>>();
+                            ReadBuffer->resize(Count, 0);
+                            ArrayCopy(*bip->ReadBuffer, 0, *ReadBuffer, 0, static_cast<int>(Count));
+                            auto a = std::make_shared<AcceptingInfo>();
+                            a->Socket = bip->Socket->Check<std::shared_ptr<asio::ip::udp::socket>>([](std::shared_ptr<asio::ip::udp::socket> s) { return s; });
+                            a->ReadBuffer = ReadBuffer;
+                            a->RemoteEndPoint = args->RemoteEndPoint;
+                            a->ShardIndex = bip->ShardIndex;
+                            AcceptConsumers[bip->ShardIndex]->Push(a);
+                        }
+                        else
+                        {
+                            bip->Socket->Update([=](std::shared_ptr<asio::ip::udp::socket> OriginalSocket) -> std::shared_ptr<asio::ip::udp::socket>
+                            {
+                                return nullptr;
+                            });
+                            bip->Socket->Update([=](std::shared_ptr<asio::ip::udp::socket> OriginalSocket) -> std::shared_ptr<asio::ip::udp::socket>
+                            {
+                                auto NewSocket = CreateSocket();
+                                NewSocket->bind(Binding);
+                                return NewSocket;
+                            });
+                        }
+                        bip->Start();
+                        return true;
+                    };
+                    bi->ListenConsumer = std::make_shared<BaseSystem::AsyncConsumer<std::shared_ptr<AcceptResult>>>(SocketQueueUserWorkItem, Completed, 1);
+                    bi->Start = [this, bip, UseBatchedIo]()
                     {
-                        if (ec == asio::error::operation_aborted) { return; }
-                        auto a = std::make_shared<AcceptResult>();
-                        a->ec = ec;
-                        a->BytesTransferred = Count;
-                        a->RemoteEndPoint = *RemoteEndPoint;
-                        bip->ListenConsumer->Push(a);
+                        auto bs = bip->Socket->Check<std::shared_ptr<asio::ip::udp::socket>>([](const std::shared_ptr<asio::ip::udp::socket> &s) { return s; });
+                        if (UseBatchedIo)
+                        {
+                            //批量读取模式下只等待可读，由ListenConsumer中的ReceiveBatch读取
+                            auto WaitHandler = [=](const asio::error_code &ec)
+                            {
+                                if (ec == asio::error::operation_aborted) { return; }
+                                auto a = std::make_shared<AcceptResult>();
+                                a->ec = ec;
+                                a->BytesTransferred = 0;
+                                bip->ListenConsumer->Push(a);
+                            };
+                            bs->async_wait(asio::ip::udp::socket::wait_read, WaitHandler);
+                            return;
+                        }
+                        auto ReadBuffer = bip->ReadBuffer;
+                        auto RemoteEndPoint = std::make_shared<asio::ip::udp::endpoint>();
+                        auto ReadHandler = [=](const asio::error_code &ec, std::size_t Count)
+                        {
+                            if (ec == asio::error::operation_aborted) { return; }
+                            auto a = std::make_shared<AcceptResult>();
+                            a->ec = ec;
+                            a->BytesTransferred = Count;
+                            a->RemoteEndPoint = *RemoteEndPoint;
+                            bip->ListenConsumer->Push(a);
+                        };
+                        bs->async_receive_from(asio::buffer(*ReadBuffer), *RemoteEndPoint, ReadHandler);
                     };
-                    bs->async_receive_from(asio::buffer(*ReadBuffer), *RemoteEndPoint, ReadHandler);
-                };
 
-                BindingInfos.push_back(bi);
+                    BindingInfos.push_back(bi);
+                }
+                BindingIndex += 1;
             }
             if (BindingInfos.size() == 0)
             {
                 throw std::logic_error("NoValidBinding");
             }
 
-            PurifyConsumer = std::make_shared<BaseSystem::AsyncConsumer<std::shared_ptr<UdpSession>>>(PurifierQueueUserWorkItem, [=](std::shared_ptr<UdpSession> s) { Purify(s); return true; }, std::numeric_limits<int>::max());
+            PurifyConsumer = std::make_shared<BaseSystem::MpscAsyncConsumer<std::shared_ptr<UdpSession>>>(PurifierQueueUserWorkItem, [=](std::shared_ptr<UdpSession> s) { Purify(s); return true; });
 
-            if (UnauthenticatedSessionIdleTimeoutValue.OnHasValue() || SessionIdleTimeoutValue.OnHasValue())
+            for (int k = 0; k < NumShard; k += 1)
             {
-                DoTimeoutCheck();
+                auto Wheel = std::make_shared<TimerWheel>(Shards != nullptr ? Shards->IoService(k) : IoService, TimerWheelTickMilliseconds());
+                Wheel->Start();
+                TimerWheels.push_back(Wheel);
             }
 
             for (auto BindingInfo : BindingInfos)
@@ -596,9 +721,9 @@ namespace Server
         {
             if (!b) { return false; }
 
-            if (LastActiveTimeCheckTimer != nullptr)
+            for (auto Wheel : TimerWheels)
             {
-                LastActiveTimeCheckTimer = nullptr;
+                Wheel->Stop();
             }
 
             if (ListeningTaskToken != nullptr)
@@ -623,10 +748,8 @@ namespace Server
                 ListeningTaskToken = nullptr;
             }
 
-            if (AcceptConsumer != nullptr)
-            {
-                AcceptConsumer = nullptr;
-            }
+            AcceptConsumers.clear();
+            AcceptBatchConsumers.clear();
 
             std::unordered_set<std::shared_ptr<UdpSession>> Sessions;
             SessionSets.DoAction([&](std::shared_ptr<ServerSessionSets> ss)
@@ -634,14 +757,16 @@ namespace Server
                 Sessions = ss->Sessions;
                 ss->Sessions.clear();
                 ss->IpSessions.clear();
-                ss->SessionIdToSession.clear();
             });
+            SessionIdToSession.Clear();
             for (auto s : Sessions)
             {
                 s->Stop();
             }
             Sessions.clear();
 
+            TimerWheels.clear();
+
             if (PurifyConsumer != nullptr)
             {
                 PurifyConsumer = nullptr;
@@ -669,6 +794,11 @@ namespace Server
                 }
             }
         });
+        //未设置未认证超时时，会话在认证前没有登记空闲检查
+        if (SessionIdleTimeoutValue.OnHasValue() && !UnauthenticatedSessionIdleTimeoutValue.OnHasValue())
+        {
+            ScheduleSessionIdleCheck(s, s->LastActiveTime() + std::chrono::seconds(SessionIdleTimeoutValue.Value()));
+        }
     }
 
     UdpServer::~UdpServer()
@@ -2,11 +2,15 @@
 
 #include "BaseSystem/LockedVariable.h"
 #include "BaseSystem/AsyncConsumer.h"
+#include "BaseSystem/MpscAsyncConsumer.h"
 #include "BaseSystem/CancellationToken.h"
 #include "BaseSystem/Optional.h"
 #include "Concept.h"
 #include "IContext.h"
 #include "StreamedServer.h"
+#include "IoServicePool.h"
+#include "SessionIdTable.h"
+#include "TimerWheel.h"
 
 #include <cstdint>
 #include <vector>
@@ -15,6 +19,7 @@
 #include <functional>
 #include <utility>
 #include <memory>
+#include <chrono>
 #include <stdexcept>
 #include <asio.hpp>
 #include <asio/steady_timer.hpp>
@@ -59,16 +64,36 @@ namespace Server
         {
         public:
             asio::ip::udp::endpoint EndPoint;
+            //套接字所在的分片，非分片模式下为0
+            int ShardIndex;
             std::shared_ptr<BaseSystem::LockedVariable<std::shared_ptr<asio::ip::udp::socket>>> Socket;
             std::shared_ptr<std::vector<std::uint8_t>> ReadBuffer;
             std::shared_ptr<BaseSystem::AsyncConsumer<std::shared_ptr<AcceptResult>>> ListenConsumer;
             std::function<void()> Start;
+
+            //批量读取模式下的缓冲池，只在ListenConsumer中访问，槽在数据包处理完成（不再被其他地方引用）后复用
+            //缓冲池大小固定为两批，一批在AcceptConsumer中处理时可读取下一批；没有空闲槽时临时分配，不放入缓冲池
+            std::vector<std::shared_ptr<std::vector<std::uint8_t>>> ReadSlots;
+            std::size_t ReadSlotCursor;
+#ifdef __linux__
+            std::vector<struct mmsghdr> ReadMessages;
+            std::vector<struct iovec> ReadIoVectors;
+            std::vector<struct sockaddr_storage> ReadAddresses;
+#endif
+
+            BindingInfo()
+                : ShardIndex(0), ReadSlotCursor(0)
+            {
+            }
+
+            std::shared_ptr<std::vector<std::uint8_t>> TakeReadSlot();
         };
 
         BaseSystem::LockedVariable<bool> IsRunningValue;
 
     private:
         asio::io_service &IoService;
+        std::shared_ptr<IoServicePool> Shards;
 
         std::vector<std::shared_ptr<BindingInfo>> BindingInfos;
         std::shared_ptr<BaseSystem::CancellationToken> ListeningTaskToken;
@@ -78,10 +103,17 @@ namespace Server
             std::shared_ptr<asio::ip::udp::socket> Socket;
             std::shared_ptr<std::vector<std::uint8_t>> ReadBuffer;
             asio::ip::udp::endpoint RemoteEndPoint;
+            //收到数据包的套接字所在的分片
+            int ShardIndex;
         };
-        std::shared_ptr<BaseSystem::AsyncConsumer<std::shared_ptr<AcceptingInfo>>> AcceptConsumer;
-        std::shared_ptr<BaseSystem::AsyncConsumer<std::shared_ptr<UdpSession>>> PurifyConsumer;
-        std::shared_ptr<asio::steady_timer> LastActiveTimeCheckTimer;
+        //数据包的校验和会话创建可并行执行，AcceptConsumer不限制并发数，每个分片一个，在收到数据包的套接字所在的分片上执行；PurifyConsumer只在会话集合的锁中做少量修改，单消费者批量处理即可
+        std::vector<std::shared_ptr<BaseSystem::AsyncConsumer<std::shared_ptr<AcceptingInfo>>>> AcceptConsumers;
+        //批量读取模式下一次recvmmsg读到的数据包整批交给所在分片处理，ListenConsumer只负责读取
+        std::vector<std::shared_ptr<BaseSystem::AsyncConsumer<std::shared_ptr<std::vector<AcceptingInfo>>>>> AcceptBatchConsumers;
+        std::shared_ptr<BaseSystem::MpscAsyncConsumer<std::shared_ptr<UdpSession>>> PurifyConsumer;
+        /// <summary>每个分片一个时间轮，用于会话的空闲超时检查和数据包重传</summary>
+        std::vector<std::shared_ptr<TimerWheel>> TimerWheels;
+        static int TimerWheelTickMilliseconds() { return 10; }
 
         struct IpAddressHash
         {
@@ -138,9 +170,10 @@ namespace Server
         public:
             std::unordered_set<std::shared_ptr<UdpSession>> Sessions;
             std::unordered_map<asio::ip::address, std::shared_ptr<IpSessionInfo>, IpAddressHash> IpSessions;
-            std::unordered_map<int, std::shared_ptr<UdpSession>> SessionIdToSession;
         };
         BaseSystem::LockedVariable<std::shared_ptr<ServerSessionSets>> SessionSets;
+        //收到的每个数据包都要查找，故不放在SessionSets中，查找只加分片的共享锁
+        SessionIdTable<UdpSession> SessionIdToSession;
 
     public:
         std::shared_ptr<IServerContext> ServerContext() const
@@ -165,7 +198,12 @@ namespace Server
         Optional<int> MaxConnectionsValue;
         Optional<int> MaxConnectionsPerIPValue;
         Optional<int> MaxUnauthenticatedPerIPValue;
-        int TimeoutCheckPeriodValue;
+        bool ReusePortValue;
+        bool BatchedIoValue;
+        int BatchSizeValue;
+        bool EnableCongestionControlValue;
+        bool SelectiveAckValue;
+        int MaxConcurrentCommandsValue;
 
     public:
         /// <summary>只能在启动前修改，以保证线程安全</summary>
@@ -260,28 +298,99 @@ namespace Server
                 MaxUnauthenticatedPerIPValue = value;
             });
         }
-        /// <summary>只能在启动前修改，以保证线程安全</summary>
-        int TimeoutCheckPeriod() const
+        /// <summary>分片模式下，每个绑定在每个分片上各使用一个设置了SO_REUSEPORT的套接字并行接收，在不支持SO_REUSEPORT的平台上无效，只能在启动前修改，以保证线程安全</summary>
+        bool ReusePort() const
+        {
+            return ReusePortValue;
+        }
+        void ReusePort(bool value)
+        {
+            IsRunningValue.DoAction([=](bool b)
+            {
+                if (b) { throw std::logic_error("InvalidOperationException"); }
+                ReusePortValue = value;
+            });
+        }
+        /// <summary>是否使用批量收发（recvmmsg/sendmmsg），仅在Linux下有效，只能在启动前修改，以保证线程安全</summary>
+        bool BatchedIo() const
+        {
+            return BatchedIoValue;
+        }
+        void BatchedIo(bool value)
+        {
+            IsRunningValue.DoAction([=](bool b)
+            {
+                if (b) { throw std::logic_error("InvalidOperationException"); }
+                BatchedIoValue = value;
+            });
+        }
+        /// <summary>批量收发时一次系统调用的最大数据包数量，只能在启动前修改，以保证线程安全</summary>
+        int BatchSize() const
+        {
+            return BatchSizeValue;
+        }
+        void BatchSize(int value)
+        {
+            IsRunningValue.DoAction([=](bool b)
+            {
+                if (b) { throw std::logic_error("InvalidOperationException"); }
+                BatchSizeValue = value;
+            });
+        }
+        /// <summary>是否使用往返时间估计和拥塞窗口，否则使用固定的重传时间表和写入窗口（兼容模式），只能在启动前修改，以保证线程安全</summary>
+        bool EnableCongestionControl() const
+        {
+            return EnableCongestionControlValue;
+        }
+        void EnableCongestionControl(bool value)
+        {
+            IsRunningValue.DoAction([=](bool b)
+            {
+                if (b) { throw std::logic_error("InvalidOperationException"); }
+                EnableCongestionControlValue = value;
+            });
+        }
+        /// <summary>客户端在INI包中声明支持时，是否对该会话使用位图格式的确认（SAK），只能在启动前修改，以保证线程安全</summary>
+        bool SelectiveAck() const
+        {
+            return SelectiveAckValue;
+        }
+        void SelectiveAck(bool value)
+        {
+            IsRunningValue.DoAction([=](bool b)
+            {
+                if (b) { throw std::logic_error("InvalidOperationException"); }
+                SelectiveAckValue = value;
+            });
+        }
+        /// <summary>每个会话中同时执行的可并发命令（Schema中标记为[Concurrent]）的最大数目，0表示全部命令依次执行，只能在启动前修改，以保证线程安全</summary>
+        int MaxConcurrentCommands() const
         {
-            return TimeoutCheckPeriodValue;
+            return MaxConcurrentCommandsValue;
         }
-        void TimeoutCheckPeriod(int value)
+        void MaxConcurrentCommands(int value)
         {
             IsRunningValue.DoAction([=](bool b)
             {
                 if (b) { throw std::logic_error("InvalidOperationException"); }
-                TimeoutCheckPeriodValue = value;
+                MaxConcurrentCommandsValue = value;
             });
         }
 
         BaseSystem::LockedVariable<std::shared_ptr<std::unordered_map<std::shared_ptr<ISessionContext>, std::shared_ptr<UdpSession>>>> SessionMappings;
 
         UdpServer(asio::io_service &IoService, std::shared_ptr<IServerContext> sc, std::function<std::pair<std::shared_ptr<IServerImplementation>, std::shared_ptr<IStreamedVirtualTransportServer>>(std::shared_ptr<ISessionContext>, std::shared_ptr<IBinaryTransformer>)> VirtualTransportServerFactory, std::function<void(std::function<void()>)> QueueUserWorkItem, std::function<void(std::function<void()>)> PurifierQueueUserWorkItem);
+        /// <summary>
+        /// 分片模式，使用ReusePort时每个绑定在每个分片上各有一个套接字，新会话分配到收到其初始包的分片；否则各绑定的套接字按轮转方式分布在各分片上，新会话按轮转方式分配到一个分片。
+        /// 数据包在收到它的套接字所在的分片上校验，通过PrePush投递到会话所在的分片
+        /// </summary>
+        UdpServer(std::shared_ptr<IoServicePool> Shards, std::shared_ptr<IServerContext> sc, std::function<std::pair<std::shared_ptr<IServerImplementation>, std::shared_ptr<IStreamedVirtualTransportServer>>(std::shared_ptr<ISessionContext>, std::shared_ptr<IBinaryTransformer>)> VirtualTransportServerFactory, std::function<void(std::function<void()>)> PurifierQueueUserWorkItem);
 
     private:
         void OnMaxConnectionsExceeded(std::shared_ptr<UdpSession> s);
         void OnMaxConnectionsPerIPExceeded(std::shared_ptr<UdpSession> s);
-        void DoTimeoutCheck();
+        void ScheduleSessionIdleCheck(std::shared_ptr<UdpSession> s, std::chrono::steady_clock::time_point Deadline);
+        void CheckSessionIdle(std::shared_ptr<UdpSession> s);
 
     public:
         void Start();
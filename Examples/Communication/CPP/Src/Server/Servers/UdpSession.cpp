@@ -4,25 +4,32 @@
 #include "BaseSystem/StringUtilities.h"
 #include "BaseSystem/Times.h"
 #include "BaseSystem/ExceptionStackTrace.h"
-#include "Rc4PacketServerTransformer.h"
+#include "SecurePacketServerTransformer.h"
+#include "BufferPool.h"
 
 #include <cstring>
+#include <cerrno>
 #include <chrono>
 #include <stdexcept>
 #include <typeinfo>
+#ifdef __linux__
+#include <sys/socket.h>
+#endif
 
 namespace Server
 {
-    UdpSession::UdpSession(UdpServer &Server, std::shared_ptr<asio::ip::udp::socket> ServerSocket, asio::ip::udp::endpoint RemoteEndPoint, std::function<std::pair<std::shared_ptr<IServerImplementation>, std::shared_ptr<IStreamedVirtualTransportServer>>(std::shared_ptr<ISessionContext>, std::shared_ptr<IBinaryTransformer>)> VirtualTransportServerFactory, std::function<void(std::function<void()>)> QueueUserWorkItem)
+    UdpSession::UdpSession(UdpServer &Server, std::shared_ptr<asio::ip::udp::socket> ServerSocket, asio::ip::udp::endpoint RemoteEndPoint, std::function<std::pair<std::shared_ptr<IServerImplementation>, std::shared_ptr<IStreamedVirtualTransportServer>>(std::shared_ptr<ISessionContext>, std::shared_ptr<IBinaryTransformer>)> VirtualTransportServerFactory, std::function<void(std::function<void()>)> QueueUserWorkItem, std::shared_ptr<TimerWheel> Wheel)
         :
         Server(Server),
         ServerSocket(ServerSocket),
         RemoteEndPoint(RemoteEndPoint),
+        Wheel(Wheel),
         LastActiveTimeValue(std::chrono::steady_clock::now()),
         NextSecureContextValue(nullptr),
         SecureContextValue(nullptr),
         NumBadCommands(0),
         IsDisposed(false),
+        SelectiveAckValue(false),
         RawReadingContext(nullptr),
         CookedWritingContext(nullptr),
         IsRunningValue(false),
@@ -34,34 +41,28 @@ namespace Server
             c->Parts = std::make_shared<PartContext>(ReadingWindowSize());
             return c;
         });
+        auto EnableCongestionControl = Server.EnableCongestionControl();
         CookedWritingContext.Update([=](std::shared_ptr<UdpWriteContext> cc)
         {
             auto c = std::make_shared<UdpWriteContext>();
             c->Parts = std::make_shared<PartContext>(WritingWindowSize());
             c->WritenIndex = IndexSpace() - 1;
+            c->Congestion = std::make_shared<CongestionControl>(EnableCongestionControl);
+            c->ScheduledResendTime = std::chrono::steady_clock::time_point::max();
             return c;
         });
 
-        ssm = std::make_shared<SessionStateMachine<std::shared_ptr<StreamedVirtualTransportServerHandleResult>, Unit>>(
-            [](const std::exception &ex) { return dynamic_cast<const asio::system_error *>(&ex) != nullptr; },
-            [this](const std::exception &ex) { return OnCriticalError(ex); },
-            [this]() { return OnShutdownRead(); },
-            [this]() { return OnShutdownWrite(); },
-            [this](Unit w, std::function<void()> OnSuccess, std::function<void()> OnFailure) { return OnWrite(w, OnSuccess, OnFailure); },
-            [this](std::shared_ptr<StreamedVirtualTransportServerHandleResult> r, std::function<void()> OnSuccess, std::function<void()> OnFailure) { return OnExecute(r, OnSuccess, OnFailure); },
-            [this](std::function<void(std::shared_ptr<std::vector<std::shared_ptr<StreamedVirtualTransportServerHandleResult>>>)> OnSuccess, std::function<void()> OnFailure) { return OnStartRawRead(OnSuccess, OnFailure); },
-            [this]() { return OnExit(); },
-            QueueUserWorkItem
-        );
+        ssm = std::make_shared<SessionStateMachine<UdpSession, std::shared_ptr<StreamedVirtualTransportServerHandleResult>>>(*this, QueueUserWorkItem, Server.MaxConcurrentCommands());
 
         Context = Server.ServerContext()->CreateSessionContext();
+        LogSource = SessionLogSource::Create(this->RemoteEndPoint.address(), this->RemoteEndPoint.port(), Context->SessionToken());
         Context->Quit = [this]() { ssm->NotifyExit(); };
         Context->Authenticated = [this]()
         {
             this->Server.NotifySessionAuthenticated(this->shared_from_this());
         };
 
-        auto rpst = std::make_shared<Rc4PacketServerTransformer>();
+        auto rpst = std::make_shared<SecurePacketServerTransformer>();
         auto Pair = VirtualTransportServerFactory(Context, rpst);
         si = std::get<0>(Pair);
         vts = std::get<1>(Pair);
@@ -70,68 +71,47 @@ namespace Server
             rpst->SetSecureContext(c);
             NextSecureContext(c);
         };
-        vts->ServerEvent = [this]() { ssm->NotifyWrite(Unit()); };
+        vts->ServerEvent = [this]() { ssm->NotifyWrite(); };
         vts->InputByteLengthReport = [this](std::u16string CommandName, std::size_t ByteLength)
         {
-            auto e = std::make_shared<SessionLogEntry>();
-            e->Token = Context->SessionTokenString();
-            e->RemoteEndPoint = systemToUtf16(this->RemoteEndPoint.address().to_string()) + u":" + ToU16String(this->RemoteEndPoint.port());
-            e->Time = UtcNow();
-            e->Type = u"InBytes";
-            e->Name = CommandName;
-            e->Message = ToU16String(ByteLength);
-            this->Server.ServerContext()->RaiseSessionLog(e);
+            this->Server.ServerContext()->RaiseSessionLog(SessionLogType::InBytes, LogSource, LogNames, CommandName, static_cast<std::int64_t>(ByteLength));
         };
         vts->OutputByteLengthReport = [this](std::u16string CommandName, std::size_t ByteLength)
         {
-            auto e = std::make_shared<SessionLogEntry>();
-            e->Token = Context->SessionTokenString();
-            e->RemoteEndPoint = systemToUtf16(this->RemoteEndPoint.address().to_string()) + u":" + ToU16String(this->RemoteEndPoint.port());
-            e->Time = UtcNow();
-            e->Type = u"OutBytes";
-            e->Name = CommandName;
-            e->Message = ToU16String(ByteLength);
-            this->Server.ServerContext()->RaiseSessionLog(e);
+            auto &Metrics = this->Server.ServerContext()->Metrics();
+            Metrics.AddOutputBytes(Metrics.GetCommandId(CommandName), ByteLength);
+            this->Server.ServerContext()->RaiseSessionLog(SessionLogType::OutBytes, LogSource, LogNames, CommandName, static_cast<std::int64_t>(ByteLength));
         };
     }
 
     void UdpSession::OnShutdownRead()
     {
-        std::function<void()> OnFailure = nullptr;
+        auto IsRawReadPending = false;
         RawReadingContext.DoAction([&](std::shared_ptr<UdpReadContext> c)
         {
-            if ((c->OnSuccess != nullptr) && (c->OnFailure != nullptr))
-            {
-                OnFailure = c->OnFailure;
-                c->OnSuccess = nullptr;
-                c->OnFailure = nullptr;
-            }
+            IsRawReadPending = c->IsRawReadPending;
+            c->IsRawReadPending = false;
         });
-        if (OnFailure != nullptr)
+        if (IsRawReadPending)
         {
-            OnFailure();
+            ssm->NotifyStartRawReadFailure();
         }
     }
     void UdpSession::OnShutdownWrite()
     {
     }
 
-    void UdpSession::OnWrite(Unit w, std::function<void()> OnSuccess, std::function<void()> OnFailure)
+    void UdpSession::OnWrite()
     {
-        auto ByteArrays = vts->TakeWriteBuffer();
+        //各回复的缓冲区直接分包，不再先复制到一个连续缓冲区；包从BufferPool获取，确认后回到池中
+        //先归入已就绪的回复再取出缓冲区，保证归入的回复都已在本次或之后的写入中
+        WriteMetrics.BeginWrite();
+        vts->TakeWriteBuffer(WritingByteArrays);
         int TotalLength = 0;
-        for (auto b : ByteArrays)
+        for (auto &b : WritingByteArrays)
         {
             TotalLength += static_cast<int>(b->size());
         }
-        auto WriteBuffer = std::make_shared<std::vector<std::uint8_t>>();
-        WriteBuffer->resize(GetMinNotLessPowerOfTwo(TotalLength), 0);
-        int Offset = 0;
-        for (auto b : ByteArrays)
-        {
-            ArrayCopy(*b, 0, *WriteBuffer, Offset, static_cast<int>(b->size()));
-            Offset += static_cast<int>(b->size());
-        }
         auto RemoteEndPoint = this->RemoteEndPoint;
         auto SessionId = this->SessionId();
         auto SecureContext = this->SecureContext();
@@ -164,17 +144,19 @@ namespace Server
             }
             c->NotAcknowledgedIndices.clear();
         });
-        if ((ByteArrays.size() == 0) && (Indices.size() == 0))
+        if ((WritingByteArrays.size() == 0) && (Indices.size() == 0))
         {
-            OnSuccess();
+            ssm->NotifyWriteSuccess();
             return;
         }
         auto Success = true;
-        std::vector<std::shared_ptr<std::vector<std::uint8_t>>> Parts;
+        WritingParts.clear();
         CookedWritingContext.DoAction([&](std::shared_ptr<UdpWriteContext> c)
         {
             auto Time = std::chrono::steady_clock::now();
             auto WritingOffset = 0;
+            std::size_t ReadingIndex = 0;
+            auto ReadingOffset = 0;
             while ((Indices.size() > 0) || (WritingOffset < TotalLength))
             {
                 auto Index = PartContext::GetSuccessor(c->WritenIndex);
@@ -187,16 +169,16 @@ namespace Server
                 }
 
                 auto IsACK = NumIndex > 0;
+                auto AckLength = IsACK ? GetAckLength(Indices, SelectiveAckValue) : 0;
 
-                auto Length = std::min(12 + (IsACK ? 2 + NumIndex * 2 : 0) + TotalLength - WritingOffset, MaxPacketLength());
-                auto DataLength = Length - (12 + (IsACK ? 2 + NumIndex * 2 : 0));
+                auto Length = std::min(12 + AckLength + TotalLength - WritingOffset, MaxPacketLength());
+                auto DataLength = Length - (12 + AckLength);
                 if (DataLength < 0)
                 {
                     Success = false;
                     return;
                 }
-                auto Buffer = std::make_shared<std::vector<std::uint8_t>>();
-                Buffer->resize(Length, 0);
+                auto Buffer = BufferPool::Acquire(static_cast<std::size_t>(Length));
                 (*Buffer)[0] = static_cast<std::uint8_t>(SessionId & 0xFF);
                 (*Buffer)[1] = static_cast<std::uint8_t>((SessionId >> 8) & 0xFF);
                 (*Buffer)[2] = static_cast<std::uint8_t>((SessionId >> 16) & 0xFF);
@@ -206,19 +188,28 @@ namespace Server
                 if (IsACK)
                 {
                     Flag |= 1; //ACK
-                    (*Buffer)[12] = static_cast<std::uint8_t>(NumIndex & 0xFF);
-                    (*Buffer)[13] = static_cast<std::uint8_t>((NumIndex >> 8) & 0xFF);
-                    int j = 0;
-                    for (auto i : Indices)
+                    if (SelectiveAckValue)
                     {
-                        (*Buffer)[14 + j * 2] = static_cast<std::uint8_t>(i & 0xFF);
-                        (*Buffer)[14 + j * 2 + 1] = static_cast<std::uint8_t>((i >> 8) & 0xFF);
-                        j += 1;
+                        Flag |= 16; //SAK
                     }
+                    WriteAck(*Buffer, 12, Indices, SelectiveAckValue);
                     Indices.clear();
                 }
 
-                ArrayCopy(*WriteBuffer, WritingOffset, *Buffer, 12 + (IsACK ? 2 + NumIndex * 2 : 0), DataLength);
+                auto CopiedLength = 0;
+                while (CopiedLength < DataLength)
+                {
+                    auto &b = *WritingByteArrays[ReadingIndex];
+                    auto n = std::min(DataLength - CopiedLength, static_cast<int>(b.size()) - ReadingOffset);
+                    ArrayCopy(b, ReadingOffset, *Buffer, 12 + AckLength + CopiedLength, n);
+                    CopiedLength += n;
+                    ReadingOffset += n;
+                    if (ReadingOffset >= static_cast<int>(b.size()))
+                    {
+                        ReadingIndex += 1;
+                        ReadingOffset = 0;
+                    }
+                }
                 WritingOffset += DataLength;
 
                 auto IsEncrypted = (SecureContext != nullptr);
@@ -230,20 +221,17 @@ namespace Server
                 (*Buffer)[5] = static_cast<std::uint8_t>((Flag >> 8) & 0xFF);
                 (*Buffer)[6] = static_cast<std::uint8_t>(Index & 0xFF);
                 (*Buffer)[7] = static_cast<std::uint8_t>((Index >> 8) & 0xFF);
+                //校验值按该位置为0计算，池中的缓冲区内容不保证为0
+                (*Buffer)[8] = 0;
+                (*Buffer)[9] = 0;
+                (*Buffer)[10] = 0;
+                (*Buffer)[11] = 0;
 
                 std::int32_t Verification = 0;
                 if (SecureContext != nullptr)
                 {
-                    std::vector<std::uint8_t> SHABuffer;
-                    SHABuffer.resize(4);
-                    ArrayCopy(*Buffer, 4, SHABuffer, 0, 4);
-                    auto SHA256 = Algorithms::Cryptography::SHA256(SHABuffer);
-                    std::vector<std::uint8_t> Key;
-                    Key.resize(SecureContext->ServerToken.size() + SHA256.size());
-                    ArrayCopy(SecureContext->ServerToken, 0, Key, 0, static_cast<int>(SecureContext->ServerToken.size()));
-                    ArrayCopy(SHA256, 0, Key, static_cast<int>(SecureContext->ServerToken.size()), static_cast<int>(SHA256.size()));
-                    auto HMACBytes = Algorithms::Cryptography::HMACSHA256Simple(Key, *Buffer);
-                    HMACBytes.resize(4);
+                    auto SHA256 = Algorithms::Cryptography::SHA256(std::span<const std::uint8_t>(Buffer->data() + 4, 4));
+                    auto HMACBytes = SecureContext->ServerTokenHMAC().Compute(SHA256, *Buffer);
                     Verification = HMACBytes[0] | (static_cast<std::int32_t>(HMACBytes[1]) << 8) | (static_cast<std::int32_t>(HMACBytes[2]) << 16) | (static_cast<std::int32_t>(HMACBytes[3]) << 24);
                 }
                 else
@@ -256,44 +244,41 @@ namespace Server
                 (*Buffer)[10] = static_cast<std::uint8_t>((Verification >> 16) & 0xFF);
                 (*Buffer)[11] = static_cast<std::uint8_t>((Verification >> 24) & 0xFF);
 
-                auto Part = std::make_shared<UdpSession::Part>();
-                Part->Index = Index;
-                Part->ResendTime = Time + std::chrono::milliseconds(GetTimeoutMilliseconds(0));
-                Part->Data = Buffer;
-                Part->ResentCount = 0;
                 if (!c->Parts->TryPushPart(Index, Buffer))
                 {
                     Success = false;
                     return;
                 }
-                Parts.push_back(Part->Data);
 
                 c->WritenIndex = Index;
             }
+            c->Parts->ForEachUnsentPacket(Time, *c->Congestion, [&](int i, std::shared_ptr<std::vector<std::uint8_t>> d) { WritingParts.push_back(d); });
+            ScheduleResend(c);
         });
-        for (auto p : Parts)
+        WritingByteArrays.clear();
+        try
         {
-            try
-            {
-                SendPacket(RemoteEndPoint, p);
-            }
-            catch (...)
-            {
-                Success = false;
-                break;
-            }
+            SendPackets(RemoteEndPoint, WritingParts);
+        }
+        catch (...)
+        {
+            Success = false;
         }
+        WritingParts.clear();
         if (!Success)
         {
-            OnFailure();
+            ssm->NotifyFailure();
         }
         else
         {
-            OnSuccess();
+            WriteMetrics.EndWrite(Server.ServerContext()->Metrics());
+            ssm->NotifyWriteSuccess();
         }
     }
-    void UdpSession::OnExecute(std::shared_ptr<StreamedVirtualTransportServerHandleResult> r, std::function<void()> OnSuccess, std::function<void()> OnFailure)
+    void UdpSession::OnExecute(std::shared_ptr<StreamedVirtualTransportServerHandleResult> r, bool IsConcurrent)
     {
+        auto OnSuccess = [this, IsConcurrent]() { ssm->NotifyExecuteSuccess(IsConcurrent); };
+        auto OnFailure = [this, IsConcurrent]() { ssm->NotifyExecuteFailure(IsConcurrent); };
         if (r->OnCommand())
         {
             auto CommandName = r->Command->CommandName;
@@ -302,54 +287,46 @@ namespace Server
             {
                 auto CurrentTime = UtcNow();
                 Context->RequestTime(CurrentTime);
-                if (Server.ServerContext()->EnableLogPerformance())
+                auto &Metrics = Server.ServerContext()->Metrics();
+                auto CommandId = Metrics.GetCommandId(CommandName);
+                auto StartTime = std::chrono::steady_clock::now();
+                Metrics.AddRequest(CommandId, r->Command->InputByteLength);
+                Metrics.AddLatency(CommandId, CommandStage::Queue, StartTime - r->Command->ReceiveTime);
+                auto OnReadyInner = [=, &Metrics](std::chrono::steady_clock::time_point EndTime)
                 {
-                    auto StartTime = std::chrono::high_resolution_clock::now();
-                    auto OnSuccessInner = [=]()
+                    Metrics.AddLatency(CommandId, CommandStage::Execute, EndTime - StartTime);
+                    WriteMetrics.Ready(CommandId, EndTime);
+                    if (Server.ServerContext()->EnableLogPerformance())
                     {
-                        auto EndTime = std::chrono::high_resolution_clock::now();
                         auto Microseconds = std::chrono::duration_cast<std::chrono::microseconds>(EndTime - StartTime).count();
-                        auto e = std::make_shared<SessionLogEntry>();
-                        e->Token = Context->SessionTokenString();
-                        e->RemoteEndPoint = systemToUtf16(this->RemoteEndPoint.address().to_string()) + u":" + ToU16String(this->RemoteEndPoint.port());
-                        e->Time = UtcNow();
-                        e->Type = u"Time";
-                        e->Name = CommandName;
-                        e->Message = ToU16String(Microseconds) + u"μs";
-                        this->Server.ServerContext()->RaiseSessionLog(e);
-                        ssm->NotifyWrite(Unit());
-                        OnSuccess();
-                    };
-                    auto OnFailureInner = [=](const std::exception &ex)
-                    {
-                        RaiseUnknownError(CommandName, ex);
-                        OnSuccess();
-                    };
-                    r->Command->ExecuteCommand(OnSuccessInner, OnFailureInner);
-                }
-                else
+                        this->Server.ServerContext()->RaiseSessionLog(SessionLogType::Time, LogSource, LogNames, CommandName, static_cast<std::int64_t>(Microseconds));
+                    }
+                };
+                auto OnSuccessInner = [=]()
                 {
-                    auto OnSuccessInner = [=]()
-                    {
-                        ssm->NotifyWrite(Unit());
-                        OnSuccess();
-                    };
-                    auto OnFailureInner = [=](const std::exception &ex)
-                    {
-                        RaiseUnknownError(CommandName, ex);
-                        OnSuccess();
-                    };
-                    r->Command->ExecuteCommand(OnSuccessInner, OnFailureInner);
-                }
+                    ssm->NotifyWrite();
+                    OnSuccess();
+                };
+                auto OnFailureInner = [=, &Metrics](const std::exception &ex)
+                {
+                    Metrics.AddError(CommandId);
+                    RaiseUnknownError(CommandName, ex);
+                    //失败的命令没有回复，但可能使此前暂存的后续命令的回复可以写入
+                    ssm->NotifyWrite();
+                    OnSuccess();
+                };
+                r->Command->ExecuteCommand(OnReadyInner, OnSuccessInner, OnFailureInner);
             };
 
-            ssm->AddToActionQueue(a);
+            //OnExecute已在状态机的操作队列中或并发执行时在QueueUserWorkItem的线程上执行，直接执行命令
+            a();
         }
         else if (r->OnBadCommand())
         {
             auto CommandName = r->BadCommand->CommandName;
 
             NumBadCommands += 1;
+            Server.ServerContext()->Metrics().AddBadCommand();
 
             // Maximum allowed bad commands exceeded.
             if (Server.MaxBadCommands() != 0 && NumBadCommands > Server.MaxBadCommands())
@@ -368,6 +345,7 @@ namespace Server
             auto CommandLine = r->BadCommandLine->CommandLine;
 
             NumBadCommands += 1;
+            Server.ServerContext()->Metrics().AddBadCommand();
 
             // Maximum allowed bad commands exceeded.
             if (Server.MaxBadCommands() != 0 && NumBadCommands > Server.MaxBadCommands())
@@ -386,13 +364,13 @@ namespace Server
             throw std::logic_error("InvalidOperationException");
         }
     }
-    void UdpSession::OnStartRawRead(std::function<void(std::shared_ptr<std::vector<std::shared_ptr<StreamedVirtualTransportServerHandleResult>>>)> OnSuccess, std::function<void()> OnFailure)
+    void UdpSession::OnStartRawRead()
     {
         auto Pushed = true;
-        auto Parts = std::make_shared<std::vector<std::shared_ptr<Part>>>();
+        auto Parts = std::make_shared<std::vector<std::shared_ptr<std::vector<std::uint8_t>>>>();
         RawReadingContext.DoAction([&](std::shared_ptr<UdpReadContext> c)
         {
-            if ((c->OnSuccess == nullptr) && (c->OnFailure == nullptr))
+            if (!c->IsRawReadPending)
             {
                 while (true)
                 {
@@ -402,8 +380,7 @@ namespace Server
                 }
                 if (Parts->size() == 0)
                 {
-                    c->OnSuccess = OnSuccess;
-                    c->OnFailure = OnFailure;
+                    c->IsRawReadPending = true;
                 }
                 Pushed = true;
             }
@@ -415,72 +392,71 @@ namespace Server
 
         if (Parts->size() > 0)
         {
-            HandleRawRead(Parts, OnSuccess, OnFailure);
+            HandleRawRead(Parts);
         }
         if (!Pushed)
         {
-            OnFailure();
+            ssm->NotifyStartRawReadFailure();
         }
     }
 
-    void UdpSession::HandleRawRead(std::shared_ptr<std::vector<std::shared_ptr<Part>>> Parts, std::function<void(std::shared_ptr<std::vector<std::shared_ptr<StreamedVirtualTransportServerHandleResult>>>)> OnSuccess, std::function<void()> OnFailure)
+    void UdpSession::HandleRawRead(std::shared_ptr<std::vector<std::shared_ptr<std::vector<std::uint8_t>>>> Parts)
     {
         if (ssm->IsExited()) { return; }
-        auto Results = std::make_shared<std::vector<std::shared_ptr<StreamedVirtualTransportServerHandleResult>>>();
+        RawReadResults.clear();
         for (auto p : *Parts)
         {
-            auto Buffer = vts->GetReadBuffer();
-            auto BufferLength = vts->GetReadBufferOffset() + vts->GetReadBufferLength();
-            if (static_cast<int>(p->Data->size()) > static_cast<int>(Buffer->size()) - BufferLength)
-            {
-                OnFailure();
-                return;
-            }
-            ArrayCopy(*p->Data, 0, *Buffer, BufferLength, static_cast<int>(p->Data->size()));
-
-            auto c = p->Data->size();
-            while (true)
+            //读取缓冲区可能在处理中切换为大参数缓冲区，因此按剩余空间分段复制
+            std::size_t Offset = 0;
+            while (Offset < p->size())
             {
-                std::shared_ptr<StreamedVirtualTransportServerHandleResult> Result;
-                try
+                auto Buffer = vts->GetReadBuffer();
+                auto BufferLength = vts->GetReadBufferOffset() + vts->GetReadBufferLength();
+                auto c = std::min(p->size() - Offset, Buffer->size() - static_cast<std::size_t>(BufferLength));
+                if (c == 0)
                 {
-                    ExceptionStackTrace::Execute([&]() { Result = vts->Handle(static_cast<int>(c)); });
+                    ssm->NotifyStartRawReadFailure();
+                    return;
                 }
-                catch (const std::exception &ex)
+                ArrayCopy(*p, static_cast<int>(Offset), *Buffer, BufferLength, static_cast<int>(c));
+                Offset += c;
+
+                while (true)
                 {
-                    if (dynamic_cast<const std::logic_error *>(&ex) != nullptr)
+                    std::shared_ptr<StreamedVirtualTransportServerHandleResult> Result;
+                    try
                     {
-                        auto e = std::make_shared<SessionLogEntry>();
-                        e->Token = Context->SessionTokenString();
-                        e->RemoteEndPoint = systemToUtf16(this->RemoteEndPoint.address().to_string()) + u":" + ToU16String(this->RemoteEndPoint.port());
-                        e->Time = UtcNow();
-                        e->Type = u"Known";
-                        e->Name = u"Exception";
-                        e->Message = systemToUtf16(std::string() + typeid(*(&ex)).name() + "\r\n" + ex.what() + "\r\n" + ExceptionStackTrace::GetStackTrace());
-                        Server.ServerContext()->RaiseSessionLog(e);
+                        ExceptionStackTrace::Execute([&]() { Result = vts->Handle(static_cast<int>(c)); });
                     }
-                    else if (!IsSocketErrorKnown(ex))
+                    catch (const std::exception &ex)
                     {
-                        auto Message = std::string() + typeid(*(&ex)).name() + "\r\n" + ex.what() + "\r\n" + ExceptionStackTrace::GetStackTrace();
-                        OnCriticalError(std::runtime_error(Message));
+                        if (dynamic_cast<const std::logic_error *>(&ex) != nullptr)
+                        {
+                            Server.ServerContext()->RaiseSessionLog(SessionLogType::Known, LogSource, u"Exception", systemToUtf16(std::string() + typeid(*(&ex)).name() + "\r\n" + ex.what() + "\r\n" + ExceptionStackTrace::GetStackTrace()));
+                        }
+                        else if (!IsSocketErrorKnown(ex))
+                        {
+                            auto Message = std::string() + typeid(*(&ex)).name() + "\r\n" + ex.what() + "\r\n" + ExceptionStackTrace::GetStackTrace();
+                            OnCriticalError(std::runtime_error(Message));
+                        }
+                        ssm->NotifyStartRawReadFailure();
+                        return;
                     }
-                    OnFailure();
-                    return;
-                }
-                c = 0;
-                if (Result->OnContinue())
-                {
-                    break;
+                    c = 0;
+                    if (Result->OnContinue())
+                    {
+                        break;
+                    }
+                    RawReadResults.push_back(Result);
                 }
-                Results->push_back(Result);
             }
         }
-        if (Results->size() == 0)
+        if (RawReadResults.size() == 0)
         {
-            OnStartRawRead(OnSuccess, OnFailure);
+            OnStartRawRead();
             return;
         }
-        OnSuccess(Results);
+        ssm->NotifyStartRawReadSuccess(RawReadResults);
     }
 
     void UdpSession::Stop()
@@ -498,7 +474,10 @@ namespace Server
                 Mappings->erase(Context);
             }
         });
-        Server.ServerContext()->TryUnregisterSession(Context);
+        if (Server.ServerContext()->TryUnregisterSession(Context))
+        {
+            Server.ServerContext()->Metrics().AddUdpSessions(-1);
+        }
 
         si->Stop();
         si = nullptr;
@@ -510,21 +489,13 @@ namespace Server
         {
         }
 
-        auto SessionTokenString = Context->SessionTokenString();
         Context = nullptr;
 
         IsExitingValue.Update([](bool b) { return false; });
 
         if (Server.ServerContext()->EnableLogSystem())
         {
-            auto e = std::make_shared<SessionLogEntry>();
-            e->Token = SessionTokenString;
-            e->RemoteEndPoint = systemToUtf16(this->RemoteEndPoint.address().to_string()) + u":" + ToU16String(this->RemoteEndPoint.port());
-            e->Time = UtcNow();
-            e->Type = u"Sys";
-            e->Name = u"SessionExit";
-            e->Message = u"";
-            Server.ServerContext()->RaiseSessionLog(e);
+            Server.ServerContext()->RaiseSessionLog(SessionLogType::Sys, LogSource, u"SessionExit", u"");
         }
     }
 
@@ -561,18 +532,12 @@ namespace Server
                 Context->RemoteEndPoint(systemToUtf16(this->RemoteEndPoint.address().to_string()) + u":" + ToU16String(this->RemoteEndPoint.port()));
 
                 Server.ServerContext()->RegisterSession(Context);
+                Server.ServerContext()->Metrics().AddUdpSessions(1);
                 Server.SessionMappings.DoAction([=](std::shared_ptr<std::unordered_map<std::shared_ptr<ISessionContext>, std::shared_ptr<UdpSession>>> Mappings) { (*Mappings)[Context] = this->shared_from_this(); });
 
                 if (Server.ServerContext()->EnableLogSystem())
                 {
-                    auto e = std::make_shared<SessionLogEntry>();
-                    e->Token = Context->SessionTokenString();
-                    e->RemoteEndPoint = systemToUtf16(this->RemoteEndPoint.address().to_string()) + u":" + ToU16String(this->RemoteEndPoint.port());
-                    e->Time = UtcNow();
-                    e->Type = u"Sys";
-                    e->Name = u"SessionEnter";
-                    e->Message = u"";
-                    Server.ServerContext()->RaiseSessionLog(e);
+                    Server.ServerContext()->RaiseSessionLog(SessionLogType::Sys, LogSource, u"SessionEnter", u"");
                 }
                 ssm->Start();
             });
@@ -589,10 +554,89 @@ namespace Server
     {
         ServerSocket->send_to(asio::buffer(*Data), RemoteEndPoint);
     }
+    void UdpSession::SendPackets(asio::ip::udp::endpoint RemoteEndPoint, const std::vector<std::shared_ptr<std::vector<std::uint8_t>>> &Packets)
+    {
+        std::size_t NumSent = 0;
+#ifdef __linux__
+        if (Server.BatchedIo() && (Packets.size() > 0))
+        {
+            //使用sendmmsg一次发送多个数据包，mmsghdr和iovec使用线程局部的缓冲区，只在需要更多项时扩大
+            //发送缓冲区满时不等待，剩余的数据包已登记为已发送，由重传定时器重发；其他错误退回到逐个发送以抛出异常
+            thread_local std::vector<struct mmsghdr> Messages;
+            thread_local std::vector<struct iovec> IoVectors;
+            if (Messages.size() < Packets.size())
+            {
+                Messages.resize(Packets.size());
+                IoVectors.resize(Packets.size());
+            }
+            for (std::size_t k = 0; k < Packets.size(); k += 1)
+            {
+                IoVectors[k].iov_base = Packets[k]->data();
+                IoVectors[k].iov_len = Packets[k]->size();
+                std::memset(&Messages[k], 0, sizeof(Messages[k]));
+                Messages[k].msg_hdr.msg_name = RemoteEndPoint.data();
+                Messages[k].msg_hdr.msg_namelen = static_cast<socklen_t>(RemoteEndPoint.size());
+                Messages[k].msg_hdr.msg_iov = &IoVectors[k];
+                Messages[k].msg_hdr.msg_iovlen = 1;
+            }
+            while (NumSent < Packets.size())
+            {
+                auto Count = sendmmsg(ServerSocket->native_handle(), Messages.data() + NumSent, static_cast<unsigned int>(Packets.size() - NumSent), MSG_DONTWAIT);
+                if (Count > 0)
+                {
+                    NumSent += static_cast<std::size_t>(Count);
+                    continue;
+                }
+                if ((Count < 0) && (errno == EINTR)) { continue; }
+                if ((Count < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) { return; }
+                break;
+            }
+        }
+#endif
+        for (; NumSent < Packets.size(); NumSent += 1)
+        {
+            SendPacket(RemoteEndPoint, Packets[NumSent]);
+        }
+    }
+
+    void UdpSession::ScheduleResend(std::shared_ptr<UdpWriteContext> c)
+    {
+        if (Wheel == nullptr) { return; }
+        auto ResendTime = c->Parts->GetNextResendTime();
+        if (ResendTime >= c->ScheduledResendTime) { return; }
+        c->ScheduledResendTime = ResendTime;
+        std::weak_ptr<UdpSession> ws = this->shared_from_this();
+        Wheel->Schedule(ResendTime, [ws]()
+        {
+            auto s = ws.lock();
+            if (s == nullptr) { return; }
+            s->PrePush([s]() { s->OnResendTimer(); });
+        });
+    }
+    void UdpSession::OnResendTimer()
+    {
+        if (!IsRunning()) { return; }
+        auto Time = std::chrono::steady_clock::now();
+        std::vector<std::shared_ptr<std::vector<std::uint8_t>>> l;
+        CookedWritingContext.DoAction([&](std::shared_ptr<UdpWriteContext> c)
+        {
+            c->ScheduledResendTime = std::chrono::steady_clock::time_point::max();
+            c->Parts->ForEachTimedoutPacket(Time, *c->Congestion, [&](int, std::shared_ptr<std::vector<std::uint8_t>> d) { l.push_back(d); });
+            c->Parts->ForEachUnsentPacket(Time, *c->Congestion, [&](int i, std::shared_ptr<std::vector<std::uint8_t>> d) { l.push_back(d); });
+            ScheduleResend(c);
+        });
+        try
+        {
+            SendPackets(RemoteEndPoint, l);
+        }
+        catch (...)
+        {
+            Server.NotifySessionQuit(this->shared_from_this());
+        }
+    }
 
     bool UdpSession::PushAux(asio::ip::udp::endpoint RemoteEndPoint, std::shared_ptr<std::vector<int>> Indices)
     {
-        auto SessionId = this->SessionId();
         auto Time = std::chrono::steady_clock::now();
         if ((Indices != nullptr) && (Indices->size() > 0))
         {
@@ -600,25 +644,24 @@ namespace Server
             {
                 auto IndicesWithoutFirst = *Indices;
                 IndicesWithoutFirst.erase(IndicesWithoutFirst.begin());
-                c->Parts->Acknowledge((*Indices)[0], IndicesWithoutFirst, c->WritenIndex);
+                c->Parts->Acknowledge((*Indices)[0], IndicesWithoutFirst, c->WritenIndex, Time, *c->Congestion);
             });
         }
         {
             auto l = std::make_shared<std::vector<std::shared_ptr<std::vector<std::uint8_t>>>>();
             CookedWritingContext.DoAction([=](std::shared_ptr<UdpWriteContext> c)
             {
-                c->Parts->ForEachTimedoutPacket(SessionId, Time, [=](int i, std::shared_ptr<std::vector<std::uint8_t>> d) { l->push_back(d); });
+                c->Parts->ForEachFastRetransmitPacket(Time, *c->Congestion, [=](int i, std::shared_ptr<std::vector<std::uint8_t>> d) { l->push_back(d); });
+                c->Parts->ForEachUnsentPacket(Time, *c->Congestion, [=](int i, std::shared_ptr<std::vector<std::uint8_t>> d) { l->push_back(d); });
+                ScheduleResend(c);
             });
-            for (auto p : *l)
+            try
             {
-                try
-                {
-                    SendPacket(RemoteEndPoint, p);
-                }
-                catch (...)
-                {
-                    return false;
-                }
+                SendPackets(RemoteEndPoint, *l);
+            }
+            catch (...)
+            {
+                return false;
             }
         }
         return true;
@@ -630,7 +673,6 @@ namespace Server
     }
     bool UdpSession::Push(asio::ip::udp::endpoint RemoteEndPoint, int Index, std::shared_ptr<std::vector<int>> Indices, std::shared_ptr<std::vector<std::uint8_t>> Buffer, int Offset, int Length)
     {
-        auto SessionId = this->SessionId();
         auto Time = std::chrono::steady_clock::now();
         if ((Indices != nullptr) && (Indices->size() > 0))
         {
@@ -638,32 +680,29 @@ namespace Server
             {
                 auto IndicesWithoutFirst = *Indices;
                 IndicesWithoutFirst.erase(IndicesWithoutFirst.begin());
-                c->Parts->Acknowledge((*Indices)[0], IndicesWithoutFirst, c->WritenIndex);
+                c->Parts->Acknowledge((*Indices)[0], IndicesWithoutFirst, c->WritenIndex, Time, *c->Congestion);
             });
         }
         {
             auto l = std::make_shared<std::vector<std::shared_ptr<std::vector<std::uint8_t>>>>();
             CookedWritingContext.DoAction([=](std::shared_ptr<UdpWriteContext> c)
             {
-                c->Parts->ForEachTimedoutPacket(SessionId, Time, [=](int i, std::shared_ptr<std::vector<std::uint8_t>> d) { l->push_back(d); });
+                c->Parts->ForEachFastRetransmitPacket(Time, *c->Congestion, [=](int i, std::shared_ptr<std::vector<std::uint8_t>> d) { l->push_back(d); });
+                c->Parts->ForEachUnsentPacket(Time, *c->Congestion, [=](int i, std::shared_ptr<std::vector<std::uint8_t>> d) { l->push_back(d); });
+                ScheduleResend(c);
             });
-            for (auto p : *l)
+            try
             {
-                try
-                {
-                    SendPacket(RemoteEndPoint, p);
-                }
-                catch (...)
-                {
-                    return false;
-                }
+                SendPackets(RemoteEndPoint, *l);
+            }
+            catch (...)
+            {
+                return false;
             }
         }
 
         auto Pushed = false;
-        auto Parts = std::make_shared<std::vector<std::shared_ptr<Part>>>();
-        std::function<void(std::shared_ptr<std::vector<std::shared_ptr<StreamedVirtualTransportServerHandleResult>>>)> OnSuccess = nullptr;
-        std::function<void()> OnFailure = nullptr;
+        auto Parts = std::make_shared<std::vector<std::shared_ptr<std::vector<std::uint8_t>>>>();
         RawReadingContext.DoAction([&](std::shared_ptr<UdpReadContext> c)
         {
             if (c->Parts->HasPart(Index))
@@ -688,7 +727,7 @@ namespace Server
                     c->NotAcknowledgedIndices.erase(i);
                 }
 
-                if ((c->OnSuccess != nullptr) && (c->OnFailure != nullptr))
+                if (c->IsRawReadPending)
                 {
                     while (true)
                     {
@@ -699,10 +738,7 @@ namespace Server
 
                     if (Parts->size() > 0)
                     {
-                        OnSuccess = c->OnSuccess;
-                        OnFailure = c->OnFailure;
-                        c->OnSuccess = nullptr;
-                        c->OnFailure = nullptr;
+                        c->IsRawReadPending = false;
                     }
                 }
             }
@@ -714,11 +750,99 @@ namespace Server
         }
         if (Parts->size() > 0)
         {
-            HandleRawRead(Parts, OnSuccess, OnFailure);
+            HandleRawRead(Parts);
         }
         return Pushed;
     }
 
+    int UdpSession::GetAckLength(const std::vector<int> &Indices, bool IsBitmap)
+    {
+        if (!IsBitmap)
+        {
+            return 2 + static_cast<int>(Indices.size()) * 2;
+        }
+        auto NumMaskBytes = 0;
+        for (std::size_t k = 1; k < Indices.size(); k += 1)
+        {
+            auto Bit = (Indices[k] - Indices[0] - 1 + IndexSpace()) % IndexSpace();
+            NumMaskBytes = std::max(NumMaskBytes, Bit / 8 + 1);
+        }
+        return 4 + NumMaskBytes;
+    }
+    void UdpSession::WriteAck(std::vector<std::uint8_t> &Buffer, int Offset, const std::vector<int> &Indices, bool IsBitmap)
+    {
+        if (!IsBitmap)
+        {
+            auto NumIndex = static_cast<int>(Indices.size());
+            Buffer[Offset] = static_cast<std::uint8_t>(NumIndex & 0xFF);
+            Buffer[Offset + 1] = static_cast<std::uint8_t>((NumIndex >> 8) & 0xFF);
+            int j = 0;
+            for (auto i : Indices)
+            {
+                Buffer[Offset + 2 + j * 2] = static_cast<std::uint8_t>(i & 0xFF);
+                Buffer[Offset + 2 + j * 2 + 1] = static_cast<std::uint8_t>((i >> 8) & 0xFF);
+                j += 1;
+            }
+            return;
+        }
+        auto Index = Indices[0];
+        auto NumMaskBytes = GetAckLength(Indices, true) - 4;
+        Buffer[Offset] = static_cast<std::uint8_t>(Index & 0xFF);
+        Buffer[Offset + 1] = static_cast<std::uint8_t>((Index >> 8) & 0xFF);
+        Buffer[Offset + 2] = static_cast<std::uint8_t>(NumMaskBytes & 0xFF);
+        Buffer[Offset + 3] = static_cast<std::uint8_t>((NumMaskBytes >> 8) & 0xFF);
+        std::fill(Buffer.begin() + Offset + 4, Buffer.begin() + Offset + 4 + NumMaskBytes, static_cast<std::uint8_t>(0));
+        for (std::size_t k = 1; k < Indices.size(); k += 1)
+        {
+            auto Bit = (Indices[k] - Index - 1 + IndexSpace()) % IndexSpace();
+            Buffer[Offset + 4 + Bit / 8] |= static_cast<std::uint8_t>(1 << (Bit % 8));
+        }
+    }
+    bool UdpSession::TryReadAck(const std::vector<std::uint8_t> &Buffer, int &Offset, bool IsBitmap, std::vector<int> &Indices)
+    {
+        auto Size = static_cast<int>(Buffer.size());
+        if (!IsBitmap)
+        {
+            if (Size < Offset + 2) { return false; }
+            auto NumIndex = Buffer[Offset] | (static_cast<std::int32_t>(Buffer[Offset + 1]) << 8);
+            if (Size < Offset + 2 + NumIndex * 2) { return false; }
+            if (NumIndex > WritingWindowSize()) { return false; }
+            Offset += 2;
+            Indices.resize(NumIndex, 0);
+            for (int k = 0; k < NumIndex; k += 1)
+            {
+                Indices[k] = Buffer[Offset + k * 2] | (static_cast<std::int32_t>(Buffer[Offset + k * 2 + 1]) << 8);
+            }
+            Offset += NumIndex * 2;
+            return true;
+        }
+        if (Size < Offset + 4) { return false; }
+        auto Index = Buffer[Offset] | (static_cast<std::int32_t>(Buffer[Offset + 1]) << 8);
+        auto NumMaskBytes = Buffer[Offset + 2] | (static_cast<std::int32_t>(Buffer[Offset + 3]) << 8);
+        if (Size < Offset + 4 + NumMaskBytes) { return false; }
+        if (NumMaskBytes > ReadingWindowSize() / 8) { return false; }
+        Offset += 4;
+        Indices.clear();
+        Indices.push_back(Index);
+        for (int k = 0; k < NumMaskBytes; k += 1)
+        {
+            auto b = Buffer[Offset + k];
+            if (b == 0) { continue; }
+            for (int Bit = 0; Bit < 8; Bit += 1)
+            {
+                if ((b & (1 << Bit)) == 0) { continue; }
+                if (static_cast<int>(Indices.size()) >= WritingWindowSize()) { return false; }
+                Indices.push_back((Index + 1 + k * 8 + Bit) % IndexSpace());
+            }
+        }
+        Offset += NumMaskBytes;
+        return true;
+    }
+
+    bool UdpSession::IsKnownException(const std::exception &ex)
+    {
+        return dynamic_cast<const asio::system_error *>(&ex) != nullptr;
+    }
     bool UdpSession::IsSocketErrorKnown(const std::exception &ex)
     {
         auto se = dynamic_cast<const asio::system_error *>(&ex);
@@ -730,22 +854,6 @@ namespace Server
         return false;
     }
 
-    int UdpSession::GetMinNotLessPowerOfTwo(int v)
-    {
-        //计算不小于TotalLength的最小2的幂
-        if (v < 1) { return 1; }
-        auto n = 0;
-        auto z = v - 1;
-        while (z != 0)
-        {
-            z >>= 1;
-            n += 1;
-        }
-        auto Value = 1 << n;
-        if (Value == 0) { throw std::logic_error("InvalidOperationException"); }
-        return Value;
-    }
-
     void UdpSession::ArrayCopy(const std::vector<std::uint8_t> &Source, int SourceIndex, std::vector<std::uint8_t> &Destination, int DestinationIndex, int Length)
     {
         if (Length < 0) { throw std::logic_error("InvalidArgument"); }
@@ -774,14 +882,7 @@ namespace Server
         }
         if (Server.ServerContext()->EnableLogUnknownError())
         {
-            auto e = std::make_shared<SessionLogEntry>();
-            e->Token = Context->SessionTokenString();
-            e->RemoteEndPoint = systemToUtf16(this->RemoteEndPoint.address().to_string()) + u":" + ToU16String(this->RemoteEndPoint.port());
-            e->Time = UtcNow();
-            e->Type = u"Unk";
-            e->Name = u"Exception";
-            e->Message = Info;
-            Server.ServerContext()->RaiseSessionLog(e);
+            Server.ServerContext()->RaiseSessionLog(SessionLogType::Unk, LogSource, u"Exception", Info);
         }
     }
 
@@ -790,14 +891,7 @@ namespace Server
         if (Server.ServerContext()->EnableLogCriticalError())
         {
             auto Info = systemToUtf16(ex.what());
-            auto e = std::make_shared<SessionLogEntry>();
-            e->Token = Context->SessionTokenString();
-            e->RemoteEndPoint = systemToUtf16(this->RemoteEndPoint.address().to_string()) + u":" + ToU16String(this->RemoteEndPoint.port());
-            e->Time = UtcNow();
-            e->Type = u"Crtcu";
-            e->Name = u"Exception";
-            e->Message = Info;
-            Server.ServerContext()->RaiseSessionLog(e);
+            Server.ServerContext()->RaiseSessionLog(SessionLogType::Crtcu, LogSource, u"Exception", Info);
         }
     }
 }
@@ -1,18 +1,25 @@
 ﻿#pragma once
 
+#include "BaseSystem/LockedVariable.h"
 #include "IContext.h"
 #include "StreamedServer.h"
 #include "SessionStateMachine.h"
+#include "TimerWheel.h"
+#include "BufferPool.h"
 
 #include <cstdint>
+#include <cmath>
+#include <algorithm>
 #include <vector>
 #include <unordered_map>
 #include <set>
+#include <atomic>
 #include <functional>
 #include <chrono>
 #include <utility>
 #include <memory>
 #include <exception>
+#include <stdexcept>
 #include <asio.hpp>
 #include <asio/steady_timer.hpp>
 #ifdef _MSC_VER
@@ -28,12 +35,18 @@ namespace Server
     /// </summary>
     class UdpSession : public std::enable_shared_from_this<UdpSession>
     {
+        friend class SessionStateMachine<UdpSession, std::shared_ptr<StreamedVirtualTransportServerHandleResult>>;
     public:
         UdpServer &Server;
     private:
         std::shared_ptr<asio::ip::udp::socket> ServerSocket;
     public:
         asio::ip::udp::endpoint RemoteEndPoint;
+        /// <summary>日志中的会话标识，随RemoteEndPoint一起更新</summary>
+        SessionLogSource LogSource;
+        SessionLogNameCache LogNames;
+        /// <summary>会话所在分片的时间轮，用于重传和空闲超时检查</summary>
+        std::shared_ptr<TimerWheel> Wheel;
 
     private:
         BaseSystem::LockedVariable<std::chrono::steady_clock::time_point> LastActiveTimeValue;
@@ -69,12 +82,23 @@ namespace Server
         std::shared_ptr<IStreamedVirtualTransportServer> vts;
         int NumBadCommands = 0;
         bool IsDisposed;
+        bool SelectiveAckValue;
 
     public:
         static int MaxPacketLength() { return 1400; }
         static int ReadingWindowSize() { return 1024; }
         static int WritingWindowSize() { return 32; }
         static int IndexSpace() { return 65536; }
+
+        /// <summary>
+        /// 确认部分以已按序收到的最大序号开头，其后为该序号之后乱序收到的序号，有两种格式
+        /// 列表格式：NumIndex(2) Index(2)*NumIndex
+        /// 位图格式（Flag中包含SAK）：Index(2) NumMaskBytes(2) Mask(NumMaskBytes)，Mask的第k位表示序号Index + 1 + k已收到
+        /// </summary>
+        static int GetAckLength(const std::vector<int> &Indices, bool IsBitmap);
+        static void WriteAck(std::vector<std::uint8_t> &Buffer, int Offset, const std::vector<int> &Indices, bool IsBitmap);
+        static bool TryReadAck(const std::vector<std::uint8_t> &Buffer, int &Offset, bool IsBitmap, std::vector<int> &Indices);
+
     private:
         static int GetTimeoutMilliseconds(int ResentCount)
         {
@@ -86,39 +110,152 @@ namespace Server
             return 4000;
         }
 
+        /// <summary>
+        /// 发送方的往返时间估计和拥塞窗口
+        /// 自适应模式下按SRTT/RTTVAR计算重传超时并指数退避，拥塞窗口按慢启动和拥塞避免增长，超时和快速重传时减小
+        /// 兼容模式下使用固定的重传时间表和固定的写入窗口
+        /// </summary>
+        class CongestionControl
+        {
+        public:
+            bool IsAdaptive;
+            double SmoothedRtt;
+            double RttVariation;
+            bool HasRttSample;
+            int RetransmissionTimeout;
+            double CongestionWindow;
+            double SlowStartThreshold;
+
+            static int InitialRetransmissionTimeout() { return 400; }
+            static int MinRetransmissionTimeout() { return 100; }
+            static int MaxRetransmissionTimeout() { return 4000; }
+            static int InitialCongestionWindow() { return 4; }
+            static int FastRetransmitThreshold() { return 3; }
+
+            CongestionControl(bool IsAdaptive)
+                : IsAdaptive(IsAdaptive), SmoothedRtt(0), RttVariation(0), HasRttSample(false), RetransmissionTimeout(InitialRetransmissionTimeout()), CongestionWindow(InitialCongestionWindow()), SlowStartThreshold(WritingWindowSize())
+            {
+            }
+
+            int GetTimeoutMilliseconds(int ResentCount)
+            {
+                if (!IsAdaptive) { return UdpSession::GetTimeoutMilliseconds(ResentCount); }
+                auto Timeout = RetransmissionTimeout;
+                for (int k = 0; (k < ResentCount) && (Timeout < MaxRetransmissionTimeout()); k += 1)
+                {
+                    Timeout *= 2;
+                }
+                return std::min(Timeout, MaxRetransmissionTimeout());
+            }
+            int WindowSize()
+            {
+                if (!IsAdaptive) { return WritingWindowSize(); }
+                return std::max(1, std::min(static_cast<int>(CongestionWindow), WritingWindowSize()));
+            }
+
+            void OnRttSample(double Milliseconds)
+            {
+                if (!IsAdaptive) { return; }
+                if (!HasRttSample)
+                {
+                    SmoothedRtt = Milliseconds;
+                    RttVariation = Milliseconds / 2;
+                    HasRttSample = true;
+                }
+                else
+                {
+                    RttVariation = 0.75 * RttVariation + 0.25 * std::abs(SmoothedRtt - Milliseconds);
+                    SmoothedRtt = 0.875 * SmoothedRtt + 0.125 * Milliseconds;
+                }
+                auto Timeout = static_cast<int>(std::ceil(SmoothedRtt + std::max(1.0, 4 * RttVariation)));
+                RetransmissionTimeout = std::max(MinRetransmissionTimeout(), std::min(Timeout, MaxRetransmissionTimeout()));
+            }
+            void OnAcknowledged(int Count)
+            {
+                if (!IsAdaptive) { return; }
+                for (int k = 0; k < Count; k += 1)
+                {
+                    if (CongestionWindow < SlowStartThreshold)
+                    {
+                        CongestionWindow += 1;
+                    }
+                    else
+                    {
+                        CongestionWindow += 1 / CongestionWindow;
+                    }
+                }
+                CongestionWindow = std::min(CongestionWindow, static_cast<double>(WritingWindowSize()));
+            }
+            void OnFastRetransmit()
+            {
+                if (!IsAdaptive) { return; }
+                SlowStartThreshold = std::max(CongestionWindow / 2, 2.0);
+                CongestionWindow = SlowStartThreshold;
+            }
+            void OnTimeout()
+            {
+                if (!IsAdaptive) { return; }
+                SlowStartThreshold = std::max(CongestionWindow / 2, 2.0);
+                CongestionWindow = 1;
+            }
+        };
+
         class Part
         {
         public:
+            bool IsOccupied;
             int Index;
             std::shared_ptr<std::vector<std::uint8_t>> Data;
             std::chrono::steady_clock::time_point ResendTime;
             int ResentCount;
+            bool IsSent;
+            std::chrono::steady_clock::time_point SentTime;
+            int NumSkipped;
         };
+        /// <summary>
+        /// 窗口内的包按Index % WindowSize存放在固定长度的环形数组中，WindowSize整除IndexSpace，窗口内的序号不会落在同一格
+        /// 包被取出或确认后格即释放数据缓冲区，复制写入的缓冲区从BufferPool获取，空闲会话的窗口不持有缓冲区
+        /// </summary>
         class PartContext
         {
         private:
             int WindowSize;
+            std::vector<Part> Slots;
+            int NumParts;
         public:
             PartContext(int WindowSize)
-                : MaxHandled(IndexSpace() - 1)
+                : WindowSize(WindowSize), NumParts(0), MaxHandled(IndexSpace() - 1), IsFastRetransmitPending(false)
             {
-                this->WindowSize = WindowSize;
+                Slots.resize(WindowSize);
+                for (auto &p : Slots)
+                {
+                    p.IsOccupied = false;
+                    p.Index = 0;
+                    p.ResentCount = 0;
+                    p.IsSent = false;
+                    p.NumSkipped = 0;
+                }
             }
 
             int MaxHandled;
-            std::unordered_map<int, std::shared_ptr<Part>> Parts;
-            std::shared_ptr<Part> TryTakeFirstPart()
+            bool IsFastRetransmitPending;
+
+            Part *Find(int Index)
             {
-                if (Parts.size() == 0) { return nullptr; }
+                auto &p = Slots[Index % WindowSize];
+                if (!p.IsOccupied || (p.Index != Index)) { return nullptr; }
+                return &p;
+            }
+            std::shared_ptr<std::vector<std::uint8_t>> TryTakeFirstPart()
+            {
+                if (NumParts == 0) { return nullptr; }
                 auto Successor = GetSuccessor(MaxHandled);
-                if (Parts.count(Successor) > 0)
-                {
-                    auto Value = Parts[Successor];
-                    Parts.erase(Successor);
-                    MaxHandled = Successor;
-                    return Value;
-                }
-                return nullptr;
+                auto p = Find(Successor);
+                if (p == nullptr) { return nullptr; }
+                p->IsOccupied = false;
+                NumParts -= 1;
+                MaxHandled = Successor;
+                return std::move(p->Data);
             }
             bool IsEqualOrAfter(int New, int Original)
             {
@@ -138,27 +275,41 @@ namespace Server
                 {
                     return true;
                 }
-                if (Parts.count(Index) > 0)
+                return Find(Index) != nullptr;
+            }
+        private:
+            Part &Occupy(int Index)
+            {
+                auto &p = Slots[Index % WindowSize];
+                if (!p.IsOccupied)
                 {
-                    return true;
+                    p.IsOccupied = true;
+                    NumParts += 1;
                 }
-                return false;
+                p.Index = Index;
+                p.ResendTime = std::chrono::steady_clock::now() + std::chrono::milliseconds(GetTimeoutMilliseconds(0));
+                p.ResentCount = 0;
+                p.IsSent = false;
+                p.NumSkipped = 0;
+                return p;
+            }
+            void Release(Part &p)
+            {
+                p.IsOccupied = false;
+                p.Data = nullptr;
+                NumParts -= 1;
             }
+        public:
             bool TryPushPart(int Index, std::shared_ptr<std::vector<std::uint8_t>> Data, int Offset, int Length)
             {
                 if (((Index - MaxHandled + IndexSpace()) % IndexSpace()) >= WindowSize)
                 {
                     return false;
                 }
-                auto b = std::make_shared<std::vector<std::uint8_t>>();
-                b->resize(Length, 0);
-                ArrayCopy(*Data, Offset, *b, 0, Length);
-                auto p = std::make_shared<Part>();
-                p->Index = Index;
-                p->Data = b;
-                p->ResendTime = std::chrono::steady_clock::now() + std::chrono::milliseconds(GetTimeoutMilliseconds(0));
-                p->ResentCount = 0;
-                Parts[Index] = p;
+                auto &p = Occupy(Index);
+                if (Length < 0) { throw std::logic_error("InvalidArgument"); }
+                p.Data = BufferPool::Acquire(static_cast<std::size_t>(Length));
+                ArrayCopy(*Data, Offset, *p.Data, 0, Length);
                 return true;
             }
             bool TryPushPart(int Index, std::shared_ptr<std::vector<std::uint8_t>> Data)
@@ -167,16 +318,12 @@ namespace Server
                 {
                     return false;
                 }
-                auto p = std::make_shared<Part>();
-                p->Index = Index;
-                p->Data = Data;
-                p->ResendTime = std::chrono::steady_clock::now() + std::chrono::milliseconds(GetTimeoutMilliseconds(0));
-                p->ResentCount = 0;
-                Parts[Index] = p;
+                auto &p = Occupy(Index);
+                p.Data = Data;
                 return true;
             }
 
-            void Acknowledge(int Index, const std::vector<int> &Indices, int MaxWritten)
+            void Acknowledge(int Index, const std::vector<int> &Indices, int MaxWritten, std::chrono::steady_clock::time_point Time, CongestionControl &cc)
             {
                 // Parts (= [MaxHandled, MaxWritten]
                 // Index (- [MaxHandled, MaxWritten]
@@ -196,26 +343,57 @@ namespace Server
                     if (!IsEqualOrAfter(MaxWritten, i)) { return; }
                 }
 
-                while (MaxHandled != Index)
+                auto NumAcknowledged = 0;
+                auto Remove = [&](int i)
                 {
-                    auto i = GetSuccessor(MaxHandled);
-                    if (Parts.count(i) > 0)
+                    auto p = Find(i);
+                    if (p == nullptr) { return; }
+                    if (p->IsSent)
                     {
-                        Parts.erase(i);
+                        //只用未重传过的包估计往返时间（Karn算法）
+                        if (p->ResentCount == 0)
+                        {
+                            cc.OnRttSample(std::chrono::duration<double, std::chrono::milliseconds::period>(Time - p->SentTime).count());
+                        }
+                        NumAcknowledged += 1;
                     }
+                    Release(*p);
+                };
+                while (MaxHandled != Index)
+                {
+                    auto i = GetSuccessor(MaxHandled);
+                    Remove(i);
                     MaxHandled = i;
                 }
+                auto MaxAcknowledged = Index;
                 for (auto i : Indices)
                 {
-                    if (Parts.count(i) > 0)
+                    Remove(i);
+                    if (IsEqualOrAfter(i, MaxAcknowledged))
+                    {
+                        MaxAcknowledged = i;
+                    }
+                }
+                //已发送但在最大确认序号之前仍未确认的包，累计被跳过的次数，用于快速重传
+                if (MaxAcknowledged != Index)
+                {
+                    for (auto &p : Slots)
                     {
-                        Parts.erase(i);
+                        if (p.IsOccupied && p.IsSent && IsEqualOrAfter(MaxAcknowledged, p.Index))
+                        {
+                            p.NumSkipped += 1;
+                            if (cc.IsAdaptive && (p.NumSkipped >= CongestionControl::FastRetransmitThreshold()))
+                            {
+                                IsFastRetransmitPending = true;
+                            }
+                        }
                     }
                 }
+                cc.OnAcknowledged(NumAcknowledged);
                 while (MaxHandled != MaxWritten)
                 {
                     auto i = GetSuccessor(MaxHandled);
-                    if (Parts.count(i) > 0)
+                    if (Find(i) != nullptr)
                     {
                         break;
                     }
@@ -223,19 +401,94 @@ namespace Server
                 }
             }
 
-            void ForEachTimedoutPacket(int SessionId, std::chrono::steady_clock::time_point Time, std::function<void(int, std::shared_ptr<std::vector<std::uint8_t>>)> f)
+            void ForEachTimedoutPacket(std::chrono::steady_clock::time_point Time, CongestionControl &cc, std::function<void(int, std::shared_ptr<std::vector<std::uint8_t>>)> f)
+            {
+                if (NumParts == 0) { return; }
+                auto IsTimedout = false;
+                for (auto &p : Slots)
+                {
+                    if (!p.IsOccupied || !p.IsSent) { continue; }
+                    if (p.ResendTime <= Time)
+                    {
+                        f(p.Index, p.Data);
+                        p.ResendTime = std::chrono::steady_clock::now() + std::chrono::milliseconds(cc.GetTimeoutMilliseconds(p.ResentCount));
+                        p.ResentCount += 1;
+                        p.NumSkipped = 0;
+                        IsTimedout = true;
+                    }
+                }
+                if (IsTimedout)
+                {
+                    cc.OnTimeout();
+                }
+            }
+
+            /// <summary>只在确认时有包达到快速重传阈值后才遍历，其余情况下不扫描</summary>
+            void ForEachFastRetransmitPacket(std::chrono::steady_clock::time_point Time, CongestionControl &cc, std::function<void(int, std::shared_ptr<std::vector<std::uint8_t>>)> f)
+            {
+                if (!IsFastRetransmitPending) { return; }
+                IsFastRetransmitPending = false;
+                auto IsFastRetransmitted = false;
+                for (auto &p : Slots)
+                {
+                    if (!p.IsOccupied || !p.IsSent) { continue; }
+                    if (p.NumSkipped >= CongestionControl::FastRetransmitThreshold())
+                    {
+                        f(p.Index, p.Data);
+                        p.ResendTime = Time + std::chrono::milliseconds(cc.GetTimeoutMilliseconds(p.ResentCount));
+                        p.ResentCount += 1;
+                        p.NumSkipped = 0;
+                        IsFastRetransmitted = true;
+                    }
+                }
+                if (IsFastRetransmitted)
+                {
+                    cc.OnFastRetransmit();
+                }
+            }
+
+            /// <summary>已发送未确认的包中最早的重传时间，没有时返回time_point::max()</summary>
+            std::chrono::steady_clock::time_point GetNextResendTime()
+            {
+                auto ResendTime = std::chrono::steady_clock::time_point::max();
+                if (NumParts == 0) { return ResendTime; }
+                for (auto &p : Slots)
+                {
+                    if (p.IsOccupied && p.IsSent && (p.ResendTime < ResendTime))
+                    {
+                        ResendTime = p.ResendTime;
+                    }
+                }
+                return ResendTime;
+            }
+
+            /// <summary>按序号顺序取出尚未发送的包，使已发送未确认的包数量不超过拥塞窗口</summary>
+            void ForEachUnsentPacket(std::chrono::steady_clock::time_point Time, CongestionControl &cc, std::function<void(int, std::shared_ptr<std::vector<std::uint8_t>>)> f)
             {
-                for (auto p : Parts)
+                if (NumParts == 0) { return; }
+                auto NumInFlight = 0;
+                for (auto &p : Slots)
                 {
-                    auto Key = std::get<0>(p);
-                    auto Value = std::get<1>(p);
-                    if (Value->ResendTime <= Time)
+                    if (p.IsOccupied && p.IsSent)
                     {
-                        f(Key, Value->Data);
-                        Value->ResendTime = std::chrono::steady_clock::now() + std::chrono::milliseconds(GetTimeoutMilliseconds(Value->ResentCount));
-                        Value->ResentCount += 1;
+                        NumInFlight += 1;
                     }
                 }
+                auto CongestionWindowSize = cc.WindowSize();
+                auto i = MaxHandled;
+                for (int k = 0; (k < WindowSize) && (NumInFlight < CongestionWindowSize); k += 1)
+                {
+                    i = GetSuccessor(i);
+                    auto p = Find(i);
+                    if (p == nullptr) { continue; }
+                    if (p->IsSent) { continue; }
+                    f(i, p->Data);
+                    p->IsSent = true;
+                    p->SentTime = Time;
+                    p->ResendTime = Time + std::chrono::milliseconds(cc.GetTimeoutMilliseconds(0));
+                    p->ResentCount = 0;
+                    NumInFlight += 1;
+                }
             }
         };
         class UdpReadContext
@@ -243,22 +496,42 @@ namespace Server
         public:
             std::shared_ptr<PartContext> Parts;
             std::set<int> NotAcknowledgedIndices;
-            std::function<void(std::shared_ptr<std::vector<std::shared_ptr<StreamedVirtualTransportServerHandleResult>>>)> OnSuccess;
-            std::function<void()> OnFailure;
+            //状态机已开始读取，等待收到数据
+            bool IsRawReadPending = false;
         };
         class UdpWriteContext
         {
         public:
             std::shared_ptr<PartContext> Parts;
             int WritenIndex;
+            std::shared_ptr<CongestionControl> Congestion;
+            std::chrono::steady_clock::time_point ScheduledResendTime;
         };
         BaseSystem::LockedVariable<std::shared_ptr<UdpReadContext>> RawReadingContext;
         BaseSystem::LockedVariable<std::shared_ptr<UdpWriteContext>> CookedWritingContext;
 
-        std::shared_ptr<SessionStateMachine<std::shared_ptr<StreamedVirtualTransportServerHandleResult>, Unit>> ssm;
+        std::shared_ptr<SessionStateMachine<UdpSession, std::shared_ptr<StreamedVirtualTransportServerHandleResult>>> ssm;
+
+        PendingWriteMetrics WriteMetrics;
+
+        //同一时间只有一个OnWrite，待分包的缓冲区列表和待发送的包列表重复使用
+        std::vector<std::shared_ptr<std::vector<std::uint8_t>>> WritingByteArrays;
+        std::vector<std::shared_ptr<std::vector<std::uint8_t>>> WritingParts;
+        //同一时间只有一个HandleRawRead，解析出的命令交给状态机时与其内部的空列表交换
+        std::vector<std::shared_ptr<StreamedVirtualTransportServerHandleResult>> RawReadResults;
 
     public:
-        UdpSession(UdpServer &Server, std::shared_ptr<asio::ip::udp::socket> ServerSocket, asio::ip::udp::endpoint RemoteEndPoint, std::function<std::pair<std::shared_ptr<IServerImplementation>, std::shared_ptr<IStreamedVirtualTransportServer>>(std::shared_ptr<ISessionContext>, std::shared_ptr<IBinaryTransformer>)> VirtualTransportServerFactory, std::function<void(std::function<void()>)> QueueUserWorkItem);
+        UdpSession(UdpServer &Server, std::shared_ptr<asio::ip::udp::socket> ServerSocket, asio::ip::udp::endpoint RemoteEndPoint, std::function<std::pair<std::shared_ptr<IServerImplementation>, std::shared_ptr<IStreamedVirtualTransportServer>>(std::shared_ptr<ISessionContext>, std::shared_ptr<IBinaryTransformer>)> VirtualTransportServerFactory, std::function<void(std::function<void()>)> QueueUserWorkItem, std::shared_ptr<TimerWheel> Wheel);
+
+        /// <summary>是否使用位图格式的确认，只能在启动前修改，以保证线程安全</summary>
+        bool SelectiveAck() const
+        {
+            return SelectiveAckValue;
+        }
+        void SelectiveAck(bool value)
+        {
+            SelectiveAckValue = value;
+        }
 
         int SessionId()
         {
@@ -270,10 +543,10 @@ namespace Server
     private:
         void OnShutdownRead();
         void OnShutdownWrite();
-        void OnWrite(Unit w, std::function<void()> OnSuccess, std::function<void()> OnFailure);
-        void OnExecute(std::shared_ptr<StreamedVirtualTransportServerHandleResult> r, std::function<void()> OnSuccess, std::function<void()> OnFailure);
-        void OnStartRawRead(std::function<void(std::shared_ptr<std::vector<std::shared_ptr<StreamedVirtualTransportServerHandleResult>>>)> OnSuccess, std::function<void()> OnFailure);
-        void HandleRawRead(std::shared_ptr<std::vector<std::shared_ptr<Part>>> Parts, std::function<void(std::shared_ptr<std::vector<std::shared_ptr<StreamedVirtualTransportServerHandleResult>>>)> OnSuccess, std::function<void()> OnFailure);
+        void OnWrite();
+        void OnExecute(std::shared_ptr<StreamedVirtualTransportServerHandleResult> r, bool IsConcurrent);
+        void OnStartRawRead();
+        void HandleRawRead(std::shared_ptr<std::vector<std::shared_ptr<std::vector<std::uint8_t>>>> Parts);
 
     public:
         void Stop();
@@ -287,6 +560,10 @@ namespace Server
 
     private:
         void SendPacket(asio::ip::udp::endpoint RemoteEndPoint, std::shared_ptr<std::vector<std::uint8_t>> Data);
+        void SendPackets(asio::ip::udp::endpoint RemoteEndPoint, const std::vector<std::shared_ptr<std::vector<std::uint8_t>>> &Packets);
+        /// <summary>需在写入锁内调用，最早的重传时间早于已登记的时间时在时间轮上登记</summary>
+        void ScheduleResend(std::shared_ptr<UdpWriteContext> c);
+        void OnResendTimer();
 
     public:
         bool PushAux(asio::ip::udp::endpoint RemoteEndPoint, std::shared_ptr<std::vector<int>> Indices);
@@ -304,10 +581,13 @@ namespace Server
         }
 
     private:
+        static bool IsKnownException(const std::exception &ex);
+        static bool IsConcurrent(const std::shared_ptr<StreamedVirtualTransportServerHandleResult> &r)
+        {
+            return r->OnCommand() && r->Command->IsConcurrent;
+        }
         static bool IsSocketErrorKnown(const std::exception &ex);
 
-        static int GetMinNotLessPowerOfTwo(int v);
-
         static void ArrayCopy(const std::vector<std::uint8_t> &Source, int SourceIndex, std::vector<std::uint8_t> &Destination, int DestinationIndex, int Length);
     public:
         //线程安全
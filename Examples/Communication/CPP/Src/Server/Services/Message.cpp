@@ -2,10 +2,62 @@
 
 #include <memory>
 #include <string>
+#include <vector>
+#include <random>
+#include <stdexcept>
+#include <format>
 
 using namespace Communication;
 using namespace Server::Services;
 
+namespace
+{
+    //ChaCha20握手：客户端发送"secure chacha20 <ClientSalt>"，服务器只向该会话发送消息"secure chacha20 <ServerSalt>"后回复成功，Salt为32字节的十六进制
+    const std::u16string SecureChaCha20Prefix = u"secure chacha20 ";
+    const std::size_t SaltLength = 32;
+
+    /// <summary>格式不正确时返回空</summary>
+    std::vector<std::uint8_t> ParseSalt(const std::u16string &s)
+    {
+        std::vector<std::uint8_t> Salt;
+        if (s.size() != SaltLength * 2) { return Salt; }
+        auto Digit = [](char16_t c) -> int
+        {
+            if ((c >= u'0') && (c <= u'9')) { return c - u'0'; }
+            if ((c >= u'A') && (c <= u'F')) { return c - u'A' + 10; }
+            if ((c >= u'a') && (c <= u'f')) { return c - u'a' + 10; }
+            return -1;
+        };
+        for (std::size_t k = 0; k < SaltLength; k += 1)
+        {
+            auto High = Digit(s[k * 2]);
+            auto Low = Digit(s[k * 2 + 1]);
+            if ((High < 0) || (Low < 0)) { return std::vector<std::uint8_t>(); }
+            Salt.push_back(static_cast<std::uint8_t>((High << 4) | Low));
+        }
+        return Salt;
+    }
+    std::u16string FormatSalt(const std::vector<std::uint8_t> &Salt)
+    {
+        std::wstring s;
+        for (auto b : Salt)
+        {
+            s += std::format(L"{:02X}", b);
+        }
+        return wideCharToUtf16(s);
+    }
+    std::vector<std::uint8_t> GenerateSalt()
+    {
+        std::random_device rd;
+        std::vector<std::uint8_t> Salt;
+        for (std::size_t k = 0; k < SaltLength; k += 1)
+        {
+            Salt.push_back(static_cast<std::uint8_t>(rd() & 0xFF));
+        }
+        return Salt;
+    }
+}
+
 /// <summary>发送消息</summary>
 std::shared_ptr<SendMessageReply> ServerImplementation::SendMessage(std::shared_ptr<SendMessageRequest> r)
 {
@@ -18,10 +70,25 @@ std::shared_ptr<SendMessageReply> ServerImplementation::SendMessage(std::shared_
         SessionContext->RaiseAuthenticated();
         return SendMessageReply::CreateSuccess();
     }
-    else if (r->Content == u"secure")
+    else if ((r->Content == u"secure") || r->Content.starts_with(SecureChaCha20Prefix))
     {
         //生成测试用确定Key
         auto sc = std::make_shared<SecureContext>();
+        if (r->Content != u"secure")
+        {
+            sc->Cipher = SecureCipher::ChaCha20;
+            sc->ClientSalt = ParseSalt(r->Content.substr(SecureChaCha20Prefix.size()));
+            if (sc->ClientSalt.size() == 0) { throw std::logic_error("InvalidSalt"); }
+            sc->ServerSalt = GenerateSalt();
+            //在回复之前以明文送达客户端
+            auto Lock = SessionContext->WriterLock();
+            if (SessionContext->EventPump != nullptr)
+            {
+                auto e = std::make_shared<MessageReceivedEvent>();
+                e->Content = SecureChaCha20Prefix + FormatSalt(sc->ServerSalt);
+                SessionContext->EventPump->MessageReceived(e);
+            }
+        }
         for (int i = 0; i < 41; i += 1)
         {
             sc->ServerToken.push_back(static_cast<std::uint8_t>(i));
@@ -34,20 +101,12 @@ std::shared_ptr<SendMessageReply> ServerImplementation::SendMessage(std::shared_
         return SendMessageReply::CreateSuccess();
     }
     SessionContext->SendMessageCount += 1;
-    auto Sessions = ServerContext->Sessions();
-    for (int k = 0; k < static_cast<int>(Sessions->size()); k += 1)
+    auto e = std::make_shared<MessageReceivedEvent>();
+    e->Content = r->Content;
+    ServerContext->Broadcast([&](IEventPump &ep) { ep.MessageReceived(e); }, [](class SessionContext &rc)
     {
-        auto rc = (*Sessions)[k];
-        {
-            auto Lock = rc->WriterLock();
-            rc->ReceivedMessageCount += 1;
-            if (rc->EventPump != nullptr)
-            {
-                auto e = std::make_shared<MessageReceivedEvent>();
-                e->Content = r->Content;
-                rc->EventPump->MessageReceived(e);
-            }
-        }
-    }
+        rc.ReceivedMessageCount += 1;
+        return true;
+    });
     return SendMessageReply::CreateSuccess();
 }
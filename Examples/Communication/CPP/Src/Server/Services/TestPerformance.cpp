@@ -49,19 +49,12 @@ std::shared_ptr<TestMessageReply> ServerImplementation::TestMessage(std::shared_
     auto m = std::make_shared<TestMessageReceivedEvent>();
     m->Message = r->Message;
     SessionContext->SendMessageCount += 1;
-    auto Sessions = ServerContext->Sessions();
-    for (int k = 0; k < static_cast<int>(Sessions->size()); k += 1)
+    auto Self = SessionContext.get();
+    auto Count = ServerContext->Broadcast([&](IEventPump &ep) { ep.TestMessageReceived(m); }, [Self](class SessionContext &rc)
     {
-        auto rc = (*Sessions)[k];
-        if (rc == SessionContext->shared_from_this()) { continue; }
-        {
-            auto Lock = rc->WriterLock();
-            rc->ReceivedMessageCount += 1;
-            if (rc->EventPump != nullptr)
-            {
-                rc->EventPump->TestMessageReceived(m);
-            }
-        }
-    }
-    return TestMessageReply::CreateSuccess(static_cast<int>(Sessions->size()));
+        if (&rc == Self) { return false; }
+        rc.ReceivedMessageCount += 1;
+        return true;
+    });
+    return TestMessageReply::CreateSuccess(Count);
 }
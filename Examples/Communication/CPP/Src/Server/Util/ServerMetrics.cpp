@@ -0,0 +1,388 @@
+﻿#include "ServerMetrics.h"
+
+#include "BaseSystem/StringUtilities.h"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <sstream>
+
+namespace Server
+{
+    namespace
+    {
+        const int SubBucketBits = 3;
+        const int SubBucketCount = 1 << SubBucketBits;
+        const int MaxValueBits = 40; //微秒，约12天
+        const int BucketCount = (MaxValueBits - SubBucketBits + 1) * SubBucketCount;
+        const int StageCount = 3;
+
+        int BucketOfValue(std::uint64_t Value)
+        {
+            if (Value < static_cast<std::uint64_t>(SubBucketCount) * 2) { return static_cast<int>(Value); }
+            if (Value >= (static_cast<std::uint64_t>(1) << MaxValueBits)) { return BucketCount - 1; }
+            auto e = static_cast<int>(std::bit_width(Value)) - 1 - SubBucketBits;
+            return (e + 1) * SubBucketCount + static_cast<int>((Value >> e) - SubBucketCount);
+        }
+        /// <summary>桶中的最大值</summary>
+        std::uint64_t UpperBoundOfBucket(int Bucket)
+        {
+            if (Bucket < SubBucketCount * 2) { return static_cast<std::uint64_t>(Bucket); }
+            auto e = Bucket / SubBucketCount - 1;
+            auto m = static_cast<std::uint64_t>(Bucket % SubBucketCount + SubBucketCount);
+            return ((m + 1) << e) - 1;
+        }
+
+        //只由所属线程写入，其他线程只读取，因此不需要原子读改写
+        void Increase(std::atomic<std::uint64_t> &a, std::uint64_t Value)
+        {
+            a.store(a.load(std::memory_order_relaxed) + Value, std::memory_order_relaxed);
+        }
+
+        std::atomic<std::uint64_t> NextMetricsId(1);
+
+        class ThreadShard
+        {
+        public:
+            std::uint64_t MetricsId = 0;
+            ServerMetricsShard *Shard = nullptr;
+        };
+        thread_local ThreadShard CurrentThreadShard;
+
+        std::string EscapeLabel(const std::u16string &s)
+        {
+            std::string r;
+            for (auto c : utf16ToUtf8(s))
+            {
+                if ((c == '\\') || (c == '"')) { r.push_back('\\'); }
+                if (c == '\n') { r += "\\n"; continue; }
+                r.push_back(c);
+            }
+            return r;
+        }
+    }
+
+    class HistogramShard
+    {
+    public:
+        std::atomic<std::uint64_t> Buckets[BucketCount];
+        std::atomic<std::uint64_t> Sum;
+        std::atomic<std::uint64_t> Max;
+
+        HistogramShard()
+            : Sum(0), Max(0)
+        {
+            for (auto &b : Buckets)
+            {
+                b.store(0, std::memory_order_relaxed);
+            }
+        }
+
+        void Add(std::uint64_t Value)
+        {
+            Increase(Buckets[BucketOfValue(Value)], 1);
+            Increase(Sum, Value);
+            if (Value > Max.load(std::memory_order_relaxed))
+            {
+                Max.store(Value, std::memory_order_relaxed);
+            }
+        }
+    };
+
+    class CommandShard
+    {
+    public:
+        std::atomic<std::uint64_t> Requests;
+        std::atomic<std::uint64_t> Errors;
+        std::atomic<std::uint64_t> InputBytes;
+        std::atomic<std::uint64_t> OutputBytes;
+        HistogramShard Latencies[StageCount];
+
+        CommandShard()
+            : Requests(0), Errors(0), InputBytes(0), OutputBytes(0)
+        {
+        }
+    };
+
+    class ServerMetricsShard
+    {
+    public:
+        std::atomic<CommandShard *> Commands[ServerMetrics::MaxCommandCount];
+        std::atomic<std::uint64_t> BadCommands;
+        std::unordered_map<std::u16string, int> CommandIdCache; //只由所属线程访问
+
+        ServerMetricsShard()
+            : BadCommands(0)
+        {
+            for (auto &c : Commands)
+            {
+                c.store(nullptr, std::memory_order_relaxed);
+            }
+        }
+        ~ServerMetricsShard()
+        {
+            for (auto &c : Commands)
+            {
+                delete c.load(std::memory_order_relaxed);
+            }
+        }
+
+        CommandShard &Command(int CommandId)
+        {
+            auto &Slot = Commands[static_cast<std::size_t>(CommandId) < static_cast<std::size_t>(ServerMetrics::MaxCommandCount) ? CommandId : 0];
+            auto c = Slot.load(std::memory_order_relaxed);
+            if (c == nullptr)
+            {
+                c = new CommandShard();
+                Slot.store(c, std::memory_order_release);
+            }
+            return *c;
+        }
+    };
+
+    ServerMetrics::ServerMetrics()
+        : Id(NextMetricsId.fetch_add(1)), CommandNames(1, u"(other)"), TcpSessions(0), UdpSessions(0)
+    {
+    }
+    ServerMetrics::~ServerMetrics()
+    {
+    }
+
+    ServerMetricsShard &ServerMetrics::GetShard()
+    {
+        auto &t = CurrentThreadShard;
+        if (t.MetricsId == Id) { return *t.Shard; }
+        auto Shard = std::make_unique<ServerMetricsShard>();
+        t.MetricsId = Id;
+        t.Shard = Shard.get();
+        std::unique_lock<std::mutex> Lock(Lockee);
+        Shards.push_back(std::move(Shard));
+        return *t.Shard;
+    }
+
+    int ServerMetrics::GetCommandId(const std::u16string &CommandName)
+    {
+        auto &Shard = GetShard();
+        auto i = Shard.CommandIdCache.find(CommandName);
+        if (i != Shard.CommandIdCache.end()) { return i->second; }
+        auto CommandId = 0;
+        {
+            std::unique_lock<std::mutex> Lock(Lockee);
+            auto j = CommandIds.find(CommandName);
+            if (j != CommandIds.end())
+            {
+                CommandId = j->second;
+            }
+            else if (CommandNames.size() < static_cast<std::size_t>(MaxCommandCount))
+            {
+                CommandId = static_cast<int>(CommandNames.size());
+                CommandNames.push_back(CommandName);
+                CommandIds.emplace(CommandName, CommandId);
+            }
+        }
+        Shard.CommandIdCache.emplace(CommandName, CommandId);
+        return CommandId;
+    }
+
+    void ServerMetrics::AddRequest(int CommandId, std::size_t InputByteLength)
+    {
+        auto &c = GetShard().Command(CommandId);
+        Increase(c.Requests, 1);
+        Increase(c.InputBytes, InputByteLength);
+    }
+    void ServerMetrics::AddError(int CommandId)
+    {
+        Increase(GetShard().Command(CommandId).Errors, 1);
+    }
+    void ServerMetrics::AddOutputBytes(int CommandId, std::size_t ByteLength)
+    {
+        Increase(GetShard().Command(CommandId).OutputBytes, ByteLength);
+    }
+    void ServerMetrics::AddLatency(int CommandId, CommandStage Stage, std::chrono::steady_clock::duration Duration)
+    {
+        auto Microseconds = std::max<std::int64_t>(std::chrono::duration_cast<std::chrono::microseconds>(Duration).count(), 0);
+        GetShard().Command(CommandId).Latencies[static_cast<int>(Stage)].Add(static_cast<std::uint64_t>(Microseconds));
+    }
+    void ServerMetrics::AddBadCommand()
+    {
+        Increase(GetShard().BadCommands, 1);
+    }
+
+    void ServerMetrics::AddTcpSessions(int Delta)
+    {
+        TcpSessions.fetch_add(Delta, std::memory_order_relaxed);
+    }
+    void ServerMetrics::AddUdpSessions(int Delta)
+    {
+        UdpSessions.fetch_add(Delta, std::memory_order_relaxed);
+    }
+
+    std::string ServerMetrics::Scrape()
+    {
+        class Histogram
+        {
+        public:
+            std::vector<std::uint64_t> Buckets = std::vector<std::uint64_t>(BucketCount, 0);
+            std::uint64_t Count = 0;
+            std::uint64_t Sum = 0;
+            std::uint64_t Max = 0;
+
+            std::uint64_t Quantile(double q) const
+            {
+                if (Count == 0) { return 0; }
+                auto Rank = std::max<std::uint64_t>(static_cast<std::uint64_t>(std::ceil(q * static_cast<double>(Count))), 1);
+                std::uint64_t Accumulated = 0;
+                for (int k = 0; k < BucketCount; k += 1)
+                {
+                    Accumulated += Buckets[k];
+                    if (Accumulated >= Rank) { return std::min(UpperBoundOfBucket(k), Max); }
+                }
+                return Max;
+            }
+        };
+        class Command
+        {
+        public:
+            std::uint64_t Requests = 0;
+            std::uint64_t Errors = 0;
+            std::uint64_t InputBytes = 0;
+            std::uint64_t OutputBytes = 0;
+            Histogram Latencies[StageCount];
+        };
+
+        std::vector<std::u16string> Names;
+        std::vector<Command> Commands;
+        std::uint64_t BadCommands = 0;
+        {
+            std::unique_lock<std::mutex> Lock(Lockee);
+            Names = CommandNames;
+            Commands.resize(Names.size());
+            for (auto &s : Shards)
+            {
+                BadCommands += s->BadCommands.load(std::memory_order_relaxed);
+                for (std::size_t k = 0; k < Names.size(); k += 1)
+                {
+                    auto sc = s->Commands[k].load(std::memory_order_acquire);
+                    if (sc == nullptr) { continue; }
+                    auto &c = Commands[k];
+                    c.Requests += sc->Requests.load(std::memory_order_relaxed);
+                    c.Errors += sc->Errors.load(std::memory_order_relaxed);
+                    c.InputBytes += sc->InputBytes.load(std::memory_order_relaxed);
+                    c.OutputBytes += sc->OutputBytes.load(std::memory_order_relaxed);
+                    for (int i = 0; i < StageCount; i += 1)
+                    {
+                        auto &h = c.Latencies[i];
+                        auto &sh = sc->Latencies[i];
+                        for (int b = 0; b < BucketCount; b += 1)
+                        {
+                            auto n = sh.Buckets[b].load(std::memory_order_relaxed);
+                            h.Buckets[b] += n;
+                            h.Count += n;
+                        }
+                        h.Sum += sh.Sum.load(std::memory_order_relaxed);
+                        h.Max = std::max(h.Max, sh.Max.load(std::memory_order_relaxed));
+                    }
+                }
+            }
+        }
+
+        const char *StageNames[StageCount] = { "queue", "execute", "write" };
+        const double Quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+        const char *QuantileNames[] = { "0.5", "0.9", "0.99", "0.999" };
+
+        std::ostringstream s;
+        s << "# TYPE server_sessions gauge\n";
+        s << "server_sessions{transport=\"tcp\"} " << TcpSessions.load(std::memory_order_relaxed) << "\n";
+        s << "server_sessions{transport=\"udp\"} " << UdpSessions.load(std::memory_order_relaxed) << "\n";
+        s << "# TYPE server_bad_commands_total counter\n";
+        s << "server_bad_commands_total " << BadCommands << "\n";
+        s << "# TYPE server_command_requests_total counter\n";
+        s << "# TYPE server_command_errors_total counter\n";
+        s << "# TYPE server_command_input_bytes_total counter\n";
+        s << "# TYPE server_command_output_bytes_total counter\n";
+        s << "# TYPE server_command_latency_microseconds summary\n";
+        for (std::size_t k = 0; k < Names.size(); k += 1)
+        {
+            auto &c = Commands[k];
+            if ((c.Requests == 0) && (c.Errors == 0) && (c.OutputBytes == 0)) { continue; }
+            auto Label = "command=\"" + EscapeLabel(Names[k]) + "\"";
+            s << "server_command_requests_total{" << Label << "} " << c.Requests << "\n";
+            s << "server_command_errors_total{" << Label << "} " << c.Errors << "\n";
+            s << "server_command_input_bytes_total{" << Label << "} " << c.InputBytes << "\n";
+            s << "server_command_output_bytes_total{" << Label << "} " << c.OutputBytes << "\n";
+            for (int i = 0; i < StageCount; i += 1)
+            {
+                auto &h = c.Latencies[i];
+                if (h.Count == 0) { continue; }
+                auto StageLabel = Label + ",stage=\"" + StageNames[i] + "\"";
+                for (int q = 0; q < 4; q += 1)
+                {
+                    s << "server_command_latency_microseconds{" << StageLabel << ",quantile=\"" << QuantileNames[q] << "\"} " << h.Quantile(Quantiles[q]) << "\n";
+                }
+                s << "server_command_latency_microseconds{" << StageLabel << ",quantile=\"1\"} " << h.Max << "\n";
+                s << "server_command_latency_microseconds_sum{" << StageLabel << "} " << h.Sum << "\n";
+                s << "server_command_latency_microseconds_count{" << StageLabel << "} " << h.Count << "\n";
+            }
+        }
+        return s.str();
+    }
+
+    PendingWriteMetrics::PendingWriteMetrics()
+        : EnqueuePosition(0), DequeuePosition(0)
+    {
+        for (std::size_t k = 0; k < Capacity; k += 1)
+        {
+            Slots[k].Sequence.store(k, std::memory_order_relaxed);
+        }
+    }
+
+    void PendingWriteMetrics::Ready(int CommandId, std::chrono::steady_clock::time_point Time)
+    {
+        auto Position = EnqueuePosition.load(std::memory_order_relaxed);
+        while (true)
+        {
+            auto &s = Slots[Position % Capacity];
+            auto Sequence = s.Sequence.load(std::memory_order_acquire);
+            auto Difference = static_cast<std::int64_t>(Sequence - Position);
+            if (Difference == 0)
+            {
+                if (EnqueuePosition.compare_exchange_weak(Position, Position + 1, std::memory_order_relaxed))
+                {
+                    s.Value = Entry{ CommandId, Time };
+                    s.Sequence.store(Position + 1, std::memory_order_release);
+                    return;
+                }
+            }
+            else if (Difference < 0)
+            {
+                //队列已满
+                return;
+            }
+            else
+            {
+                Position = EnqueuePosition.load(std::memory_order_relaxed);
+            }
+        }
+    }
+    void PendingWriteMetrics::BeginWrite()
+    {
+        //遇到已占用但尚未写完的槽位时停止，其后的记录归入之后的写入
+        while (true)
+        {
+            auto &s = Slots[DequeuePosition % Capacity];
+            if (s.Sequence.load(std::memory_order_acquire) != DequeuePosition + 1) { break; }
+            Writing.push_back(s.Value);
+            s.Sequence.store(DequeuePosition + Capacity, std::memory_order_release);
+            DequeuePosition += 1;
+        }
+    }
+    void PendingWriteMetrics::EndWrite(ServerMetrics &Metrics)
+    {
+        auto Time = std::chrono::steady_clock::now();
+        for (auto &e : Writing)
+        {
+            Metrics.AddLatency(e.CommandId, CommandStage::Write, Time - e.Time);
+        }
+        Writing.clear();
+    }
+}
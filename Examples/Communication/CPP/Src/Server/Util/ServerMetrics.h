@@ -0,0 +1,107 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <unordered_map>
+
+namespace Server
+{
+    enum class CommandStage
+    {
+        Queue, //命令解析完成到开始执行
+        Execute, //开始执行到回复就绪
+        Write //回复就绪到写入套接字完成
+    };
+
+    class ServerMetricsShard;
+
+    /// <summary>
+    /// 服务器指标，包括按命令统计的请求数、错误数、字节数和各阶段的延迟直方图，以及TCP和UDP会话数。
+    /// 计数器和直方图按线程分片，每个线程只写入自己的分片，记录时不加锁也不使用原子读改写；Scrape时汇总所有分片。
+    /// 延迟直方图按2的幂分段，每段再等分为8个桶，相对误差不超过12.5%。
+    /// 本类的所有公共成员均是线程安全的。
+    /// </summary>
+    class ServerMetrics
+    {
+    public:
+        static const int MaxCommandCount = 256;
+
+        ServerMetrics();
+        ~ServerMetrics();
+
+        ServerMetrics(const ServerMetrics &) = delete;
+        ServerMetrics &operator=(const ServerMetrics &) = delete;
+
+        /// <summary>命令编号，首次出现时分配；命令数超过上限时归入编号0，即"(other)"</summary>
+        int GetCommandId(const std::u16string &CommandName);
+
+        void AddRequest(int CommandId, std::size_t InputByteLength);
+        void AddError(int CommandId);
+        void AddOutputBytes(int CommandId, std::size_t ByteLength);
+        void AddLatency(int CommandId, CommandStage Stage, std::chrono::steady_clock::duration Duration);
+        void AddBadCommand();
+
+        void AddTcpSessions(int Delta);
+        void AddUdpSessions(int Delta);
+
+        /// <summary>汇总所有分片，以Prometheus文本格式返回</summary>
+        std::string Scrape();
+
+    private:
+        const std::uint64_t Id;
+
+        std::mutex Lockee;
+        std::vector<std::unique_ptr<ServerMetricsShard>> Shards;
+        std::vector<std::u16string> CommandNames;
+        std::unordered_map<std::u16string, int> CommandIds;
+
+        std::atomic<std::int64_t> TcpSessions;
+        std::atomic<std::int64_t> UdpSessions;
+
+        ServerMetricsShard &GetShard();
+    };
+
+    /// <summary>
+    /// 记录回复就绪到写入完成的时间。Ready可在执行命令的任意线程上调用，BeginWrite和EndWrite只在会话的写入流程中调用。
+    /// 就绪的回复放入定长的无锁多生产者单消费者队列，队列满时丢弃该次记录，只影响统计。
+    /// </summary>
+    class PendingWriteMetrics
+    {
+    public:
+        PendingWriteMetrics();
+
+        void Ready(int CommandId, std::chrono::steady_clock::time_point Time);
+        /// <summary>将此前就绪的回复归入本次写入</summary>
+        void BeginWrite();
+        /// <summary>本次写入完成，记录其中各回复的写入时间</summary>
+        void EndWrite(ServerMetrics &Metrics);
+
+    private:
+        class Entry
+        {
+        public:
+            int CommandId;
+            std::chrono::steady_clock::time_point Time;
+        };
+        //Sequence等于槽位序号时可写入，等于槽位序号加1时可读取
+        class Slot
+        {
+        public:
+            std::atomic<std::uint64_t> Sequence;
+            Entry Value;
+        };
+
+        static constexpr std::size_t Capacity = 64;
+        Slot Slots[Capacity];
+        std::atomic<std::uint64_t> EnqueuePosition;
+        //以下只在写入流程中访问
+        std::uint64_t DequeuePosition;
+        std::vector<Entry> Writing;
+    };
+}
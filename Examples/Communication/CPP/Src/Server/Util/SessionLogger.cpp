@@ -0,0 +1,454 @@
+﻿#include "SessionLogger.h"
+
+#include "BaseSystem/StringUtilities.h"
+#include "BaseSystem/Times.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstdio>
+
+namespace Server
+{
+    /// <summary>
+    /// 单生产者单消费者环形缓冲区，生产者为写日志的线程，消费者为日志线程。
+    /// </summary>
+    class SessionLogRing
+    {
+    public:
+        std::vector<SessionLogRecord> Records;
+        const std::uint64_t Mask;
+        alignas(64) std::atomic<std::uint64_t> Head; //消费者已读取到的位置
+        alignas(64) std::atomic<std::uint64_t> Tail; //生产者已写入到的位置
+        std::uint64_t CachedHead; //生产者看到的Head，只在看起来已满时重新读取
+        std::atomic<bool> IsAbandoned; //生产者线程已退出
+
+        SessionLogRing(std::size_t Capacity)
+            : Records(Capacity), Mask(Capacity - 1), Head(0), Tail(0), CachedHead(0), IsAbandoned(false)
+        {
+        }
+
+        bool IsFull()
+        {
+            auto t = Tail.load(std::memory_order_relaxed);
+            if (t - CachedHead < Records.size()) { return false; }
+            CachedHead = Head.load(std::memory_order_acquire);
+            return t - CachedHead >= Records.size();
+        }
+        /// <summary>调用前需要确认IsFull()为false</summary>
+        SessionLogRecord &Next()
+        {
+            return Records[Tail.load(std::memory_order_relaxed) & Mask];
+        }
+        void Commit()
+        {
+            Tail.store(Tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+    };
+
+    namespace
+    {
+        const std::size_t MaxNameCount = 65536;
+        const std::size_t NameChunkSize = 1024;
+
+        std::atomic<std::uint64_t> NextLoggerId(1);
+
+        //名称编号从1开始，全局共享，只增不减
+        //名称分块存放，只追加不移动，编号小于PublishedNameCount的名称可不加锁读取，日志线程不必复制名称表
+        std::mutex NameLockee;
+        std::unique_ptr<std::u16string[]> NameChunks[MaxNameCount / NameChunkSize];
+        std::atomic<std::uint32_t> PublishedNameCount(1);
+        std::unordered_map<std::u16string, std::uint32_t> NameIds;
+
+        thread_local std::unordered_map<std::u16string, std::uint32_t> NameIdCache;
+
+        /// <summary>调用前需要确认Id不为0且已发布，即Id小于以acquire读取的PublishedNameCount，或Id由与发布同步的途径取得</summary>
+        const std::u16string &GetName(std::uint32_t Id)
+        {
+            return NameChunks[Id / NameChunkSize][Id % NameChunkSize];
+        }
+
+        /// <summary>返回0表示名称为空或名称表已满，此时名称需要通过文本传递</summary>
+        std::uint32_t GetNameId(const std::u16string &Name)
+        {
+            if (Name.empty()) { return 0; }
+            auto i = NameIdCache.find(Name);
+            if (i != NameIdCache.end()) { return i->second; }
+            std::uint32_t Id = 0;
+            {
+                std::unique_lock<std::mutex> Lock(NameLockee);
+                auto j = NameIds.find(Name);
+                if (j != NameIds.end())
+                {
+                    Id = j->second;
+                }
+                else
+                {
+                    auto Count = PublishedNameCount.load(std::memory_order_relaxed);
+                    if (Count < MaxNameCount)
+                    {
+                        auto &Chunk = NameChunks[Count / NameChunkSize];
+                        if (Chunk == nullptr)
+                        {
+                            Chunk = std::make_unique<std::u16string[]>(NameChunkSize);
+                        }
+                        Chunk[Count % NameChunkSize] = Name;
+                        NameIds.emplace(Name, Count);
+                        PublishedNameCount.store(Count + 1, std::memory_order_release);
+                        Id = Count;
+                    }
+                }
+            }
+            if (Id != 0)
+            {
+                NameIdCache.emplace(Name, Id);
+            }
+            return Id;
+        }
+
+        std::int64_t NowMicroseconds()
+        {
+            return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+        }
+
+        const char16_t *SessionLogTypeToString(SessionLogType Type)
+        {
+            switch (Type)
+            {
+            case SessionLogType::InBytes: return u"InBytes";
+            case SessionLogType::OutBytes: return u"OutBytes";
+            case SessionLogType::Time: return u"Time";
+            case SessionLogType::Known: return u"Known";
+            case SessionLogType::Sys: return u"Sys";
+            case SessionLogType::Unk: return u"Unk";
+            case SessionLogType::Crtcu: return u"Crtcu";
+            }
+            return u"";
+        }
+
+        class ThreadRing
+        {
+        public:
+            std::uint64_t LoggerId = 0;
+            std::shared_ptr<SessionLogRing> Ring;
+
+            ~ThreadRing();
+        };
+
+        thread_local bool IsThreadRingDestroyed = false;
+        thread_local ThreadRing CurrentThreadRing;
+
+        ThreadRing::~ThreadRing()
+        {
+            if (Ring != nullptr)
+            {
+                Ring->IsAbandoned.store(true, std::memory_order_release);
+            }
+            IsThreadRingDestroyed = true;
+        }
+    }
+
+    SessionLogSource SessionLogSource::Create(const asio::ip::address &Address, std::uint16_t Port)
+    {
+        SessionLogSource s = {};
+        s.Port = Port;
+        if (Address.is_v6())
+        {
+            s.IsV6 = true;
+            auto Bytes = Address.to_v6().to_bytes();
+            std::copy(Bytes.begin(), Bytes.end(), s.Address);
+        }
+        else
+        {
+            s.IsV6 = false;
+            auto Bytes = Address.to_v4().to_bytes();
+            std::copy(Bytes.begin(), Bytes.end(), s.Address);
+        }
+        s.HasSessionId = false;
+        s.SessionId = 0;
+        return s;
+    }
+    SessionLogSource SessionLogSource::Create(const asio::ip::address &Address, std::uint16_t Port, std::uint32_t SessionId)
+    {
+        auto s = Create(Address, Port);
+        s.HasSessionId = true;
+        s.SessionId = SessionId;
+        return s;
+    }
+    SessionLogSource SessionLogSource::Create(const asio::ip::address &Address, std::uint16_t Port, const std::vector<std::uint8_t> &SessionToken)
+    {
+        std::uint32_t SessionId = 0;
+        for (auto b : SessionToken)
+        {
+            SessionId = (SessionId << 8) | b;
+        }
+        return Create(Address, Port, SessionId);
+    }
+
+    SessionLogNameCache::SessionLogNameCache()
+        : LastNameId(0)
+    {
+    }
+
+    std::uint32_t SessionLogNameCache::GetNameId(const std::u16string &Name)
+    {
+        if (Name.empty()) { return 0; }
+        //LastNameId以release写入，写入者已与名称的发布同步，因此以acquire读取后可直接读取名称
+        auto Id = LastNameId.load(std::memory_order_acquire);
+        if ((Id != 0) && (GetName(Id) == Name)) { return Id; }
+        Id = Server::GetNameId(Name);
+        if (Id != 0)
+        {
+            LastNameId.store(Id, std::memory_order_release);
+        }
+        return Id;
+    }
+
+    SessionLogger::SessionLogger(std::function<void(const std::u16string &)> Write, int RingCapacity, int FlushPeriodMilliseconds)
+        : Id(NextLoggerId.fetch_add(1)),
+          RingCapacity(std::bit_ceil(static_cast<std::size_t>(std::max(RingCapacity, 2)))),
+          FlushPeriod(std::max(FlushPeriodMilliseconds, 1)),
+          Write(Write),
+          DroppedCountValue(0),
+          NextTextId(1),
+          IsExited(false)
+    {
+        LogThread = std::thread([this]() { Consume(); });
+    }
+
+    SessionLogger::~SessionLogger()
+    {
+        {
+            std::unique_lock<std::mutex> Lock(Lockee);
+            IsExited = true;
+        }
+        Notifier.notify_one();
+        LogThread.join();
+    }
+
+    SessionLogRing *SessionLogger::GetRing()
+    {
+        if (IsThreadRingDestroyed) { return nullptr; }
+        auto &t = CurrentThreadRing;
+        if (t.LoggerId == Id) { return t.Ring.get(); }
+        if (t.Ring != nullptr)
+        {
+            t.Ring->IsAbandoned.store(true, std::memory_order_release);
+        }
+        auto r = std::make_shared<SessionLogRing>(RingCapacity);
+        {
+            std::unique_lock<std::mutex> Lock(RingLockee);
+            Rings.push_back(r);
+        }
+        t.LoggerId = Id;
+        t.Ring = r;
+        return r.get();
+    }
+
+    void SessionLogger::Log(SessionLogType Type, const SessionLogSource &Source, const std::u16string &Name, std::int64_t Value)
+    {
+        LogValue(Type, Source, GetNameId(Name), Name, Value);
+    }
+    void SessionLogger::Log(SessionLogType Type, const SessionLogSource &Source, SessionLogNameCache &NameCache, const std::u16string &Name, std::int64_t Value)
+    {
+        LogValue(Type, Source, NameCache.GetNameId(Name), Name, Value);
+    }
+    void SessionLogger::LogValue(SessionLogType Type, const SessionLogSource &Source, std::uint32_t NameId, const std::u16string &Name, std::int64_t Value)
+    {
+        auto Ring = GetRing();
+        if ((Ring == nullptr) || Ring->IsFull())
+        {
+            DroppedCountValue.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        std::uint64_t TextId = 0;
+        if ((NameId == 0) && !Name.empty())
+        {
+            std::unique_lock<std::mutex> Lock(TextLockee);
+            TextId = NextTextId;
+            NextTextId += 1;
+            Texts.emplace(TextId, std::make_pair(Name, std::u16string()));
+        }
+        auto &r = Ring->Next();
+        r.Time = NowMicroseconds();
+        r.Value = Value;
+        r.TextId = TextId;
+        r.Source = Source;
+        r.NameId = NameId;
+        r.Type = Type;
+        Ring->Commit();
+    }
+    void SessionLogger::Log(SessionLogType Type, const SessionLogSource &Source, const std::u16string &Name, const std::u16string &Message)
+    {
+        auto Ring = GetRing();
+        if ((Ring == nullptr) || Ring->IsFull())
+        {
+            DroppedCountValue.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        auto NameId = GetNameId(Name);
+        std::uint64_t TextId = 0;
+        {
+            std::unique_lock<std::mutex> Lock(TextLockee);
+            TextId = NextTextId;
+            NextTextId += 1;
+            Texts.emplace(TextId, std::make_pair(NameId == 0 ? Name : std::u16string(), Message));
+        }
+        auto &r = Ring->Next();
+        r.Time = NowMicroseconds();
+        r.Value = 0;
+        r.TextId = TextId;
+        r.Source = Source;
+        r.NameId = NameId;
+        r.Type = Type;
+        Ring->Commit();
+    }
+
+    std::uint64_t SessionLogger::DroppedCount()
+    {
+        return DroppedCountValue.load(std::memory_order_relaxed);
+    }
+
+    void SessionLogger::Consume()
+    {
+        std::vector<SessionLogRecord> Records;
+        std::u16string Lines;
+        while (true)
+        {
+            auto IsExiting = false;
+            {
+                std::unique_lock<std::mutex> Lock(Lockee);
+                Notifier.wait_for(Lock, FlushPeriod, [&]() { return IsExited; });
+                IsExiting = IsExited;
+            }
+            Flush(Records, Lines);
+            if (IsExiting) { return; }
+        }
+    }
+
+    void SessionLogger::Flush(std::vector<SessionLogRecord> &Records, std::u16string &Lines)
+    {
+        std::vector<std::shared_ptr<SessionLogRing>> CurrentRings;
+        {
+            std::unique_lock<std::mutex> Lock(RingLockee);
+            CurrentRings = Rings;
+        }
+
+        Records.clear();
+        std::vector<std::shared_ptr<SessionLogRing>> AbandonedRings;
+        for (auto &r : CurrentRings)
+        {
+            //先读取IsAbandoned再读取Tail，保证线程退出前写入的记录都能被收集
+            auto IsAbandoned = r->IsAbandoned.load(std::memory_order_acquire);
+            auto h = r->Head.load(std::memory_order_relaxed);
+            auto t = r->Tail.load(std::memory_order_acquire);
+            for (auto k = h; k != t; k += 1)
+            {
+                Records.push_back(r->Records[k & r->Mask]);
+            }
+            r->Head.store(t, std::memory_order_release);
+            if (IsAbandoned)
+            {
+                AbandonedRings.push_back(r);
+            }
+        }
+        if (AbandonedRings.size() > 0)
+        {
+            std::unique_lock<std::mutex> Lock(RingLockee);
+            Rings.erase(std::remove_if(Rings.begin(), Rings.end(), [&](const std::shared_ptr<SessionLogRing> &r) { return std::find(AbandonedRings.begin(), AbandonedRings.end(), r) != AbandonedRings.end(); }), Rings.end());
+        }
+        if (Records.size() == 0) { return; }
+
+        std::stable_sort(Records.begin(), Records.end(), [](const SessionLogRecord &a, const SessionLogRecord &b) { return a.Time < b.Time; });
+
+        std::unordered_map<std::uint64_t, std::pair<std::u16string, std::u16string>> RecordTexts;
+        {
+            std::unique_lock<std::mutex> Lock(TextLockee);
+            for (auto &r : Records)
+            {
+                if (r.TextId == 0) { continue; }
+                auto i = Texts.find(r.TextId);
+                if (i == Texts.end()) { continue; }
+                RecordTexts.emplace(r.TextId, std::move(i->second));
+                Texts.erase(i);
+            }
+        }
+        //记录中的名称编号在写入记录前已发布，此处读取的数量不小于其中任何编号
+        auto NameCount = PublishedNameCount.load(std::memory_order_acquire);
+
+        //同一秒内的记录共用时间字符串
+        std::int64_t LastSecond = -1;
+        std::u16string LastTimeString;
+        Lines.clear();
+        for (auto &r : Records)
+        {
+            auto Second = r.Time / 1000000;
+            if (Second != LastSecond)
+            {
+                LastSecond = Second;
+                LastTimeString = wideCharToUtf16(DateTimeUtcToString(std::chrono::system_clock::time_point(std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::seconds(Second)))));
+            }
+            Lines += LastTimeString;
+            Lines += u" ";
+
+            auto &s = r.Source;
+            if (s.IsV6)
+            {
+                asio::ip::address_v6::bytes_type Bytes;
+                std::copy(s.Address, s.Address + 16, Bytes.begin());
+                Lines += systemToUtf16(asio::ip::address_v6(Bytes).to_string());
+            }
+            else
+            {
+                asio::ip::address_v4::bytes_type Bytes;
+                std::copy(s.Address, s.Address + 4, Bytes.begin());
+                Lines += systemToUtf16(asio::ip::address_v4(Bytes).to_string());
+            }
+            Lines += u":";
+            Lines += ToU16String(s.Port);
+            Lines += u" ";
+            if (s.HasSessionId)
+            {
+                char Token[9];
+                std::snprintf(Token, sizeof(Token), "%08X", static_cast<unsigned>(s.SessionId));
+                for (int k = 0; k < 8; k += 1)
+                {
+                    Lines.push_back(static_cast<char16_t>(Token[k]));
+                }
+            }
+            Lines += u" ";
+            Lines += SessionLogTypeToString(r.Type);
+            Lines += u" ";
+
+            const std::pair<std::u16string, std::u16string> *Text = nullptr;
+            if (r.TextId != 0)
+            {
+                auto i = RecordTexts.find(r.TextId);
+                if (i != RecordTexts.end()) { Text = &i->second; }
+            }
+            if ((r.NameId != 0) && (r.NameId < NameCount))
+            {
+                Lines += GetName(r.NameId);
+            }
+            else if (Text != nullptr)
+            {
+                Lines += Text->first;
+            }
+            Lines += u" ";
+            if ((r.Type == SessionLogType::InBytes) || (r.Type == SessionLogType::OutBytes))
+            {
+                Lines += ToU16String(r.Value);
+            }
+            else if (r.Type == SessionLogType::Time)
+            {
+                Lines += ToU16String(r.Value);
+                Lines += u"μs";
+            }
+            else if (Text != nullptr)
+            {
+                Lines += Text->second;
+            }
+            Lines += u"\n";
+        }
+        Write(Lines);
+    }
+}
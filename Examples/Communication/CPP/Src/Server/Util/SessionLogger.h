@@ -0,0 +1,131 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <string>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <unordered_map>
+#include <asio.hpp>
+#ifdef _MSC_VER
+#undef SendMessage
+#endif
+
+namespace Server
+{
+    enum class SessionLogType : std::uint8_t
+    {
+        InBytes, //Value为字节数
+        OutBytes, //Value为字节数
+        Time, //Value为微秒数
+        Known,
+        Sys,
+        Unk,
+        Crtcu
+    };
+
+    /// <summary>
+    /// 日志中的会话标识，在会话创建或远程端点改变时计算一次，之后每条日志只需复制。
+    /// </summary>
+    class SessionLogSource
+    {
+    public:
+        std::uint8_t Address[16]; //IPv4时只使用前4个字节
+        std::uint16_t Port;
+        bool IsV6;
+        bool HasSessionId;
+        std::uint32_t SessionId; //会话Token的4个字节按大端序组合，十六进制形式与SessionTokenString相同
+
+        static SessionLogSource Create(const asio::ip::address &Address, std::uint16_t Port);
+        static SessionLogSource Create(const asio::ip::address &Address, std::uint16_t Port, std::uint32_t SessionId);
+        static SessionLogSource Create(const asio::ip::address &Address, std::uint16_t Port, const std::vector<std::uint8_t> &SessionToken);
+    };
+
+    /// <summary>
+    /// 定长的二进制日志记录，在后台线程上才格式化为文本。
+    /// </summary>
+    class SessionLogRecord
+    {
+    public:
+        std::int64_t Time; //UTC，自1970-01-01起的微秒数
+        std::int64_t Value;
+        std::uint64_t TextId; //0表示无文本
+        SessionLogSource Source;
+        std::uint32_t NameId; //0表示名称在文本中或为空
+        SessionLogType Type;
+    };
+
+    /// <summary>
+    /// 会话中缓存最近使用的名称编号。同一会话的日志通常连续使用同一命令名称，命中时只需与名称表中的名称比较，不必计算哈希。
+    /// 线程安全，会话的各个线程可共用一个。
+    /// </summary>
+    class SessionLogNameCache
+    {
+    public:
+        SessionLogNameCache();
+
+        /// <summary>返回0表示名称为空或名称表已满，此时名称需要通过文本传递</summary>
+        std::uint32_t GetNameId(const std::u16string &Name);
+
+    private:
+        std::atomic<std::uint32_t> LastNameId;
+    };
+
+    class SessionLogRing;
+
+    /// <summary>
+    /// 会话日志管道。每个线程写入自己的单生产者单消费者环形缓冲区，写入一条日志只需若干次存储，环形缓冲区满时丢弃并计数。
+    /// 一个后台线程定期收集所有环形缓冲区中的记录，按时间排序后成批格式化，通过Write写出。
+    /// Log和DroppedCount是线程安全的。
+    /// </summary>
+    class SessionLogger
+    {
+    public:
+        /// <summary>Write在后台线程上调用，每次传入一批已格式化的日志行，每行以\n结尾</summary>
+        SessionLogger(std::function<void(const std::u16string &)> Write, int RingCapacity = 8192, int FlushPeriodMilliseconds = 20);
+        /// <summary>停止后台线程，写出剩余的日志</summary>
+        ~SessionLogger();
+
+        SessionLogger(const SessionLogger &) = delete;
+        SessionLogger &operator=(const SessionLogger &) = delete;
+
+        void Log(SessionLogType Type, const SessionLogSource &Source, const std::u16string &Name, std::int64_t Value);
+        /// <summary>通过会话的名称缓存取得名称编号，用于会话中的高频日志</summary>
+        void Log(SessionLogType Type, const SessionLogSource &Source, SessionLogNameCache &NameCache, const std::u16string &Name, std::int64_t Value);
+        /// <summary>带文本的日志，文本通过加锁的旁路表传递，只用于异常等低频日志</summary>
+        void Log(SessionLogType Type, const SessionLogSource &Source, const std::u16string &Name, const std::u16string &Message);
+
+        /// <summary>因环形缓冲区满而丢弃的日志数量</summary>
+        std::uint64_t DroppedCount();
+
+    private:
+        const std::uint64_t Id;
+        const std::size_t RingCapacity;
+        const std::chrono::milliseconds FlushPeriod;
+        std::function<void(const std::u16string &)> Write;
+
+        std::mutex RingLockee;
+        std::vector<std::shared_ptr<SessionLogRing>> Rings;
+        std::atomic<std::uint64_t> DroppedCountValue;
+
+        std::mutex TextLockee;
+        std::uint64_t NextTextId;
+        std::unordered_map<std::uint64_t, std::pair<std::u16string, std::u16string>> Texts;
+
+        std::mutex Lockee;
+        std::condition_variable Notifier;
+        bool IsExited;
+        std::thread LogThread;
+
+        SessionLogRing *GetRing();
+        void LogValue(SessionLogType Type, const SessionLogSource &Source, std::uint32_t NameId, const std::u16string &Name, std::int64_t Value);
+        void Consume();
+        void Flush(std::vector<SessionLogRecord> &Records, std::u16string &Lines);
+    };
+}
@@ -497,6 +497,22 @@ namespace Niveum.ObjectSchema.Cpp
                     }
                 }
             }
+            yield return "";
+            yield return "    /// <summary>标记为[Concurrent]的命令可能在同一会话中与其他[Concurrent]命令并发执行，其实现须线程安全</summary>";
+            yield return "    static bool IsConcurrentCommand(const std::u16string &CommandName)";
+            yield return "    {";
+            foreach (var c in Commands)
+            {
+                if (c.OnClientCommand && c.ClientCommand.Attributes.Any(a => a.Key == "Concurrent"))
+                {
+                    foreach (var _Line in Combine(Combine(Combine(Begin(), "if (CommandName == "), GetEscapedStringLiteral(c.ClientCommand.FullName())), ") { return true; }"))
+                    {
+                        yield return _Line == "" ? "" : "        " + _Line;
+                    }
+                }
+            }
+            yield return "        return false;";
+            yield return "    }";
             yield return "};";
         }
         public IEnumerable<String> IApplicationClient(List<TypeDef> Commands, String NamespaceName)
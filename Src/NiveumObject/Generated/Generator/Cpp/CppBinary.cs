@@ -77,124 +77,168 @@ namespace Niveum.ObjectSchema.CppBinary
                 yield return GetEscapedIdentifier(Identifier);
             }
         }
-        public IEnumerable<String> BinarySerializationServer(UInt64 Hash, List<TypeDef> Commands, ISchemaClosureGenerator SchemaClosureGenerator, String NamespaceName)
+        public IEnumerable<String> BinaryCommandIds(List<TypeDef> Commands, ISchemaClosureGenerator SchemaClosureGenerator)
         {
-            yield return "class BinarySerializationServer final";
+            var CommandIds = Commands.Select((c, i) => new { Name = c.OnClientCommand ? c.ClientCommand.FullName() : c.ServerCommand.FullName(), CommandHash = ((UInt32)(SchemaClosureGenerator.GetSubSchema(new List<TypeDef> { c }, new List<TypeSpec> { }).GetNonversioned().GetNonattributed().Hash().Bits(31, 0))).ToString("X8", System.Globalization.CultureInfo.InvariantCulture), CommandId = i }).ToList();
+            var HashGroups = CommandIds.GroupBy(p => p.CommandHash).OrderBy(g => g.Key, StringComparer.Ordinal).ToList();
+            yield return "/// <summary>命令的紧凑编号，为命令在Schema中的序号，只在通讯双方的Hash相同时使用</summary>";
+            yield return "class BinaryCommandIds final";
             yield return "{";
-            yield return "private:";
-            yield return "    struct Hash";
+            yield return "public:";
+            yield return "    /// <summary>不存在时返回-1</summary>";
+            yield return "    static std::int32_t GetCommandId(const std::u16string &CommandName, std::uint32_t CommandHash)";
             yield return "    {";
-            yield return "        std::size_t operator() (const std::pair<std::u16string, std::uint32_t> &p) const";
+            yield return "        switch (CommandHash)";
             yield return "        {";
-            yield return "            return std::hash<std::u16string>()(std::get<0>(p)) ^ std::get<1>(p);";
+            foreach (var g in HashGroups)
+            {
+                foreach (var _Line in Combine(Combine(Combine(Begin(), "case 0x"), g.Key), ":"))
+                {
+                    yield return _Line == "" ? "" : "            " + _Line;
+                }
+                foreach (var p in g)
+                {
+                    foreach (var _Line in Combine(Combine(Combine(Combine(Combine(Begin(), "    if (CommandName == "), GetEscapedStringLiteral(p.Name)), ") { return "), p.CommandId), "; }"))
+                    {
+                        yield return _Line == "" ? "" : "            " + _Line;
+                    }
+                }
+                yield return "            " + "    break;";
+            }
+            yield return "            default:";
+            yield return "                break;";
             yield return "        }";
-            yield return "    };";
-            yield return "    std::unordered_map<std::pair<std::u16string, std::uint32_t>, std::function<std::vector<std::uint8_t>(std::shared_ptr<IApplicationServer>, std::vector<std::uint8_t>)>, Hash> ClientCommands;";
-            yield return "    std::unordered_map<std::pair<std::u16string, std::uint32_t>, std::function<void(std::shared_ptr<IApplicationServer>, std::vector<std::uint8_t>, std::function<void(std::vector<std::uint8_t>)>, std::function<void(const std::exception &)>)>, Hash> AsyncClientCommands;";
-            yield return "";
+            yield return "        return -1;";
+            yield return "    }";
+            yield return "    static Boolean TryGetCommand(std::int32_t CommandId, std::u16string &CommandName, std::uint32_t &CommandHash)";
+            yield return "    {";
+            yield return "        switch (CommandId)";
+            yield return "        {";
+            foreach (var p in CommandIds)
+            {
+                foreach (var _Line in Combine(Combine(Combine(Begin(), "case "), p.CommandId), ":"))
+                {
+                    yield return _Line == "" ? "" : "            " + _Line;
+                }
+                foreach (var _Line in Combine(Combine(Combine(Begin(), "    CommandName = "), GetEscapedStringLiteral(p.Name)), ";"))
+                {
+                    yield return _Line == "" ? "" : "            " + _Line;
+                }
+                foreach (var _Line in Combine(Combine(Combine(Begin(), "    CommandHash = 0x"), p.CommandHash), ";"))
+                {
+                    yield return _Line == "" ? "" : "            " + _Line;
+                }
+                yield return "            " + "    return true;";
+            }
+            yield return "            default:";
+            yield return "                break;";
+            yield return "        }";
+            yield return "        return false;";
+            yield return "    }";
+            yield return "};";
+        }
+        public IEnumerable<String> BinarySerializationServer(UInt64 Hash, List<TypeDef> Commands, ISchemaClosureGenerator SchemaClosureGenerator, String NamespaceName)
+        {
+            var ClientCommands = Commands.Where(c => c.OnClientCommand).Select(c => new { Command = c.ClientCommand, CommandHash = ((UInt32)(SchemaClosureGenerator.GetSubSchema(new List<TypeDef> { c }, new List<TypeSpec> { }).GetNonversioned().GetNonattributed().Hash().Bits(31, 0))).ToString("X8", System.Globalization.CultureInfo.InvariantCulture) }).ToList();
+            var SyncGroups = ClientCommands.Where(p => !p.Command.Attributes.Any(a => a.Key == "Async")).GroupBy(p => p.CommandHash).OrderBy(g => g.Key, StringComparer.Ordinal).ToList();
+            var AsyncGroups = ClientCommands.Where(p => p.Command.Attributes.Any(a => a.Key == "Async")).GroupBy(p => p.CommandHash).OrderBy(g => g.Key, StringComparer.Ordinal).ToList();
+            yield return "class BinarySerializationServer final";
+            yield return "{";
             yield return "public:";
-            yield return "    BinarySerializationServer()";
+            yield return "    typedef std::vector<std::uint8_t> (*ClientCommandFunction)(std::shared_ptr<IApplicationServer> s, std::vector<std::uint8_t> p);";
+            yield return "    typedef void (*AsyncClientCommandFunction)(std::shared_ptr<IApplicationServer> s, std::vector<std::uint8_t> p, std::function<void(std::vector<std::uint8_t>)> Callback, std::function<void(const std::exception &)> OnFailure);";
+            yield return "";
+            yield return "    std::uint64_t Hash()";
             yield return "    {";
-            foreach (var c in Commands)
+            foreach (var _Line in Combine(Combine(Combine(Begin(), "        return 0x"), Hash.ToString("X16", System.Globalization.CultureInfo.InvariantCulture)), ";"))
             {
-                if (c.OnClientCommand)
+                yield return _Line;
+            }
+            yield return "    }";
+            yield return "";
+            yield return "    /// <summary>命令集在生成时确定，先按CommandHash分支再比较CommandName，不分配内存；不存在时返回nullptr</summary>";
+            yield return "    static ClientCommandFunction GetCommand(const std::u16string &CommandName, std::uint32_t CommandHash)";
+            yield return "    {";
+            yield return "        switch (CommandHash)";
+            yield return "        {";
+            foreach (var g in SyncGroups)
+            {
+                foreach (var _Line in Combine(Combine(Combine(Begin(), "case 0x"), g.Key), ":"))
                 {
-                    var CommandNameString = GetEscapedStringLiteral(c.ClientCommand.FullName());
-                    var RequestTypeString = GetSuffixedTypeString(c.ClientCommand.Name, c.ClientCommand.Version, "Request", NamespaceName);
-                    var ReplyTypeString = GetSuffixedTypeString(c.ClientCommand.Name, c.ClientCommand.Version, "Reply", NamespaceName);
-                    var RequestName = GetSuffixedTypeName(c.ClientCommand.Name, c.ClientCommand.Version, "Request", NamespaceName);
-                    var ReplyName = GetSuffixedTypeName(c.ClientCommand.Name, c.ClientCommand.Version, "Reply", NamespaceName);
-                    var Name = c.ClientCommand.GetTypeSpec().SimpleName(NamespaceName);
-                    var CommandHash = ((UInt32)(SchemaClosureGenerator.GetSubSchema(new List<TypeDef> { c }, new List<TypeSpec> { }).GetNonversioned().GetNonattributed().Hash().Bits(31, 0))).ToString("X8", System.Globalization.CultureInfo.InvariantCulture);
-                    if (c.ClientCommand.Attributes.Any(a => a.Key == "Async"))
+                    yield return _Line == "" ? "" : "            " + _Line;
+                }
+                foreach (var p in g)
+                {
+                    foreach (var _Line in Combine(Combine(Combine(Begin(), "    if (CommandName == "), GetEscapedStringLiteral(p.Command.FullName())), ")"))
                     {
-                        foreach (var _Line in Combine(Combine(Combine(Combine(Combine(Begin(), "AsyncClientCommands[std::pair<std::u16string, std::uint32_t>("), CommandNameString), ", 0x"), CommandHash), ")] = [](std::shared_ptr<IApplicationServer> s, std::vector<std::uint8_t> p, std::function<void(std::vector<std::uint8_t>)> Callback, std::function<void(const std::exception &)> OnFailure) -> void"))
-                        {
-                            yield return _Line == "" ? "" : "        " + _Line;
-                        }
-                        yield return "        " + "{";
-                        yield return "        " + "    ByteArrayStream bas;";
-                        yield return "        " + "    bas.WriteBytes(p);";
-                        yield return "        " + "    bas.SetPosition(0);";
-                        foreach (var _Line in Combine(Combine(Combine(Begin(), "    auto Request = BinaryTranslator::"), GetEscapedIdentifier(Combine(Combine(Begin(), RequestName), "FromBinary"))), "(bas);"))
-                        {
-                            yield return _Line == "" ? "" : "        " + _Line;
-                        }
-                        foreach (var _Line in Combine(Combine(Combine(Combine(Combine(Begin(), "    s->"), GetEscapedIdentifier(Name)), "(Request, [=]("), ReplyTypeString), " Reply)"))
-                        {
-                            yield return _Line == "" ? "" : "        " + _Line;
-                        }
-                        yield return "        " + "    {";
-                        yield return "        " + "        ByteArrayStream bas;";
-                        yield return "        " + "        bas.SetPosition(0);";
-                        yield return "        " + "        bas.SetLength(0);";
-                        foreach (var _Line in Combine(Combine(Combine(Begin(), "        BinaryTranslator::"), GetEscapedIdentifier(Combine(Combine(Begin(), ReplyName), "ToBinary"))), "(bas, Reply);"))
-                        {
-                            yield return _Line == "" ? "" : "        " + _Line;
-                        }
-                        yield return "        " + "        bas.SetPosition(0);";
-                        yield return "        " + "        Callback(bas.ReadBytes(bas.GetLength()));";
-                        yield return "        " + "    }, OnFailure);";
-                        yield return "        " + "};";
+                        yield return _Line == "" ? "" : "            " + _Line;
                     }
-                    else
+                    yield return "            " + "    {";
+                    foreach (var _Line in Combine(Combine(Begin(), "        "), BinarySerializationServer_ClientCommand(p.Command, NamespaceName)))
                     {
-                        foreach (var _Line in Combine(Combine(Combine(Combine(Combine(Begin(), "ClientCommands[std::pair<std::u16string, std::uint32_t>("), CommandNameString), ", 0x"), CommandHash), ")] = [](std::shared_ptr<IApplicationServer> s, std::vector<std::uint8_t> p) -> std::vector<std::uint8_t>"))
-                        {
-                            yield return _Line == "" ? "" : "        " + _Line;
-                        }
-                        yield return "        " + "{";
-                        yield return "        " + "    ByteArrayStream bas;";
-                        yield return "        " + "    bas.WriteBytes(p);";
-                        yield return "        " + "    bas.SetPosition(0);";
-                        foreach (var _Line in Combine(Combine(Combine(Begin(), "    auto Request = BinaryTranslator::"), GetEscapedIdentifier(Combine(Combine(Begin(), RequestName), "FromBinary"))), "(bas);"))
-                        {
-                            yield return _Line == "" ? "" : "        " + _Line;
-                        }
-                        foreach (var _Line in Combine(Combine(Combine(Begin(), "    auto Reply = s->"), GetEscapedIdentifier(Name)), "(Request);"))
-                        {
-                            yield return _Line == "" ? "" : "        " + _Line;
-                        }
-                        yield return "        " + "    bas.SetPosition(0);";
-                        yield return "        " + "    bas.SetLength(0);";
-                        foreach (var _Line in Combine(Combine(Combine(Begin(), "    BinaryTranslator::"), GetEscapedIdentifier(Combine(Combine(Begin(), ReplyName), "ToBinary"))), "(bas, Reply);"))
-                        {
-                            yield return _Line == "" ? "" : "        " + _Line;
-                        }
-                        yield return "        " + "    bas.SetPosition(0);";
-                        yield return "        " + "    return bas.ReadBytes(bas.GetLength());";
-                        yield return "        " + "};";
+                        yield return _Line == "" ? "" : "            " + _Line;
                     }
+                    yield return "            " + "    }";
                 }
+                yield return "            " + "    break;";
             }
+            yield return "            default:";
+            yield return "                break;";
+            yield return "        }";
+            yield return "        return nullptr;";
             yield return "    }";
-            yield return "";
-            yield return "    std::uint64_t Hash()";
+            yield return "    /// <summary>命令集在生成时确定，先按CommandHash分支再比较CommandName，不分配内存；不存在时返回nullptr</summary>";
+            yield return "    static AsyncClientCommandFunction GetCommandAsync(const std::u16string &CommandName, std::uint32_t CommandHash)";
             yield return "    {";
-            foreach (var _Line in Combine(Combine(Combine(Begin(), "        return 0x"), Hash.ToString("X16", System.Globalization.CultureInfo.InvariantCulture)), ";"))
+            yield return "        switch (CommandHash)";
+            yield return "        {";
+            foreach (var g in AsyncGroups)
             {
-                yield return _Line;
+                foreach (var _Line in Combine(Combine(Combine(Begin(), "case 0x"), g.Key), ":"))
+                {
+                    yield return _Line == "" ? "" : "            " + _Line;
+                }
+                foreach (var p in g)
+                {
+                    foreach (var _Line in Combine(Combine(Combine(Begin(), "    if (CommandName == "), GetEscapedStringLiteral(p.Command.FullName())), ")"))
+                    {
+                        yield return _Line == "" ? "" : "            " + _Line;
+                    }
+                    yield return "            " + "    {";
+                    foreach (var _Line in Combine(Combine(Begin(), "        "), BinarySerializationServer_AsyncClientCommand(p.Command, NamespaceName)))
+                    {
+                        yield return _Line == "" ? "" : "            " + _Line;
+                    }
+                    yield return "            " + "    }";
+                }
+                yield return "            " + "    break;";
             }
+            yield return "            default:";
+            yield return "                break;";
+            yield return "        }";
+            yield return "        return nullptr;";
             yield return "    }";
             yield return "";
-            yield return "    Boolean HasCommand(std::u16string CommandName, std::uint32_t CommandHash)";
+            yield return "    Boolean HasCommand(const std::u16string &CommandName, std::uint32_t CommandHash)";
             yield return "    {";
-            yield return "        return ClientCommands.count(std::pair<String, std::uint32_t>(CommandName, CommandHash)) > 0;";
+            yield return "        return GetCommand(CommandName, CommandHash) != nullptr;";
             yield return "    }";
-            yield return "    Boolean HasCommandAsync(std::u16string CommandName, std::uint32_t CommandHash)";
+            yield return "    Boolean HasCommandAsync(const std::u16string &CommandName, std::uint32_t CommandHash)";
             yield return "    {";
-            yield return "        return AsyncClientCommands.count(std::pair<String, std::uint32_t>(CommandName, CommandHash)) > 0;";
+            yield return "        return GetCommandAsync(CommandName, CommandHash) != nullptr;";
             yield return "    }";
             yield return "";
-            yield return "    std::vector<std::uint8_t> ExecuteCommand(std::shared_ptr<IApplicationServer> s, std::u16string CommandName, std::uint32_t CommandHash, std::vector<std::uint8_t> Parameters)";
+            yield return "    std::vector<std::uint8_t> ExecuteCommand(std::shared_ptr<IApplicationServer> s, const std::u16string &CommandName, std::uint32_t CommandHash, std::vector<std::uint8_t> Parameters)";
             yield return "    {";
-            yield return "        auto cmd = ClientCommands[std::pair<std::u16string, std::uint32_t>(CommandName, CommandHash)];";
-            yield return "        return cmd(s, Parameters);";
+            yield return "        auto cmd = GetCommand(CommandName, CommandHash);";
+            yield return "        if (cmd == nullptr) { throw std::logic_error(\"InvalidOperation\"); }";
+            yield return "        return cmd(s, std::move(Parameters));";
             yield return "    }";
-            yield return "    void ExecuteCommandAsync(std::shared_ptr<IApplicationServer> s, std::u16string CommandName, std::uint32_t CommandHash, std::vector<std::uint8_t> Parameters, std::function<void(std::vector<std::uint8_t>)> Callback, std::function<void(const std::exception &)> OnFailure)";
+            yield return "    void ExecuteCommandAsync(std::shared_ptr<IApplicationServer> s, const std::u16string &CommandName, std::uint32_t CommandHash, std::vector<std::uint8_t> Parameters, std::function<void(std::vector<std::uint8_t>)> Callback, std::function<void(const std::exception &)> OnFailure)";
             yield return "    {";
-            yield return "        auto cmd = AsyncClientCommands[std::pair<std::u16string, std::uint32_t>(CommandName, CommandHash)];";
-            yield return "        cmd(s, Parameters, Callback, OnFailure);";
+            yield return "        auto cmd = GetCommandAsync(CommandName, CommandHash);";
+            yield return "        if (cmd == nullptr) { throw std::logic_error(\"InvalidOperation\"); }";
+            yield return "        cmd(s, std::move(Parameters), Callback, OnFailure);";
             yield return "    }";
             yield return "};";
             yield return "class BinarySerializationServerEventDispatcher final";
@@ -216,13 +260,16 @@ namespace Niveum.ObjectSchema.CppBinary
                         yield return _Line == "" ? "" : "        " + _Line;
                     }
                     yield return "        " + "{";
-                    yield return "        " + "    ByteArrayStream bas;";
-                    foreach (var _Line in Combine(Combine(Combine(Begin(), "    BinaryTranslator::"), GetEscapedIdentifier(Combine(Combine(Begin(), EventName), "ToBinary"))), "(bas, e);"))
+                    foreach (var _Line in Combine(Combine(Combine(Begin(), "    std::vector<std::uint8_t> Buffer(BinaryTranslator::"), GetEscapedIdentifier(Combine(Combine(Begin(), EventName), "SerializedSize"))), "(e));"))
                     {
                         yield return _Line == "" ? "" : "        " + _Line;
                     }
-                    yield return "        " + "    bas.SetPosition(0);";
-                    foreach (var _Line in Combine(Combine(Combine(Combine(Combine(Begin(), "    if (ServerEvent != nullptr) { ServerEvent("), CommandNameString), ", 0x"), CommandHash), ", bas.ReadBytes(bas.GetLength())); }"))
+                    yield return "        " + "    SpanWriter sw(Buffer);";
+                    foreach (var _Line in Combine(Combine(Combine(Begin(), "    BinaryTranslator::"), GetEscapedIdentifier(Combine(Combine(Begin(), EventName), "ToBinary"))), "(sw, e);"))
+                    {
+                        yield return _Line == "" ? "" : "        " + _Line;
+                    }
+                    foreach (var _Line in Combine(Combine(Combine(Combine(Combine(Begin(), "    if (ServerEvent != nullptr) { ServerEvent("), CommandNameString), ", 0x"), CommandHash), ", std::move(Buffer)); }"))
                     {
                         yield return _Line == "" ? "" : "        " + _Line;
                     }
@@ -236,6 +283,65 @@ namespace Niveum.ObjectSchema.CppBinary
             yield return "    ServerEventDelegate ServerEvent;";
             yield return "};";
         }
+        public IEnumerable<String> BinarySerializationServer_ClientCommand(ClientCommandDef c, String NamespaceName)
+        {
+            var RequestName = GetSuffixedTypeName(c.Name, c.Version, "Request", NamespaceName);
+            var ReplyName = GetSuffixedTypeName(c.Name, c.Version, "Reply", NamespaceName);
+            var Name = c.GetTypeSpec().SimpleName(NamespaceName);
+            yield return "return [](std::shared_ptr<IApplicationServer> s, std::vector<std::uint8_t> p) -> std::vector<std::uint8_t>";
+            yield return "{";
+            yield return "    SpanReader sr(p.data(), p.size());";
+            foreach (var _Line in Combine(Combine(Combine(Begin(), "    auto Request = BinaryTranslator::"), GetEscapedIdentifier(Combine(Combine(Begin(), RequestName), "FromBinary"))), "(sr);"))
+            {
+                yield return _Line;
+            }
+            foreach (var _Line in Combine(Combine(Combine(Begin(), "    auto Reply = s->"), GetEscapedIdentifier(Name)), "(Request);"))
+            {
+                yield return _Line;
+            }
+            foreach (var _Line in Combine(Combine(Combine(Begin(), "    std::vector<std::uint8_t> Buffer(BinaryTranslator::"), GetEscapedIdentifier(Combine(Combine(Begin(), ReplyName), "SerializedSize"))), "(Reply));"))
+            {
+                yield return _Line;
+            }
+            yield return "    SpanWriter sw(Buffer);";
+            foreach (var _Line in Combine(Combine(Combine(Begin(), "    BinaryTranslator::"), GetEscapedIdentifier(Combine(Combine(Begin(), ReplyName), "ToBinary"))), "(sw, Reply);"))
+            {
+                yield return _Line;
+            }
+            yield return "    return Buffer;";
+            yield return "};";
+        }
+        public IEnumerable<String> BinarySerializationServer_AsyncClientCommand(ClientCommandDef c, String NamespaceName)
+        {
+            var ReplyTypeString = GetSuffixedTypeString(c.Name, c.Version, "Reply", NamespaceName);
+            var RequestName = GetSuffixedTypeName(c.Name, c.Version, "Request", NamespaceName);
+            var ReplyName = GetSuffixedTypeName(c.Name, c.Version, "Reply", NamespaceName);
+            var Name = c.GetTypeSpec().SimpleName(NamespaceName);
+            yield return "return [](std::shared_ptr<IApplicationServer> s, std::vector<std::uint8_t> p, std::function<void(std::vector<std::uint8_t>)> Callback, std::function<void(const std::exception &)> OnFailure) -> void";
+            yield return "{";
+            yield return "    SpanReader sr(p.data(), p.size());";
+            foreach (var _Line in Combine(Combine(Combine(Begin(), "    auto Request = BinaryTranslator::"), GetEscapedIdentifier(Combine(Combine(Begin(), RequestName), "FromBinary"))), "(sr);"))
+            {
+                yield return _Line;
+            }
+            foreach (var _Line in Combine(Combine(Combine(Combine(Combine(Begin(), "    s->"), GetEscapedIdentifier(Name)), "(Request, [=]("), ReplyTypeString), " Reply)"))
+            {
+                yield return _Line;
+            }
+            yield return "    {";
+            foreach (var _Line in Combine(Combine(Combine(Begin(), "        std::vector<std::uint8_t> Buffer(BinaryTranslator::"), GetEscapedIdentifier(Combine(Combine(Begin(), ReplyName), "SerializedSize"))), "(Reply));"))
+            {
+                yield return _Line;
+            }
+            yield return "        SpanWriter sw(Buffer);";
+            foreach (var _Line in Combine(Combine(Combine(Begin(), "        BinaryTranslator::"), GetEscapedIdentifier(Combine(Combine(Begin(), ReplyName), "ToBinary"))), "(sw, Reply);"))
+            {
+                yield return _Line;
+            }
+            yield return "        Callback(std::move(Buffer));";
+            yield return "    }, OnFailure);";
+            yield return "};";
+        }
         public IEnumerable<String> IBinarySender()
         {
             yield return "class IBinarySender";
@@ -328,22 +434,22 @@ namespace Niveum.ObjectSchema.CppBinary
                     {
                         yield return _Line == "" ? "" : "        " + _Line;
                     }
-                    yield return "        " + "    ByteArrayStream bas;";
-                    foreach (var _Line in Combine(Combine(Combine(Begin(), "    BinaryTranslator::"), GetEscapedIdentifier(Combine(Combine(Begin(), RequestName), "ToBinary"))), "(bas, r);"))
+                    foreach (var _Line in Combine(Combine(Combine(Begin(), "    std::vector<std::uint8_t> Request(BinaryTranslator::"), GetEscapedIdentifier(Combine(Combine(Begin(), RequestName), "SerializedSize"))), "(r));"))
+                    {
+                        yield return _Line == "" ? "" : "        " + _Line;
+                    }
+                    yield return "        " + "    SpanWriter sw(Request);";
+                    foreach (var _Line in Combine(Combine(Combine(Begin(), "    BinaryTranslator::"), GetEscapedIdentifier(Combine(Combine(Begin(), RequestName), "ToBinary"))), "(sw, r);"))
                     {
                         yield return _Line == "" ? "" : "        " + _Line;
                     }
-                    yield return "        " + "    bas.SetPosition(0);";
-                    yield return "        " + "    auto Request = bas.ReadBytes(bas.GetLength());";
                     foreach (var _Line in Combine(Combine(Combine(Combine(Combine(Begin(), "    AddCallback("), CommandNameString), ", 0x"), CommandHash), ", [=](std::vector<std::uint8_t> Parameters)"))
                     {
                         yield return _Line == "" ? "" : "        " + _Line;
                     }
                     yield return "        " + "    {";
-                    yield return "        " + "        ByteArrayStream bas;";
-                    yield return "        " + "        bas.WriteBytes(Parameters);";
-                    yield return "        " + "        bas.SetPosition(0);";
-                    foreach (var _Line in Combine(Combine(Combine(Begin(), "        auto Reply = BinaryTranslator::"), GetEscapedIdentifier(Combine(Combine(Begin(), ReplyName), "FromBinary"))), "(bas);"))
+                    yield return "        " + "        SpanReader sr(Parameters.data(), Parameters.size());";
+                    foreach (var _Line in Combine(Combine(Combine(Begin(), "        auto Reply = BinaryTranslator::"), GetEscapedIdentifier(Combine(Combine(Begin(), ReplyName), "FromBinary"))), "(sr);"))
                     {
                         yield return _Line == "" ? "" : "        " + _Line;
                     }
@@ -386,10 +492,8 @@ namespace Niveum.ObjectSchema.CppBinary
                         yield return _Line == "" ? "" : "        " + _Line;
                     }
                     yield return "        " + "{";
-                    yield return "        " + "    ByteArrayStream bas;";
-                    yield return "        " + "    bas.WriteBytes(Parameters);";
-                    yield return "        " + "    bas.SetPosition(0);";
-                    foreach (var _Line in Combine(Combine(Combine(Begin(), "    auto e = BinaryTranslator::"), GetEscapedIdentifier(Combine(Combine(Begin(), EventName), "FromBinary"))), "(bas);"))
+                    yield return "        " + "    SpanReader sr(Parameters.data(), Parameters.size());";
+                    foreach (var _Line in Combine(Combine(Combine(Begin(), "    auto e = BinaryTranslator::"), GetEscapedIdentifier(Combine(Combine(Begin(), EventName), "FromBinary"))), "(sr);"))
                     {
                         yield return _Line == "" ? "" : "        " + _Line;
                     }
@@ -769,50 +873,390 @@ namespace Niveum.ObjectSchema.CppBinary
             yield return "        Buffer.resize(Length, 0);";
             yield return "    }";
             yield return "};";
-        }
-        public IEnumerable<String> BinaryTranslator(Schema Schema, String NamespaceName)
-        {
-            yield return "class BinaryTranslator final";
+            yield return "";
+            yield return "/// <summary>连续内存上的只读流，不复制数据，非虚调用；数据须在读取期间保持有效</summary>";
+            yield return "class SpanReader final";
             yield return "{";
+            yield return "private:";
+            yield return "    const std::uint8_t *Data;";
+            yield return "    std::size_t Size;";
+            yield return "    std::size_t Position;";
+            yield return "";
+            yield return "    const std::uint8_t *Take(std::size_t Count)";
+            yield return "    {";
+            yield return "        if (Count > Size - Position) { throw std::out_of_range(\"\"); }";
+            yield return "        auto p = Data + Position;";
+            yield return "        Position += Count;";
+            yield return "        return p;";
+            yield return "    }";
+            yield return "    template <typename T>";
+            yield return "    T LoadLittleEndian()";
+            yield return "    {";
+            yield return "        std::uint8_t b[sizeof(T)];";
+            yield return "        std::memcpy(b, Take(sizeof(T)), sizeof(T));";
+            yield return "        T o = 0;";
+            yield return "        for (std::size_t k = 0; k < sizeof(T); k += 1)";
+            yield return "        {";
+            yield return "            o = static_cast<T>(o | (static_cast<T>(b[k]) << (8 * k)));";
+            yield return "        }";
+            yield return "        return o;";
+            yield return "    }";
             yield return "public:";
-            foreach (var _Line in Combine(Combine(Begin(), "    "), GetBinaryTranslatorSerializers(Schema, NamespaceName)))
-            {
-                yield return _Line;
-            }
+            yield return "    SpanReader(const std::uint8_t *Data, std::size_t Size) : Data(Data), Size(Size), Position(0)";
+            yield return "    {";
+            yield return "    }";
+            yield return "    SpanReader(const std::vector<std::uint8_t> &l) : Data(l.data()), Size(l.size()), Position(0)";
+            yield return "    {";
+            yield return "    }";
+            yield return "";
+            yield return "    std::uint8_t ReadByte()";
+            yield return "    {";
+            yield return "        return *Take(1);";
+            yield return "    }";
+            yield return "    /// <summary>从原数据直接复制到结果中，不经过中间缓冲区</summary>";
+            yield return "    std::vector<std::uint8_t> ReadBytes(std::size_t Size)";
+            yield return "    {";
+            yield return "        auto p = Take(Size);";
+            yield return "        return std::vector<std::uint8_t>(p, p + Size);";
+            yield return "    }";
+            yield return "";
+            yield return "    Unit ReadUnit()";
+            yield return "    {";
+            yield return "        return Unit();";
+            yield return "    }";
+            yield return "    Boolean ReadBoolean()";
+            yield return "    {";
+            yield return "        return ReadByte() != 0;";
+            yield return "    }";
+            yield return "";
+            yield return "    std::uint8_t ReadUInt8()";
+            yield return "    {";
+            yield return "        return ReadByte();";
+            yield return "    }";
+            yield return "    std::uint16_t ReadUInt16()";
+            yield return "    {";
+            yield return "        return LoadLittleEndian<std::uint16_t>();";
+            yield return "    }";
+            yield return "    std::uint32_t ReadUInt32()";
+            yield return "    {";
+            yield return "        return LoadLittleEndian<std::uint32_t>();";
+            yield return "    }";
+            yield return "    std::uint64_t ReadUInt64()";
+            yield return "    {";
+            yield return "        return LoadLittleEndian<std::uint64_t>();";
+            yield return "    }";
+            yield return "    std::int8_t ReadInt8()";
+            yield return "    {";
+            yield return "        return static_cast<std::int8_t>(ReadByte());";
+            yield return "    }";
+            yield return "    std::int16_t ReadInt16()";
+            yield return "    {";
+            yield return "        return static_cast<std::int16_t>(LoadLittleEndian<std::uint16_t>());";
+            yield return "    }";
+            yield return "    std::int32_t ReadInt32()";
+            yield return "    {";
+            yield return "        return static_cast<std::int32_t>(LoadLittleEndian<std::uint32_t>());";
+            yield return "    }";
+            yield return "    std::int64_t ReadInt64()";
+            yield return "    {";
+            yield return "        return static_cast<std::int64_t>(LoadLittleEndian<std::uint64_t>());";
+            yield return "    }";
+            yield return "";
+            yield return "    float ReadFloat32()";
+            yield return "    {";
+            yield return "        auto i = LoadLittleEndian<std::uint32_t>();";
+            yield return "        float f;";
+            yield return "        std::memcpy(&f, &i, sizeof(f));";
+            yield return "        return f;";
+            yield return "    }";
+            yield return "    double ReadFloat64()";
+            yield return "    {";
+            yield return "        auto i = LoadLittleEndian<std::uint64_t>();";
+            yield return "        double f;";
+            yield return "        std::memcpy(&f, &i, sizeof(f));";
+            yield return "        return f;";
+            yield return "    }";
+            yield return "";
+            yield return "    std::int64_t ReadSize()";
+            yield return "    {";
+            yield return "        auto Lower = ReadUInt32();";
+            yield return "        if ((Lower & 0x80000000) == 0)";
+            yield return "        {";
+            yield return "            return Lower;";
+            yield return "        }";
+            yield return "        auto Upper = ReadUInt32();";
+            yield return "        if ((Upper & 0x80000000) != 0)";
+            yield return "        {";
+            yield return "            throw std::out_of_range(\"\");";
+            yield return "        }";
+            yield return "        return static_cast<std::int64_t>((static_cast<std::uint64_t>(Upper) << 31) | static_cast<std::uint64_t>(Lower));";
+            yield return "    }";
+            yield return "";
+            yield return "    String ReadString()";
+            yield return "    {";
+            yield return "        auto Length = ReadSize();";
+            yield return "        auto n = Length / 2;";
+            yield return "        if (sizeof(std::size_t) >= 8)";
+            yield return "        {";
+            yield return "            if (Length < 0LL || Length > 0x3FFFFFFFFFFFFFFFLL) { throw std::logic_error(\"InvalidOperation\"); }";
+            yield return "        }";
+            yield return "        else if (sizeof(std::size_t) == 4)";
+            yield return "        {";
+            yield return "            if (Length < 0LL || Length > 0x7FFFFFFFLL) { throw std::logic_error(\"InvalidOperation\"); }";
+            yield return "        }";
+            yield return "        else";
+            yield return "        {";
+            yield return "            throw std::logic_error(\"InvalidOperation\");";
+            yield return "        }";
+            yield return "        auto p = Take(static_cast<std::size_t>(n) * 2);";
+            yield return "        std::u16string v;";
+            yield return "        v.resize(static_cast<std::size_t>(n));";
+            yield return "        for (std::size_t k = 0; k < static_cast<std::size_t>(n); k += 1)";
+            yield return "        {";
+            yield return "            v[k] = static_cast<char16_t>(static_cast<std::uint16_t>(p[k * 2]) | (static_cast<std::uint16_t>(p[k * 2 + 1]) << 8));";
+            yield return "        }";
+            yield return "        return v;";
+            yield return "    }";
+            yield return "";
+            yield return "    std::size_t GetPosition()";
+            yield return "    {";
+            yield return "        return Position;";
+            yield return "    }";
+            yield return "";
+            yield return "    std::size_t GetLength()";
+            yield return "    {";
+            yield return "        return Size;";
+            yield return "    }";
             yield return "};";
-        }
-        public IEnumerable<String> BinaryTranslator_Primitive_Unit()
-        {
-            yield return "static Unit UnitFromBinary(IReadableStream &s)";
-            yield return "{";
-            yield return "    return s.ReadUnit();";
-            yield return "}";
-            yield return "static void UnitToBinary(IWritableStream &s, Unit v)";
-            yield return "{";
-            yield return "    s.WriteUnit(v);";
-            yield return "}";
-        }
-        public IEnumerable<String> BinaryTranslator_Primitive_Boolean()
-        {
-            yield return "static Boolean BooleanFromBinary(IReadableStream &s)";
-            yield return "{";
-            yield return "    return s.ReadBoolean();";
-            yield return "}";
-            yield return "static void BooleanToBinary(IWritableStream &s, Boolean v)";
+            yield return "";
+            yield return "/// <summary>连续内存上的只写流，写入预先按SerializedSize分配好的缓冲区，非虚调用</summary>";
+            yield return "class SpanWriter final";
             yield return "{";
-            yield return "    s.WriteBoolean(v);";
-            yield return "}";
-        }
-        public IEnumerable<String> BinaryTranslator_Primitive_String()
-        {
+            yield return "private:";
+            yield return "    std::uint8_t *Data;";
+            yield return "    std::size_t Size;";
+            yield return "    std::size_t Position;";
+            yield return "";
+            yield return "    std::uint8_t *Take(std::size_t Count)";
+            yield return "    {";
+            yield return "        if (Count > Size - Position) { throw std::out_of_range(\"\"); }";
+            yield return "        auto p = Data + Position;";
+            yield return "        Position += Count;";
+            yield return "        return p;";
+            yield return "    }";
+            yield return "    template <typename T>";
+            yield return "    void StoreLittleEndian(T v)";
+            yield return "    {";
+            yield return "        std::uint8_t b[sizeof(T)];";
+            yield return "        for (std::size_t k = 0; k < sizeof(T); k += 1)";
+            yield return "        {";
+            yield return "            b[k] = static_cast<std::uint8_t>((v >> (8 * k)) & 0xFF);";
+            yield return "        }";
+            yield return "        std::memcpy(Take(sizeof(T)), b, sizeof(T));";
+            yield return "    }";
+            yield return "public:";
+            yield return "    SpanWriter(std::uint8_t *Data, std::size_t Size) : Data(Data), Size(Size), Position(0)";
+            yield return "    {";
+            yield return "    }";
+            yield return "    SpanWriter(std::vector<std::uint8_t> &l) : Data(l.data()), Size(l.size()), Position(0)";
+            yield return "    {";
+            yield return "    }";
+            yield return "";
+            yield return "    static std::size_t GetSizeLength(std::int64_t v)";
+            yield return "    {";
+            yield return "        return ((static_cast<std::uint64_t>(v) >> 31) != 0) ? 8 : 4;";
+            yield return "    }";
+            yield return "";
+            yield return "    void WriteByte(std::uint8_t b)";
+            yield return "    {";
+            yield return "        *Take(1) = b;";
+            yield return "    }";
+            yield return "    void WriteBytes(const std::uint8_t *p, std::size_t Count)";
+            yield return "    {";
+            yield return "        if (Count == 0) { return; }";
+            yield return "        std::memcpy(Take(Count), p, Count);";
+            yield return "    }";
+            yield return "    void WriteBytes(const std::vector<std::uint8_t> & l)";
+            yield return "    {";
+            yield return "        WriteBytes(l.data(), l.size());";
+            yield return "    }";
+            yield return "";
+            yield return "    void WriteUnit(Unit v)";
+            yield return "    {";
+            yield return "    }";
+            yield return "    void WriteBoolean(Boolean v)";
+            yield return "    {";
+            yield return "        WriteByte(v ? 0xFF : 0);";
+            yield return "    }";
+            yield return "";
+            yield return "    void WriteUInt8(std::uint8_t v)";
+            yield return "    {";
+            yield return "        WriteByte(v);";
+            yield return "    }";
+            yield return "    void WriteUInt16(std::uint16_t v)";
+            yield return "    {";
+            yield return "        StoreLittleEndian<std::uint16_t>(v);";
+            yield return "    }";
+            yield return "    void WriteUInt32(std::uint32_t v)";
+            yield return "    {";
+            yield return "        StoreLittleEndian<std::uint32_t>(v);";
+            yield return "    }";
+            yield return "    void WriteUInt64(std::uint64_t v)";
+            yield return "    {";
+            yield return "        StoreLittleEndian<std::uint64_t>(v);";
+            yield return "    }";
+            yield return "    void WriteInt8(std::int8_t v)";
+            yield return "    {";
+            yield return "        WriteByte(static_cast<std::uint8_t>(v));";
+            yield return "    }";
+            yield return "    void WriteInt16(std::int16_t v)";
+            yield return "    {";
+            yield return "        StoreLittleEndian<std::uint16_t>(static_cast<std::uint16_t>(v));";
+            yield return "    }";
+            yield return "    void WriteInt32(std::int32_t v)";
+            yield return "    {";
+            yield return "        StoreLittleEndian<std::uint32_t>(static_cast<std::uint32_t>(v));";
+            yield return "    }";
+            yield return "    void WriteInt64(std::int64_t v)";
+            yield return "    {";
+            yield return "        StoreLittleEndian<std::uint64_t>(static_cast<std::uint64_t>(v));";
+            yield return "    }";
+            yield return "";
+            yield return "    void WriteFloat32(float v)";
+            yield return "    {";
+            yield return "        std::uint32_t i;";
+            yield return "        std::memcpy(&i, &v, sizeof(i));";
+            yield return "        StoreLittleEndian<std::uint32_t>(i);";
+            yield return "    }";
+            yield return "    void WriteFloat64(double v)";
+            yield return "    {";
+            yield return "        std::uint64_t i;";
+            yield return "        std::memcpy(&i, &v, sizeof(i));";
+            yield return "        StoreLittleEndian<std::uint64_t>(i);";
+            yield return "    }";
+            yield return "";
+            yield return "    void WriteSize(std::int64_t v)";
+            yield return "    {";
+            yield return "        if ((v < 0) || (v > 0x3FFFFFFFFFFFFFFFLL))";
+            yield return "        {";
+            yield return "            throw std::out_of_range(\"\");";
+            yield return "        }";
+            yield return "        auto Lower = static_cast<std::uint32_t>(static_cast<std::uint64_t>(v) & 0x7FFFFFFF);";
+            yield return "        auto Upper = static_cast<std::uint32_t>((static_cast<std::uint64_t>(v) >> 31) & 0x7FFFFFFF);";
+            yield return "        if (Upper != 0)";
+            yield return "        {";
+            yield return "            Lower |= 0x80000000;";
+            yield return "            WriteUInt32(Lower);";
+            yield return "            WriteUInt32(Upper);";
+            yield return "        }";
+            yield return "        else";
+            yield return "        {";
+            yield return "            WriteUInt32(Lower);";
+            yield return "        }";
+            yield return "    }";
+            yield return "";
+            yield return "    void WriteString(const String &v)";
+            yield return "    {";
+            yield return "        WriteSize(static_cast<std::int64_t>(v.size() * 2));";
+            yield return "        auto p = Take(v.size() * 2);";
+            yield return "        for (std::size_t k = 0; k < v.size(); k += 1)";
+            yield return "        {";
+            yield return "            auto c = static_cast<std::uint16_t>(v[k]);";
+            yield return "            p[k * 2] = static_cast<std::uint8_t>(c & 0xFF);";
+            yield return "            p[k * 2 + 1] = static_cast<std::uint8_t>((c >> 8) & 0xFF);";
+            yield return "        }";
+            yield return "    }";
+            yield return "";
+            yield return "    std::size_t GetPosition()";
+            yield return "    {";
+            yield return "        return Position;";
+            yield return "    }";
+            yield return "";
+            yield return "    std::size_t GetLength()";
+            yield return "    {";
+            yield return "        return Size;";
+            yield return "    }";
+            yield return "};";
+        }
+        public IEnumerable<String> BinaryTranslator(Schema Schema, String NamespaceName)
+        {
+            yield return "class BinaryTranslator final";
+            yield return "{";
+            yield return "public:";
+            foreach (var _Line in Combine(Combine(Begin(), "    "), GetBinaryTranslatorSerializers(Schema, NamespaceName)))
+            {
+                yield return _Line;
+            }
+            yield return "};";
+        }
+        public IEnumerable<String> BinaryTranslator_Primitive_Unit()
+        {
+            yield return "static Unit UnitFromBinary(IReadableStream &s)";
+            yield return "{";
+            yield return "    return s.ReadUnit();";
+            yield return "}";
+            yield return "static Unit UnitFromBinary(SpanReader &s)";
+            yield return "{";
+            yield return "    return s.ReadUnit();";
+            yield return "}";
+            yield return "static void UnitToBinary(IWritableStream &s, Unit v)";
+            yield return "{";
+            yield return "    s.WriteUnit(v);";
+            yield return "}";
+            yield return "static void UnitToBinary(SpanWriter &s, Unit v)";
+            yield return "{";
+            yield return "    s.WriteUnit(v);";
+            yield return "}";
+            yield return "static std::size_t UnitSerializedSize(Unit v)";
+            yield return "{";
+            yield return "    return 0;";
+            yield return "}";
+        }
+        public IEnumerable<String> BinaryTranslator_Primitive_Boolean()
+        {
+            yield return "static Boolean BooleanFromBinary(IReadableStream &s)";
+            yield return "{";
+            yield return "    return s.ReadBoolean();";
+            yield return "}";
+            yield return "static Boolean BooleanFromBinary(SpanReader &s)";
+            yield return "{";
+            yield return "    return s.ReadBoolean();";
+            yield return "}";
+            yield return "static void BooleanToBinary(IWritableStream &s, Boolean v)";
+            yield return "{";
+            yield return "    s.WriteBoolean(v);";
+            yield return "}";
+            yield return "static void BooleanToBinary(SpanWriter &s, Boolean v)";
+            yield return "{";
+            yield return "    s.WriteBoolean(v);";
+            yield return "}";
+            yield return "static std::size_t BooleanSerializedSize(Boolean v)";
+            yield return "{";
+            yield return "    return 1;";
+            yield return "}";
+        }
+        public IEnumerable<String> BinaryTranslator_Primitive_String()
+        {
             yield return "static String StringFromBinary(IReadableStream &s)";
             yield return "{";
             yield return "    return s.ReadString();";
             yield return "}";
+            yield return "static String StringFromBinary(SpanReader &s)";
+            yield return "{";
+            yield return "    return s.ReadString();";
+            yield return "}";
             yield return "static void StringToBinary(IWritableStream &s, String v)";
             yield return "{";
             yield return "    s.WriteString(v);";
             yield return "}";
+            yield return "static void StringToBinary(SpanWriter &s, String v)";
+            yield return "{";
+            yield return "    s.WriteString(v);";
+            yield return "}";
+            yield return "static std::size_t StringSerializedSize(const String &v)";
+            yield return "{";
+            yield return "    return SpanWriter::GetSizeLength(static_cast<std::int64_t>(v.size() * 2)) + v.size() * 2;";
+            yield return "}";
         }
         public IEnumerable<String> BinaryTranslator_Primitive_Int()
         {
@@ -820,10 +1264,22 @@ namespace Niveum.ObjectSchema.CppBinary
             yield return "{";
             yield return "    return static_cast<Int>(s.ReadInt32());";
             yield return "}";
+            yield return "static Int IntFromBinary(SpanReader &s)";
+            yield return "{";
+            yield return "    return static_cast<Int>(s.ReadInt32());";
+            yield return "}";
             yield return "static void IntToBinary(IWritableStream &s, Int v)";
             yield return "{";
             yield return "    s.WriteInt32(static_cast<Int>(v));";
             yield return "}";
+            yield return "static void IntToBinary(SpanWriter &s, Int v)";
+            yield return "{";
+            yield return "    s.WriteInt32(static_cast<Int>(v));";
+            yield return "}";
+            yield return "static std::size_t IntSerializedSize(Int v)";
+            yield return "{";
+            yield return "    return 4;";
+            yield return "}";
         }
         public IEnumerable<String> BinaryTranslator_Primitive_Real()
         {
@@ -831,10 +1287,22 @@ namespace Niveum.ObjectSchema.CppBinary
             yield return "{";
             yield return "    return s.ReadFloat64();";
             yield return "}";
+            yield return "static Real RealFromBinary(SpanReader &s)";
+            yield return "{";
+            yield return "    return s.ReadFloat64();";
+            yield return "}";
             yield return "static void RealToBinary(IWritableStream &s, Real v)";
             yield return "{";
             yield return "    s.WriteFloat64(v);";
             yield return "}";
+            yield return "static void RealToBinary(SpanWriter &s, Real v)";
+            yield return "{";
+            yield return "    s.WriteFloat64(v);";
+            yield return "}";
+            yield return "static std::size_t RealSerializedSize(Real v)";
+            yield return "{";
+            yield return "    return 8;";
+            yield return "}";
         }
         public IEnumerable<String> BinaryTranslator_Primitive_Byte()
         {
@@ -842,10 +1310,22 @@ namespace Niveum.ObjectSchema.CppBinary
             yield return "{";
             yield return "    return s.ReadByte();";
             yield return "}";
+            yield return "static Byte ByteFromBinary(SpanReader &s)";
+            yield return "{";
+            yield return "    return s.ReadByte();";
+            yield return "}";
             yield return "static void ByteToBinary(IWritableStream &s, Byte v)";
             yield return "{";
             yield return "    s.WriteByte(v);";
             yield return "}";
+            yield return "static void ByteToBinary(SpanWriter &s, Byte v)";
+            yield return "{";
+            yield return "    s.WriteByte(v);";
+            yield return "}";
+            yield return "static std::size_t ByteSerializedSize(Byte v)";
+            yield return "{";
+            yield return "    return 1;";
+            yield return "}";
         }
         public IEnumerable<String> BinaryTranslator_Primitive_UInt8()
         {
@@ -853,10 +1333,22 @@ namespace Niveum.ObjectSchema.CppBinary
             yield return "{";
             yield return "    return s.ReadUInt8();";
             yield return "}";
+            yield return "static UInt8 UInt8FromBinary(SpanReader &s)";
+            yield return "{";
+            yield return "    return s.ReadUInt8();";
+            yield return "}";
             yield return "static void UInt8ToBinary(IWritableStream &s, UInt8 v)";
             yield return "{";
             yield return "    s.WriteUInt8(v);";
             yield return "}";
+            yield return "static void UInt8ToBinary(SpanWriter &s, UInt8 v)";
+            yield return "{";
+            yield return "    s.WriteUInt8(v);";
+            yield return "}";
+            yield return "static std::size_t UInt8SerializedSize(UInt8 v)";
+            yield return "{";
+            yield return "    return 1;";
+            yield return "}";
         }
         public IEnumerable<String> BinaryTranslator_Primitive_UInt16()
         {
@@ -864,10 +1356,22 @@ namespace Niveum.ObjectSchema.CppBinary
             yield return "{";
             yield return "    return s.ReadUInt16();";
             yield return "}";
+            yield return "static UInt16 UInt16FromBinary(SpanReader &s)";
+            yield return "{";
+            yield return "    return s.ReadUInt16();";
+            yield return "}";
             yield return "static void UInt16ToBinary(IWritableStream &s, UInt16 v)";
             yield return "{";
             yield return "    s.WriteUInt16(v);";
             yield return "}";
+            yield return "static void UInt16ToBinary(SpanWriter &s, UInt16 v)";
+            yield return "{";
+            yield return "    s.WriteUInt16(v);";
+            yield return "}";
+            yield return "static std::size_t UInt16SerializedSize(UInt16 v)";
+            yield return "{";
+            yield return "    return 2;";
+            yield return "}";
         }
         public IEnumerable<String> BinaryTranslator_Primitive_UInt32()
         {
@@ -875,10 +1379,22 @@ namespace Niveum.ObjectSchema.CppBinary
             yield return "{";
             yield return "    return s.ReadUInt32();";
             yield return "}";
+            yield return "static UInt32 UInt32FromBinary(SpanReader &s)";
+            yield return "{";
+            yield return "    return s.ReadUInt32();";
+            yield return "}";
             yield return "static void UInt32ToBinary(IWritableStream &s, UInt32 v)";
             yield return "{";
             yield return "    s.WriteUInt32(v);";
             yield return "}";
+            yield return "static void UInt32ToBinary(SpanWriter &s, UInt32 v)";
+            yield return "{";
+            yield return "    s.WriteUInt32(v);";
+            yield return "}";
+            yield return "static std::size_t UInt32SerializedSize(UInt32 v)";
+            yield return "{";
+            yield return "    return 4;";
+            yield return "}";
         }
         public IEnumerable<String> BinaryTranslator_Primitive_UInt64()
         {
@@ -886,10 +1402,22 @@ namespace Niveum.ObjectSchema.CppBinary
             yield return "{";
             yield return "    return s.ReadUInt64();";
             yield return "}";
+            yield return "static UInt64 UInt64FromBinary(SpanReader &s)";
+            yield return "{";
+            yield return "    return s.ReadUInt64();";
+            yield return "}";
             yield return "static void UInt64ToBinary(IWritableStream &s, UInt64 v)";
             yield return "{";
             yield return "    s.WriteUInt64(v);";
             yield return "}";
+            yield return "static void UInt64ToBinary(SpanWriter &s, UInt64 v)";
+            yield return "{";
+            yield return "    s.WriteUInt64(v);";
+            yield return "}";
+            yield return "static std::size_t UInt64SerializedSize(UInt64 v)";
+            yield return "{";
+            yield return "    return 8;";
+            yield return "}";
         }
         public IEnumerable<String> BinaryTranslator_Primitive_Int8()
         {
@@ -897,10 +1425,22 @@ namespace Niveum.ObjectSchema.CppBinary
             yield return "{";
             yield return "    return s.ReadInt8();";
             yield return "}";
+            yield return "static Int8 Int8FromBinary(SpanReader &s)";
+            yield return "{";
+            yield return "    return s.ReadInt8();";
+            yield return "}";
             yield return "static void Int8ToBinary(IWritableStream &s, Int8 v)";
             yield return "{";
             yield return "    s.WriteInt8(v);";
             yield return "}";
+            yield return "static void Int8ToBinary(SpanWriter &s, Int8 v)";
+            yield return "{";
+            yield return "    s.WriteInt8(v);";
+            yield return "}";
+            yield return "static std::size_t Int8SerializedSize(Int8 v)";
+            yield return "{";
+            yield return "    return 1;";
+            yield return "}";
         }
         public IEnumerable<String> BinaryTranslator_Primitive_Int16()
         {
@@ -908,10 +1448,22 @@ namespace Niveum.ObjectSchema.CppBinary
             yield return "{";
             yield return "    return s.ReadInt16();";
             yield return "}";
+            yield return "static Int16 Int16FromBinary(SpanReader &s)";
+            yield return "{";
+            yield return "    return s.ReadInt16();";
+            yield return "}";
             yield return "static void Int16ToBinary(IWritableStream &s, Int16 v)";
             yield return "{";
             yield return "    s.WriteInt16(v);";
             yield return "}";
+            yield return "static void Int16ToBinary(SpanWriter &s, Int16 v)";
+            yield return "{";
+            yield return "    s.WriteInt16(v);";
+            yield return "}";
+            yield return "static std::size_t Int16SerializedSize(Int16 v)";
+            yield return "{";
+            yield return "    return 2;";
+            yield return "}";
         }
         public IEnumerable<String> BinaryTranslator_Primitive_Int32()
         {
@@ -919,10 +1471,22 @@ namespace Niveum.ObjectSchema.CppBinary
             yield return "{";
             yield return "    return s.ReadInt32();";
             yield return "}";
+            yield return "static Int32 Int32FromBinary(SpanReader &s)";
+            yield return "{";
+            yield return "    return s.ReadInt32();";
+            yield return "}";
             yield return "static void Int32ToBinary(IWritableStream &s, Int32 v)";
             yield return "{";
             yield return "    s.WriteInt32(v);";
             yield return "}";
+            yield return "static void Int32ToBinary(SpanWriter &s, Int32 v)";
+            yield return "{";
+            yield return "    s.WriteInt32(v);";
+            yield return "}";
+            yield return "static std::size_t Int32SerializedSize(Int32 v)";
+            yield return "{";
+            yield return "    return 4;";
+            yield return "}";
         }
         public IEnumerable<String> BinaryTranslator_Primitive_Int64()
         {
@@ -930,10 +1494,22 @@ namespace Niveum.ObjectSchema.CppBinary
             yield return "{";
             yield return "    return s.ReadInt64();";
             yield return "}";
+            yield return "static Int64 Int64FromBinary(SpanReader &s)";
+            yield return "{";
+            yield return "    return s.ReadInt64();";
+            yield return "}";
             yield return "static void Int64ToBinary(IWritableStream &s, Int64 v)";
             yield return "{";
             yield return "    s.WriteInt64(v);";
             yield return "}";
+            yield return "static void Int64ToBinary(SpanWriter &s, Int64 v)";
+            yield return "{";
+            yield return "    s.WriteInt64(v);";
+            yield return "}";
+            yield return "static std::size_t Int64SerializedSize(Int64 v)";
+            yield return "{";
+            yield return "    return 8;";
+            yield return "}";
         }
         public IEnumerable<String> BinaryTranslator_Primitive_Float32()
         {
@@ -941,10 +1517,22 @@ namespace Niveum.ObjectSchema.CppBinary
             yield return "{";
             yield return "    return s.ReadFloat32();";
             yield return "}";
+            yield return "static Float32 Float32FromBinary(SpanReader &s)";
+            yield return "{";
+            yield return "    return s.ReadFloat32();";
+            yield return "}";
             yield return "static void Float32ToBinary(IWritableStream &s, Float32 v)";
             yield return "{";
             yield return "    s.WriteFloat32(v);";
             yield return "}";
+            yield return "static void Float32ToBinary(SpanWriter &s, Float32 v)";
+            yield return "{";
+            yield return "    s.WriteFloat32(v);";
+            yield return "}";
+            yield return "static std::size_t Float32SerializedSize(Float32 v)";
+            yield return "{";
+            yield return "    return 4;";
+            yield return "}";
         }
         public IEnumerable<String> BinaryTranslator_Primitive_Float64()
         {
@@ -952,10 +1540,22 @@ namespace Niveum.ObjectSchema.CppBinary
             yield return "{";
             yield return "    return s.ReadFloat64();";
             yield return "}";
+            yield return "static Float64 Float64FromBinary(SpanReader &s)";
+            yield return "{";
+            yield return "    return s.ReadFloat64();";
+            yield return "}";
             yield return "static void Float64ToBinary(IWritableStream &s, Float64 v)";
             yield return "{";
             yield return "    s.WriteFloat64(v);";
             yield return "}";
+            yield return "static void Float64ToBinary(SpanWriter &s, Float64 v)";
+            yield return "{";
+            yield return "    s.WriteFloat64(v);";
+            yield return "}";
+            yield return "static std::size_t Float64SerializedSize(Float64 v)";
+            yield return "{";
+            yield return "    return 8;";
+            yield return "}";
         }
         public IEnumerable<String> BinaryTranslator_Primitive_Type()
         {
@@ -963,10 +1563,22 @@ namespace Niveum.ObjectSchema.CppBinary
             yield return "{";
             yield return "    throw std::logic_error(\"NotSupported\");";
             yield return "}";
+            yield return "static Type TypeFromBinary(SpanReader &s)";
+            yield return "{";
+            yield return "    throw std::logic_error(\"NotSupported\");";
+            yield return "}";
             yield return "static void TypeToBinary(IWritableStream &s, Type v)";
             yield return "{";
             yield return "    throw std::logic_error(\"NotSupported\");";
             yield return "}";
+            yield return "static void TypeToBinary(SpanWriter &s, Type v)";
+            yield return "{";
+            yield return "    throw std::logic_error(\"NotSupported\");";
+            yield return "}";
+            yield return "static std::size_t TypeSerializedSize(Type v)";
+            yield return "{";
+            yield return "    throw std::logic_error(\"NotSupported\");";
+            yield return "}";
         }
         public IEnumerable<String> BinaryTranslator_Alias(AliasDef a, String NamespaceName)
         {
@@ -978,7 +1590,36 @@ namespace Niveum.ObjectSchema.CppBinary
         public IEnumerable<String> BinaryTranslator_Alias(String Name, String TypeString, TypeSpec ValueType, String NamespaceName)
         {
             var ValueSimpleName = ValueType.SimpleName(NamespaceName);
-            foreach (var _Line in Combine(Combine(Combine(Combine(Combine(Begin(), "static "), TypeString), " "), GetEscapedIdentifier(Combine(Combine(Begin(), Name), "FromBinary"))), "(IReadableStream &s)"))
+            foreach (var _Line in Combine(Begin(), BinaryTranslator_Alias_FromBinary(Name, TypeString, ValueSimpleName, "IReadableStream")))
+            {
+                yield return _Line;
+            }
+            foreach (var _Line in Combine(Begin(), BinaryTranslator_Alias_FromBinary(Name, TypeString, ValueSimpleName, "SpanReader")))
+            {
+                yield return _Line;
+            }
+            foreach (var _Line in Combine(Begin(), BinaryTranslator_Alias_ToBinary(Name, TypeString, ValueSimpleName, "IWritableStream")))
+            {
+                yield return _Line;
+            }
+            foreach (var _Line in Combine(Begin(), BinaryTranslator_Alias_ToBinary(Name, TypeString, ValueSimpleName, "SpanWriter")))
+            {
+                yield return _Line;
+            }
+            foreach (var _Line in Combine(Combine(Combine(Combine(Combine(Begin(), "static std::size_t "), GetEscapedIdentifier(Combine(Combine(Begin(), Name), "SerializedSize"))), "(const "), TypeString), " &o)"))
+            {
+                yield return _Line;
+            }
+            yield return "{";
+            foreach (var _Line in Combine(Combine(Combine(Begin(), "    return "), GetEscapedIdentifier(Combine(Combine(Begin(), ValueSimpleName), "SerializedSize"))), "(o.Value);"))
+            {
+                yield return _Line;
+            }
+            yield return "}";
+        }
+        public IEnumerable<String> BinaryTranslator_Alias_FromBinary(String Name, String TypeString, String ValueSimpleName, String StreamType)
+        {
+            foreach (var _Line in Combine(Combine(Combine(Combine(Combine(Combine(Combine(Begin(), "static "), TypeString), " "), GetEscapedIdentifier(Combine(Combine(Begin(), Name), "FromBinary"))), "("), StreamType), " &s)"))
             {
                 yield return _Line;
             }
@@ -987,33 +1628,70 @@ namespace Niveum.ObjectSchema.CppBinary
             {
                 yield return _Line;
             }
-            foreach (var _Line in Combine(Combine(Combine(Begin(), "    o.Value = "), GetEscapedIdentifier(Combine(Combine(Begin(), ValueSimpleName), "FromBinary"))), "(s);"))
+            foreach (var _Line in Combine(Combine(Combine(Begin(), "    o.Value = "), GetEscapedIdentifier(Combine(Combine(Begin(), ValueSimpleName), "FromBinary"))), "(s);"))
+            {
+                yield return _Line;
+            }
+            yield return "    return o;";
+            yield return "}";
+        }
+        public IEnumerable<String> BinaryTranslator_Alias_ToBinary(String Name, String TypeString, String ValueSimpleName, String StreamType)
+        {
+            foreach (var _Line in Combine(Combine(Combine(Combine(Combine(Combine(Combine(Begin(), "static void "), GetEscapedIdentifier(Combine(Combine(Begin(), Name), "ToBinary"))), "("), StreamType), " &s, "), TypeString), " o)"))
+            {
+                yield return _Line;
+            }
+            yield return "{";
+            foreach (var _Line in Combine(Combine(Combine(Begin(), "    "), GetEscapedIdentifier(Combine(Combine(Begin(), ValueSimpleName), "ToBinary"))), "(s, o.Value);"))
+            {
+                yield return _Line;
+            }
+            yield return "}";
+        }
+        public IEnumerable<String> BinaryTranslator_Record(RecordDef r, String NamespaceName)
+        {
+            foreach (var _Line in Combine(Begin(), BinaryTranslator_Record(r.GetTypeSpec().SimpleName(NamespaceName), GetTypeString(r.GetTypeSpec(), NamespaceName), r.Fields, NamespaceName)))
+            {
+                yield return _Line;
+            }
+        }
+        public IEnumerable<String> BinaryTranslator_Record(String Name, String TypeString, List<VariableDef> Fields, String NamespaceName)
+        {
+            foreach (var _Line in Combine(Begin(), BinaryTranslator_Record_FromBinary(Name, TypeString, Fields, NamespaceName, "IReadableStream")))
+            {
+                yield return _Line;
+            }
+            foreach (var _Line in Combine(Begin(), BinaryTranslator_Record_FromBinary(Name, TypeString, Fields, NamespaceName, "SpanReader")))
+            {
+                yield return _Line;
+            }
+            foreach (var _Line in Combine(Begin(), BinaryTranslator_Record_ToBinary(Name, TypeString, Fields, NamespaceName, "IWritableStream")))
+            {
+                yield return _Line;
+            }
+            foreach (var _Line in Combine(Begin(), BinaryTranslator_Record_ToBinary(Name, TypeString, Fields, NamespaceName, "SpanWriter")))
             {
                 yield return _Line;
             }
-            yield return "    return o;";
-            yield return "}";
-            foreach (var _Line in Combine(Combine(Combine(Combine(Combine(Begin(), "static void "), GetEscapedIdentifier(Combine(Combine(Begin(), Name), "ToBinary"))), "(IWritableStream &s, "), TypeString), " o)"))
+            foreach (var _Line in Combine(Combine(Combine(Combine(Combine(Begin(), "static std::size_t "), GetEscapedIdentifier(Combine(Combine(Begin(), Name), "SerializedSize"))), "(const "), TypeString), " &o)"))
             {
                 yield return _Line;
             }
             yield return "{";
-            foreach (var _Line in Combine(Combine(Combine(Begin(), "    "), GetEscapedIdentifier(Combine(Combine(Begin(), ValueSimpleName), "ToBinary"))), "(s, o.Value);"))
+            yield return "    std::size_t Size = 0;";
+            foreach (var f in Fields)
             {
-                yield return _Line;
+                foreach (var _Line in Combine(Combine(Combine(Combine(Combine(Begin(), "Size += "), GetEscapedIdentifier(Combine(Combine(Begin(), f.Type.SimpleName(NamespaceName)), "SerializedSize"))), "(o->"), GetEscapedIdentifier(f.Name)), ");"))
+                {
+                    yield return _Line == "" ? "" : "    " + _Line;
+                }
             }
+            yield return "    return Size;";
             yield return "}";
         }
-        public IEnumerable<String> BinaryTranslator_Record(RecordDef r, String NamespaceName)
-        {
-            foreach (var _Line in Combine(Begin(), BinaryTranslator_Record(r.GetTypeSpec().SimpleName(NamespaceName), GetTypeString(r.GetTypeSpec(), NamespaceName), r.Fields, NamespaceName)))
-            {
-                yield return _Line;
-            }
-        }
-        public IEnumerable<String> BinaryTranslator_Record(String Name, String TypeString, List<VariableDef> Fields, String NamespaceName)
+        public IEnumerable<String> BinaryTranslator_Record_FromBinary(String Name, String TypeString, List<VariableDef> Fields, String NamespaceName, String StreamType)
         {
-            foreach (var _Line in Combine(Combine(Combine(Combine(Combine(Begin(), "static "), TypeString), " "), GetEscapedIdentifier(Combine(Combine(Begin(), Name), "FromBinary"))), "(IReadableStream &s)"))
+            foreach (var _Line in Combine(Combine(Combine(Combine(Combine(Combine(Combine(Begin(), "static "), TypeString), " "), GetEscapedIdentifier(Combine(Combine(Begin(), Name), "FromBinary"))), "("), StreamType), " &s)"))
             {
                 yield return _Line;
             }
@@ -1031,7 +1709,10 @@ namespace Niveum.ObjectSchema.CppBinary
             }
             yield return "    return o;";
             yield return "}";
-            foreach (var _Line in Combine(Combine(Combine(Combine(Combine(Begin(), "static void "), GetEscapedIdentifier(Combine(Combine(Begin(), Name), "ToBinary"))), "(IWritableStream &s, "), TypeString), " o)"))
+        }
+        public IEnumerable<String> BinaryTranslator_Record_ToBinary(String Name, String TypeString, List<VariableDef> Fields, String NamespaceName, String StreamType)
+        {
+            foreach (var _Line in Combine(Combine(Combine(Combine(Combine(Combine(Combine(Begin(), "static void "), GetEscapedIdentifier(Combine(Combine(Begin(), Name), "ToBinary"))), "("), StreamType), " &s, "), TypeString), " o)"))
             {
                 yield return _Line;
             }
@@ -1058,7 +1739,46 @@ namespace Niveum.ObjectSchema.CppBinary
             {
                 yield return _Line;
             }
-            foreach (var _Line in Combine(Combine(Combine(Combine(Combine(Begin(), "static "), TypeString), " "), GetEscapedIdentifier(Combine(Combine(Begin(), Name), "FromBinary"))), "(IReadableStream &s)"))
+            foreach (var _Line in Combine(Begin(), BinaryTranslator_TaggedUnion_FromBinary(Name, TypeString, TagName, SimpleTagTypeString, Alternatives, NamespaceName, "IReadableStream")))
+            {
+                yield return _Line;
+            }
+            foreach (var _Line in Combine(Begin(), BinaryTranslator_TaggedUnion_FromBinary(Name, TypeString, TagName, SimpleTagTypeString, Alternatives, NamespaceName, "SpanReader")))
+            {
+                yield return _Line;
+            }
+            foreach (var _Line in Combine(Begin(), BinaryTranslator_TaggedUnion_ToBinary(Name, TypeString, TagName, SimpleTagTypeString, Alternatives, NamespaceName, "IWritableStream")))
+            {
+                yield return _Line;
+            }
+            foreach (var _Line in Combine(Begin(), BinaryTranslator_TaggedUnion_ToBinary(Name, TypeString, TagName, SimpleTagTypeString, Alternatives, NamespaceName, "SpanWriter")))
+            {
+                yield return _Line;
+            }
+            foreach (var _Line in Combine(Combine(Combine(Combine(Combine(Begin(), "static std::size_t "), GetEscapedIdentifier(Combine(Combine(Begin(), Name), "SerializedSize"))), "(const "), TypeString), " &o)"))
+            {
+                yield return _Line;
+            }
+            yield return "{";
+            foreach (var a in Alternatives)
+            {
+                foreach (var _Line in Combine(Combine(Combine(Combine(Combine(Begin(), "if (o->_Tag == "), SimpleTagTypeString), "::"), GetEscapedIdentifier(a.Name)), ")"))
+                {
+                    yield return _Line == "" ? "" : "    " + _Line;
+                }
+                yield return "    " + "{";
+                foreach (var _Line in Combine(Combine(Combine(Combine(Combine(Combine(Combine(Begin(), "    return "), GetEscapedIdentifier(Combine(Combine(Begin(), TagName), "SerializedSize"))), "(o->_Tag) + "), GetEscapedIdentifier(Combine(Combine(Begin(), a.Type.SimpleName(NamespaceName)), "SerializedSize"))), "(o->"), GetEscapedIdentifier(a.Name)), ");"))
+                {
+                    yield return _Line == "" ? "" : "    " + _Line;
+                }
+                yield return "    " + "}";
+            }
+            yield return "    throw std::logic_error(\"InvalidOperation\");";
+            yield return "}";
+        }
+        public IEnumerable<String> BinaryTranslator_TaggedUnion_FromBinary(String Name, String TypeString, String TagName, String SimpleTagTypeString, List<VariableDef> Alternatives, String NamespaceName, String StreamType)
+        {
+            foreach (var _Line in Combine(Combine(Combine(Combine(Combine(Combine(Combine(Begin(), "static "), TypeString), " "), GetEscapedIdentifier(Combine(Combine(Begin(), Name), "FromBinary"))), "("), StreamType), " &s)"))
             {
                 yield return _Line;
             }
@@ -1087,7 +1807,10 @@ namespace Niveum.ObjectSchema.CppBinary
             }
             yield return "    throw std::logic_error(\"InvalidOperation\");";
             yield return "}";
-            foreach (var _Line in Combine(Combine(Combine(Combine(Combine(Begin(), "static void "), GetEscapedIdentifier(Combine(Combine(Begin(), Name), "ToBinary"))), "(IWritableStream &s, "), TypeString), " o)"))
+        }
+        public IEnumerable<String> BinaryTranslator_TaggedUnion_ToBinary(String Name, String TypeString, String TagName, String SimpleTagTypeString, List<VariableDef> Alternatives, String NamespaceName, String StreamType)
+        {
+            foreach (var _Line in Combine(Combine(Combine(Combine(Combine(Combine(Combine(Begin(), "static void "), GetEscapedIdentifier(Combine(Combine(Begin(), Name), "ToBinary"))), "("), StreamType), " &s, "), TypeString), " o)"))
             {
                 yield return _Line;
             }
@@ -1132,6 +1855,16 @@ namespace Niveum.ObjectSchema.CppBinary
                 yield return _Line;
             }
             yield return "}";
+            foreach (var _Line in Combine(Combine(Combine(Combine(Combine(Begin(), "static "), TypeString), " "), GetEscapedIdentifier(Combine(Combine(Begin(), Name), "FromBinary"))), "(SpanReader &s)"))
+            {
+                yield return _Line;
+            }
+            yield return "{";
+            foreach (var _Line in Combine(Combine(Combine(Combine(Combine(Begin(), "    return static_cast<"), TypeString), ">("), GetEscapedIdentifier(Combine(Combine(Begin(), UnderlyingSimpleName), "FromBinary"))), "(s));"))
+            {
+                yield return _Line;
+            }
+            yield return "}";
             foreach (var _Line in Combine(Combine(Combine(Combine(Combine(Begin(), "static void "), GetEscapedIdentifier(Combine(Combine(Begin(), Name), "ToBinary"))), "(IWritableStream &s, "), TypeString), " o)"))
             {
                 yield return _Line;
@@ -1142,6 +1875,26 @@ namespace Niveum.ObjectSchema.CppBinary
                 yield return _Line;
             }
             yield return "}";
+            foreach (var _Line in Combine(Combine(Combine(Combine(Combine(Begin(), "static void "), GetEscapedIdentifier(Combine(Combine(Begin(), Name), "ToBinary"))), "(SpanWriter &s, "), TypeString), " o)"))
+            {
+                yield return _Line;
+            }
+            yield return "{";
+            foreach (var _Line in Combine(Combine(Combine(Combine(Combine(Begin(), "    "), GetEscapedIdentifier(Combine(Combine(Begin(), UnderlyingSimpleName), "ToBinary"))), "(s, static_cast<"), UnderlyingType), ">(o));"))
+            {
+                yield return _Line;
+            }
+            yield return "}";
+            foreach (var _Line in Combine(Combine(Combine(Combine(Combine(Begin(), "static std::size_t "), GetEscapedIdentifier(Combine(Combine(Begin(), Name), "SerializedSize"))), "("), TypeString), " o)"))
+            {
+                yield return _Line;
+            }
+            yield return "{";
+            foreach (var _Line in Combine(Combine(Combine(Combine(Combine(Begin(), "    return "), GetEscapedIdentifier(Combine(Combine(Begin(), UnderlyingSimpleName), "SerializedSize"))), "(static_cast<"), UnderlyingType), ">(o));"))
+            {
+                yield return _Line;
+            }
+            yield return "}";
         }
         public IEnumerable<String> BinaryTranslator_ClientCommand(ClientCommandDef c, String NamespaceName)
         {
@@ -1165,7 +1918,47 @@ namespace Niveum.ObjectSchema.CppBinary
         {
             var SimpleName = tp.SimpleName(NamespaceName);
             var TypeString = GetTypeString(tp, NamespaceName);
-            foreach (var _Line in Combine(Combine(Combine(Combine(Combine(Begin(), "static "), TypeString), " "), GetEscapedIdentifier(Combine(Combine(Begin(), SimpleName), "FromBinary"))), "(IReadableStream &s)"))
+            foreach (var _Line in Combine(Begin(), BinaryTranslator_Tuple_FromBinary(tp, NamespaceName, "IReadableStream")))
+            {
+                yield return _Line;
+            }
+            foreach (var _Line in Combine(Begin(), BinaryTranslator_Tuple_FromBinary(tp, NamespaceName, "SpanReader")))
+            {
+                yield return _Line;
+            }
+            foreach (var _Line in Combine(Begin(), BinaryTranslator_Tuple_ToBinary(tp, NamespaceName, "IWritableStream")))
+            {
+                yield return _Line;
+            }
+            foreach (var _Line in Combine(Begin(), BinaryTranslator_Tuple_ToBinary(tp, NamespaceName, "SpanWriter")))
+            {
+                yield return _Line;
+            }
+            foreach (var _Line in Combine(Combine(Combine(Combine(Combine(Begin(), "static std::size_t "), GetEscapedIdentifier(Combine(Combine(Begin(), SimpleName), "SerializedSize"))), "(const "), TypeString), " &t)"))
+            {
+                yield return _Line;
+            }
+            yield return "{";
+            yield return "    std::size_t Size = 0;";
+            {
+                int k = 0;
+                foreach (var t in tp.Tuple)
+                {
+                    foreach (var _Line in Combine(Combine(Combine(Combine(Combine(Begin(), "Size += "), GetEscapedIdentifier(Combine(Combine(Begin(), t.SimpleName(NamespaceName)), "SerializedSize"))), "(std::get<"), k), ">(t));"))
+                    {
+                        yield return _Line == "" ? "" : "    " + _Line;
+                    }
+                    k += 1;
+                }
+            }
+            yield return "    return Size;";
+            yield return "}";
+        }
+        public IEnumerable<String> BinaryTranslator_Tuple_FromBinary(TypeSpec tp, String NamespaceName, String StreamType)
+        {
+            var SimpleName = tp.SimpleName(NamespaceName);
+            var TypeString = GetTypeString(tp, NamespaceName);
+            foreach (var _Line in Combine(Combine(Combine(Combine(Combine(Combine(Combine(Begin(), "static "), TypeString), " "), GetEscapedIdentifier(Combine(Combine(Begin(), SimpleName), "FromBinary"))), "("), StreamType), " &s)"))
             {
                 yield return _Line;
             }
@@ -1188,7 +1981,12 @@ namespace Niveum.ObjectSchema.CppBinary
                 yield return _Line;
             }
             yield return "}";
-            foreach (var _Line in Combine(Combine(Combine(Combine(Combine(Begin(), "static void "), GetEscapedIdentifier(Combine(Combine(Begin(), SimpleName), "ToBinary"))), "(IWritableStream &s, const "), TypeString), " &t)"))
+        }
+        public IEnumerable<String> BinaryTranslator_Tuple_ToBinary(TypeSpec tp, String NamespaceName, String StreamType)
+        {
+            var SimpleName = tp.SimpleName(NamespaceName);
+            var TypeString = GetTypeString(tp, NamespaceName);
+            foreach (var _Line in Combine(Combine(Combine(Combine(Combine(Combine(Combine(Begin(), "static void "), GetEscapedIdentifier(Combine(Combine(Begin(), SimpleName), "ToBinary"))), "("), StreamType), " &s, const "), TypeString), " &t)"))
             {
                 yield return _Line;
             }
@@ -1211,7 +2009,43 @@ namespace Niveum.ObjectSchema.CppBinary
             var ElementType = o.GenericTypeSpec.ParameterValues.Single();
             var SimpleName = o.SimpleName(NamespaceName);
             var TypeString = GetTypeString(o, NamespaceName);
-            foreach (var _Line in Combine(Combine(Combine(Combine(Combine(Begin(), "static "), TypeString), " "), GetEscapedIdentifier(Combine(Combine(Begin(), SimpleName), "FromBinary"))), "(IReadableStream &s)"))
+            foreach (var _Line in Combine(Begin(), BinaryTranslator_Optional_FromBinary(SimpleName, TypeString, ElementType.SimpleName(NamespaceName), "IReadableStream")))
+            {
+                yield return _Line;
+            }
+            foreach (var _Line in Combine(Begin(), BinaryTranslator_Optional_FromBinary(SimpleName, TypeString, ElementType.SimpleName(NamespaceName), "SpanReader")))
+            {
+                yield return _Line;
+            }
+            foreach (var _Line in Combine(Begin(), BinaryTranslator_Optional_ToBinary(SimpleName, TypeString, ElementType.SimpleName(NamespaceName), "IWritableStream")))
+            {
+                yield return _Line;
+            }
+            foreach (var _Line in Combine(Begin(), BinaryTranslator_Optional_ToBinary(SimpleName, TypeString, ElementType.SimpleName(NamespaceName), "SpanWriter")))
+            {
+                yield return _Line;
+            }
+            foreach (var _Line in Combine(Combine(Combine(Combine(Combine(Begin(), "static std::size_t "), GetEscapedIdentifier(Combine(Combine(Begin(), SimpleName), "SerializedSize"))), "(const "), TypeString), " &o)"))
+            {
+                yield return _Line;
+            }
+            yield return "{";
+            yield return "    if (!o.has_value())";
+            yield return "    {";
+            yield return "        return IntSerializedSize(0);";
+            yield return "    }";
+            yield return "    else";
+            yield return "    {";
+            foreach (var _Line in Combine(Combine(Combine(Begin(), "        return IntSerializedSize(1) + "), GetEscapedIdentifier(Combine(Combine(Begin(), ElementType.SimpleName(NamespaceName)), "SerializedSize"))), "(o.value());"))
+            {
+                yield return _Line;
+            }
+            yield return "    }";
+            yield return "}";
+        }
+        public IEnumerable<String> BinaryTranslator_Optional_FromBinary(String SimpleName, String TypeString, String ElementSimpleName, String StreamType)
+        {
+            foreach (var _Line in Combine(Combine(Combine(Combine(Combine(Combine(Combine(Begin(), "static "), TypeString), " "), GetEscapedIdentifier(Combine(Combine(Begin(), SimpleName), "FromBinary"))), "("), StreamType), " &s)"))
             {
                 yield return _Line;
             }
@@ -1223,13 +2057,16 @@ namespace Niveum.ObjectSchema.CppBinary
             yield return "    }";
             yield return "    else";
             yield return "    {";
-            foreach (var _Line in Combine(Combine(Combine(Begin(), "        return "), GetEscapedIdentifier(Combine(Combine(Begin(), ElementType.SimpleName(NamespaceName)), "FromBinary"))), "(s);"))
+            foreach (var _Line in Combine(Combine(Combine(Begin(), "        return "), GetEscapedIdentifier(Combine(Combine(Begin(), ElementSimpleName), "FromBinary"))), "(s);"))
             {
                 yield return _Line;
             }
             yield return "    }";
             yield return "}";
-            foreach (var _Line in Combine(Combine(Combine(Combine(Combine(Begin(), "static void "), GetEscapedIdentifier(Combine(Combine(Begin(), SimpleName), "ToBinary"))), "(IWritableStream &s, const "), TypeString), " &o)"))
+        }
+        public IEnumerable<String> BinaryTranslator_Optional_ToBinary(String SimpleName, String TypeString, String ElementSimpleName, String StreamType)
+        {
+            foreach (var _Line in Combine(Combine(Combine(Combine(Combine(Combine(Combine(Begin(), "static void "), GetEscapedIdentifier(Combine(Combine(Begin(), SimpleName), "ToBinary"))), "("), StreamType), " &s, const "), TypeString), " &o)"))
             {
                 yield return _Line;
             }
@@ -1241,7 +2078,7 @@ namespace Niveum.ObjectSchema.CppBinary
             yield return "    else";
             yield return "    {";
             yield return "        IntToBinary(s, 1);";
-            foreach (var _Line in Combine(Combine(Combine(Begin(), "        "), GetEscapedIdentifier(Combine(Combine(Begin(), ElementType.SimpleName(NamespaceName)), "ToBinary"))), "(s, o.value());"))
+            foreach (var _Line in Combine(Combine(Combine(Begin(), "        "), GetEscapedIdentifier(Combine(Combine(Begin(), ElementSimpleName), "ToBinary"))), "(s, o.value());"))
             {
                 yield return _Line;
             }
@@ -1254,7 +2091,56 @@ namespace Niveum.ObjectSchema.CppBinary
             var TypeString = GetTypeString(l, NamespaceName);
             var ElementType = l.GenericTypeSpec.ParameterValues.Single();
             var ElementSimpleName = ElementType.SimpleName(NamespaceName);
-            foreach (var _Line in Combine(Combine(Combine(Combine(Combine(Begin(), "static "), TypeString), " "), GetEscapedIdentifier(Combine(Combine(Begin(), SimpleName), "FromBinary"))), "(IReadableStream &s)"))
+            var ElementFixedSize = GetFixedSerializedSize(ElementType);
+            foreach (var _Line in Combine(Begin(), BinaryTranslator_List_FromBinary(l, NamespaceName, "IReadableStream")))
+            {
+                yield return _Line;
+            }
+            foreach (var _Line in Combine(Begin(), BinaryTranslator_List_FromBinary(l, NamespaceName, "SpanReader")))
+            {
+                yield return _Line;
+            }
+            foreach (var _Line in Combine(Begin(), BinaryTranslator_List_ToBinary(l, NamespaceName, "IWritableStream")))
+            {
+                yield return _Line;
+            }
+            foreach (var _Line in Combine(Begin(), BinaryTranslator_List_ToBinary(l, NamespaceName, "SpanWriter")))
+            {
+                yield return _Line;
+            }
+            foreach (var _Line in Combine(Combine(Combine(Combine(Combine(Begin(), "static std::size_t "), GetEscapedIdentifier(Combine(Combine(Begin(), SimpleName), "SerializedSize"))), "(const "), TypeString), " &l)"))
+            {
+                yield return _Line;
+            }
+            yield return "{";
+            if (ElementFixedSize != null)
+            {
+                foreach (var _Line in Combine(Combine(Combine(Begin(), "return SpanWriter::GetSizeLength(static_cast<std::int64_t>(l.size())) + l.size() * "), ElementFixedSize.Value), ";"))
+                {
+                    yield return _Line == "" ? "" : "    " + _Line;
+                }
+            }
+            else
+            {
+                yield return "    " + "std::size_t Size = SpanWriter::GetSizeLength(static_cast<std::int64_t>(l.size()));";
+                yield return "    " + "for (const auto &e : l)";
+                yield return "    " + "{";
+                foreach (var _Line in Combine(Combine(Combine(Begin(), "    Size += "), GetEscapedIdentifier(Combine(Combine(Begin(), ElementSimpleName), "SerializedSize"))), "(e);"))
+                {
+                    yield return _Line == "" ? "" : "    " + _Line;
+                }
+                yield return "    " + "}";
+                yield return "    " + "return Size;";
+            }
+            yield return "}";
+        }
+        public IEnumerable<String> BinaryTranslator_List_FromBinary(TypeSpec l, String NamespaceName, String StreamType)
+        {
+            var SimpleName = l.SimpleName(NamespaceName);
+            var TypeString = GetTypeString(l, NamespaceName);
+            var ElementType = l.GenericTypeSpec.ParameterValues.Single();
+            var ElementSimpleName = ElementType.SimpleName(NamespaceName);
+            foreach (var _Line in Combine(Combine(Combine(Combine(Combine(Combine(Combine(Begin(), "static "), TypeString), " "), GetEscapedIdentifier(Combine(Combine(Begin(), SimpleName), "FromBinary"))), "("), StreamType), " &s)"))
             {
                 yield return _Line;
             }
@@ -1293,7 +2179,14 @@ namespace Niveum.ObjectSchema.CppBinary
             }
             yield return "    return l;";
             yield return "}";
-            foreach (var _Line in Combine(Combine(Combine(Combine(Combine(Begin(), "static void "), GetEscapedIdentifier(Combine(Combine(Begin(), SimpleName), "ToBinary"))), "(IWritableStream &s, const "), TypeString), " &l)"))
+        }
+        public IEnumerable<String> BinaryTranslator_List_ToBinary(TypeSpec l, String NamespaceName, String StreamType)
+        {
+            var SimpleName = l.SimpleName(NamespaceName);
+            var TypeString = GetTypeString(l, NamespaceName);
+            var ElementType = l.GenericTypeSpec.ParameterValues.Single();
+            var ElementSimpleName = ElementType.SimpleName(NamespaceName);
+            foreach (var _Line in Combine(Combine(Combine(Combine(Combine(Combine(Combine(Begin(), "static void "), GetEscapedIdentifier(Combine(Combine(Begin(), SimpleName), "ToBinary"))), "("), StreamType), " &s, const "), TypeString), " &l)"))
             {
                 yield return _Line;
             }
@@ -1319,8 +2212,54 @@ namespace Niveum.ObjectSchema.CppBinary
         {
             var SimpleName = l.SimpleName(NamespaceName);
             var TypeString = GetTypeString(l, NamespaceName);
-            var ElementSimpleName = l.GenericTypeSpec.ParameterValues.Single().SimpleName(NamespaceName);
-            foreach (var _Line in Combine(Combine(Combine(Combine(Combine(Begin(), "static "), TypeString), " "), GetEscapedIdentifier(Combine(Combine(Begin(), SimpleName), "FromBinary"))), "(IReadableStream &s)"))
+            var ElementType = l.GenericTypeSpec.ParameterValues.Single();
+            var ElementSimpleName = ElementType.SimpleName(NamespaceName);
+            var ElementFixedSize = GetFixedSerializedSize(ElementType);
+            foreach (var _Line in Combine(Begin(), BinaryTranslator_Set_FromBinary(SimpleName, TypeString, ElementSimpleName, "IReadableStream")))
+            {
+                yield return _Line;
+            }
+            foreach (var _Line in Combine(Begin(), BinaryTranslator_Set_FromBinary(SimpleName, TypeString, ElementSimpleName, "SpanReader")))
+            {
+                yield return _Line;
+            }
+            foreach (var _Line in Combine(Begin(), BinaryTranslator_Set_ToBinary(SimpleName, TypeString, ElementSimpleName, "IWritableStream")))
+            {
+                yield return _Line;
+            }
+            foreach (var _Line in Combine(Begin(), BinaryTranslator_Set_ToBinary(SimpleName, TypeString, ElementSimpleName, "SpanWriter")))
+            {
+                yield return _Line;
+            }
+            foreach (var _Line in Combine(Combine(Combine(Combine(Combine(Begin(), "static std::size_t "), GetEscapedIdentifier(Combine(Combine(Begin(), SimpleName), "SerializedSize"))), "(const "), TypeString), " &l)"))
+            {
+                yield return _Line;
+            }
+            yield return "{";
+            if (ElementFixedSize != null)
+            {
+                foreach (var _Line in Combine(Combine(Combine(Begin(), "return SpanWriter::GetSizeLength(static_cast<std::int64_t>(l.size())) + l.size() * "), ElementFixedSize.Value), ";"))
+                {
+                    yield return _Line == "" ? "" : "    " + _Line;
+                }
+            }
+            else
+            {
+                yield return "    " + "std::size_t Size = SpanWriter::GetSizeLength(static_cast<std::int64_t>(l.size()));";
+                yield return "    " + "for (const auto &e : l)";
+                yield return "    " + "{";
+                foreach (var _Line in Combine(Combine(Combine(Begin(), "    Size += "), GetEscapedIdentifier(Combine(Combine(Begin(), ElementSimpleName), "SerializedSize"))), "(e);"))
+                {
+                    yield return _Line == "" ? "" : "    " + _Line;
+                }
+                yield return "    " + "}";
+                yield return "    " + "return Size;";
+            }
+            yield return "}";
+        }
+        public IEnumerable<String> BinaryTranslator_Set_FromBinary(String SimpleName, String TypeString, String ElementSimpleName, String StreamType)
+        {
+            foreach (var _Line in Combine(Combine(Combine(Combine(Combine(Combine(Combine(Begin(), "static "), TypeString), " "), GetEscapedIdentifier(Combine(Combine(Begin(), SimpleName), "FromBinary"))), "("), StreamType), " &s)"))
             {
                 yield return _Line;
             }
@@ -1352,7 +2291,10 @@ namespace Niveum.ObjectSchema.CppBinary
             yield return "    }";
             yield return "    return l;";
             yield return "}";
-            foreach (var _Line in Combine(Combine(Combine(Combine(Combine(Begin(), "static void "), GetEscapedIdentifier(Combine(Combine(Begin(), SimpleName), "ToBinary"))), "(IWritableStream &s, const "), TypeString), " &l)"))
+        }
+        public IEnumerable<String> BinaryTranslator_Set_ToBinary(String SimpleName, String TypeString, String ElementSimpleName, String StreamType)
+        {
+            foreach (var _Line in Combine(Combine(Combine(Combine(Combine(Combine(Combine(Begin(), "static void "), GetEscapedIdentifier(Combine(Combine(Begin(), SimpleName), "ToBinary"))), "("), StreamType), " &s, const "), TypeString), " &l)"))
             {
                 yield return _Line;
             }
@@ -1378,7 +2320,45 @@ namespace Niveum.ObjectSchema.CppBinary
             var TypeString = GetTypeString(l, NamespaceName);
             var KeySimpleName = gp[0].SimpleName(NamespaceName);
             var ValueSimpleName = gp[1].SimpleName(NamespaceName);
-            foreach (var _Line in Combine(Combine(Combine(Combine(Combine(Begin(), "static "), TypeString), " "), GetEscapedIdentifier(Combine(Combine(Begin(), SimpleName), "FromBinary"))), "(IReadableStream &s)"))
+            foreach (var _Line in Combine(Begin(), BinaryTranslator_Map_FromBinary(SimpleName, TypeString, KeySimpleName, ValueSimpleName, "IReadableStream")))
+            {
+                yield return _Line;
+            }
+            foreach (var _Line in Combine(Begin(), BinaryTranslator_Map_FromBinary(SimpleName, TypeString, KeySimpleName, ValueSimpleName, "SpanReader")))
+            {
+                yield return _Line;
+            }
+            foreach (var _Line in Combine(Begin(), BinaryTranslator_Map_ToBinary(SimpleName, TypeString, KeySimpleName, ValueSimpleName, "IWritableStream")))
+            {
+                yield return _Line;
+            }
+            foreach (var _Line in Combine(Begin(), BinaryTranslator_Map_ToBinary(SimpleName, TypeString, KeySimpleName, ValueSimpleName, "SpanWriter")))
+            {
+                yield return _Line;
+            }
+            foreach (var _Line in Combine(Combine(Combine(Combine(Combine(Begin(), "static std::size_t "), GetEscapedIdentifier(Combine(Combine(Begin(), SimpleName), "SerializedSize"))), "(const "), TypeString), " &l)"))
+            {
+                yield return _Line;
+            }
+            yield return "{";
+            yield return "    std::size_t Size = SpanWriter::GetSizeLength(static_cast<std::int64_t>(l.size()));";
+            yield return "    for (const auto &p : l)";
+            yield return "    {";
+            foreach (var _Line in Combine(Combine(Combine(Begin(), "        Size += "), GetEscapedIdentifier(Combine(Combine(Begin(), KeySimpleName), "SerializedSize"))), "(std::get<0>(p));"))
+            {
+                yield return _Line;
+            }
+            foreach (var _Line in Combine(Combine(Combine(Begin(), "        Size += "), GetEscapedIdentifier(Combine(Combine(Begin(), ValueSimpleName), "SerializedSize"))), "(std::get<1>(p));"))
+            {
+                yield return _Line;
+            }
+            yield return "    }";
+            yield return "    return Size;";
+            yield return "}";
+        }
+        public IEnumerable<String> BinaryTranslator_Map_FromBinary(String SimpleName, String TypeString, String KeySimpleName, String ValueSimpleName, String StreamType)
+        {
+            foreach (var _Line in Combine(Combine(Combine(Combine(Combine(Combine(Combine(Begin(), "static "), TypeString), " "), GetEscapedIdentifier(Combine(Combine(Begin(), SimpleName), "FromBinary"))), "("), StreamType), " &s)"))
             {
                 yield return _Line;
             }
@@ -1414,7 +2394,10 @@ namespace Niveum.ObjectSchema.CppBinary
             yield return "    }";
             yield return "    return l;";
             yield return "}";
-            foreach (var _Line in Combine(Combine(Combine(Combine(Combine(Begin(), "static void "), GetEscapedIdentifier(Combine(Combine(Begin(), SimpleName), "ToBinary"))), "(IWritableStream &s, const "), TypeString), " &l)"))
+        }
+        public IEnumerable<String> BinaryTranslator_Map_ToBinary(String SimpleName, String TypeString, String KeySimpleName, String ValueSimpleName, String StreamType)
+        {
+            foreach (var _Line in Combine(Combine(Combine(Combine(Combine(Combine(Combine(Begin(), "static void "), GetEscapedIdentifier(Combine(Combine(Begin(), SimpleName), "ToBinary"))), "("), StreamType), " &s, const "), TypeString), " &l)"))
             {
                 yield return _Line;
             }
@@ -1446,6 +2429,7 @@ namespace Niveum.ObjectSchema.CppBinary
             yield return "";
             yield return "#include <cstdint>";
             yield return "#include <climits>";
+            yield return "#include <cstring>";
             yield return "#include <string>";
             yield return "#include <vector>";
             yield return "#include <queue>";
@@ -3,7 +3,7 @@
 //  File:        CppBinary.cs
 //  Location:    Niveum.Object <Visual C#>
 //  Description: 对象类型结构C++二进制通讯代码生成器
-//  Version:     2022.11.01.
+//  Version:     2026.10.17.
 //  Copyright(C) F.R.C.
 //
 //==========================================================================
@@ -35,11 +35,13 @@ namespace Niveum.ObjectSchema.CppBinary
         private Cpp.Templates Inner;
         private Boolean WithServer;
         private Boolean WithClient;
+        private HashSet<String> PrimitiveNames;
         public Templates(Schema Schema, Boolean WithServer, Boolean WithClient)
         {
             this.Inner = new Cpp.Templates(Schema);
             this.WithServer = WithServer;
             this.WithClient = WithClient;
+            this.PrimitiveNames = new HashSet<String>(Schema.TypeRefs.Concat(Schema.Types).Where(t => t.OnPrimitive).Select(t => t.VersionedName()));
         }
 
         public String GetEscapedIdentifier(String Identifier)
@@ -71,6 +73,38 @@ namespace Niveum.ObjectSchema.CppBinary
         {
             return Inner.GetPrimitives(Schema);
         }
+        /// <summary>获取定长基元类型的序列化长度，非定长类型返回null</summary>
+        public Int32? GetFixedSerializedSize(TypeSpec Type)
+        {
+            if (!Type.OnTypeRef) { return null; }
+            var Name = Type.TypeRef.VersionedName();
+            if (!PrimitiveNames.Contains(Name)) { return null; }
+            switch (Name)
+            {
+                case "Unit":
+                    return 0;
+                case "Boolean":
+                case "Byte":
+                case "UInt8":
+                case "Int8":
+                    return 1;
+                case "UInt16":
+                case "Int16":
+                    return 2;
+                case "Int":
+                case "UInt32":
+                case "Int32":
+                case "Float32":
+                    return 4;
+                case "Real":
+                case "UInt64":
+                case "Int64":
+                case "Float64":
+                    return 8;
+                default:
+                    return null;
+            }
+        }
         public List<String> GetBinaryTranslatorSerializers(Schema Schema, String NamespaceName)
         {
             var l = new List<String>();
@@ -250,6 +284,7 @@ namespace Niveum.ObjectSchema.CppBinary
             {
                 var SchemaClosureGenerator = Schema.GetSchemaClosureGenerator();
                 var Hash = SchemaClosureGenerator.GetSubSchema(Schema.Types.Where(t => (t.OnClientCommand || t.OnServerCommand) && t.Version() == ""), new List<TypeSpec> { }).GetNonattributed().Hash();
+                AddClass(NamespaceName, BinaryCommandIds(Commands, SchemaClosureGenerator));
                 if (WithServer)
                 {
                     AddClass(NamespaceName, BinarySerializationServer(Hash, Commands, SchemaClosureGenerator, NamespaceName));
@@ -208,6 +208,20 @@ namespace Niveum.SchemaManipulator
                         return -1;
                     }
                 }
+                else if (optNameLower == "concurrent")
+                {
+                    var args = opt.Arguments;
+                    if (args.Length == 1)
+                    {
+                        InvalidateSchema();
+                        LoadConcurrent(args[0]);
+                    }
+                    else
+                    {
+                        DisplayInfo();
+                        return -1;
+                    }
+                }
                 else if (optNameLower == "nullable")
                 {
                     var args = opt.Arguments;
@@ -631,6 +645,8 @@ namespace Niveum.SchemaManipulator
             Console.WriteLine(@"/async:<AsyncCommandListFile>");
             Console.WriteLine(@"指定所有命令为异步");
             Console.WriteLine(@"/async:*");
+            Console.WriteLine(@"增加可并发命令指定");
+            Console.WriteLine(@"/concurrent:<ConcurrentCommandListFile>");
             Console.WriteLine(@"指定生成C#代码中声明nullable");
             Console.WriteLine(@"/nullable");
             Console.WriteLine(@"将Tree格式数据转化为二进制数据");
@@ -684,6 +700,7 @@ namespace Niveum.SchemaManipulator
             Console.WriteLine(@"CookedObjectSchemaFile 已编译过的对象类型结构Tree文件路径。");
             Console.WriteLine(@"ObjectSchemaDir|ObjectSchemaFile 对象类型结构Tree文件(夹)路径。");
             Console.WriteLine(@"AsyncCommandListFile 异步命令列表文件");
+            Console.WriteLine(@"ConcurrentCommandListFile 可并发命令列表文件，列出的命令可能在同一会话中并发执行");
             Console.WriteLine(@"TreeFile Tree文件路径。");
             Console.WriteLine(@"BinaryFile 二进制文件路径。");
             Console.WriteLine(@"MainType 主类型。");
@@ -718,6 +735,7 @@ namespace Niveum.SchemaManipulator
         private static TreeBinaryConverter? tbc = null;
         private static HashSet<String> AsyncCommands = new HashSet<String>();
         private static bool AsyncAll = false;
+        private static HashSet<String> ConcurrentCommands = new HashSet<String>();
         private static OS.ObjectSchemaLoaderResult GetObjectSchemaLoaderResult()
         {
             if (oslr != null) { return oslr; }
@@ -734,6 +752,13 @@ namespace Niveum.SchemaManipulator
                             cc.Attributes.Add(new KeyValuePair<String, List<String>>("Async", new List<String> { }));
                         }
                     }
+                    if (ConcurrentCommands.Contains(cc.FullName()))
+                    {
+                        if (!cc.Attributes.Any(a => a.Key == "Concurrent"))
+                        {
+                            cc.Attributes.Add(new KeyValuePair<String, List<String>>("Concurrent", new List<String> { }));
+                        }
+                    }
                 }
             }
             return oslr;
@@ -798,6 +823,19 @@ namespace Niveum.SchemaManipulator
                 }
             }
         }
+        private static void LoadConcurrent(String ConcurrentCommandListFilePath)
+        {
+            var f = Txt.ReadFile(ConcurrentCommandListFilePath);
+            var Commands = f.UnifyNewLineToLf().Split('\n');
+            foreach (var c in Commands)
+            {
+                if (c == "") { continue; }
+                if (!ConcurrentCommands.Contains(c))
+                {
+                    ConcurrentCommands.Add(c);
+                }
+            }
+        }
 
         public static void TreeToBinary(String TreePath, String BinaryPath, String MainType)
         {